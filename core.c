@@ -0,0 +1,823 @@
+#include "config.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "squint.h"
+
+//
+// Backend-independent logic shared by all backends:
+// - viewport (offset of the source image inside the destination window)
+// - damage merging
+// - refresh scheduling (rate limiter)
+// - cursor prediction
+//
+
+
+void
+adjust_offset_value(gint* offset, gint src, gint dst, gint cursor)
+{
+	if (dst >= src)
+	{
+		// dst window is enough big
+		// -> static offset
+		*offset = (dst - src) / 2;
+	} else {
+		// dynamic offset
+		if (cursor >= 0) {
+			// on-screen
+			int v = cursor + *offset;
+
+			if (v < 0) {
+				*offset -= v;
+			} else if (v >= dst) {
+				*offset -= v - dst;
+			}
+		} else {
+			// off-screen
+			// -> update only if there is unused space
+			if (*offset > 0) {
+				*offset = 0;
+			} else {
+				int min_offset = dst - src;
+				if (*offset < min_offset) {
+					*offset = min_offset;
+				}
+			}
+		}
+	}
+}
+
+// return true if dst->offset was updated
+gboolean
+fix_offset(const struct mirror* m, struct destination* dst, const GdkPoint* cursor)
+{
+	GdkPoint offset_bak = dst->offset;
+
+	if (m->wall)
+	{
+		// video wall: the offset is computed for the whole wall, then
+		// translated into the coordinates of the tile
+		GdkPoint offset = { dst->offset.x + dst->tile.x, dst->offset.y + dst->tile.y };
+		adjust_offset_value(&offset.x, m->src_rect.width,  m->wall_rect.width,  cursor->x);
+		adjust_offset_value(&offset.y, m->src_rect.height, m->wall_rect.height, cursor->y);
+		dst->offset.x = offset.x - dst->tile.x;
+		dst->offset.y = offset.y - dst->tile.y;
+	} else if (dst->transform) {
+		// the window presents the transformed image
+		int width, height;
+		GdkPoint c;
+		transform_size(dst->transform, m->src_rect.width, m->src_rect.height, &width, &height);
+		transform_point(dst->transform, m->src_rect.width, m->src_rect.height, cursor, &c);
+		adjust_offset_value(&dst->offset.x, width,  dst->rect.width,  c.x);
+		adjust_offset_value(&dst->offset.y, height, dst->rect.height, c.y);
+	} else {
+		// Adjust the offsets
+		adjust_offset_value(&dst->offset.x, m->src_rect.width,  dst->rect.width,  cursor->x);
+		adjust_offset_value(&dst->offset.y, m->src_rect.height, dst->rect.height, cursor->y);
+	}
+
+	return memcmp(&dst->offset, &offset_bak, sizeof(offset_bak));
+}
+
+
+//
+// Destination transforms
+//
+// The image of a mirror (width x height) is first flipped (left-right) if
+// requested, then rotated clockwise. The transform is an affine map with
+// integer coefficients, in continuous coordinates (pixel (x,y) covers the
+// square [x,x+1[ x [y,y+1[):
+//
+//	u = matrix[0]*x + matrix[1]*y + matrix[2]
+//	v = matrix[3]*x + matrix[4]*y + matrix[5]
+//
+
+void
+transform_matrix(enum transform t, int width, int height, int matrix[6])
+{
+	static const int identity[6] = { 1, 0, 0, 0, 1, 0 };
+	int f[6], r[6];
+
+	memcpy(f, identity, sizeof(f));
+	if (t & TRANSFORM_FLIPPED) {
+		f[0] = -1;
+		f[2] = width;
+	}
+
+	switch (t & 3)
+	{
+	case TRANSFORM_90:
+		memcpy(r, (int[6]){ 0, -1, height,   1, 0, 0 }, sizeof(r));
+		break;
+	case TRANSFORM_180:
+		memcpy(r, (int[6]){ -1, 0, width,   0, -1, height }, sizeof(r));
+		break;
+	case TRANSFORM_270:
+		memcpy(r, (int[6]){ 0, 1, 0,   -1, 0, width }, sizeof(r));
+		break;
+	default:
+		memcpy(r, identity, sizeof(r));
+	}
+
+	// rotation o flip
+	matrix[0] = r[0]*f[0] + r[1]*f[3];
+	matrix[1] = r[0]*f[1] + r[1]*f[4];
+	matrix[2] = r[0]*f[2] + r[1]*f[5] + r[2];
+	matrix[3] = r[3]*f[0] + r[4]*f[3];
+	matrix[4] = r[3]*f[1] + r[4]*f[4];
+	matrix[5] = r[3]*f[2] + r[4]*f[5] + r[5];
+}
+
+// size of the transformed image
+void
+transform_size(enum transform t, int width, int height, int* t_width, int* t_height)
+{
+	*t_width  = (t & 1) ? height : width;
+	*t_height = (t & 1) ? width  : height;
+}
+
+// location of a rectangle of the image in the transformed image
+void
+transform_rect(enum transform t, int width, int height, const GdkRectangle* rect, GdkRectangle* t_rect)
+{
+	int m[6];
+	transform_matrix(t, width, height, m);
+
+	// opposite corners
+	int u0 = m[0]*rect->x + m[1]*rect->y + m[2];
+	int v0 = m[3]*rect->x + m[4]*rect->y + m[5];
+	int u1 = m[0]*(rect->x + rect->width) + m[1]*(rect->y + rect->height) + m[2];
+	int v1 = m[3]*(rect->x + rect->width) + m[4]*(rect->y + rect->height) + m[5];
+
+	t_rect->x = MIN(u0, u1);
+	t_rect->y = MIN(v0, v1);
+	t_rect->width  = ABS(u1 - u0);
+	t_rect->height = ABS(v1 - v0);
+}
+
+// location of a pixel of the image in the transformed image ({-1,-1} stays
+// off-screen)
+void
+transform_point(enum transform t, int width, int height, const GdkPoint* point, GdkPoint* t_point)
+{
+	if (point->x < 0) {
+		t_point->x = t_point->y = -1;
+		return;
+	}
+	GdkRectangle r = { point->x, point->y, 1, 1 };
+	transform_rect(t, width, height, &r, &r);
+	t_point->x = r.x;
+	t_point->y = r.y;
+}
+
+// location of a pixel of the transformed image in the image (inverse of
+// transform_point())
+void
+untransform_point(enum transform t, int width, int height, const GdkPoint* t_point, GdkPoint* point)
+{
+	// the flipped transforms are their own inverse, the inverse of a
+	// rotation is the opposite rotation
+	enum transform inverse = (t & TRANSFORM_FLIPPED) ? t : ((4 - t) & 3);
+	int t_width, t_height;
+
+	transform_size(t, width, height, &t_width, &t_height);
+	transform_point(inverse, t_width, t_height, t_point, point);
+}
+
+
+//
+// Cursor prediction
+//
+// The mirrored cursor is displayed some time after the pointer was sampled
+// (at least the next frame of the destination). Its location at the display
+// time is extrapolated from the recent samples: the velocity and the
+// acceleration are finite differences over samples at least
+// PREDICTION_MIN_DT apart (to smooth the jitter of the event stream). The
+// extrapolation is bounded in time and in distance, it never turns the
+// cursor back and it stops when the pointer is idle (the caller must add a
+// new sample once the pointer stopped, so that the cursor settles on its real
+// location).
+//
+
+#define PREDICTION_MIN_DT	4000	// µs
+#define PREDICTION_IDLE		50000	// µs without samples -> the pointer is stopped
+#define PREDICTION_MAX_HORIZON	50000	// µs
+#define PREDICTION_MAX_DISTANCE	64	// pixels
+
+void
+predictor_add(struct predictor* p, gint64 time, const GdkPoint* location)
+{
+	p->samples[p->next].time = time;
+	p->samples[p->next].location = *location;
+	p->next = (p->next + 1) % PREDICTION_SAMPLES;
+	p->n = MIN(p->n + 1, PREDICTION_SAMPLES);
+}
+
+// i-th sample, from the newest one
+const struct prediction_sample*
+predictor_sample(const struct predictor* p, int i)
+{
+	return &p->samples[(p->next + 2*PREDICTION_SAMPLES - 1 - i) % PREDICTION_SAMPLES];
+}
+
+// velocity (pixels per µs) between sample i and the first older sample at
+// least PREDICTION_MIN_DT before it
+//
+// mid: time of the velocity (middle of the two samples)
+//
+// return the index of the older sample (-1 if none)
+int
+predictor_velocity(const struct predictor* p, int i, double* vx, double* vy, gint64* mid)
+{
+	const struct prediction_sample* a = predictor_sample(p, i);
+	int k;
+
+	for (k=i+1 ; k<p->n ; k++)
+	{
+		const struct prediction_sample* b = predictor_sample(p, k);
+		gint64 dt = a->time - b->time;
+		if (dt > PREDICTION_IDLE) {
+			// (the motion started after b)
+			break;
+		}
+		if (dt >= PREDICTION_MIN_DT) {
+			*vx = (a->location.x - b->location.x) / (double)dt;
+			*vy = (a->location.y - b->location.y) / (double)dt;
+			*mid = (a->time + b->time) / 2;
+			return k;
+		}
+	}
+	return -1;
+}
+
+// location of the pointer at time now + delay
+//
+// return the extrapolation horizon (µs since the last sample, 0 if the
+// location of the last sample is returned)
+gint64
+predictor_predict(const struct predictor* p, gint64 now, gint64 delay, GdkPoint* location)
+{
+	double vx, vy, vx0, vy0, ax = 0, ay = 0;
+	gint64 mid, mid0;
+	int k;
+
+	if (!p->n) {
+		return 0;
+	}
+	const struct prediction_sample* last = predictor_sample(p, 0);
+	*location = last->location;
+
+	if ((now - last->time > PREDICTION_IDLE)
+		|| ((k = predictor_velocity(p, 0, &vx, &vy, &mid)) < 0)
+		|| (!vx && !vy))
+	{
+		// idle
+		return 0;
+	}
+	if (predictor_velocity(p, k, &vx0, &vy0, &mid0) >= 0) {
+		ax = (vx - vx0) / (mid - mid0);
+		ay = (vy - vy0) / (mid - mid0);
+	}
+
+	// (v is the velocity at mid)
+	double t = MIN(now + delay - last->time, PREDICTION_MAX_HORIZON);
+	double t0 = last->time - mid;
+	double dx = vx*t + ax*t*(t0 + t/2);
+	double dy = vy*t + ay*t*(t0 + t/2);
+
+	// the acceleration may slow down the cursor, not turn it back
+	if (dx*vx < 0) {
+		dx = 0;
+	}
+	if (dy*vy < 0) {
+		dy = 0;
+	}
+
+	double d = MAX(ABS(dx), ABS(dy));
+	if (d > PREDICTION_MAX_DISTANCE) {
+		dx *= PREDICTION_MAX_DISTANCE / d;
+		dy *= PREDICTION_MAX_DISTANCE / d;
+	}
+	location->x += (int)(dx + ((dx < 0) ? -0.5 : 0.5));
+	location->y += (int)(dy + ((dy < 0) ? -0.5 : 0.5));
+	return (gint64)t;
+}
+
+
+// return TRUE if rect is located entirely inside a destination (these damages
+// are likely caused by our own windows)
+gboolean
+is_inside_destination(const struct mirror* m, const GdkRectangle* rect)
+{
+	for (int i=0 ; i<m->n_destinations ; i++)
+	{
+		GdkRectangle r;
+		gdk_rectangle_union(rect, &m->destinations[i].rect, &r);
+		if (gdk_rectangle_equal(&m->destinations[i].rect, &r)) {
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+// convert a damaged rectangle (in root coordinates) into the coordinates of
+// the composed image
+gboolean
+mosaic_compute_damaged_rect(const struct mirror* m, GdkRectangle* rect)
+{
+	GdkRectangle acc = {0, 0, 0, 0};
+
+	if (is_inside_destination(m, rect)) {
+		return FALSE;
+	}
+
+	for (int i=0 ; i<m->n_sources ; i++)
+	{
+		GdkRectangle r;
+		if (gdk_rectangle_intersect(rect, &m->sources[i].rect, &r))
+		{
+			mosaic_source_to_cell(&m->sources[i], &r, &r);
+			if (acc.width == 0) {
+				acc = r;
+			} else {
+				gdk_rectangle_union(&r, &acc, &acc);
+			}
+		}
+	}
+	*rect = acc;
+	return acc.width != 0;
+}
+
+gboolean
+compute_damaged_rect(const struct mirror* m, GdkRectangle* rect)
+{
+	if (m->n_sources) {
+		return mosaic_compute_damaged_rect(m, rect);
+	}
+	if (m->capture_window || m->source_display) {
+		// window capture/cross-display: rect is already in the
+		// coordinates of the source
+		return gdk_rectangle_intersect(&m->src_rect, rect, rect);
+	}
+
+	// intersect the rectangle with src_rect
+	if (!gdk_rectangle_intersect(&m->src_rect, rect, rect)) {
+		// src_rect not damaged
+		return FALSE;
+	}
+
+	return !is_inside_destination(m, rect);
+}
+
+
+//
+// Mosaic
+//
+// The sources are scaled (keeping their aspect ratio) into the cells of the
+// composed image. The rectangles are converted with a margin of one pixel
+// because of the bilinear filtering.
+//
+
+#define MOSAIC_PIP_MARGIN	16
+
+// compute the location of the cells in a composed image of width×height
+void
+mosaic_layout(struct mirror* m, int width, int height)
+{
+	int i, n = m->n_sources;
+
+	m->src_rect = (GdkRectangle){0, 0, width, height};
+
+	for (i=0 ; i<n ; i++)
+	{
+		GdkRectangle area;	// area available for this source
+
+		if (config.mosaic_layout == MOSAIC_PIP)
+		{
+			if (i == 0) {
+				area = m->src_rect;
+			} else {
+				// insets at 1/4 of the size, stacked in the bottom-right corner
+				area.width  = width  / 4;
+				area.height = height / 4;
+				area.x = width  - area.width - MOSAIC_PIP_MARGIN;
+				area.y = height - i*(area.height + MOSAIC_PIP_MARGIN);
+			}
+		} else {
+			int cols = 1;
+			while (cols*cols < n) {
+				cols++;
+			}
+			int rows = (n + cols - 1) / cols;
+
+			area.x = (i % cols) * width  / cols;
+			area.y = (i / cols) * height / rows;
+			area.width  = width  / cols;
+			area.height = height / rows;
+		}
+
+		// fit the source inside the area
+		const GdkRectangle* r = &m->sources[i].rect;
+		GdkRectangle* c = &m->sources[i].cell;
+		if ((gint64)r->width * area.height > (gint64)r->height * area.width) {
+			c->width  = area.width;
+			c->height = MAX(1, (gint64)r->height * area.width / r->width);
+		} else {
+			c->width  = MAX(1, (gint64)r->width * area.height / r->height);
+			c->height = area.height;
+		}
+		c->x = area.x + (area.width  - c->width)  / 2;
+		c->y = area.y + (area.height - c->height) / 2;
+	}
+}
+
+// scale the interval [v0,v1[ from a length of 'from' to a length of 'to'
+// (rounded outwards, with a margin of one pixel)
+void
+mosaic_scale(int* v0, int* v1, int from, int to)
+{
+	*v0 = (gint64)*v0 * to / from - 1;
+	*v1 = ((gint64)*v1 * to + from - 1) / from + 1;
+}
+
+// convert an area of the cell into the corresponding area of the source
+// monitor (root coordinates)
+void
+mosaic_cell_to_source(const struct source* s, const GdkRectangle* cell_rect, GdkRectangle* src_rect)
+{
+	int x0 = cell_rect->x - s->cell.x, x1 = x0 + cell_rect->width;
+	int y0 = cell_rect->y - s->cell.y, y1 = y0 + cell_rect->height;
+	mosaic_scale(&x0, &x1, s->cell.width,  s->rect.width);
+	mosaic_scale(&y0, &y1, s->cell.height, s->rect.height);
+
+	GdkRectangle r = { s->rect.x + x0, s->rect.y + y0, x1 - x0, y1 - y0 };
+	if (!gdk_rectangle_intersect(&r, &s->rect, src_rect)) {
+		src_rect->width = src_rect->height = 0;
+	}
+}
+
+// convert an area of the source monitor (root coordinates) into the
+// corresponding area of the cell
+void
+mosaic_source_to_cell(const struct source* s, const GdkRectangle* src_rect, GdkRectangle* cell_rect)
+{
+	int x0 = src_rect->x - s->rect.x, x1 = x0 + src_rect->width;
+	int y0 = src_rect->y - s->rect.y, y1 = y0 + src_rect->height;
+	mosaic_scale(&x0, &x1, s->rect.width,  s->cell.width);
+	mosaic_scale(&y0, &y1, s->rect.height, s->cell.height);
+
+	GdkRectangle r = { s->cell.x + x0, s->cell.y + y0, x1 - x0, y1 - y0 };
+	if (!gdk_rectangle_intersect(&r, &s->cell, cell_rect)) {
+		cell_rect->width = cell_rect->height = 0;
+	}
+}
+
+// convert a location from root coordinates into the coordinates of the
+// composed image
+//
+// return FALSE if the point is outside the sources
+gboolean
+mosaic_map_point(const struct mirror* m, GdkPoint* p)
+{
+	for (int i=0 ; i<m->n_sources ; i++)
+	{
+		const struct source* s = &m->sources[i];
+		int x = p->x - s->rect.x;
+		int y = p->y - s->rect.y;
+		if ((x>=0) && (y>=0) && (x<s->rect.width) && (y<s->rect.height))
+		{
+			p->x = s->cell.x + (gint64)x * s->cell.width  / s->rect.width;
+			p->y = s->cell.y + (gint64)y * s->cell.height / s->rect.height;
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+
+//
+// Follow focus
+//
+// The source of the mirror is cropped to the active window, then scaled to
+// fit the destination (with the mosaic code). The damages outside the crop
+// are ignored.
+//
+
+// crop the source to the active window (window_rect is NULL or empty if
+// there is no active window)
+//
+// The whole monitor is displayed when the active window is not on the source
+// monitor.
+//
+// return TRUE if the crop was changed
+gboolean
+focus_crop(struct mirror* m, const GdkRectangle* window_rect)
+{
+	GdkRectangle crop;
+	if (!window_rect || !gdk_rectangle_intersect(window_rect, &m->crop_area, &crop)) {
+		crop = m->crop_area;
+	}
+
+	if (gdk_rectangle_equal(&crop, &m->sources[0].rect)) {
+		return FALSE;
+	}
+	m->sources[0].rect = crop;
+	mosaic_layout(m, m->src_rect.width, m->src_rect.height);
+	return TRUE;
+}
+
+
+//
+// Magnifier
+//
+// The source of the mirror is a small area around the pointer (1/zoom of the
+// size of the destination), scaled to fit the destination with the mosaic
+// code. Only this area is captured. It moves smoothly towards the pointer,
+// one step per frame (see zoom_step()).
+//
+
+#define ZOOM_EASING	4	// the area moves by 1/ZOOM_EASING of the remaining distance per step
+
+// set up the magnifier for a destination of width×height (the area is
+// centered in crop_area)
+void
+zoom_init(struct mirror* m, int zoom, int width, int height)
+{
+	GdkRectangle* r = &m->sources[0].rect;
+
+	m->zoom = zoom;
+	r->width  = MIN(MAX(1, width  / zoom), m->crop_area.width);
+	r->height = MIN(MAX(1, height / zoom), m->crop_area.height);
+	r->x = m->crop_area.x + (m->crop_area.width  - r->width)  / 2;
+	r->y = m->crop_area.y + (m->crop_area.height - r->height) / 2;
+
+	m->zoom_target.x = r->x;
+	m->zoom_target.y = r->y;
+}
+
+// center the area on the pointer (root coordinates)
+//
+// return FALSE if the pointer is outside the source monitor (the target is
+// then unchanged)
+gboolean
+zoom_set_target(struct mirror* m, const GdkPoint* pointer)
+{
+	const GdkRectangle* a = &m->crop_area;
+	const GdkRectangle* r = &m->sources[0].rect;
+
+	if (	(pointer->x < a->x) || (pointer->x >= a->x + a->width)
+	     ||	(pointer->y < a->y) || (pointer->y >= a->y + a->height))
+	{
+		return FALSE;
+	}
+	m->zoom_target.x = CLAMP(pointer->x - r->width/2,  a->x, a->x + a->width  - r->width);
+	m->zoom_target.y = CLAMP(pointer->y - r->height/2, a->y, a->y + a->height - r->height);
+	return TRUE;
+}
+
+// move the area one step towards its target
+//
+// return TRUE if the area was moved
+gboolean
+zoom_step(struct mirror* m)
+{
+	GdkRectangle* r = &m->sources[0].rect;
+	int dx = m->zoom_target.x - r->x;
+	int dy = m->zoom_target.y - r->y;
+
+	if (!dx && !dy) {
+		return FALSE;
+	}
+	r->x += (dx / ZOOM_EASING) ? (dx / ZOOM_EASING) : dx;
+	r->y += (dy / ZOOM_EASING) ? (dy / ZOOM_EASING) : dy;
+	return TRUE;
+}
+
+
+//
+// Refresh scheduler
+//
+// There is one scheduler per mirror. The damage events (common to all
+// mirrors) are dispatched according to the source rect of each mirror.
+// The window capture mirrors receive the damage events of their window
+// only.
+//
+// Damage events are merged into a single rectangle until the last event of
+// a batch ('more' is false), then the refresh function is called at most
+// once per min_refresh_period (the remaining damages are kept until the
+// next period).
+//
+// Timestamps are in milliseconds (X11 server time for the X11 backend).
+//
+
+void scheduler_try_refresh(struct mirror* m, guint32 timestamp, const GdkRectangle* damaged_rect);
+
+int
+scheduler_get_min_refresh_period()
+{
+	// (also called by the capture thread of the cross-display mirrors)
+	gint limit = __atomic_load_n(&config.opt_limit, __ATOMIC_RELAXED);
+	if (limit == 0) {
+		// no limit
+		return 0;
+	} else {
+		// 50 fps by default
+		return 1000 / ((limit<0) ? 50 : limit);
+	}
+}
+
+void
+scheduler_enable(gboolean (*refresh)(struct mirror*, const GdkRectangle*), struct stats* stats)
+{
+	for (int i=0 ; i<n_mirrors ; i++)
+	{
+		struct scheduler* scheduler = &mirrors[i].scheduler;
+		memset(scheduler, 0, sizeof(*scheduler));
+		scheduler->refresh = refresh;
+		scheduler->stats   = stats;
+		scheduler->min_refresh_period = scheduler_get_min_refresh_period();
+	}
+}
+
+void
+scheduler_cancel_timeout(struct scheduler* scheduler)
+{
+	if (scheduler->refresh_timeout) {
+		g_source_destroy(scheduler->refresh_timeout);
+		g_source_unref(scheduler->refresh_timeout);
+		scheduler->refresh_timeout = NULL;
+	}
+}
+
+void
+scheduler_disable()
+{
+	for (int i=0 ; i<n_mirrors ; i++)
+	{
+		struct scheduler* scheduler = &mirrors[i].scheduler;
+		scheduler_cancel_timeout(scheduler);
+		scheduler->refresh = NULL;
+	}
+}
+
+// apply a new value of config.opt_limit to the running schedulers
+void
+scheduler_update_limit()
+{
+	int period = scheduler_get_min_refresh_period();
+	for (int i=0 ; i<n_mirrors ; i++) {
+		// (the scheduler may run in the render thread)
+		__atomic_store_n(&mirrors[i].scheduler.min_refresh_period, period, __ATOMIC_RELAXED);
+	}
+}
+
+// refresh now the damages delayed by the rate limiter (before the scheduler
+// moves to another thread, its timeouts belong to the current one)
+void
+scheduler_flush()
+{
+	for (int i=0 ; i<n_mirrors ; i++)
+	{
+		struct scheduler* scheduler = &mirrors[i].scheduler;
+		if (!scheduler->refresh_timeout) {
+			continue;
+		}
+		scheduler_cancel_timeout(scheduler);
+		if (scheduler->pending_damage.width) {
+			scheduler->refresh(&mirrors[i], &scheduler->pending_damage);
+			scheduler->pending_damage.width = 0;
+		}
+	}
+}
+
+// run the delayed refreshes that are due at timestamp
+//
+// (for a backend driving the schedulers with a simulated clock: their
+// timeouts are then attached to a context that is never iterated, see
+// synthetic.c)
+void
+scheduler_run_due(guint32 timestamp)
+{
+	for (int i=0 ; i<n_mirrors ; i++)
+	{
+		struct mirror* m = &mirrors[i];
+		struct scheduler* scheduler = &m->scheduler;
+		if (scheduler->refresh_timeout && (timestamp >= scheduler->next_refresh)) {
+			scheduler_cancel_timeout(scheduler);
+			scheduler_try_refresh(m, scheduler->next_refresh, NULL);
+		}
+	}
+}
+
+gboolean
+scheduler_try_refresh_timeout(gpointer data)
+{
+	struct mirror* m = data;
+	g_source_unref(m->scheduler.refresh_timeout);
+	m->scheduler.refresh_timeout = NULL;
+
+	scheduler_try_refresh(m, m->scheduler.next_refresh, NULL);
+	return FALSE;
+}
+
+void
+scheduler_try_refresh(struct mirror* m, guint32 timestamp, const GdkRectangle* damaged_rect)
+{
+	struct scheduler* scheduler = &m->scheduler;
+	GdkRectangle* acc = &scheduler->pending_damage;
+	if (damaged_rect != NULL) {
+		if (acc->width == 0) {
+			*acc = *damaged_rect;
+		} else {
+			gdk_rectangle_union(damaged_rect, acc, acc);
+		}
+	}
+
+	guint32 next_refresh = scheduler->next_refresh;
+	if ((timestamp >= next_refresh) || (timestamp < next_refresh - 1000)) {
+		scheduler_cancel_timeout(scheduler);
+		scheduler->next_refresh = timestamp + __atomic_load_n(&scheduler->min_refresh_period, __ATOMIC_RELAXED);
+		if (acc->width) {
+			scheduler->refresh(m, acc);
+			acc->width = 0;
+		}
+
+	} else {
+		if (damaged_rect != NULL) {
+			STATS_ADD(scheduler->stats->drops, 1);
+		}
+		if (!scheduler->refresh_timeout) {
+			// the scheduler may run in another thread than the main
+			// loop (see the render thread in x11.c)
+			scheduler->refresh_timeout = g_timeout_source_new(next_refresh - timestamp);
+			g_source_set_callback(scheduler->refresh_timeout,
+					scheduler_try_refresh_timeout, m, NULL);
+			g_source_attach(scheduler->refresh_timeout,
+					g_main_context_get_thread_default());
+		}
+	}
+}
+
+// merge a damaged area into the current batch of a mirror
+void
+scheduler_merge_damage(struct mirror* m, guint32 timestamp, const GdkRectangle* damaged_rect, gboolean more)
+{
+	GdkRectangle rect = *damaged_rect;
+	GdkRectangle* acc = &m->scheduler.accumulated_damage;
+
+	if (compute_damaged_rect(m, &rect)) {
+		// source screen damaged
+		if (acc->width == 0) {
+			*acc = rect;
+		} else {
+			gdk_rectangle_union(&rect, acc, acc);
+		}
+	}
+
+	if (!more && acc->width)
+	{
+		scheduler_try_refresh(m, timestamp, acc);
+		acc->width = 0;
+	}
+}
+
+// register a damaged area (in root coordinates)
+//
+// The window capture and cross-display mirrors are ignored (they have their
+// own damage events).
+//
+// more: TRUE if more damage events are following immediately
+void
+scheduler_add_damage(guint32 timestamp, const GdkRectangle* damaged_rect, gboolean more)
+{
+	struct stats* stats = NULL;
+
+	for (int i=0 ; i<n_mirrors ; i++)
+	{
+		struct mirror* m = &mirrors[i];
+		if (!m->scheduler.refresh || m->capture_window || m->source_display) {
+			continue;
+		}
+		stats = m->scheduler.stats;
+
+		scheduler_merge_damage(m, timestamp, damaged_rect, more);
+	}
+
+	if (stats) {
+		STATS_ADD(stats->events, 1);
+	}
+}
+
+// register a damaged area of a single mirror (in the coordinates of its
+// source, used for the window capture and the cross-display mirrors)
+void
+scheduler_add_mirror_damage(struct mirror* m, guint32 timestamp, const GdkRectangle* damaged_rect, gboolean more)
+{
+	if (!m->scheduler.refresh) {
+		return;
+	}
+	STATS_ADD(m->scheduler.stats->events, 1);
+
+	scheduler_merge_damage(m, timestamp, damaged_rect, more);
+}
@@ -0,0 +1,363 @@
+#define _GNU_SOURCE
+#include "config.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <glib-unix.h>
+
+#include "squint.h"
+#include "squint-export.h"
+
+//
+// Frame export (--export)
+//
+// The protocol and the layout of the ring are described in squint-export.h.
+//
+// The backend keeps the current image in a canvas (like for the recording)
+// and reports the modified areas with export_damage(). They are accumulated
+// until the main loop is idle, then published as a single frame: the slot is
+// brought up to date by copying from the canvas the areas modified since it
+// was last written (the rectangles of the other slots), then the new ones.
+//
+// The socket is kept across the restarts (the clients receive a new ring),
+// it is removed by export_cleanup() when squint exits.
+//
+
+#define EXPORT_MAX_CLIENTS	8
+
+static struct {
+	const guint8*	canvas;
+	int		stride;		// of the canvas (in bytes)
+	int		width, height;
+
+	int		memfd;
+	gsize		size;
+	struct squint_export_header* header;
+	guint8*		frames;
+
+	// areas modified since the last frame
+	struct squint_export_rect rects[SQUINT_EXPORT_MAX_RECTS];
+	int		n_rects;
+	guint		publish_idle;
+} ex = { .memfd = -1 };
+
+static int	listen_fd = -1;
+static guint	listen_watch = 0;
+static struct {
+	int	fd;
+	guint	watch;
+} clients[EXPORT_MAX_CLIENTS];
+static int	n_clients = 0;
+
+
+// send a message to a client (without blocking)
+//
+// memfd: file descriptor to be attached (-1 if none)
+gboolean
+export_send(int fd, uint32_t type, uint64_t value, int memfd)
+{
+	struct squint_export_msg msg = { .type = type, .value = value };
+	struct iovec iov = { &msg, sizeof(msg) };
+	union {
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	struct msghdr hdr = { .msg_iov = &iov, .msg_iovlen = 1 };
+
+	if (memfd >= 0)
+	{
+		hdr.msg_control    = control.buf;
+		hdr.msg_controllen = sizeof(control.buf);
+		struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type  = SCM_RIGHTS;
+		cmsg->cmsg_len   = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &memfd, sizeof(int));
+	}
+	return sendmsg(fd, &hdr, MSG_DONTWAIT | MSG_NOSIGNAL) == sizeof(msg);
+}
+
+void
+export_remove_client(int i)
+{
+	g_source_remove(clients[i].watch);
+	close(clients[i].fd);
+	clients[i] = clients[--n_clients];
+}
+
+// the clients do not send anything, this is only for detecting the
+// disconnections
+gboolean
+export_on_client_event(gint fd, GIOCondition condition, gpointer data)
+{
+	char buf[sizeof(struct squint_export_msg)];
+	int i;
+
+	if (!(condition & (G_IO_HUP | G_IO_ERR)) && (recv(fd, buf, sizeof(buf), MSG_DONTWAIT) > 0)) {
+		return G_SOURCE_CONTINUE;
+	}
+
+	for (i=0 ; i<n_clients ; i++) {
+		if (clients[i].fd == fd) {
+			clients[i].watch = 0;
+			close(fd);
+			clients[i] = clients[--n_clients];
+			break;
+		}
+	}
+	return G_SOURCE_REMOVE;
+}
+
+gboolean
+export_on_connect(gint fd, GIOCondition condition, gpointer data)
+{
+	int client = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+	if (client < 0) {
+		return G_SOURCE_CONTINUE;
+	}
+	if ((n_clients == EXPORT_MAX_CLIENTS)
+		|| (ex.header && !export_send(client, SQUINT_EXPORT_MSG_RING, ex.size, ex.memfd)))
+	{
+		close(client);
+		return G_SOURCE_CONTINUE;
+	}
+
+	clients[n_clients].fd = client;
+	clients[n_clients].watch = g_unix_fd_add(client, G_IO_IN | G_IO_HUP | G_IO_ERR,
+			export_on_client_event, NULL);
+	n_clients++;
+	return G_SOURCE_CONTINUE;
+}
+
+// create the control socket (if not yet done)
+gboolean
+export_listen()
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+	if (listen_fd >= 0) {
+		return TRUE;
+	}
+	if (strlen(config.opt_export) >= sizeof(addr.sun_path)) {
+		squint_error("The path of the export socket is too long");
+		return FALSE;
+	}
+	strcpy(addr.sun_path, config.opt_export);
+
+	// remove the socket of a previous instance
+	unlink(config.opt_export);
+
+	listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if ((listen_fd < 0)
+		|| (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+		|| (listen(listen_fd, EXPORT_MAX_CLIENTS) < 0))
+	{
+		char* msg = g_strdup_printf("%s: %s", config.opt_export, g_strerror(errno));
+		squint_error(msg);
+		g_free(msg);
+		if (listen_fd >= 0) {
+			close(listen_fd);
+			listen_fd = -1;
+		}
+		return FALSE;
+	}
+	listen_watch = g_unix_fd_add(listen_fd, G_IO_IN, export_on_connect, NULL);
+	return TRUE;
+}
+
+// copy an area of the canvas into a slot
+void
+export_copy(int slot, const struct squint_export_rect* r)
+{
+	guint8* frame = ex.frames + slot * ex.header->frame_size;
+	int y;
+	for (y=r->y ; y<r->y + r->height ; y++) {
+		memcpy(frame + y * ex.header->stride + r->x * sizeof(guint32),
+			ex.canvas + y * ex.stride + r->x * sizeof(guint32),
+			r->width * sizeof(guint32));
+	}
+}
+
+gboolean
+export_publish(gpointer data)
+{
+	struct squint_export_header* h = ex.header;
+	const struct squint_export_rect full = { 0, 0, ex.width, ex.height };
+	guint64 seq = h->sequence + 1;
+	int s = seq % SQUINT_EXPORT_SLOTS;
+	struct squint_export_slot* slot = &h->slots[s];
+	int i, k;
+
+	ex.publish_idle = 0;
+
+	// invalidate the slot while it is rewritten
+	guint64 old = slot->sequence;
+	__atomic_store_n(&slot->sequence, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	if (old && (old + SQUINT_EXPORT_SLOTS == seq))
+	{
+		// the slot holds the frame seq-n_slots, the other slots hold
+		// the changes made since then
+		for (k=1 ; k<SQUINT_EXPORT_SLOTS ; k++)
+		{
+			const struct squint_export_slot* other = &h->slots[(s + k) % SQUINT_EXPORT_SLOTS];
+			for (i=0 ; i<other->n_rects ; i++) {
+				export_copy(s, &other->rects[i]);
+			}
+		}
+	} else {
+		export_copy(s, &full);
+	}
+
+	for (i=0 ; i<ex.n_rects ; i++) {
+		export_copy(s, &ex.rects[i]);
+	}
+	memcpy(slot->rects, ex.rects, ex.n_rects * sizeof(*ex.rects));
+	slot->n_rects = ex.n_rects;
+	ex.n_rects = 0;
+
+	__atomic_store_n(&slot->sequence, seq, __ATOMIC_RELEASE);
+	__atomic_store_n(&h->sequence, seq, __ATOMIC_RELEASE);
+
+	// notify the clients (the notification is lost if the client is late)
+	for (i=0 ; i<n_clients ; i++) {
+		export_send(clients[i].fd, SQUINT_EXPORT_MSG_FRAME, seq, -1);
+	}
+	return G_SOURCE_REMOVE;
+}
+
+// an area of the canvas was modified
+void
+export_damage(int x, int y, int width, int height)
+{
+	if (!ex.header) {
+		return;
+	}
+
+	GdkRectangle r = { x, y, width, height };
+	const GdkRectangle canvas = { 0, 0, ex.width, ex.height };
+	if (!gdk_rectangle_intersect(&r, &canvas, &r)) {
+		return;
+	}
+
+	if (ex.n_rects == SQUINT_EXPORT_MAX_RECTS)
+	{
+		// too many rectangles -> bounding box
+		int i;
+		for (i=0 ; i<ex.n_rects ; i++) {
+			GdkRectangle other = { ex.rects[i].x, ex.rects[i].y, ex.rects[i].width, ex.rects[i].height };
+			gdk_rectangle_union(&r, &other, &r);
+		}
+		ex.n_rects = 0;
+	}
+	ex.rects[ex.n_rects++] = (struct squint_export_rect){ r.x, r.y, r.width, r.height };
+
+	if (!ex.publish_idle) {
+		ex.publish_idle = g_idle_add(export_publish, NULL);
+	}
+}
+
+// start exporting the canvas (XRGB, the backend must update it and call
+// export_damage() for every modified area)
+//
+// does nothing if the export is not enabled (--export)
+gboolean
+export_start(const void* canvas, int width, int height, int stride)
+{
+	int i;
+
+	if (!config.opt_export || ex.header || !export_listen()) {
+		return FALSE;
+	}
+
+	gsize header_size = (sizeof(struct squint_export_header) + 4095) & ~4095;
+	gsize frame_size = (gsize)width * height * sizeof(guint32);
+
+	ex.canvas = canvas;
+	ex.stride = stride;
+	ex.width  = width;
+	ex.height = height;
+	ex.size   = header_size + SQUINT_EXPORT_SLOTS * frame_size;
+
+	ex.memfd = memfd_create("squint-export", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if ((ex.memfd < 0) || (ftruncate(ex.memfd, ex.size) < 0)) {
+		squint_error("Cannot allocate the export ring");
+		export_stop();
+		return FALSE;
+	}
+	// the clients may rely on the size of the mapping
+	fcntl(ex.memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+
+	ex.header = mmap(NULL, ex.size, PROT_READ | PROT_WRITE, MAP_SHARED, ex.memfd, 0);
+	if (ex.header == MAP_FAILED) {
+		ex.header = NULL;
+		squint_error("Cannot map the export ring");
+		export_stop();
+		return FALSE;
+	}
+	ex.frames = (guint8*)ex.header + header_size;
+
+	ex.header->magic   = SQUINT_EXPORT_MAGIC;
+	ex.header->version = SQUINT_EXPORT_VERSION;
+	ex.header->width   = width;
+	ex.header->height  = height;
+	ex.header->stride  = width * sizeof(guint32);
+	ex.header->n_slots = SQUINT_EXPORT_SLOTS;
+	ex.header->frame_offset = header_size;
+	ex.header->frame_size   = frame_size;
+
+	for (i=n_clients-1 ; i>=0 ; i--) {
+		if (!export_send(clients[i].fd, SQUINT_EXPORT_MSG_RING, ex.size, ex.memfd)) {
+			export_remove_client(i);
+		}
+	}
+
+	// the first frame is complete
+	export_damage(0, 0, width, height);
+	return TRUE;
+}
+
+void
+export_stop()
+{
+	if (ex.publish_idle) {
+		// last frame
+		g_source_remove(ex.publish_idle);
+		export_publish(NULL);
+	}
+	if (ex.header) {
+		munmap(ex.header, ex.size);
+	}
+	if (ex.memfd >= 0) {
+		close(ex.memfd);
+	}
+	memset(&ex, 0, sizeof(ex));
+	ex.memfd = -1;
+}
+
+// close the socket (when exiting)
+void
+export_cleanup()
+{
+	export_stop();
+
+	while (n_clients) {
+		export_remove_client(n_clients - 1);
+	}
+	if (listen_fd >= 0)
+	{
+		g_source_remove(listen_watch);
+		close(listen_fd);
+		unlink(config.opt_export);
+		listen_fd = -1;
+	}
+}
@@ -0,0 +1,306 @@
+#include "config.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "squint.h"
+
+//
+// Recording (--record)
+//
+// The image of the first mirror is recorded into a YUV4MPEG2 file (which can
+// be played by mpv or compressed by ffmpeg) at a constant frame rate.
+//
+// The backend keeps the current image in a canvas and reports the areas it
+// modifies (record_damage()). On each tick, the tiles modified since the
+// previous tick are copied from the canvas into a free frame of the ring and
+// the frame is handed to the encoder thread. The encoder converts only these
+// tiles into its YUV image (the others are unchanged) and writes the image.
+//
+// The main loop never waits for the encoder (nor for the disk): when there is
+// no free frame in the ring, the frame is dropped and the modified tiles are
+// carried over to the next one.
+//
+
+#define RECORD_FPS		25
+#define RECORD_RING_SIZE	4
+#define RECORD_TILE_SIZE	64	// must be even (chroma subsampling)
+
+struct record_frame {
+	guint8*		dirty;		// modified tiles
+	guint32*	pixels;		// XRGB (only the modified tiles are valid)
+};
+
+static struct {
+	const guint8*	canvas;
+	int		stride;		// of the canvas (in bytes)
+	int		width, height;	// (even)
+	int		tiles_x, tiles_y;
+	guint8*		dirty;		// tiles modified since the last frame
+
+	struct record_frame frames[RECORD_RING_SIZE];
+	GAsyncQueue*	free_frames;
+	GAsyncQueue*	full_frames;
+	GThread*	thread;
+	guint		timer;
+
+	gchar*		path;
+	guint		written;	// number of frames written (by the encoder thread)
+	guint		drops;		// number of frames dropped
+} rec;
+
+// pushed into full_frames to stop the encoder
+static struct record_frame record_end;
+
+// number of recordings since the start (the next ones are suffixed)
+static int n_recordings = 0;
+
+
+// report an error from the encoder thread
+gboolean
+record_on_error(gpointer data)
+{
+	squint_error(data);
+	g_free(data);
+	return G_SOURCE_REMOVE;
+}
+
+// convert a tile into the YUV image (BT.601 full range, as expected by
+// C420jpeg)
+void
+record_convert_tile(const struct record_frame* frame, guint8* yuv, int tx, int ty)
+{
+	const int w = rec.width, h = rec.height;
+	guint8* y_plane = yuv;
+	guint8* u_plane = yuv + w*h;
+	guint8* v_plane = u_plane + (w/2)*(h/2);
+
+	int x0 = tx * RECORD_TILE_SIZE, x1 = MIN(x0 + RECORD_TILE_SIZE, w);
+	int y0 = ty * RECORD_TILE_SIZE, y1 = MIN(y0 + RECORD_TILE_SIZE, h);
+	int x, y, i;
+
+	for (y=y0 ; y<y1 ; y+=2)
+	{
+		const guint32* row[2] = { frame->pixels + y*w, frame->pixels + (y+1)*w };
+		for (x=x0 ; x<x1 ; x+=2)
+		{
+			int r = 0, g = 0, b = 0;
+			for (i=0 ; i<4 ; i++)
+			{
+				guint32 p = row[i>>1][x + (i&1)];
+				int pr = (p >> 16) & 0xff, pg = (p >> 8) & 0xff, pb = p & 0xff;
+				y_plane[(y + (i>>1))*w + x + (i&1)] = (77*pr + 150*pg + 29*pb + 128) >> 8;
+				r += pr;
+				g += pg;
+				b += pb;
+			}
+			// the chroma is averaged over the 2x2 block
+			u_plane[(y/2)*(w/2) + x/2] = ( -43*r -  85*g + 128*b + (128<<10)) >> 10;
+			v_plane[(y/2)*(w/2) + x/2] = ( 128*r - 107*g -  21*b + (128<<10)) >> 10;
+		}
+	}
+}
+
+gpointer
+record_encoder(gpointer data)
+{
+	const gsize y_size = (gsize)rec.width * rec.height;
+	const gsize yuv_size = y_size + y_size/2;
+	guint8* yuv = g_malloc(yuv_size);
+	struct record_frame* frame;
+	int tx, ty;
+
+	// black image
+	memset(yuv, 0, y_size);
+	memset(yuv + y_size, 128, yuv_size - y_size);
+
+	// may block (eg: if the output is a fifo)
+	FILE* f = fopen(rec.path, "wb");
+	if (f) {
+		fprintf(f, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n",
+				rec.width, rec.height, RECORD_FPS);
+	} else {
+		g_idle_add(record_on_error, g_strdup_printf("%s: %s", rec.path, g_strerror(errno)));
+	}
+
+	while ((frame = g_async_queue_pop(rec.full_frames)) != &record_end)
+	{
+		for (ty=0 ; ty<rec.tiles_y ; ty++) {
+			for (tx=0 ; tx<rec.tiles_x ; tx++) {
+				if (frame->dirty[ty*rec.tiles_x + tx]) {
+					record_convert_tile(frame, yuv, tx, ty);
+				}
+			}
+		}
+		g_async_queue_push(rec.free_frames, frame);
+
+		// the unchanged frames are written too (constant frame rate)
+		if (f && ((fputs("FRAME\n", f) < 0) || (fwrite(yuv, yuv_size, 1, f) != 1))) {
+			g_idle_add(record_on_error, g_strdup_printf("%s: %s", rec.path, g_strerror(errno)));
+			fclose(f);
+			f = NULL;
+		}
+		if (f) {
+			rec.written++;
+		}
+	}
+
+	if (f) {
+		fclose(f);
+	}
+	g_free(yuv);
+	return NULL;
+}
+
+// hand the tiles modified since the last frame to the encoder
+//
+// return FALSE if the ring is full
+gboolean
+record_push_frame(struct record_frame* frame)
+{
+	int tx, ty, y;
+
+	if (!frame) {
+		rec.drops++;
+		return FALSE;
+	}
+
+	for (ty=0 ; ty<rec.tiles_y ; ty++)
+	{
+		int y0 = ty * RECORD_TILE_SIZE, y1 = MIN(y0 + RECORD_TILE_SIZE, rec.height);
+		for (tx=0 ; tx<rec.tiles_x ; tx++)
+		{
+			int i = ty*rec.tiles_x + tx;
+			frame->dirty[i] = rec.dirty[i];
+			if (!rec.dirty[i]) {
+				continue;
+			}
+			int x0 = tx * RECORD_TILE_SIZE;
+			int len = (MIN(x0 + RECORD_TILE_SIZE, rec.width) - x0) * sizeof(guint32);
+			for (y=y0 ; y<y1 ; y++) {
+				memcpy(frame->pixels + y*rec.width + x0,
+					rec.canvas + y*rec.stride + x0*sizeof(guint32), len);
+			}
+		}
+	}
+	memset(rec.dirty, 0, rec.tiles_x * rec.tiles_y);
+
+	g_async_queue_push(rec.full_frames, frame);
+	return TRUE;
+}
+
+gboolean
+record_on_tick(gpointer data)
+{
+	record_push_frame(g_async_queue_try_pop(rec.free_frames));
+	return G_SOURCE_CONTINUE;
+}
+
+// start recording the canvas (XRGB, the backend must update it and call
+// record_damage() for every modified area)
+//
+// does nothing if the recording is not enabled (--record)
+gboolean
+record_start(const void* canvas, int width, int height, int stride)
+{
+	int i;
+
+	if (!config.opt_record || rec.thread) {
+		return FALSE;
+	}
+
+	// the chroma is subsampled -> even size
+	width  &= ~1;
+	height &= ~1;
+	if (!width || !height) {
+		return FALSE;
+	}
+
+	rec.canvas = canvas;
+	rec.stride = stride;
+	rec.width  = width;
+	rec.height = height;
+	rec.tiles_x = (width  + RECORD_TILE_SIZE - 1) / RECORD_TILE_SIZE;
+	rec.tiles_y = (height + RECORD_TILE_SIZE - 1) / RECORD_TILE_SIZE;
+
+	// the first frame is complete
+	rec.dirty = g_malloc(rec.tiles_x * rec.tiles_y);
+	memset(rec.dirty, 1, rec.tiles_x * rec.tiles_y);
+
+	rec.free_frames = g_async_queue_new();
+	rec.full_frames = g_async_queue_new();
+	for (i=0 ; i<RECORD_RING_SIZE ; i++)
+	{
+		rec.frames[i].dirty  = g_malloc(rec.tiles_x * rec.tiles_y);
+		rec.frames[i].pixels = g_new(guint32, (gsize)width * height);
+		g_async_queue_push(rec.free_frames, &rec.frames[i]);
+	}
+
+	rec.path = n_recordings
+		? g_strdup_printf("%s.%d", config.opt_record, n_recordings)
+		: g_strdup(config.opt_record);
+	n_recordings++;
+	rec.written = rec.drops = 0;
+
+	rec.thread = g_thread_new("encoder", record_encoder, NULL);
+	rec.timer  = g_timeout_add(1000 / RECORD_FPS, record_on_tick, NULL);
+	return TRUE;
+}
+
+// an area of the canvas was modified
+void
+record_damage(int x, int y, int width, int height)
+{
+	int tx, ty;
+
+	if (!rec.thread) {
+		return;
+	}
+
+	GdkRectangle r = { x, y, width, height };
+	const GdkRectangle canvas = { 0, 0, rec.width, rec.height };
+	if (!gdk_rectangle_intersect(&r, &canvas, &r)) {
+		return;
+	}
+
+	for (ty = r.y / RECORD_TILE_SIZE ; ty <= (r.y + r.height - 1) / RECORD_TILE_SIZE ; ty++) {
+		for (tx = r.x / RECORD_TILE_SIZE ; tx <= (r.x + r.width - 1) / RECORD_TILE_SIZE ; tx++) {
+			rec.dirty[ty*rec.tiles_x + tx] = 1;
+		}
+	}
+}
+
+// stop the recording (wait until the encoder has written the pending frames)
+void
+record_stop()
+{
+	int i;
+
+	if (!rec.thread) {
+		return;
+	}
+
+	g_source_remove(rec.timer);
+	rec.timer = 0;
+
+	// last frame
+	record_push_frame(g_async_queue_pop(rec.free_frames));
+
+	g_async_queue_push(rec.full_frames, &record_end);
+	g_thread_join(rec.thread);
+	rec.thread = NULL;
+
+	printf("record: %s: %u frames written, %u dropped\n", rec.path, rec.written, rec.drops);
+
+	for (i=0 ; i<RECORD_RING_SIZE ; i++) {
+		g_free(rec.frames[i].dirty);
+		g_free(rec.frames[i].pixels);
+	}
+	g_async_queue_unref(rec.free_frames);
+	g_async_queue_unref(rec.full_frames);
+	g_free(rec.dirty);
+	g_free(rec.path);
+	memset(&rec, 0, sizeof(rec));
+}
@@ -0,0 +1,722 @@
+#include "config.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCALE_AVX2
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define SCALE_NEON
+#endif
+
+#include "squint.h"
+
+//
+// CPU scaler (--scale)
+//
+// Used by the backends that hold the captured image in memory (wayland,
+// synthetic) to scale it to fit the destination, and by the X11 backend
+// without the OpenGL presenter (on the images read back from the server).
+//
+// The filter is separable: for each axis, the weights of every destination
+// pixel are computed once (when the scaler is created) as 'taps' consecutive
+// 2.14 fixed point values. The image is processed by tiles of the
+// destination, only the tiles covering the areas passed to scaler_run() are
+// computed: the source rows needed by the tile are first scaled horizontally
+// into a buffer of 16-bit values (with 6 bits of fraction), then the buffer is
+// scaled vertically into the destination. scaler_map_area() gives the
+// destination area affected by a source damage (it is larger than the damage
+// because of the support of the filter).
+//
+// The rows are computed by the AVX2 or NEON kernels when available (the
+// generic kernels give the same results).
+//
+// The tiles are split between the threads of a pool shared by all the
+// scalers (the caller works too). Each thread takes the tiles from the front
+// of its own share, then steals from the back of the other ones when it is
+// done.
+//
+
+#define SCALE_TILE_SIZE		64
+#define SCALE_MAX_THREADS	4	// (including the caller)
+#define SCALE_MIN_PARALLEL	4	// smaller jobs are run by the caller alone
+
+#define SCALE_WEIGHT_BITS	14	// fraction bits of the weights
+#define SCALE_H_SHIFT		8	// the horizontal pass keeps 6 fraction bits
+#define SCALE_V_SHIFT		20
+
+// weights of a dimension
+struct scale_axis {
+	int	taps;		// number of source pixels per destination pixel
+	int*	start;		// first source pixel of each destination pixel
+	gint16*	weights;	// (taps per destination pixel)
+};
+
+typedef void (*scale_row_h_func)(const guint8* src, gint16* out, const struct scale_axis* a, int x0, int x1);
+typedef void (*scale_row_v_func)(const gint16* rows, int row_stride, const gint16* weights, int taps, guint8* dst, int n);
+
+struct scaler {
+	int			src_width, src_height;
+	int			dst_width, dst_height;
+	struct scale_axis	h, v;
+
+	int			tiles_x, tiles_y;
+	guint8*			dirty;		// tiles to be computed by the current run
+	int*			jobs;		// (indexes of these tiles)
+	int			max_rows;	// max number of source rows needed by a tile
+
+	scale_row_h_func	row_h;
+	scale_row_v_func	row_v;
+
+	// arguments of the current run
+	const guint8*		src;
+	int			src_stride;
+	guint8*			dst;
+	int			dst_stride;
+};
+
+// thread pool (shared by all the scalers)
+static struct {
+	int		refs;
+	int		n_threads;	// including the caller (thread 0)
+	GThread*	threads[SCALE_MAX_THREADS];
+
+	GMutex		lock;
+	GCond		start_cond;
+	GCond		done_cond;
+	guint		generation;	// incremented for every job
+	int		busy;		// number of workers still running the job
+	gboolean	quit;
+	struct scaler*	job;
+
+	struct {
+		// tiles not yet taken: [first, end) of the list of jobs,
+		// packed as (first << 32) | end
+		guint64	range;
+		gint16*	buffer;
+		gsize	buffer_size;
+	} __attribute__((aligned(64))) shares[SCALE_MAX_THREADS];
+} pool;
+
+
+//
+// filters
+//
+
+double
+scale_filter_triangle(double x)
+{
+	x = fabs(x);
+	return (x < 1.0) ? 1.0 - x : 0.0;
+}
+
+double
+scale_sinc(double x)
+{
+	return (x == 0.0) ? 1.0 : sin(G_PI * x) / (G_PI * x);
+}
+
+double
+scale_filter_lanczos(double x)
+{
+	return (fabs(x) < 3.0) ? scale_sinc(x) * scale_sinc(x / 3.0) : 0.0;
+}
+
+// compute the weights of an axis
+void
+scale_axis_init(struct scale_axis* a, enum scale_filter filter, int src, int dst)
+{
+	double (*func)(double) = (filter == SCALE_LANCZOS) ? scale_filter_lanczos : scale_filter_triangle;
+	double radius = (filter == SCALE_LANCZOS) ? 3.0 : 1.0;
+	double scale = (double)dst / src;
+
+	// when reducing, the filter is stretched over the source pixels
+	double stretch = (scale < 1.0) ? 1.0 / scale : 1.0;
+	double support = radius * stretch;
+
+	// the SIMD kernels process the taps by pairs
+	a->taps = (int)ceil(2.0 * support - 1e-9);
+	a->taps = MIN((a->taps + 1) & ~1, src);
+	a->start   = g_new(int, dst);
+	a->weights = g_new0(gint16, (gsize)dst * a->taps);
+
+	double* w = g_new(double, a->taps);
+	int i, j, k;
+	for (i=0 ; i<dst ; i++)
+	{
+		double center = (i + 0.5) / scale;
+		int first = (int)floor(center - 0.5 - support) + 1;
+		int start = CLAMP(first, 0, src - a->taps);
+		double sum = 0;
+
+		// the pixels outside the source are replaced with the ones of
+		// the edge
+		memset(w, 0, a->taps * sizeof(*w));
+		for (j=first ; j<first + a->taps ; j++) {
+			double v = func((j + 0.5 - center) / stretch);
+			w[CLAMP(j, 0, src - 1) - start] += v;
+			sum += v;
+		}
+
+		// normalise, the rounding error goes to the largest weight
+		gint16* out = a->weights + (gsize)i * a->taps;
+		int total = 0, largest = 0;
+		for (k=0 ; k<a->taps ; k++) {
+			out[k] = lround(w[k] / sum * (1 << SCALE_WEIGHT_BITS));
+			total += out[k];
+			if (out[k] > out[largest]) {
+				largest = k;
+			}
+		}
+		out[largest] += (1 << SCALE_WEIGHT_BITS) - total;
+		a->start[i] = start;
+	}
+	g_free(w);
+}
+
+void
+scale_axis_fini(struct scale_axis* a)
+{
+	g_free(a->start);
+	g_free(a->weights);
+}
+
+// range of destination pixels [*dst_first, *dst_end) that depend on the
+// source pixels [src_first, src_end)
+void
+scale_axis_map(const struct scale_axis* a, int n, int src_first, int src_end, int* dst_first, int* dst_end)
+{
+	// (start is non-decreasing)
+	int lo = 0, hi = n;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (a->start[mid] + a->taps > src_first) {
+			hi = mid;
+		} else {
+			lo = mid + 1;
+		}
+	}
+	*dst_first = lo;
+
+	hi = n;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (a->start[mid] < src_end) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	*dst_end = lo;
+}
+
+
+//
+// kernels
+//
+// row_h() scales the source pixels needed by the destination pixels
+// [x0, x1) of a row and stores 4 values per pixel into 'out'.
+//
+// row_v() computes n bytes of a destination row from 'taps' rows of the
+// horizontal pass.
+//
+
+void
+scale_row_h_generic(const guint8* src, gint16* out, const struct scale_axis* a, int x0, int x1)
+{
+	int x, c, k;
+	for (x=x0 ; x<x1 ; x++)
+	{
+		const guint8* p = src + a->start[x] * 4;
+		const gint16* w = a->weights + (gsize)x * a->taps;
+		for (c=0 ; c<4 ; c++)
+		{
+			int sum = 0;
+			for (k=0 ; k<a->taps ; k++) {
+				sum += p[k*4 + c] * w[k];
+			}
+			*out++ = (sum + (1 << (SCALE_H_SHIFT-1))) >> SCALE_H_SHIFT;
+		}
+	}
+}
+
+void
+scale_row_v_generic(const gint16* rows, int row_stride, const gint16* weights, int taps, guint8* dst, int n)
+{
+	int i, k;
+	for (i=0 ; i<n ; i++)
+	{
+		int sum = 1 << (SCALE_V_SHIFT-1);
+		for (k=0 ; k<taps ; k++) {
+			sum += rows[k*row_stride + i] * weights[k];
+		}
+		sum >>= SCALE_V_SHIFT;
+		dst[i] = CLAMP(sum, 0, 255);
+	}
+}
+
+#ifdef SCALE_AVX2
+// two destination pixels per iteration (one per lane), the pixels of two
+// consecutive taps are interleaved by channel (and zero-extended) so that a
+// single madd multiplies and adds both taps
+__attribute__((target("avx2")))
+void
+scale_row_h_avx2(const guint8* src, gint16* out, const struct scale_axis* a, int x0, int x1)
+{
+	const __m256i taps01 = _mm256_setr_epi8(
+			0, -1, 4, -1, 1, -1, 5, -1, 2, -1, 6, -1, 3, -1, 7, -1,
+			0, -1, 4, -1, 1, -1, 5, -1, 2, -1, 6, -1, 3, -1, 7, -1);
+	const __m256i taps23 = _mm256_setr_epi8(
+			8, -1, 12, -1, 9, -1, 13, -1, 10, -1, 14, -1, 11, -1, 15, -1,
+			8, -1, 12, -1, 9, -1, 13, -1, 10, -1, 14, -1, 11, -1, 15, -1);
+	const __m256i round = _mm256_set1_epi32(1 << (SCALE_H_SHIFT-1));
+	const int taps = a->taps;
+	int x, k;
+
+	for (x=x0 ; x+2<=x1 ; x+=2)
+	{
+		const guint8* p0 = src + a->start[x] * 4;
+		const guint8* p1 = src + a->start[x+1] * 4;
+		const gint16* w0 = a->weights + (gsize)x * taps;
+		const gint16* w1 = w0 + taps;
+		__m256i acc = round;
+		gint32 u, v;
+
+		// 4 taps per iteration
+		for (k=0 ; k+4<=taps ; k+=4)
+		{
+			__m256i px = _mm256_inserti128_si256(_mm256_castsi128_si256(
+						_mm_loadu_si128((const __m128i*)(p0 + k*4))),
+					_mm_loadu_si128((const __m128i*)(p1 + k*4)), 1);
+			memcpy(&u, w0 + k, 4);
+			memcpy(&v, w1 + k, 4);
+			acc = _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_shuffle_epi8(px, taps01),
+						_mm256_setr_epi32(u, u, u, u, v, v, v, v)));
+			memcpy(&u, w0 + k + 2, 4);
+			memcpy(&v, w1 + k + 2, 4);
+			acc = _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_shuffle_epi8(px, taps23),
+						_mm256_setr_epi32(u, u, u, u, v, v, v, v)));
+		}
+		if (k < taps)
+		{
+			// last pair
+			__m256i px = _mm256_inserti128_si256(_mm256_castsi128_si256(
+						_mm_loadl_epi64((const __m128i*)(p0 + k*4))),
+					_mm_loadl_epi64((const __m128i*)(p1 + k*4)), 1);
+			memcpy(&u, w0 + k, 4);
+			memcpy(&v, w1 + k, 4);
+			acc = _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_shuffle_epi8(px, taps01),
+						_mm256_setr_epi32(u, u, u, u, v, v, v, v)));
+		}
+
+		acc = _mm256_srai_epi32(acc, SCALE_H_SHIFT);
+		acc = _mm256_permute4x64_epi64(_mm256_packs_epi32(acc, acc), 0x08);
+		_mm_storeu_si128((__m128i*)out, _mm256_castsi256_si128(acc));
+		out += 8;
+	}
+	scale_row_h_generic(src, out, a, x, x1);
+}
+
+// 16 values per iteration, the rows are processed by pairs (interleaved for
+// madd)
+__attribute__((target("avx2")))
+void
+scale_row_v_avx2(const gint16* rows, int row_stride, const gint16* weights, int taps, guint8* dst, int n)
+{
+	const __m256i round = _mm256_set1_epi32(1 << (SCALE_V_SHIFT-1));
+	int i, k;
+
+	for (i=0 ; i+16<=n ; i+=16)
+	{
+		__m256i lo = round, hi = round;
+		for (k=0 ; k<taps ; k+=2)
+		{
+			__m256i a = _mm256_loadu_si256((const __m256i*)(rows + k*row_stride + i));
+			__m256i b = _mm256_loadu_si256((const __m256i*)(rows + (k+1)*row_stride + i));
+			gint32 w;
+			memcpy(&w, weights + k, 4);
+			__m256i wv = _mm256_set1_epi32(w);
+			lo = _mm256_add_epi32(lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), wv));
+			hi = _mm256_add_epi32(hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), wv));
+		}
+		// (packs restores the order of the unpacked values)
+		__m256i v = _mm256_packs_epi32(_mm256_srai_epi32(lo, SCALE_V_SHIFT), _mm256_srai_epi32(hi, SCALE_V_SHIFT));
+		v = _mm256_permute4x64_epi64(_mm256_packus_epi16(v, v), 0x08);
+		_mm_storeu_si128((__m128i*)(dst + i), _mm256_castsi256_si128(v));
+	}
+	scale_row_v_generic(rows + i, row_stride, weights, taps, dst + i, n - i);
+}
+#endif
+
+#ifdef SCALE_NEON
+// the taps are accumulated for the 4 channels of a pixel
+void
+scale_row_h_neon(const guint8* src, gint16* out, const struct scale_axis* a, int x0, int x1)
+{
+	const int taps = a->taps;
+	int x, k;
+
+	for (x=x0 ; x<x1 ; x++)
+	{
+		const guint8* p = src + a->start[x] * 4;
+		const gint16* w = a->weights + (gsize)x * taps;
+		int32x4_t acc = vdupq_n_s32(0);
+
+		// 2 taps per iteration
+		for (k=0 ; k<taps ; k+=2)
+		{
+			int16x8_t px = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(p + k*4)));
+			acc = vmlal_n_s16(acc, vget_low_s16(px),  w[k]);
+			acc = vmlal_n_s16(acc, vget_high_s16(px), w[k+1]);
+		}
+		vst1_s16(out, vqmovn_s32(vrshrq_n_s32(acc, SCALE_H_SHIFT)));
+		out += 4;
+	}
+}
+
+// 8 values per iteration
+void
+scale_row_v_neon(const gint16* rows, int row_stride, const gint16* weights, int taps, guint8* dst, int n)
+{
+	int i, k;
+
+	for (i=0 ; i+8<=n ; i+=8)
+	{
+		int32x4_t lo = vdupq_n_s32(0), hi = vdupq_n_s32(0);
+		for (k=0 ; k<taps ; k++)
+		{
+			int16x8_t r = vld1q_s16(rows + k*row_stride + i);
+			lo = vmlal_n_s16(lo, vget_low_s16(r),  weights[k]);
+			hi = vmlal_n_s16(hi, vget_high_s16(r), weights[k]);
+		}
+		int16x8_t v = vcombine_s16(vqmovn_s32(vrshrq_n_s32(lo, SCALE_V_SHIFT)),
+					   vqmovn_s32(vrshrq_n_s32(hi, SCALE_V_SHIFT)));
+		vst1_u8(dst + i, vqmovun_s16(v));
+	}
+	scale_row_v_generic(rows + i, row_stride, weights, taps, dst + i, n - i);
+}
+#endif
+
+
+//
+// tiles
+//
+
+// source rows needed by a row of tiles
+void
+scale_tile_rows(const struct scaler* s, int ty, int* first, int* end)
+{
+	int y0 = ty * SCALE_TILE_SIZE;
+	int y1 = MIN(y0 + SCALE_TILE_SIZE, s->dst_height);
+	*first = s->v.start[y0];
+	*end   = s->v.start[y1 - 1] + s->v.taps;
+}
+
+void
+scale_tile(const struct scaler* s, int tile, gint16* buffer)
+{
+	int tx = tile % s->tiles_x, ty = tile / s->tiles_x;
+	int x0 = tx * SCALE_TILE_SIZE, x1 = MIN(x0 + SCALE_TILE_SIZE, s->dst_width);
+	int y0 = ty * SCALE_TILE_SIZE, y1 = MIN(y0 + SCALE_TILE_SIZE, s->dst_height);
+	int row_stride = (x1 - x0) * 4;
+	int first, end, y;
+
+	scale_tile_rows(s, ty, &first, &end);
+
+	for (y=first ; y<end ; y++) {
+		s->row_h(s->src + (gssize)y * s->src_stride, buffer + (y - first) * row_stride, &s->h, x0, x1);
+	}
+	for (y=y0 ; y<y1 ; y++) {
+		s->row_v(buffer + (s->v.start[y] - first) * row_stride, row_stride,
+			s->v.weights + (gsize)y * s->v.taps, s->v.taps,
+			s->dst + (gssize)y * s->dst_stride + x0 * 4, row_stride);
+	}
+}
+
+// take a tile from the front of a share (own == TRUE) or from its back
+//
+// return -1 if the share is empty
+int
+scale_take(int share, gboolean own)
+{
+	guint64* range = &pool.shares[share].range;
+	guint64 cur = __atomic_load_n(range, __ATOMIC_RELAXED);
+	guint32 first, end;
+
+	do {
+		first = cur >> 32;
+		end   = (guint32)cur;
+		if (first >= end) {
+			return -1;
+		}
+	} while (!__atomic_compare_exchange_n(range, &cur,
+			own ? ((guint64)(first + 1) << 32) | end : ((guint64)first << 32) | (end - 1),
+			FALSE, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+	return own ? first : end - 1;
+}
+
+// run the tiles of a job (in thread 'id')
+void
+scale_work(const struct scaler* s, int id)
+{
+	gint16* buffer = pool.shares[id].buffer;
+	int i, job;
+
+	while ((job = scale_take(id, TRUE)) >= 0) {
+		scale_tile(s, s->jobs[job], buffer);
+	}
+	for (i=1 ; i<pool.n_threads ; i++) {
+		int victim = (id + i) % pool.n_threads;
+		while ((job = scale_take(victim, FALSE)) >= 0) {
+			scale_tile(s, s->jobs[job], buffer);
+		}
+	}
+}
+
+gpointer
+scale_worker(gpointer data)
+{
+	int id = GPOINTER_TO_INT(data);
+	guint generation = 0;
+
+	g_mutex_lock(&pool.lock);
+	for (;;)
+	{
+		while (!pool.quit && (pool.generation == generation)) {
+			g_cond_wait(&pool.start_cond, &pool.lock);
+		}
+		if (pool.quit) {
+			break;
+		}
+		generation = pool.generation;
+		const struct scaler* s = pool.job;
+		g_mutex_unlock(&pool.lock);
+
+		scale_work(s, id);
+
+		g_mutex_lock(&pool.lock);
+		if (--pool.busy == 0) {
+			g_cond_signal(&pool.done_cond);
+		}
+	}
+	g_mutex_unlock(&pool.lock);
+	return NULL;
+}
+
+void
+scale_pool_ref()
+{
+	int i;
+
+	if (pool.refs++) {
+		return;
+	}
+	pool.n_threads = CLAMP(g_get_num_processors(), 1, SCALE_MAX_THREADS);
+	pool.quit = FALSE;
+	pool.generation = 0;
+	for (i=1 ; i<pool.n_threads ; i++) {
+		pool.threads[i] = g_thread_new("scaler", scale_worker, GINT_TO_POINTER(i));
+	}
+}
+
+void
+scale_pool_unref()
+{
+	int i;
+
+	if (--pool.refs) {
+		return;
+	}
+	g_mutex_lock(&pool.lock);
+	pool.quit = TRUE;
+	g_cond_broadcast(&pool.start_cond);
+	g_mutex_unlock(&pool.lock);
+
+	for (i=0 ; i<pool.n_threads ; i++)
+	{
+		if (pool.threads[i]) {
+			g_thread_join(pool.threads[i]);
+			pool.threads[i] = NULL;
+		}
+		g_free(pool.shares[i].buffer);
+		pool.shares[i].buffer = NULL;
+		pool.shares[i].buffer_size = 0;
+	}
+}
+
+
+//
+// public interface
+//
+
+// location of an image of src_width x src_height scaled to fit into an area
+// of width x height (keeping the aspect ratio, centered)
+void
+scaler_fit(int src_width, int src_height, int width, int height, GdkRectangle* rect)
+{
+	if ((gint64)src_width * height > (gint64)src_height * width) {
+		rect->width  = width;
+		rect->height = MAX(1, (gint64)src_height * width / src_width);
+	} else {
+		rect->width  = MAX(1, (gint64)src_width * height / src_height);
+		rect->height = height;
+	}
+	rect->x = (width  - rect->width)  / 2;
+	rect->y = (height - rect->height) / 2;
+}
+
+// create a scaler from an image of src_width x src_height into an image of
+// dst_width x dst_height (XRGB)
+struct scaler*
+scaler_new(enum scale_filter filter, int src_width, int src_height, int dst_width, int dst_height)
+{
+	struct scaler* s = g_new0(struct scaler, 1);
+	int ty;
+
+	s->src_width  = src_width;
+	s->src_height = src_height;
+	s->dst_width  = dst_width;
+	s->dst_height = dst_height;
+	scale_axis_init(&s->h, filter, src_width, dst_width);
+	scale_axis_init(&s->v, filter, src_height, dst_height);
+
+	s->tiles_x = (dst_width  + SCALE_TILE_SIZE - 1) / SCALE_TILE_SIZE;
+	s->tiles_y = (dst_height + SCALE_TILE_SIZE - 1) / SCALE_TILE_SIZE;
+	s->dirty = g_malloc0(s->tiles_x * s->tiles_y);
+	s->jobs  = g_new(int, s->tiles_x * s->tiles_y);
+
+	for (ty=0 ; ty<s->tiles_y ; ty++) {
+		int first, end;
+		scale_tile_rows(s, ty, &first, &end);
+		s->max_rows = MAX(s->max_rows, end - first);
+	}
+
+	s->row_h = scale_row_h_generic;
+	s->row_v = scale_row_v_generic;
+#ifdef SCALE_AVX2
+	if (__builtin_cpu_supports("avx2")) {
+		s->row_h = scale_row_h_avx2;
+		s->row_v = scale_row_v_avx2;
+	}
+#endif
+#ifdef SCALE_NEON
+	s->row_h = scale_row_h_neon;
+	s->row_v = scale_row_v_neon;
+#endif
+	// (the kernels need an even number of taps, which is the case unless
+	// the source is tiny)
+	if (s->h.taps & 1) {
+		s->row_h = scale_row_h_generic;
+	}
+	if (s->v.taps & 1) {
+		s->row_v = scale_row_v_generic;
+	}
+
+	scale_pool_ref();
+	return s;
+}
+
+void
+scaler_free(struct scaler* s)
+{
+	if (!s) {
+		return;
+	}
+	scale_pool_unref();
+	scale_axis_fini(&s->h);
+	scale_axis_fini(&s->v);
+	g_free(s->dirty);
+	g_free(s->jobs);
+	g_free(s);
+}
+
+// area of the destination to be recomputed when an area of the source is
+// modified
+void
+scaler_map_area(const struct scaler* s, const GdkRectangle* src_area, GdkRectangle* dst_area)
+{
+	int x0, x1, y0, y1;
+	scale_axis_map(&s->h, s->dst_width,  src_area->x, src_area->x + src_area->width,  &x0, &x1);
+	scale_axis_map(&s->v, s->dst_height, src_area->y, src_area->y + src_area->height, &y0, &y1);
+	*dst_area = (GdkRectangle){ x0, y0, x1 - x0, y1 - y0 };
+}
+
+// recompute the areas of the destination (the whole tiles covering them)
+//
+// src_stride may be negative (the image is then bottom-up and src points to
+// its first row)
+void
+scaler_run(struct scaler* s, const void* src, int src_stride, void* dst, int dst_stride,
+		const GdkRectangle* areas, int n_areas)
+{
+	const GdkRectangle bounds = { 0, 0, s->dst_width, s->dst_height };
+	int i, tx, ty, n_jobs = 0;
+
+	for (i=0 ; i<n_areas ; i++)
+	{
+		GdkRectangle r;
+		if (!gdk_rectangle_intersect(&areas[i], &bounds, &r)) {
+			continue;
+		}
+		for (ty = r.y / SCALE_TILE_SIZE ; ty <= (r.y + r.height - 1) / SCALE_TILE_SIZE ; ty++) {
+			for (tx = r.x / SCALE_TILE_SIZE ; tx <= (r.x + r.width - 1) / SCALE_TILE_SIZE ; tx++) {
+				s->dirty[ty*s->tiles_x + tx] = 1;
+			}
+		}
+	}
+	for (i=0 ; i<s->tiles_x * s->tiles_y ; i++) {
+		if (s->dirty[i]) {
+			s->dirty[i] = 0;
+			s->jobs[n_jobs++] = i;
+		}
+	}
+	if (!n_jobs) {
+		return;
+	}
+
+	s->src = src;
+	s->src_stride = src_stride;
+	s->dst = dst;
+	s->dst_stride = dst_stride;
+
+	// the workers are idle, their buffers can be resized
+	gsize buffer_size = (gsize)s->max_rows * SCALE_TILE_SIZE * 4;
+	int n_threads = (n_jobs < SCALE_MIN_PARALLEL) ? 1 : MIN(pool.n_threads, n_jobs);
+	for (i=0 ; i<pool.n_threads ; i++)
+	{
+		if (pool.shares[i].buffer_size < buffer_size) {
+			g_free(pool.shares[i].buffer);
+			pool.shares[i].buffer = g_new(gint16, buffer_size);
+			pool.shares[i].buffer_size = buffer_size;
+		}
+		// contiguous shares (the neighbouring tiles use the same
+		// source rows)
+		guint64 first = (guint64)n_jobs * MIN(i, n_threads) / n_threads;
+		guint64 end   = (guint64)n_jobs * MIN(i+1, n_threads) / n_threads;
+		pool.shares[i].range = (first << 32) | end;
+	}
+
+	if (n_threads == 1) {
+		scale_work(s, 0);
+		return;
+	}
+
+	g_mutex_lock(&pool.lock);
+	pool.job = s;
+	pool.busy = pool.n_threads - 1;
+	pool.generation++;
+	g_cond_broadcast(&pool.start_cond);
+	g_mutex_unlock(&pool.lock);
+
+	scale_work(s, 0);
+
+	g_mutex_lock(&pool.lock);
+	while (pool.busy) {
+		g_cond_wait(&pool.done_cond, &pool.lock);
+	}
+	g_mutex_unlock(&pool.lock);
+}
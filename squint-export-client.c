@@ -0,0 +1,221 @@
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "squint-export.h"
+
+//
+// Reference client of the frame export (see squint-export.h)
+//
+//	squint-export-client SOCKET [OUTPUT.ppm]
+//
+// It keeps a private copy of the exported image, updated with the modified
+// areas only, prints a line per frame and saves the last image when squint
+// closes the connection.
+//
+
+static struct squint_export_header* header = NULL;
+static size_t mapping_size = 0;
+
+static uint32_t* image = NULL;		// private copy
+static uint64_t last = 0;		// last frame copied
+
+// receive a message (and the attached fd if any)
+int
+receive(int sock, struct squint_export_msg* msg, int* fd)
+{
+	struct iovec iov = { msg, sizeof(*msg) };
+	union {
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	struct msghdr hdr = {
+		.msg_iov = &iov, .msg_iovlen = 1,
+		.msg_control = control.buf, .msg_controllen = sizeof(control.buf),
+	};
+
+	*fd = -1;
+	if (recvmsg(sock, &hdr, MSG_CMSG_CLOEXEC) != sizeof(*msg)) {
+		return 0;
+	}
+	struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+	if (cmsg && (cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_RIGHTS)) {
+		memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+	}
+	return 1;
+}
+
+void
+map_ring(int fd, size_t size)
+{
+	if (header) {
+		munmap(header, mapping_size);
+		free(image);
+	}
+	header = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (header == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+	if ((header->magic != SQUINT_EXPORT_MAGIC) || (header->version != SQUINT_EXPORT_VERSION)) {
+		fprintf(stderr, "unsupported ring format\n");
+		exit(1);
+	}
+	mapping_size = size;
+	image = calloc((size_t)header->width * header->height, sizeof(uint32_t));
+	last = 0;
+	printf("ring: %ux%u, %u slots\n", header->width, header->height, header->n_slots);
+}
+
+const uint8_t*
+slot_pixels(uint64_t seq)
+{
+	return (const uint8_t*)header + header->frame_offset
+		+ (seq % header->n_slots) * header->frame_size;
+}
+
+void
+copy_rect(const uint8_t* src, const struct squint_export_rect* r)
+{
+	int y;
+	for (y=r->y ; y<r->y + r->height ; y++) {
+		memcpy(image + (size_t)y * header->width + r->x,
+			src + (size_t)y * header->stride + r->x * sizeof(uint32_t),
+			r->width * sizeof(uint32_t));
+	}
+}
+
+// update the private copy with the latest frame
+//
+// return the number of pixels copied
+uint64_t
+update()
+{
+	const struct squint_export_rect full = { 0, 0, header->width, header->height };
+	uint64_t seq, s, pixels;
+	uint32_t i;
+
+retry:
+	seq = __atomic_load_n(&header->sequence, __ATOMIC_ACQUIRE);
+	if (seq == last) {
+		return 0;
+	}
+	const struct squint_export_slot* slot = &header->slots[seq % header->n_slots];
+	const uint8_t* src = slot_pixels(seq);
+
+	// areas modified since the last frame copied (taken from the slots of
+	// the intermediate frames, if they are still available)
+	struct squint_export_rect rects[SQUINT_EXPORT_SLOTS * SQUINT_EXPORT_MAX_RECTS];
+	int n_rects = 0;
+	int partial = last && (seq - last <= header->n_slots - 1);
+	for (s=last+1 ; partial && (s<=seq) ; s++)
+	{
+		const struct squint_export_slot* other = &header->slots[s % header->n_slots];
+		if (__atomic_load_n(&other->sequence, __ATOMIC_ACQUIRE) != s) {
+			partial = 0;
+			break;
+		}
+		for (i=0 ; (i<other->n_rects) && (i<SQUINT_EXPORT_MAX_RECTS) ; i++) {
+			rects[n_rects++] = other->rects[i];
+		}
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&other->sequence, __ATOMIC_RELAXED) != s) {
+			partial = 0;
+		}
+	}
+
+	// (the latest slot is complete)
+	pixels = 0;
+	if (partial) {
+		for (i=0 ; i<(uint32_t)n_rects ; i++) {
+			copy_rect(src, &rects[i]);
+			pixels += (uint64_t)rects[i].width * rects[i].height;
+		}
+	} else {
+		copy_rect(src, &full);
+		pixels = (uint64_t)full.width * full.height;
+	}
+
+	// the slot may have been rewritten in the meantime
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if (__atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) != seq) {
+		goto retry;
+	}
+	last = seq;
+	return pixels;
+}
+
+void
+save_ppm(const char* path)
+{
+	FILE* f = fopen(path, "wb");
+	size_t i, n = (size_t)header->width * header->height;
+	if (!f) {
+		perror(path);
+		return;
+	}
+	fprintf(f, "P6\n%u %u\n255\n", header->width, header->height);
+	for (i=0 ; i<n ; i++) {
+		uint8_t rgb[3] = { image[i] >> 16, image[i] >> 8, image[i] };
+		fwrite(rgb, 3, 1, f);
+	}
+	fclose(f);
+}
+
+int
+main(int argc, char* argv[])
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct squint_export_msg msg;
+	int fd;
+
+	if ((argc < 2) || (strlen(argv[1]) >= sizeof(addr.sun_path))) {
+		fprintf(stderr, "usage: %s SOCKET [OUTPUT.ppm]\n", argv[0]);
+		return 1;
+	}
+	strcpy(addr.sun_path, argv[1]);
+
+	int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if ((sock < 0) || (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0)) {
+		perror(argv[1]);
+		return 1;
+	}
+
+	while (receive(sock, &msg, &fd))
+	{
+		switch (msg.type)
+		{
+		case SQUINT_EXPORT_MSG_RING:
+			if (fd < 0) {
+				fprintf(stderr, "no file descriptor attached\n");
+				return 1;
+			}
+			map_ring(fd, msg.value);
+			break;
+
+		case SQUINT_EXPORT_MSG_FRAME:
+			if (header) {
+				uint64_t pixels = update();
+				if (pixels) {
+					printf("frame %llu: %llu pixels copied\n",
+						(unsigned long long)last, (unsigned long long)pixels);
+				}
+			}
+			break;
+		}
+	}
+
+	if (header && (argc > 2)) {
+		update();
+		save_ppm(argv[2]);
+	}
+	return 0;
+}
@@ -0,0 +1,73 @@
+#ifndef SQUINT_EXPORT_H
+#define SQUINT_EXPORT_H
+
+#include <stdint.h>
+
+//
+// Frame export (--export, see export.c)
+//
+// squint publishes the image of its first mirror into a ring of frames
+// stored in a memfd, so that other processes on the same machine can map
+// it (read-only) instead of capturing the screen again.
+//
+// Control channel: a Unix socket (SOCK_SEQPACKET) at the path given with
+// --export. The server sends fixed-size messages (struct squint_export_msg):
+//
+// - SQUINT_EXPORT_MSG_RING: a new ring is available, the memfd is attached
+//   (SCM_RIGHTS) and 'value' is the size of the mapping. This is the first
+//   message received after connecting, it is sent again when the size of the
+//   image changes (the previous ring must be unmapped).
+//
+// - SQUINT_EXPORT_MSG_FRAME: frame number 'value' was published. These
+//   notifications are dropped when the client does not read them fast
+//   enough, the authoritative value is header->sequence.
+//
+// The client does not send anything, it closes the socket to disconnect.
+//
+// Reading a frame: read header->sequence (S) then the slot S % n_slots. The
+// slot is valid while slot->sequence == S (it is set to 0 while the slot is
+// rewritten, n_slots frames later): check it again after reading the pixels
+// and retry with the latest frame if it changed. The rectangles of a slot are
+// the areas modified since frame S-1, a client that missed some frames can
+// merge the rectangles of the previous slots (if still valid) or read the
+// whole image.
+//
+
+#define SQUINT_EXPORT_MAGIC	0x544e5153	// "SQNT"
+#define SQUINT_EXPORT_VERSION	1
+#define SQUINT_EXPORT_SLOTS	3
+#define SQUINT_EXPORT_MAX_RECTS	16	// (merged into their bounding box beyond)
+
+#define SQUINT_EXPORT_MSG_RING	1
+#define SQUINT_EXPORT_MSG_FRAME	2
+
+struct squint_export_msg {
+	uint32_t	type;
+	uint32_t	reserved;
+	uint64_t	value;
+};
+
+struct squint_export_rect {
+	int32_t		x, y, width, height;
+};
+
+struct squint_export_slot {
+	uint64_t	sequence;	// frame stored in the slot (0 while being written)
+	uint32_t	n_rects;
+	uint32_t	reserved;
+	struct squint_export_rect rects[SQUINT_EXPORT_MAX_RECTS];	// modified since the previous frame
+};
+
+struct squint_export_header {
+	uint32_t	magic;
+	uint32_t	version;
+	uint32_t	width, height;
+	uint32_t	stride;		// in bytes (pixels are 32-bit XRGB in the native byte order)
+	uint32_t	n_slots;
+	uint64_t	frame_offset;	// offset of the pixels of slot 0
+	uint64_t	frame_size;	// (slot i starts at frame_offset + i*frame_size)
+	uint64_t	sequence;	// last published frame (0 if none)
+	struct squint_export_slot slots[SQUINT_EXPORT_SLOTS];
+};
+
+#endif
@@ -13,24 +13,35 @@
 
 #include "squint.h"
 
+#define ICON_PATH	PREFIX "/share/squint/squint.png"
+
 // Config
 struct config config;
 
 // State
 gboolean enabled = FALSE;
 gboolean fullscreen = FALSE;
-gboolean raised = FALSE;
 
-GtkWidget* gtkwin = NULL;
-GdkWindow* gdkwin = NULL;
 GdkDisplay* gdisplay = NULL;
 
-GdkRectangle src_rect, dst_rect, active_window_rect;
+GdkRectangle active_window_rect;
+
+struct mirror mirrors[MAX_MIRRORS];
+int n_mirrors = 0;
 
-static GdkMonitor* src_monitor = NULL;
-static GdkMonitor* dst_monitor = NULL;
+const struct backend* backend = NULL;
+
+static const struct backend* const backends[] = {
+	&x11_backend,
+	&synthetic_backend,
+#ifdef HAVE_WAYLAND
+	&wayland_backend,
+#endif
+	NULL
+};
 
 static GApplication* gtkapp = NULL;
+static GMainLoop* main_loop = NULL;	// used instead of gtkapp when running without display
 static GdkPixbuf* icon = NULL;
 static GIcon* gicon = NULL;
 
@@ -50,6 +61,10 @@ void refresh_app_indicator();
 #endif
 
 gboolean squint_enable();
+void squint_disable();
+void reconfigure();
+void settings_changed();
+void squint_pause(enum pause_mode mode);
 
 void
 show_about_dialog()
@@ -69,7 +84,7 @@ show_about_dialog()
 void
 squint_error(const char* msg)
 {
-	if (g_application_get_is_registered(gtkapp)) {
+	if (gtkapp && g_application_get_is_registered(gtkapp) && !g_application_get_is_remote(gtkapp)) {
 		GNotification* notif = g_notification_new(APPNAME " error");
 		g_notification_set_body(notif, msg);
 		g_notification_set_icon(notif, gicon);
@@ -79,37 +94,98 @@ squint_error(const char* msg)
 	}
 }
 
+//
+// Startup timing (--timing)
+//
+// The time elapsed since the start of the process is printed after each
+// phase of the startup, until the first frame is displayed and the deferred
+// initialisation is done.
+//
+
+static gint64 timing_start = 0;
+static gint64 timing_prev = 0;
+static int    timing_pending = 2;	// first frame + late init
+
+void
+timing_mark(const char* phase)
+{
+	if (!config.opt_timing || !timing_pending) {
+		return;
+	}
+	gint64 now = g_get_monotonic_time();
+	printf("timing: %-20s %8.2f ms  (+%.2f ms)\n", phase,
+			(now - timing_start) / 1000.0, (now - timing_prev) / 1000.0);
+	fflush(stdout);
+	timing_prev = now;
+}
+
+void
+timing_end(const char* phase)
+{
+	timing_mark(phase);
+	if (timing_pending) {
+		timing_pending--;
+	}
+}
+
+// called by the backend after each refresh
+void
+squint_first_frame()
+{
+	static gboolean done = FALSE;
+	if (!done) {
+		done = TRUE;
+		timing_end("first frame");
+	}
+}
+
+void
+squint_quit()
+{
+	if (gtkapp) {
+		g_application_release(gtkapp);
+	} else {
+		g_main_loop_quit(main_loop);
+	}
+}
+
 void
-squint_show()
+squint_show(struct mirror* m)
 {
-	if (!raised)
+	if (!m->raised)
 	{
-		raised = TRUE;
-		if (fullscreen) {
-			gtk_widget_show(gtkwin);
-		} else if (!config.opt_passive) {
-			gdk_window_raise(gdkwin);
+		m->raised = TRUE;
+		for (int i=0 ; i<m->n_destinations ; i++)
+		{
+			if (fullscreen) {
+				gtk_widget_show(m->destinations[i].gtkwin);
+			} else if (!config.opt_passive) {
+				gdk_window_raise(m->destinations[i].gdkwin);
+			}
 		}
 	}
 }
 
 void
-do_hide()
+do_hide(struct mirror* m)
 {
-	raised = FALSE;
-	if (fullscreen) {
-		gtk_widget_hide(gtkwin);
-	} else if (!config.opt_passive) {
-		gdk_window_lower(gdkwin);
+	m->raised = FALSE;
+	for (int i=0 ; i<m->n_destinations ; i++)
+	{
+		if (fullscreen) {
+			gtk_widget_hide(m->destinations[i].gtkwin);
+		} else if (!config.opt_passive) {
+			gdk_window_lower(m->destinations[i].gdkwin);
+		}
 	}
 }
 
 void
-squint_hide()
+squint_hide(struct mirror* m)
 {
-	if(raised)
+	if(m->raised)
 	{
-		do_hide();
+		do_hide(m);
 	}
 }
 
@@ -118,13 +194,20 @@ gboolean
 on_window_button_press_event(GtkWidget* widget, GdkEvent* event, gpointer data)
 {
 	GdkEventButton* ev = (GdkEventButton*) event;
+	struct mirror* m = data;
 
 	if (enabled
 		&& (ev->type == GDK_2BUTTON_PRESS)
 		&& (ev->button = 1)
 	) {
+		GdkWindow* gdkwin = gtk_widget_get_window(widget);
+		int i, width, height;
+		for (i=0 ; (i<m->n_destinations-1) && (m->destinations[i].gtkwin != widget) ; i++)
+			;
+		transform_size(m->destinations[i].transform, m->src_rect.width, m->src_rect.height,
+				&width, &height);
 		gdk_window_unmaximize(gdkwin);
-		gdk_window_resize(gdkwin, src_rect.width, src_rect.height);
+		gdk_window_resize(gdkwin, width, height);
 	}
 	return FALSE;
 }
@@ -144,6 +227,8 @@ on_window_delete_event(GtkWidget* widget, GdkEvent* event, gpointer data)
 #define ITEM_DST_MONITOR	(1<<12)
 #define ITEM_ABOUT		(1<<13)
 #define ITEM_PASSIVE		(1<<14)
+#define ITEM_FREEZE		(1<<15)
+#define ITEM_BLANK		(1<<16)
 #define ITEM_AUTO		0xff
 
 void
@@ -161,6 +246,75 @@ update_monitor_config(const char** monitor_name, int id)
 	}
 }
 
+static const char* const transform_names[] = {
+	"normal", "90", "180", "270", "flip", "flip-90", "flip-180", "flip-270",
+};
+
+// parse a transform (see enum transform)
+gboolean
+parse_transform(const char* arg, enum transform* transform)
+{
+	int i;
+	for (i=0 ; i<G_N_ELEMENTS(transform_names) ; i++) {
+		if (!strcmp(arg, transform_names[i])) {
+			*transform = i;
+			return TRUE;
+		}
+	}
+	squint_error("unknown transform");
+	return FALSE;
+}
+
+// add a destination to a mirror config
+//
+// the name may be followed by the transform of the destination (eg:
+// "HDMI-1@90"), config.transform is used otherwise
+gboolean
+add_dst_monitor_name(struct mirror_config* mc, const char* arg)
+{
+	enum transform transform = config.transform;
+	const char* suffix = strchr(arg, '@');
+
+	if (suffix && !parse_transform(suffix + 1, &transform)) {
+		return FALSE;
+	}
+	mc->dst_transforms[mc->n_dst_monitor_names] = transform;
+	mc->dst_monitor_names[mc->n_dst_monitor_names++] = suffix ? g_strndup(arg, suffix - arg) : g_strdup(arg);
+	return TRUE;
+}
+
+// add/remove a monitor in the list of destinations
+void
+toggle_dst_monitor_config(struct mirror_config* mc, int id)
+{
+	int i;
+	if (id == ITEM_AUTO)
+	{
+		for (i=0 ; i<mc->n_dst_monitor_names ; i++) {
+			g_free((gpointer)mc->dst_monitor_names[i]);
+		}
+		mc->n_dst_monitor_names = 0;
+		return;
+	}
+
+	const char* name = gdk_monitor_get_model(gdk_display_get_monitor(gdisplay, id));
+	for (i=0 ; i<mc->n_dst_monitor_names ; i++)
+	{
+		if (!strcmp(mc->dst_monitor_names[i], name)) {
+			// already selected -> remove it
+			g_free((gpointer)mc->dst_monitor_names[i]);
+			mc->n_dst_monitor_names--;
+			mc->dst_monitor_names[i] = mc->dst_monitor_names[mc->n_dst_monitor_names];
+			mc->dst_transforms[i]    = mc->dst_transforms[mc->n_dst_monitor_names];
+			return;
+		}
+	}
+	if (mc->n_dst_monitor_names < MAX_DESTINATIONS) {
+		mc->dst_transforms[mc->n_dst_monitor_names] = config.transform;
+		mc->dst_monitor_names[mc->n_dst_monitor_names++] = g_strdup(name);
+	}
+}
+
 #ifdef HAVE_APPINDICATOR
 void
 on_menu_item_activate(gpointer pointer, gpointer user_data)
@@ -188,16 +342,26 @@ on_menu_item_activate(gpointer pointer, gpointer user_data)
 		config.opt_window = !config.opt_window;
 		goto reset;
 
+	case ITEM_FREEZE:
+		squint_toggle_pause(PAUSE_FREEZE);
+		break;
+
+	case ITEM_BLANK:
+		squint_toggle_pause(PAUSE_BLANK);
+		break;
+
 	case ITEM_QUIT:
-		g_application_release(gtkapp);
+		squint_quit();
 		break;
 	
 	case ITEM_SRC_MONITOR:
-		update_monitor_config(&config.src_monitor_name, code & ITEM_AUTO);
+		update_monitor_config(&config.mirrors[0].src_monitor_name, code & ITEM_AUTO);
+		config.mirrors[0].capture_window = 0;
+		config.mirrors[0].source_display = NULL;
 		goto reset;
 		
 	case ITEM_DST_MONITOR:
-		update_monitor_config(&config.dst_monitor_name, code & ITEM_AUTO);
+		toggle_dst_monitor_config(&config.mirrors[0], code & ITEM_AUTO);
 		goto reset;
 	
 	case ITEM_ABOUT:
@@ -206,12 +370,7 @@ on_menu_item_activate(gpointer pointer, gpointer user_data)
 	}
 	return;
 reset:
-	if (enabled) {
-		squint_disable();
-		squint_enable();
-	} else {
-		refresh_app_indicator();
-	}
+	settings_changed();
 }
 
 void
@@ -220,7 +379,8 @@ connect_menu_item(GtkWidget* item, intptr_t user_data) {
 }
 
 void
-populate_menu_with_monitors(int index, const char* config_name, GdkMonitor* active_monitor, intptr_t userdata)
+populate_menu_with_monitors(int index, const char* const* config_names, int n_config_names,
+		GdkMonitor* active_monitor, intptr_t userdata)
 {
 	void append(int* index, GtkWidget* item) {
 		if (*index < 0) {
@@ -233,15 +393,15 @@ populate_menu_with_monitors(int index, const char* config_name, GdkMonitor* acti
 	// Auto button
 	GtkWidget* auto_item = gtk_check_menu_item_new_with_label("Auto");
 	{
-		if (config_name == NULL) {
+		if (n_config_names == 0) {
 			gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(auto_item), TRUE);
 		}
 		connect_menu_item(auto_item, userdata | ITEM_AUTO);
 		append(&index, auto_item);
 	}
 
-	int i, n = gdk_display_get_n_monitors(gdisplay);
-	gboolean found = FALSE;
+	int i, j, n = gdk_display_get_n_monitors(gdisplay);
+	gboolean found[MAX_DESTINATIONS] = { FALSE };
 	char buff[64];
 	GtkWidget* item;
 	for (i=0 ; i<n ; i++)
@@ -257,23 +417,28 @@ populate_menu_with_monitors(int index, const char* config_name, GdkMonitor* acti
 		connect_menu_item(item, userdata | (i & 0xff));
 		append(&index, item);
 
-		if (config_name == NULL) {
+		if (n_config_names == 0) {
 			if (enabled && monitor==active_monitor) {
 				g_snprintf(buff, 64, "Auto (%s)", name);
 				gtk_menu_item_set_label(GTK_MENU_ITEM(auto_item), buff);
 			}
-		} else if (!strcmp(config_name, name)) {
-			found = TRUE;
-			gtk_check_menu_item_set_active(
-					GTK_CHECK_MENU_ITEM(item), TRUE);
+		}
+		for (j=0 ; j<n_config_names ; j++) {
+			if (!strcmp(config_names[j], name)) {
+				found[j] = TRUE;
+				gtk_check_menu_item_set_active(
+						GTK_CHECK_MENU_ITEM(item), TRUE);
+			}
 		}
 	}
-	if (!found && config_name) {
-		// choosen monitor is not active
-		item = gtk_check_menu_item_new_with_label(config_name);
-		gtk_check_menu_item_set_active(
-			GTK_CHECK_MENU_ITEM(item), TRUE);
-		append(&index, item);
+	for (j=0 ; j<n_config_names ; j++) {
+		if (!found[j]) {
+			// choosen monitor is not active
+			item = gtk_check_menu_item_new_with_label(config_names[j]);
+			gtk_check_menu_item_set_active(
+				GTK_CHECK_MENU_ITEM(item), TRUE);
+			append(&index, item);
+		}
 	}
 	gtk_widget_show_all(GTK_WIDGET(menu.shell));
 }
@@ -303,6 +468,15 @@ init_app_indicator()
 	connect_menu_item(item, ITEM_PASSIVE);
 	gtk_menu_shell_append(menu.shell, item);
 
+	// freeze/blank
+	item = gtk_check_menu_item_new_with_label("Freeze");
+	connect_menu_item(item, ITEM_FREEZE);
+	gtk_menu_shell_append(menu.shell, item);
+
+	item = gtk_check_menu_item_new_with_label("Blank");
+	connect_menu_item(item, ITEM_BLANK);
+	gtk_menu_shell_append(menu.shell, item);
+
 	// about
 	item = gtk_menu_item_new_with_label("About");
 	connect_menu_item(item, ITEM_ABOUT);
@@ -361,6 +535,14 @@ refresh_app_indicator()
 			// disable the button if running in fullscreen mode (because it has no effects)
 			gtk_widget_set_sensitive(item, config.opt_window);
 			break;
+		case 3:
+			// freeze button
+			gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(item), config.pause == PAUSE_FREEZE);
+			break;
+		case 4:
+			// blank button
+			gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(item), config.pause == PAUSE_BLANK);
+			break;
 		default:
 			// delete all other GtkTypeCheckMenuItem objects
 			if (G_OBJECT_TYPE(item) == GTK_TYPE_CHECK_MENU_ITEM) {
@@ -377,216 +559,706 @@ refresh_app_indicator()
 
 	menu.update_index = 0;
 	gtk_container_foreach(GTK_CONTAINER(menu.shell), each_menu_item, NULL);
-	populate_menu_with_monitors(-1, config.dst_monitor_name, dst_monitor, ITEM_DST_MONITOR);
-	populate_menu_with_monitors(6,  config.src_monitor_name, src_monitor, ITEM_SRC_MONITOR);
+	// the menu configures only the first mirror
+	const struct mirror_config* mc = &config.mirrors[0];
+	populate_menu_with_monitors(-1, mc->dst_monitor_names, mc->n_dst_monitor_names,
+			mirrors[0].destinations[0].monitor, ITEM_DST_MONITOR);
+	populate_menu_with_monitors(8,  &mc->src_monitor_name, (mc->src_monitor_name ? 1 : 0),
+			mirrors[0].src_monitor, ITEM_SRC_MONITOR);
 	menu.update_index = -1;
 
 }
 #endif
 
 
-gboolean
-init()
-{
-	gtkapp = G_APPLICATION(gtk_application_new("org.github.a-ba.squint",
-				G_APPLICATION_NON_UNIQUE));
-	g_application_hold(gtkapp);
+//
+// D-Bus interface
+//
+// squint is a unique application: when it is started again, the new process
+// forwards its request (--action) to the running instance and exits. The
+// actions are exported on the session bus (org.gtk.Actions and
+// org.freedesktop.Application interfaces), so they can also be activated with
+// gapplication(1) or gdbus(1). They apply the change live (see reconfigure()).
+//
+// The runtime counters of the backend are exported as read-only properties of
+// the object /org/github/a_ba/squint (there is no change notification, the
+// clients are expected to poll them).
+//
 
+#define DBUS_STATS_INTERFACE	"org.github.a_ba.squint.Stats"
 
-	gdisplay = gdk_display_get_default();
-	if (!gdisplay) {
-		squint_error("No display available");
-		return FALSE;
-	}
+static const gchar dbus_introspection_xml[] =
+	"<node>"
+	"  <interface name='" DBUS_STATS_INTERFACE "'>"
+	"    <property name='Enabled' type='b' access='read'/>"
+	"    <property name='Events'  type='u' access='read'/>"
+	"    <property name='Frames'  type='u' access='read'/>"
+	"    <property name='Pixels'  type='t' access='read'/>"
+	"    <property name='Drops'   type='u' access='read'/>"
+	"    <property name='CursorLatency' type='u' access='read'/>"
+	"  </interface>"
+	"</node>";
 
-	{
-		GError* err = NULL;
+static gchar* opt_action = NULL;
 
-		// load the icon
-		const char* icon_path = PREFIX "/share/squint/squint.png";
-		icon = gdk_pixbuf_new_from_file (icon_path, &err);
-		if (!icon)
-		{
-			squint_error(err->message);
-			g_clear_error (&err);
-		}
-		gicon = g_file_icon_new(g_file_new_for_path(icon_path));
+// apply a change of the settings (from the menu or from D-Bus)
+void
+settings_changed()
+{
+	if (enabled) {
+		// reuse the current windows and resources if possible
+		reconfigure();
 	}
-	cursor_icon = gdk_cursor_new_for_display(gdisplay, GDK_X_CURSOR);
-
-	gboolean result = x11_init();
-
 #ifdef HAVE_APPINDICATOR
-	if (result) {
-		// create the status icon in the tray
-		init_app_indicator();
+	else if (app_indicator) {
 		refresh_app_indicator();
 	}
 #endif
-	return result;
 }
 
-
-gboolean select_monitor(GdkMonitor** mon, GdkRectangle* rect, GdkMonitor* candidate)
+// freeze or blank the mirrors, or resume them with PAUSE_NONE (from the menu,
+// D-Bus or a hotkey)
+//
+// The mode is kept when squint is disabled (it is applied again by
+// backend->enable()).
+void
+squint_pause(enum pause_mode mode)
 {
-	g_assert_null(*mon);
-
-	if (candidate == NULL) {
-		return FALSE;
-	} else {
-		gdk_monitor_get_geometry(candidate, rect);
-		*mon = candidate;
-		g_object_ref(*mon);
-		return TRUE;
+	if (!backend->pause) {
+		if (mode) {
+			squint_error("The freeze and blank modes are not supported by this backend");
+		}
+		return;
+	}
+	config.pause = mode;
+	if (enabled) {
+		backend->pause(mode);
+	}
+#ifdef HAVE_APPINDICATOR
+	if (app_indicator) {
+		refresh_app_indicator();
 	}
+#endif
 }
 
-void unselect_monitor(GdkMonitor** mon, GdkRectangle* rect)
+void
+squint_toggle_pause(enum pause_mode mode)
 {
-	if (*mon != NULL) {
-		g_object_unref(*mon);
-		*mon = NULL;
-	}
-	memset(rect, 0, sizeof(GdkRectangle));
+	squint_pause((config.pause == mode) ? PAUSE_NONE : mode);
 }
 
-gboolean
-select_monitor_by_name(GdkDisplay* dsp, const char* name,
-		GdkMonitor** mon, GdkRectangle* rect)
+void
+on_action_enable(GSimpleAction* action, GVariant* param, gpointer data)
 {
-	int n = gdk_display_get_n_monitors(dsp);
-	int i;
-	for (i=0 ; i<n ; i++)
-	{
-		GdkMonitor* candidate_mon = gdk_display_get_monitor(dsp, i);
+	squint_enable();
+}
 
-		if (strcmp(name, gdk_monitor_get_model(candidate_mon)) == 0) {
-			return select_monitor(mon, rect, candidate_mon);
-		}
+void
+on_action_disable(GSimpleAction* action, GVariant* param, gpointer data)
+{
+	if (enabled) {
+		squint_disable();
 	}
-
-	char buff[128];
-	g_snprintf(buff, 128, "Monitor %s is not active", name);
-	squint_error(buff);
-	return FALSE;
 }
 
-gboolean
-select_rightmost_monitor_but(GdkDisplay* dsp, GdkMonitor** mon, GdkRectangle* rect,
-		const GdkRectangle* other_rect)
+void
+on_action_quit(GSimpleAction* action, GVariant* param, gpointer data)
 {
-	int n = gdk_display_get_n_monitors(dsp);
-	int i;
-	GdkMonitor* found_monitor = NULL;
-	GdkRectangle found_rect;
-	for (i=0 ; i<n ; i++)
-	{
-		GdkRectangle candidate_rect;
-		GdkMonitor* candidate_mon = gdk_display_get_monitor(dsp, i);
-		gdk_monitor_get_geometry(candidate_mon, &candidate_rect);
-		if (!other_rect || memcmp(&candidate_rect, other_rect, sizeof(GdkRectangle)))
-		{
-			if ((found_monitor == NULL) ||
-			    (candidate_rect.x+candidate_rect.width > found_rect.x+found_rect.width))
-			{
-				memcpy(&found_rect, &candidate_rect, sizeof(GdkRectangle));
-				found_monitor = candidate_mon;
-			}
-		}
-	}
-	return select_monitor(mon, rect, found_monitor);
+	squint_quit();
 }
 
-gboolean
-select_any_monitor_but(GdkDisplay* dsp, GdkMonitor** mon, GdkRectangle* rect, const GdkRectangle* other_rect)
+// set the source monitor of the first mirror ("" for automatic selection)
+void
+on_action_source(GSimpleAction* action, GVariant* param, gpointer data)
 {
-	int n = gdk_display_get_n_monitors(dsp);
+	struct mirror_config* mc = &config.mirrors[0];
+	const char* name = g_variant_get_string(param, NULL);
 	int i;
-	for (i=0 ; i<n ; i++)
-	{
-		GdkMonitor*  candidate_mon = gdk_display_get_monitor(dsp, i);
-		GdkRectangle candidate_rect;
-		gdk_monitor_get_geometry(candidate_mon, &candidate_rect);
-		if (!other_rect || memcmp(&candidate_rect, other_rect, sizeof(GdkRectangle)))
-		{
-			return select_monitor(mon, rect, candidate_mon);
-		}
+
+	g_free((gpointer)mc->src_monitor_name);
+	for (i=0 ; i<mc->n_extra_src_monitor_names ; i++) {
+		g_free((gpointer)mc->extra_src_monitor_names[i]);
 	}
-	return FALSE;
+	mc->n_extra_src_monitor_names = 0;
+	mc->src_monitor_name = (*name && strcmp("-", name)) ? g_strdup(name) : NULL;
+	mc->capture_window = 0;
+	mc->source_display = NULL;
+	settings_changed();
 }
 
-
-//
-// select which monitor is going to be duplicated
-//
-// initialises:
-// 	src_rect
-// 	src_monitor
-// 	dst_rect
-// 	dst_monitor
-gboolean
-select_monitors()
+// set the destination monitors of the first mirror (comma-separated list, ""
+// for automatic selection)
+void
+on_action_destination(GSimpleAction* action, GVariant* param, gpointer data)
 {
-	int n;
-	unselect_monitor(&src_monitor, &src_rect);
-	unselect_monitor(&dst_monitor, &dst_rect);
+	struct mirror_config* mc = &config.mirrors[0];
+	int i;
 
-	n = gdk_display_get_n_monitors (gdisplay);
-	if ((n < 2) && !config.src_monitor_name) {
-		squint_error("There is only one monitor. What am I supposed to do?");
-		return FALSE;
+	for (i=0 ; i<mc->n_dst_monitor_names ; i++) {
+		g_free((gpointer)mc->dst_monitor_names[i]);
 	}
+	mc->n_dst_monitor_names = 0;
 
-	// first we try to allocate the requested monitors
-	if (config.src_monitor_name
-		&& !select_monitor_by_name(gdisplay, config.src_monitor_name, &src_monitor, &src_rect)) {
-			return FALSE;
-	}
-	if (config.dst_monitor_name
-		&& !select_monitor_by_name(gdisplay, config.dst_monitor_name, &dst_monitor, &dst_rect)) {
-			return FALSE;
-	}
-	if (src_monitor && dst_monitor && !memcmp(&src_rect, &dst_rect, sizeof(GdkRectangle)))
-	{
-		squint_error("Source and destination both map the same screen area");
-		return FALSE;
+	gchar** names = g_strsplit(g_variant_get_string(param, NULL), ",", -1);
+	for (i=0 ; names[i] && (mc->n_dst_monitor_names < MAX_DESTINATIONS) ; i++) {
+		if (names[i][0] && strcmp("-", names[i])) {
+			add_dst_monitor_name(mc, names[i]);
+		}
 	}
+	g_strfreev(names);
+	settings_changed();
+}
 
-	// if the source monitor is not yet decided, then use the rightmost monitor
-	if (src_monitor == NULL) {
-		select_rightmost_monitor_but(gdisplay, &src_monitor, &src_rect,
-				(dst_monitor ? &dst_rect : NULL));
-	}
+// change the refresh rate limit (same values as --limit)
+void
+on_action_limit(GSimpleAction* action, GVariant* param, gpointer data)
+{
+	__atomic_store_n(&config.opt_limit, g_variant_get_int32(param), __ATOMIC_RELAXED);
+	scheduler_update_limit();
+}
 
-	// if the destination_monitor is not yet decided, then use the first unused monitor
-	if (dst_monitor == NULL) {
-		select_any_monitor_but(gdisplay, &dst_monitor, &dst_rect,
-				(src_monitor ? &src_rect : NULL));
-	}
+void
+on_action_passive(GSimpleAction* action, GVariant* param, gpointer data)
+{
+	config.opt_passive = g_variant_get_boolean(param);
+	settings_changed();
+}
 
-	if (src_monitor && dst_monitor) {
-		return TRUE;
-	} else {
-		unselect_monitor(&src_monitor, &src_rect);
-		unselect_monitor(&dst_monitor, &dst_rect);
+// kill switch of the cursor prediction (applied on the next motion)
+void
+on_action_prediction(GSimpleAction* action, GVariant* param, gpointer data)
+{
+	config.opt_no_prediction = !g_variant_get_boolean(param);
+}
 
-		squint_error("Could not find any monitor to be cloned");
-		return FALSE;
+// freeze=true|false, blank=true|false
+void
+set_pause_mode(enum pause_mode mode, GVariant* param)
+{
+	if (g_variant_get_boolean(param)) {
+		squint_pause(mode);
+	} else if (config.pause == mode) {
+		squint_pause(PAUSE_NONE);
 	}
 }
 
-//
-// Prepare the window to host the duplicated screen (create the pixmap, subwindow)
-//
-// initialises:
-// 	gtkwin
-// 	gdkwin
-//	fullscreen
-//
 void
-enable_window()
+on_action_freeze(GSimpleAction* action, GVariant* param, gpointer data)
 {
-	fullscreen = !config.opt_window;
+	set_pause_mode(PAUSE_FREEZE, param);
+}
+
+void
+on_action_blank(GSimpleAction* action, GVariant* param, gpointer data)
+{
+	set_pause_mode(PAUSE_BLANK, param);
+}
+
+void
+on_action_fullscreen(GSimpleAction* action, GVariant* param, gpointer data)
+{
+	config.opt_window = !g_variant_get_boolean(param);
+	settings_changed();
+}
+
+void
+on_action_wall(GSimpleAction* action, GVariant* param, gpointer data)
+{
+	config.opt_wall = g_variant_get_boolean(param);
+	settings_changed();
+}
+
+GVariant*
+on_dbus_get_property(GDBusConnection* connection, const gchar* sender,
+		const gchar* object_path, const gchar* interface_name,
+		const gchar* property_name, GError** error, gpointer data)
+{
+	const struct stats* stats = backend->stats();
+
+	if (!strcmp(property_name, "Enabled")) {
+		return g_variant_new_boolean(enabled);
+	} else if (!strcmp(property_name, "Events")) {
+		return g_variant_new_uint32(STATS_GET(stats->events));
+	} else if (!strcmp(property_name, "Frames")) {
+		return g_variant_new_uint32(STATS_GET(stats->frames));
+	} else if (!strcmp(property_name, "Pixels")) {
+		return g_variant_new_uint64(STATS_GET(stats->pixels));
+	} else if (!strcmp(property_name, "Drops")) {
+		return g_variant_new_uint32(STATS_GET(stats->drops));
+	} else if (!strcmp(property_name, "CursorLatency")) {
+		return g_variant_new_uint32(STATS_GET(stats->cursor_latency));
+	}
+	g_set_error(error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_PROPERTY,
+			"unknown property %s", property_name);
+	return NULL;
+}
+
+// register the application on the session bus
+//
+// On return, gtkapp is either the primary instance (with the actions and the
+// stats exported) or a proxy to the running instance (see remote_action()).
+gboolean
+register_app()
+{
+	static const GActionEntry actions[] = {
+		{ "enable",	on_action_enable },
+		{ "disable",	on_action_disable },
+		{ "quit",	on_action_quit },
+		{ "source",	on_action_source,	"s" },
+		{ "destination",on_action_destination,	"s" },
+		{ "limit",	on_action_limit,	"i" },
+		{ "passive",	on_action_passive,	"b" },
+		{ "prediction",	on_action_prediction,	"b" },
+		{ "freeze",	on_action_freeze,	"b" },
+		{ "blank",	on_action_blank,	"b" },
+		{ "fullscreen",	on_action_fullscreen,	"b" },
+		{ "wall",	on_action_wall,		"b" },
+	};
+	static const GDBusInterfaceVTable vtable = {
+		.get_property = on_dbus_get_property,
+	};
+	GError* err = NULL;
+
+	g_action_map_add_action_entries(G_ACTION_MAP(gtkapp), actions, G_N_ELEMENTS(actions), NULL);
+
+	if (!g_application_register(gtkapp, NULL, &err))
+	{
+		// no session bus -> run without the D-Bus interface
+		squint_error(err->message);
+		g_clear_error(&err);
+		g_application_set_flags(gtkapp, G_APPLICATION_NON_UNIQUE);
+		return g_application_register(gtkapp, NULL, NULL);
+	}
+
+	GDBusConnection* connection = g_application_get_dbus_connection(gtkapp);
+	if (connection && !g_application_get_is_remote(gtkapp))
+	{
+		GDBusNodeInfo* info = g_dbus_node_info_new_for_xml(dbus_introspection_xml, NULL);
+		if (!g_dbus_connection_register_object(connection,
+				g_application_get_dbus_object_path(gtkapp),
+				info->interfaces[0], &vtable, NULL, NULL, &err))
+		{
+			squint_error(err->message);
+			g_clear_error(&err);
+		}
+		g_dbus_node_info_unref(info);
+	}
+	return TRUE;
+}
+
+// forward the request to the running instance: activate the action given
+// with --action NAME[=VALUE] (or re-enable the duplication)
+gboolean
+remote_action()
+{
+	GActionGroup* group = G_ACTION_GROUP(gtkapp);
+	const GVariantType* type;
+	GVariant* param = NULL;
+	GError* err = NULL;
+	gboolean result = FALSE;
+
+	if (!opt_action) {
+		fprintf(stderr, APPNAME " is already running (use --action to control it)\n");
+	}
+	gchar** words = g_strsplit(opt_action ? opt_action : "enable", "=", 2);
+
+	if (!g_action_group_query_action(group, words[0], NULL, &type, NULL, NULL, NULL)) {
+		squint_error("unknown action");
+	} else if (!type != !words[1]) {
+		squint_error(type ? "this action requires a value" : "this action does not take any value");
+	} else {
+		if (type) {
+			param = g_variant_type_equal(type, G_VARIANT_TYPE_STRING)
+				? g_variant_new_string(words[1])
+				: g_variant_parse(type, words[1], NULL, NULL, &err);
+		}
+		if (err) {
+			squint_error(err->message);
+			g_clear_error(&err);
+		} else {
+			g_action_group_activate_action(group, words[0], param);
+			g_dbus_connection_flush_sync(g_application_get_dbus_connection(gtkapp), NULL, NULL);
+			result = TRUE;
+		}
+	}
+	g_strfreev(words);
+	return result;
+}
+
+
+gboolean
+init()
+{
+	if (!backend->uses_gtk) {
+		if (opt_action) {
+			squint_error("the D-Bus interface is not available with this backend");
+			return FALSE;
+		}
+		main_loop = g_main_loop_new(NULL, FALSE);
+		return backend->init();
+	}
+
+	gtkapp = G_APPLICATION(gtk_application_new("org.github.a-ba.squint",
+				G_APPLICATION_FLAGS_NONE));
+	if (!register_app()) {
+		return FALSE;
+	}
+	if (g_application_get_is_remote(gtkapp)) {
+		// another instance is running (see remote_action())
+		return TRUE;
+	}
+	if (opt_action) {
+		squint_error(APPNAME " is not running");
+		return FALSE;
+	}
+	g_application_hold(gtkapp);
+
+
+	gdisplay = gdk_display_get_default();
+	if (!gdisplay) {
+		squint_error("No display available");
+		return FALSE;
+	}
+
+	gicon = g_file_icon_new(g_file_new_for_path(ICON_PATH));
+	cursor_icon = gdk_cursor_new_for_display(gdisplay, GDK_X_CURSOR);
+
+	// the icon and the status icon are loaded later (see late_init())
+	return backend->init();
+}
+
+// initialisation deferred after the first frame (the mirror is displayed as
+// soon as possible)
+gboolean
+late_init(gpointer data)
+{
+	if (backend->late_init) {
+		backend->late_init();
+		timing_mark("backend late init");
+	}
+
+	if (backend->uses_gtk)
+	{
+		GError* err = NULL;
+
+		// load the icon
+		icon = gdk_pixbuf_new_from_file (ICON_PATH, &err);
+		if (icon) {
+			gtk_window_set_default_icon(icon);
+		} else {
+			squint_error(err->message);
+			g_clear_error (&err);
+		}
+		timing_mark("icon");
+
+#ifdef HAVE_APPINDICATOR
+		// create the status icon in the tray
+		init_app_indicator();
+		refresh_app_indicator();
+		timing_mark("app indicator");
+#endif
+	}
+	timing_end("late init done");
+	return G_SOURCE_REMOVE;
+}
+
+
+gboolean select_monitor(GdkMonitor** mon, GdkRectangle* rect, GdkMonitor* candidate)
+{
+	g_assert_null(*mon);
+
+	if (candidate == NULL) {
+		return FALSE;
+	} else {
+		gdk_monitor_get_geometry(candidate, rect);
+		*mon = candidate;
+		g_object_ref(*mon);
+		return TRUE;
+	}
+}
+
+void unselect_monitor(GdkMonitor** mon, GdkRectangle* rect)
+{
+	if (*mon != NULL) {
+		g_object_unref(*mon);
+		*mon = NULL;
+	}
+	memset(rect, 0, sizeof(GdkRectangle));
+}
+
+gboolean
+select_monitor_by_name(GdkDisplay* dsp, const char* name,
+		GdkMonitor** mon, GdkRectangle* rect)
+{
+	int n = gdk_display_get_n_monitors(dsp);
+	int i;
+	for (i=0 ; i<n ; i++)
+	{
+		GdkMonitor* candidate_mon = gdk_display_get_monitor(dsp, i);
+
+		if (strcmp(name, gdk_monitor_get_model(candidate_mon)) == 0) {
+			return select_monitor(mon, rect, candidate_mon);
+		}
+	}
+
+	char buff[128];
+	g_snprintf(buff, 128, "Monitor %s is not active", name);
+	squint_error(buff);
+	return FALSE;
+}
+
+gboolean
+select_rightmost_monitor_but(GdkDisplay* dsp, GdkMonitor** mon, GdkRectangle* rect,
+		const GdkRectangle* other_rects, int n_other_rects)
+{
+	int n = gdk_display_get_n_monitors(dsp);
+	int i;
+	GdkMonitor* found_monitor = NULL;
+	GdkRectangle found_rect;
+	for (i=0 ; i<n ; i++)
+	{
+		GdkRectangle candidate_rect;
+		GdkMonitor* candidate_mon = gdk_display_get_monitor(dsp, i);
+		gdk_monitor_get_geometry(candidate_mon, &candidate_rect);
+
+		int j;
+		for (j=0 ; (j<n_other_rects) && memcmp(&candidate_rect, &other_rects[j], sizeof(GdkRectangle)) ; j++)
+			;
+		if (j == n_other_rects)
+		{
+			if ((found_monitor == NULL) ||
+			    (candidate_rect.x+candidate_rect.width > found_rect.x+found_rect.width))
+			{
+				memcpy(&found_rect, &candidate_rect, sizeof(GdkRectangle));
+				found_monitor = candidate_mon;
+			}
+		}
+	}
+	return select_monitor(mon, rect, found_monitor);
+}
+
+gboolean
+select_any_monitor_but(GdkDisplay* dsp, GdkMonitor** mon, GdkRectangle* rect,
+		const GdkRectangle* other_rects, int n_other_rects)
+{
+	int n = gdk_display_get_n_monitors(dsp);
+	int i, j;
+	for (i=0 ; i<n ; i++)
+	{
+		GdkMonitor*  candidate_mon = gdk_display_get_monitor(dsp, i);
+		GdkRectangle candidate_rect;
+		gdk_monitor_get_geometry(candidate_mon, &candidate_rect);
+
+		for (j=0 ; (j<n_other_rects) && memcmp(&candidate_rect, &other_rects[j], sizeof(GdkRectangle)) ; j++)
+			;
+		if (j == n_other_rects)
+		{
+			return select_monitor(mon, rect, candidate_mon);
+		}
+	}
+	return FALSE;
+}
+
+
+void
+unselect_monitors()
+{
+	int i, j;
+	for (i=0 ; i<n_mirrors ; i++)
+	{
+		struct mirror* m = &mirrors[i];
+		unselect_monitor(&m->src_monitor, &m->src_rect);
+		m->capture_window = 0;
+		m->source_display = NULL;
+		for (j=0 ; j<m->n_sources ; j++) {
+			unselect_monitor(&m->sources[j].monitor, &m->sources[j].rect);
+		}
+		m->n_sources = 0;
+		for (j=0 ; j<m->n_destinations ; j++) {
+			unselect_monitor(&m->destinations[j].monitor, &m->destinations[j].rect);
+		}
+		m->n_destinations = 0;
+		m->follow_focus = FALSE;
+		m->zoom = 0;
+	}
+	n_mirrors = 0;
+}
+
+//
+// select which monitors are going to be duplicated
+//
+// initialises:
+// 	mirrors[].src_rect
+// 	mirrors[].src_monitor
+// 	mirrors[].destinations[].rect
+// 	mirrors[].destinations[].monitor
+// 	mirrors[].n_destinations
+// 	n_mirrors
+gboolean
+select_monitors()
+{
+	int i, j, n;
+	unselect_monitors();
+
+	n = gdk_display_get_n_monitors (gdisplay);
+	if ((n < 2) && !config.mirrors[0].src_monitor_name && !config.mirrors[0].capture_window
+			&& !config.mirrors[0].source_display && !config.opt_headless) {
+		squint_error("There is only one monitor. What am I supposed to do?");
+		return FALSE;
+	}
+
+	// monitors already used by a mirror
+	GdkRectangle used[MAX_MIRRORS * (MAX_SOURCES + MAX_DESTINATIONS)];
+	int n_used = 0;
+
+	// first we try to allocate the requested monitors
+	for (i=0 ; i<config.n_mirrors ; i++)
+	{
+		struct mirror* m = &mirrors[n_mirrors++];
+		const struct mirror_config* mc = &config.mirrors[i];
+
+		if (mc->capture_window)
+		{
+			// window capture (the geometry of the window is set by the
+			// backend)
+			m->capture_window = mc->capture_window;
+		}
+		else if (mc->source_display)
+		{
+			// cross-display (the geometry of the source screen is set
+			// by the backend)
+			m->source_display = mc->source_display;
+		}
+		else if (mc->n_extra_src_monitor_names)
+		{
+			// mosaic (all the sources are given explicitly)
+			for (j=-1 ; j<mc->n_extra_src_monitor_names ; j++)
+			{
+				const char* name = (j<0) ? mc->src_monitor_name : mc->extra_src_monitor_names[j];
+				struct source* src = &m->sources[m->n_sources];
+				if (!select_monitor_by_name(gdisplay, name, &src->monitor, &src->rect)) {
+					goto error;
+				}
+				m->n_sources++;
+				used[n_used++] = src->rect;
+			}
+		}
+		else if (mc->src_monitor_name)
+		{
+			if (!select_monitor_by_name(gdisplay, mc->src_monitor_name, &m->src_monitor, &m->src_rect)) {
+				goto error;
+			}
+			used[n_used++] = m->src_rect;
+		}
+
+		for (j=0 ; (j<mc->n_dst_monitor_names) && !config.opt_headless ; j++)
+		{
+			struct destination* dst = &m->destinations[m->n_destinations];
+			if (!select_monitor_by_name(gdisplay, mc->dst_monitor_names[j], &dst->monitor, &dst->rect)) {
+				goto error;
+			}
+			dst->transform = mc->dst_transforms[j];
+			m->n_destinations++;
+			used[n_used++] = dst->rect;
+
+			int k;
+			for (k=0 ; (k<m->n_sources) && memcmp(&m->sources[k].rect, &dst->rect, sizeof(GdkRectangle)) ; k++)
+				;
+			if ((m->src_monitor && !memcmp(&m->src_rect, &dst->rect, sizeof(GdkRectangle)))
+				|| (k < m->n_sources))
+			{
+				squint_error("Source and destination both map the same screen area");
+				goto error;
+			}
+		}
+	}
+
+	for (i=0 ; i<n_mirrors ; i++)
+	{
+		struct mirror* m = &mirrors[i];
+
+		// if the source monitor is not yet decided, then use the rightmost unused monitor
+		if ((m->src_monitor == NULL) && (m->n_sources == 0) && !m->capture_window && !m->source_display)
+		{
+			if (!select_rightmost_monitor_but(gdisplay, &m->src_monitor, &m->src_rect,
+					used, n_used)) {
+				goto not_found;
+			}
+			used[n_used++] = m->src_rect;
+		}
+
+		// if the destination_monitor is not yet decided, then use the first unused monitor
+		if ((m->n_destinations == 0) && !config.opt_headless)
+		{
+			struct destination* dst = &m->destinations[0];
+			if (!select_any_monitor_but(gdisplay, &dst->monitor, &dst->rect, used, n_used)) {
+				goto not_found;
+			}
+			dst->transform = config.transform;
+			m->n_destinations = 1;
+			used[n_used++] = dst->rect;
+		}
+
+		// size of the image presented (the first destination, or the
+		// source in headless mode)
+		GdkRectangle out = m->n_destinations ? m->destinations[0].rect
+				 : (m->n_sources ? m->sources[0].rect : m->src_rect);
+		if (m->n_destinations) {
+			// (the image is transformed afterwards)
+			transform_size(m->destinations[0].transform, out.width, out.height,
+					&out.width, &out.height);
+		}
+
+		// follow focus: the source monitor is handled as a mosaic of a
+		// single source (cropped later to the active window)
+		if (config.opt_follow_focus && m->src_monitor)
+		{
+			m->follow_focus = TRUE;
+			m->crop_area = m->src_rect;
+			m->sources[0].monitor = m->src_monitor;
+			m->sources[0].rect    = m->src_rect;
+			m->n_sources = 1;
+			m->src_monitor = NULL;
+		}
+
+		// magnifier: same thing, the source is the area around the pointer
+		if (config.opt_zoom && m->src_monitor)
+		{
+			m->crop_area = m->src_rect;
+			m->sources[0].monitor = m->src_monitor;
+			m->n_sources = 1;
+			m->src_monitor = NULL;
+			zoom_init(m, config.opt_zoom, out.width, out.height);
+		}
+
+		// mosaic: the sources are composed in an image of the size of the
+		// first destination
+		if (m->n_sources) {
+			mosaic_layout(m, out.width, out.height);
+		}
+	}
+	return TRUE;
+
+not_found:
+	squint_error("Could not find any monitor to be cloned");
+error:
+	unselect_monitors();
+	return FALSE;
+}
+
+//
+// Prepare the windows to host the duplicated screen
+//
+// initialises:
+// 	mirrors[].destinations[].gtkwin
+// 	mirrors[].destinations[].gdkwin
+//	fullscreen
+//
+void
+enable_window(struct mirror* m, struct destination* dst)
+{
+	GtkWidget* gtkwin;
+	GdkWindow* gdkwin;
 
 	if (fullscreen)
 	{
@@ -595,10 +1267,10 @@ enable_window()
 
 		// resize it to the dimensions of the dst monitor
 		gtk_window_resize(GTK_WINDOW(gtkwin),
-				dst_rect.width, dst_rect.height);
+				dst->rect.width, dst->rect.height);
 
 		// move the window into the cover the destination screen
-		gtk_window_move(GTK_WINDOW(gtkwin), dst_rect.x, dst_rect.y);
+		gtk_window_move(GTK_WINDOW(gtkwin), dst->rect.x, dst->rect.y);
 
 		// create the gdkwindow
 		gtk_widget_realize(gtkwin);
@@ -607,21 +1279,25 @@ enable_window()
 		// create the window
 		gtkwin = gtk_window_new (GTK_WINDOW_TOPLEVEL);
 		gtk_window_set_resizable(GTK_WINDOW(gtkwin), TRUE);
-		if (icon) {
-			gtk_window_set_icon (GTK_WINDOW(gtkwin), icon);
-		}
 
 		// resize the window
-		int w = src_rect.width;
-		int max_w = dst_rect.width - 100;
-		int h = src_rect.height;
-		int max_h = dst_rect.height - 100;
+		// (the size of a captured window or of the screen of the source
+		// display is not known yet)
+		int max_w = dst->rect.width - 100;
+		int max_h = dst->rect.height - 100;
+		gboolean unknown = m->capture_window || m->source_display;
+		int w, h;
+		transform_size(dst->transform, m->src_rect.width, m->src_rect.height, &w, &h);
+		if (unknown) {
+			w = max_w;
+			h = max_h;
+		}
 		gtk_window_resize(GTK_WINDOW(gtkwin),
 			((w < max_w) ? w : max_w),
 			((h < max_h) ? h : max_h));
 
 		// move the window into the destination screen
-		gtk_window_move(GTK_WINDOW(gtkwin), dst_rect.x+50, dst_rect.y+50);
+		gtk_window_move(GTK_WINDOW(gtkwin), dst->rect.x+50, dst->rect.y+50);
 
 		// map my window
 		gtk_widget_show (gtkwin);
@@ -632,7 +1308,7 @@ enable_window()
 		g_signal_connect (gtkwin, "delete-event", G_CALLBACK (on_window_delete_event), NULL);
 
 		// - resize the window to src monitor size on double click
-		g_signal_connect (gtkwin, "button-press-event", G_CALLBACK (on_window_button_press_event), NULL);
+		g_signal_connect (gtkwin, "button-press-event", G_CALLBACK (on_window_button_press_event), m);
 		gdk_window_set_events (gdkwin, gdk_window_get_events(gdkwin) | GDK_BUTTON_PRESS_MASK);
 	}
 
@@ -642,16 +1318,68 @@ enable_window()
 	// override the cursor icon
 	gdk_window_set_cursor(gdkwin, cursor_icon);
 
-	// hide the window for the moment
-	do_hide();
+	dst->gtkwin = gtkwin;
+	dst->gdkwin = gdkwin;
+}
+
+// initialises:
+// 	m->wall
+// 	m->wall_rect
+// 	m->destinations[].tile
+void
+init_video_wall(struct mirror* m)
+{
+	int i;
+
+	// the video wall is meaningful only in fullscreen mode
+	m->wall = config.opt_wall && fullscreen && (m->n_destinations > 1);
+
+	m->wall_rect = m->destinations[0].rect;
+	for (i=1 ; i<m->n_destinations ; i++) {
+		gdk_rectangle_union(&m->wall_rect, &m->destinations[i].rect, &m->wall_rect);
+	}
+	for (i=0 ; i<m->n_destinations ; i++)
+	{
+		struct destination* dst = &m->destinations[i];
+		dst->tile.x = m->wall ? (dst->rect.x - m->wall_rect.x) : 0;
+		dst->tile.y = m->wall ? (dst->rect.y - m->wall_rect.y) : 0;
+	}
 }
 
 void
-disable_window()
+enable_windows()
 {
-	gtk_widget_destroy(gtkwin);
-	gdkwin = NULL;
-	gtkwin = NULL;
+	int i, j;
+	fullscreen = !config.opt_window;
+
+	for (i=0 ; i<n_mirrors ; i++)
+	{
+		struct mirror* m = &mirrors[i];
+		init_video_wall(m);
+
+		for (j=0 ; j<m->n_destinations ; j++) {
+			enable_window(m, &m->destinations[j]);
+		}
+
+		// hide the windows for the moment
+		do_hide(m);
+	}
+}
+
+void
+disable_windows()
+{
+	int i, j;
+	for (i=0 ; i<n_mirrors ; i++)
+	{
+		struct mirror* m = &mirrors[i];
+		for (j=0 ; j<m->n_destinations ; j++)
+		{
+			gtk_widget_destroy(m->destinations[j].gtkwin);
+			m->destinations[j].gdkwin = NULL;
+			m->destinations[j].gtkwin = NULL;
+		}
+	}
 }
 
 gboolean
@@ -659,16 +1387,27 @@ squint_enable()
 {
 	if (!enabled)
 	{
-		if(select_monitors())
+		if (!backend->uses_gtk)
 		{
-			enable_window();
-
-			x11_enable();
-
-			enabled = TRUE;
+			// the mirrors are set up by the backend
+			enabled = backend->enable();
+		}
+		else if(select_monitors())
+		{
+			timing_mark("monitors");
+			enable_windows();
+			timing_mark("windows");
+
+			if (backend->enable()) {
+				enabled = TRUE;
+			} else {
+				disable_windows();
+			}
 		}
 #ifdef HAVE_APPINDICATOR
-		refresh_app_indicator();
+		if (app_indicator) {
+			refresh_app_indicator();
+		}
 #endif
 	}
 	return enabled;
@@ -679,22 +1418,322 @@ squint_disable()
 {
 	enabled = FALSE;
 
-	x11_disable();
+	backend->disable();
+
+	if (backend->uses_gtk) {
+		disable_windows();
+	}
 
-	disable_window();
+#ifdef HAVE_APPINDICATOR
+	if (app_indicator) {
+		refresh_app_indicator();
+	}
+#endif
+}
+
+//
+// Reconfiguration (hotplug, mode change of the monitors, settings changed in
+// the menu)
+//
+// The monitors are selected again. When the mirrors keep the same structure
+// (same number of mirrors, sources and destinations), the windows are moved
+// and the backend updates only the resources affected by the change of
+// geometry (see backend->reconfigure). Otherwise squint is restarted.
+//
+// When switching between fullscreen and windowed mode, new windows are
+// created and the backend moves its resources into them (the capture is not
+// reallocated).
+//
+
+static guint reconfigure_idle = 0;
+
+// take (or release) a reference on all the monitors of a copy of mirrors[]
+void
+ref_monitors(struct mirror* ms, int n, gboolean ref)
+{
+	void apply(GdkMonitor* mon)
+	{
+		if (mon == NULL) {
+			return;
+		}
+		if (ref) {
+			g_object_ref(mon);
+		} else {
+			g_object_unref(mon);
+		}
+	}
+
+	int i, j;
+	for (i=0 ; i<n ; i++)
+	{
+		apply(ms[i].src_monitor);
+		for (j=0 ; j<ms[i].n_sources ; j++) {
+			apply(ms[i].sources[j].monitor);
+		}
+		for (j=0 ; j<ms[i].n_destinations ; j++) {
+			apply(ms[i].destinations[j].monitor);
+		}
+	}
+}
+
+// return TRUE if the mirrors have the same structure as old[] (and so they
+// can reuse the same windows and resources)
+gboolean
+same_mirror_structure(const struct mirror* old, int n_old)
+{
+	int i;
+	if (n_mirrors != n_old) {
+		return FALSE;
+	}
+	for (i=0 ; i<n_mirrors ; i++)
+	{
+		const struct mirror* m = &mirrors[i];
+		if (	(m->n_sources      != old[i].n_sources)
+		     ||	(m->n_destinations != old[i].n_destinations)
+		     ||	(m->capture_window != old[i].capture_window)
+		     ||	(m->source_display != old[i].source_display))
+		{
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+void
+reconfigure()
+{
+	struct mirror old[MAX_MIRRORS];
+	int n_old = n_mirrors;
+	int i, j;
+
+	// keep the previous state (select_monitors() releases the monitors)
+	memcpy(old, mirrors, sizeof(old));
+	ref_monitors(old, n_old, TRUE);
+
+	if (!select_monitors() || !backend->reconfigure || !same_mirror_structure(old, n_old))
+	{
+		// restore the previous state so that it can be torn down, then
+		// restart
+		unselect_monitors();
+		memcpy(mirrors, old, sizeof(old));
+		n_mirrors = n_old;
+
+		squint_disable();
+		squint_enable();
+		return;
+	}
+	ref_monitors(old, n_old, FALSE);
+
+	if (fullscreen != !config.opt_window)
+	{
+		// new windows
+		enable_windows();
+		backend->reconfigure(old);
+
+		for (i=0 ; i<n_old ; i++) {
+			for (j=0 ; j<old[i].n_destinations ; j++) {
+				gtk_widget_destroy(old[i].destinations[j].gtkwin);
+			}
+		}
+	} else {
+		for (i=0 ; i<n_mirrors ; i++)
+		{
+			struct mirror* m = &mirrors[i];
+			for (j=0 ; j<m->n_destinations ; j++)
+			{
+				struct destination* dst = &m->destinations[j];
+				if (!fullscreen) {
+					// the geometry is the one of the window (not affected)
+					dst->rect = old[i].destinations[j].rect;
+				} else if (!gdk_rectangle_equal(&dst->rect, &old[i].destinations[j].rect)) {
+					gtk_window_resize(GTK_WINDOW(dst->gtkwin), dst->rect.width, dst->rect.height);
+					gtk_window_move(GTK_WINDOW(dst->gtkwin), dst->rect.x, dst->rect.y);
+				}
+			}
+			init_video_wall(m);
+		}
+
+		backend->reconfigure(old);
+	}
 
 #ifdef HAVE_APPINDICATOR
-	refresh_app_indicator();
+	if (app_indicator) {
+		refresh_app_indicator();
+	}
 #endif
 }
 
+gboolean
+on_reconfigure_idle(gpointer data)
+{
+	reconfigure_idle = 0;
+	if (enabled) {
+		reconfigure();
+	}
+	return G_SOURCE_REMOVE;
+}
+
+// the geometry of the monitors was changed
+//
+// The events come in bursts, they are coalesced until the main loop is idle
+// (then GDK has also updated its list of monitors).
+void
+squint_monitors_changed()
+{
+	if (!reconfigure_idle) {
+		reconfigure_idle = g_idle_add(on_reconfigure_idle, NULL);
+	}
+}
+
+
+// parse a --mirror argument: SOURCE[+SOURCE...]:DESTINATION[,DESTINATION...]
+//
+// ('-' or an empty name means automatic selection, several sources make a
+// mosaic)
+gboolean
+parse_mirror_option(const char* arg)
+{
+	if (config.n_mirrors >= MAX_MIRRORS) {
+		squint_error("too many mirrors");
+		return FALSE;
+	}
+	struct mirror_config* mc = &config.mirrors[config.n_mirrors++];
+	gboolean result = TRUE;
+	int i;
+
+	gchar** names = g_strsplit(arg, ":", 2);
+	gchar** src_names = g_strsplit(names[0] ? names[0] : "", "+", -1);
+	int n_src_names = g_strv_length(src_names);
+	if (n_src_names > MAX_SOURCES)
+	{
+		squint_error("too many sources");
+		result = FALSE;
+	}
+	else if (n_src_names > 1)
+	{
+		// mosaic
+		for (i=0 ; i<n_src_names ; i++)
+		{
+			if (!src_names[i][0] || !strcmp("-", src_names[i])) {
+				squint_error("the sources of a mosaic must be given explicitly");
+				result = FALSE;
+				break;
+			}
+			if (i == 0) {
+				mc->src_monitor_name = g_strdup(src_names[i]);
+			} else {
+				mc->extra_src_monitor_names[mc->n_extra_src_monitor_names++] = g_strdup(src_names[i]);
+			}
+		}
+	}
+	else if ((n_src_names == 1) && src_names[0][0] && strcmp("-", src_names[0]))
+	{
+		mc->src_monitor_name = g_strdup(src_names[0]);
+	}
+	g_strfreev(src_names);
+
+	if (names[0] && names[1])
+	{
+		gchar** dst_names = g_strsplit(names[1], ",", -1);
+		for (i=0 ; dst_names[i] ; i++)
+		{
+			if (!dst_names[i][0] || !strcmp("-", dst_names[i])) {
+				continue;
+			}
+			if (mc->n_dst_monitor_names >= MAX_DESTINATIONS) {
+				squint_error("too many destinations");
+				result = FALSE;
+				break;
+			}
+			if (!add_dst_monitor_name(mc, dst_names[i])) {
+				result = FALSE;
+				break;
+			}
+		}
+		g_strfreev(dst_names);
+	}
+	g_strfreev(names);
+	return result;
+}
+
+// parse the --layout argument
+gboolean
+parse_layout_option(const char* arg)
+{
+	if (!strcmp(arg, "grid")) {
+		config.mosaic_layout = MOSAIC_GRID;
+	} else if (!strcmp(arg, "pip")) {
+		config.mosaic_layout = MOSAIC_PIP;
+	} else {
+		squint_error("unknown layout");
+		return FALSE;
+	}
+	return TRUE;
+}
+
+// parse the --scale argument
+gboolean
+parse_scale_option(const char* arg)
+{
+	if (!strcmp(arg, "bilinear")) {
+		config.scale_filter = SCALE_BILINEAR;
+	} else if (!strcmp(arg, "lanczos")) {
+		config.scale_filter = SCALE_LANCZOS;
+	} else {
+		squint_error("unknown scaling filter");
+		return FALSE;
+	}
+	return TRUE;
+}
+
+// hotkey given as a GTK accelerator (eg: <Control><Alt>f, Pause)
+gboolean
+parse_hotkey_option(const char* arg, struct hotkey* key)
+{
+	gtk_accelerator_parse(arg, &key->keyval, &key->modifiers);
+	if (!key->keyval) {
+		squint_error("invalid hotkey");
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static gchar** opt_mirrors = NULL;
+static gchar*  opt_layout  = NULL;
+static gchar*  opt_scale   = NULL;
+static gchar*  opt_transform = NULL;
+static gchar*  opt_capture_window = NULL;
+static gchar*  opt_freeze_key = NULL;
+static gchar*  opt_blank_key  = NULL;
 
 GOptionEntry option_entries[] = {
+  { "action",	'a',	0,	G_OPTION_ARG_STRING,	&opt_action,		"Activate action NAME in the running instance (see the manual page)", "NAME[=VALUE]"},
+  { "backend",	'b',	0,	G_OPTION_ARG_STRING,	&config.backend_name,	"Use backend NAME (x11, wayland or synthetic)", "NAME"},
+  { "blank-image", 'B',	0,	G_OPTION_ARG_FILENAME,	&config.opt_blank_image, "Display the image FILE in the middle of the destinations in blank mode (X11 only)", "FILE"},
+  { "blank-key", 'K',	0,	G_OPTION_ARG_STRING,	&opt_blank_key,		"Toggle the blank mode with the global shortcut KEY (X11 only)", "KEY"},
+  { "capture-window", 'c', 0,	G_OPTION_ARG_STRING,	&opt_capture_window,	"Duplicate the window XID instead of the source monitor (X11 only)", "XID"},
   { "disable",	'd',	0,	G_OPTION_ARG_NONE,	&config.opt_disable,	"Do not enable screen duplication at startup", NULL},
+  { "export",	'e',	0,	G_OPTION_ARG_FILENAME,	&config.opt_export,	"Export the frames of the first mirror through the Unix socket SOCKET (see the manual page)", "SOCKET"},
+  { "follow-focus", 'F', 0,	G_OPTION_ARG_NONE,	&config.opt_follow_focus, "Display only the active window (cropped from the source monitor and scaled to fit the destination)", NULL},
+  { "freeze-key", 'k',	0,	G_OPTION_ARG_STRING,	&opt_freeze_key,	"Toggle the freeze mode with the global shortcut KEY, eg: '<Control><Alt>f' (X11 only)", "KEY"},
+  { "gl",	'g',	0,	G_OPTION_ARG_NONE,	&config.opt_gl,		"Present the mirrors with OpenGL, scaled to fit the destinations (X11 only)", NULL},
+  { "headless",	'H',	0,	G_OPTION_ARG_NONE,	&config.opt_headless,	"Capture without displaying anything (with --record or --export)", NULL},
+  { "interactive", 'i', 0,	G_OPTION_ARG_NONE,	&config.opt_interactive, "Forward the pointer and keyboard events of the mirror to the source (only the buttons for the local display, not in passive mode)", NULL},
+  { "layout",	'L',	0,	G_OPTION_ARG_STRING,	&opt_layout,		"Layout of the mosaics: grid (default) or pip (picture in picture)", "LAYOUT"},
   { "limit",	'l',	0,	G_OPTION_ARG_INT,	&config.opt_limit,	"Limit refresh rate to N frames per second", "N"},
+  { "mirror",	'm',	0,	G_OPTION_ARG_STRING_ARRAY, &opt_mirrors,	"Add a mirror duplicating monitor SRC (or a mosaic of several monitors) into monitor(s) DST (may be repeated)", "SRC[+SRC...]:DST[,DST...]"},
+  { "no-prediction", 'P', 0,	G_OPTION_ARG_NONE,	&config.opt_no_prediction, "Draw the mirrored cursor where the pointer is, instead of where it is expected when the frame is displayed (X11 only)", NULL},
+  { "overlay",	'o',	0,	G_OPTION_ARG_NONE,	&config.opt_overlay,	"Display a debug overlay showing the damaged areas and the refresh statistics", NULL},
   { "passive",	'p',	0,	G_OPTION_ARG_NONE,	&config.opt_passive,	"Do not raise the window on user activity (has no effects in fullscreen mode)", NULL},
   { "rate",	'r',	0,	G_OPTION_ARG_INT,	&config.opt_rate,	"Use fixed refresh rate of N frames per second", "N"},
+  { "record",	'R',	0,	G_OPTION_ARG_FILENAME,	&config.opt_record,	"Record the first mirror into FILE (YUV4MPEG2 format)", "FILE"},
+  { "scale",	'S',	0,	G_OPTION_ARG_STRING,	&opt_scale,		"Scale the image to fit the destination with the CPU using FILTER: bilinear or lanczos (not with --gl)", "FILTER"},
+  { "source-display", 's', 0,	G_OPTION_ARG_STRING,	&config.mirrors[0].source_display, "Duplicate the screen of the X display DISPLAY instead of the source monitor (X11 only)", "DISPLAY"},
+  { "timing",	't',	0,	G_OPTION_ARG_NONE,	&config.opt_timing,	"Print the time to first frame (broken down by phase of the startup)", NULL},
+  { "transform", 'T', 0,	G_OPTION_ARG_STRING,	&opt_transform,		"Rotate or flip the image of the destinations: normal, 90, 180, 270, flip, flip-90, flip-180 or flip-270 (may be given per destination with MONITOR@TRANSFORM, X11 only)", "TRANSFORM"},
   { "version",	'v',	0,	G_OPTION_ARG_NONE,	&config.opt_version,	"Display version information and exit", NULL},
+  { "wall",	'W',	0,	G_OPTION_ARG_NONE,	&config.opt_wall,	"Video wall mode: span the source monitor across all the destination monitors", NULL},
+  { "zoom",	'z',	0,	G_OPTION_ARG_INT,	&config.opt_zoom,	"Magnifier mode: display the area around the pointer zoomed N times (2 to 4)", "N"},
   { "window",	'w',	0,	G_OPTION_ARG_NONE,	&config.opt_window,	"Run inside a window instead of going fullscreen", NULL},
   { NULL }
 };
@@ -707,12 +1746,13 @@ main (int argc, char *argv[])
 
 	memset(&config, 0, sizeof(config));
 	config.opt_limit = -1;
+	timing_start = timing_prev = g_get_monotonic_time();
 
-	context = g_option_context_new (NULL);
+	context = g_option_context_new ("[SourceMonitor [DestinationMonitor...]]");
 	g_option_context_add_main_entries (context, option_entries, NULL);
-	g_option_context_add_group (context, gtk_get_option_group (TRUE));
+	g_option_context_add_group (context, gtk_get_option_group (FALSE));
 
-	if (!gtk_init_with_args (&argc, &argv, "[SourceMonitor [DestinationMonitor]]", option_entries, NULL, &err))
+	if (!g_option_context_parse (context, &argc, &argv, &err))
 	{
 		squint_error(err->message);
 		return 1;
@@ -725,33 +1765,133 @@ main (int argc, char *argv[])
 		return 0;
 	}
 
+	// select the backend
+	backend = backends[0];
+	if (config.backend_name) {
+		int i;
+		for (i=0 ; backends[i] && strcmp(backends[i]->name, config.backend_name) ; i++)
+			;
+		if (!backends[i]) {
+			squint_error("unknown backend");
+			return 1;
+		}
+		backend = backends[i];
+	}
+
+	timing_mark("options");
+
+	if (backend->uses_gtk && !gtk_init_check(&argc, &argv)) {
+		squint_error("No display available");
+		return 1;
+	}
+	timing_mark("gtk init");
+
+	if (opt_transform && !parse_transform(opt_transform, &config.transform)) {
+		return 1;
+	}
+	g_free(opt_transform);
+	if ((opt_freeze_key && !parse_hotkey_option(opt_freeze_key, &config.freeze_key))
+		|| (opt_blank_key && !parse_hotkey_option(opt_blank_key, &config.blank_key)))
+	{
+		return 1;
+	}
+	g_free(opt_freeze_key);
+	g_free(opt_blank_key);
+
 	// TODO: manage args w/ GApplication
-	switch (argc)
+	if (argc > 2 + MAX_DESTINATIONS) {
+		squint_error("invalid arguments");
+		return 1;
+	}
+	if (argc > 1)
 	{
-		case 3:
-			if (strcmp("-", argv[2])) {
-				config.dst_monitor_name = g_strdup(argv[2]);
-			}
-		case 2:
-			if (strcmp("-", argv[1])) {
-				config.src_monitor_name = g_strdup(argv[1]);
+		// the positional arguments configure the first mirror
+		struct mirror_config* mc = &config.mirrors[config.n_mirrors++];
+		if (strcmp("-", argv[1])) {
+			mc->src_monitor_name = g_strdup(argv[1]);
+		}
+		for (int i=2 ; i<argc ; i++) {
+			if (strcmp("-", argv[i]) && !add_dst_monitor_name(mc, argv[i])) {
+				return 1;
 			}
-		case 1:
-			break;
-		default:
-			squint_error("invalid arguments");
+		}
+	}
+	for (int i=0 ; opt_mirrors && opt_mirrors[i] ; i++) {
+		if (!parse_mirror_option(opt_mirrors[i])) {
 			return 1;
+		}
+	}
+	g_strfreev(opt_mirrors);
+	if (opt_layout && !parse_layout_option(opt_layout)) {
+		return 1;
+	}
+	g_free(opt_layout);
+	if (opt_scale && !parse_scale_option(opt_scale)) {
+		return 1;
+	}
+	g_free(opt_scale);
+	if (config.n_mirrors == 0) {
+		// automatic selection
+		config.n_mirrors = 1;
+	}
+	if (config.opt_zoom && ((config.opt_zoom < 2) || (config.opt_zoom > 4))) {
+		squint_error("the zoom factor must be between 2 and 4");
+		return 1;
+	}
+	if (config.opt_zoom && config.opt_follow_focus) {
+		squint_error("the magnifier and the follow-focus modes are mutually exclusive");
+		return 1;
+	}
+	if (config.opt_headless && ((config.n_mirrors > 1) || (!config.opt_record && !config.opt_export))) {
+		squint_error("the headless mode requires --record or --export and a single mirror");
+		return 1;
+	}
+	if (opt_capture_window && config.mirrors[0].source_display) {
+		squint_error("the window capture and the cross-display source are mutually exclusive");
+		return 1;
+	}
+	if (opt_capture_window)
+	{
+		// the captured window replaces the source of the first mirror
+		char* end;
+		config.mirrors[0].capture_window = strtoul(opt_capture_window, &end, 0);
+		if (*end || !config.mirrors[0].capture_window) {
+			squint_error("invalid window id");
+			return 1;
+		}
+		g_free(opt_capture_window);
 	}
 
 	// initialisation
 	if (!init()) {
 		return 1;
 	}
+	if (gtkapp && g_application_get_is_remote(gtkapp)) {
+		return remote_action() ? 0 : 1;
+	}
+	timing_mark("backend init");
 
 	// activation
 	if (!config.opt_disable) {
 		squint_enable();
 	}
 
-	return g_application_run(gtkapp, argc, argv);
+	// the remaining initialisation is done once the first frame is out
+	g_idle_add(late_init, NULL);
+
+	int status = 0;
+	if (gtkapp) {
+		status = g_application_run(gtkapp, argc, argv);
+	} else {
+		g_main_loop_run(main_loop);
+	}
+
+	// finish the recording and remove the export socket
+	if (enabled) {
+		squint_disable();
+	}
+	if (config.opt_export) {
+		export_cleanup();
+	}
+	return status;
 }
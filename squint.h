@@ -3,33 +3,326 @@
 
 
 
+#define MAX_DESTINATIONS 8
+#define MAX_MIRRORS 4
+#define MAX_SOURCES 4
+
+// layout of the mosaic mirrors
+enum mosaic_layout {
+	MOSAIC_GRID,	// sources side by side
+	MOSAIC_PIP,	// first source in full size, others inset (picture in picture)
+};
+
+// rotation/flip of the image of a destination (see transform_matrix())
+enum transform {
+	TRANSFORM_NORMAL,
+	TRANSFORM_90,		// rotated clockwise
+	TRANSFORM_180,
+	TRANSFORM_270,
+	TRANSFORM_FLIPPED,	// flipped left-right
+	TRANSFORM_FLIPPED_90,	// flipped, then rotated clockwise
+	TRANSFORM_FLIPPED_180,
+	TRANSFORM_FLIPPED_270,
+};
+
+// filter of the CPU scaler (--scale)
+enum scale_filter {
+	SCALE_NONE,	// no scaling
+	SCALE_BILINEAR,
+	SCALE_LANCZOS,
+};
+
+// suspension of the capture (see squint_pause())
+enum pause_mode {
+	PAUSE_NONE,
+	PAUSE_FREEZE,	// the destinations keep displaying the last frame
+	PAUSE_BLANK,	// the destinations are black (or display --blank-image)
+};
+
+// global shortcut (--freeze-key, --blank-key)
+struct hotkey {
+	guint		keyval;		// 0 if none
+	GdkModifierType	modifiers;
+};
+
 // Config
-extern struct config {
+struct mirror_config {
+	// NULL/empty for automatic selection
 	const char* src_monitor_name;
-	const char* dst_monitor_name;
+	const char* dst_monitor_names[MAX_DESTINATIONS];
+	enum transform dst_transforms[MAX_DESTINATIONS];
+	int n_dst_monitor_names;
+
+	// mosaic: other sources composed with src_monitor_name
+	const char* extra_src_monitor_names[MAX_SOURCES - 1];
+	int n_extra_src_monitor_names;
+
+	// window captured instead of the source monitor (0 if none)
+	gulong capture_window;
+
+	// X display whose screen is duplicated instead of the source monitor
+	// (NULL if none)
+	const char* source_display;
+};
+
+extern struct config {
+	// mirrors[0] is the one configured in the menu
+	struct mirror_config mirrors[MAX_MIRRORS];
+	int n_mirrors;
+
+	const char* backend_name;
+	const char* opt_record;		// output file (NULL if not recording)
+	const char* opt_export;		// export socket (NULL if not exporting)
+	const char* opt_blank_image;	// logo of the blank mode (NULL if none)
 
-	gboolean opt_version, opt_window, opt_disable, opt_passive;
+	gboolean opt_version, opt_window, opt_disable, opt_passive, opt_overlay, opt_wall;
+	gboolean opt_follow_focus, opt_timing, opt_headless, opt_gl, opt_interactive;
+	gboolean opt_no_prediction;
+	gint opt_zoom;
 	gint opt_limit, opt_rate;
+	enum mosaic_layout mosaic_layout;
+	enum scale_filter scale_filter;
+	enum transform transform;	// of the destinations without explicit transform
+	enum pause_mode pause;		// requested at runtime (applied by the backend when enabled)
+	struct hotkey freeze_key, blank_key;
 } config;
 
 
 // State
 extern gboolean enabled;
 extern gboolean fullscreen;
-extern gboolean raised;
 
-extern GtkWidget* gtkwin;
-extern GdkWindow* gdkwin;
 extern GdkDisplay* gdisplay;
 
-extern GdkRectangle src_rect, dst_rect, active_window_rect;
+extern GdkRectangle active_window_rect;
+
+
+// Performance counters
+struct stats {
+	guint	events;		// number of damage events received
+	guint	frames;		// number of refreshes
+	guint64	pixels;		// number of pixels copied from the source
+	guint	drops;		// number of damage events delayed by the rate limiter
+	guint	cursor_latency;	// estimated latency of the mirrored cursor (µs, smoothed)
+};
+
+// the counters are updated by the thread running the scheduler (possibly
+// the render thread in x11.c) and read by the main thread
+#define STATS_ADD(field, n)	__atomic_fetch_add(&(field), (n), __ATOMIC_RELAXED)
+#define STATS_GET(field)	__atomic_load_n(&(field), __ATOMIC_RELAXED)
+
+
+// Destinations
+//
+// All destinations of a mirror present the same capture of the source
+// monitor, each one in its own window.
+struct destination {
+	GdkMonitor*	monitor;
+	GdkRectangle	rect;		// geometry of the window
+	GdkPoint	offset;		// location of the source image inside the window
+	GdkPoint	tile;		// location of the window inside the video wall
+	enum transform	transform;	// applied to the image (offset is in the transformed coordinates)
+	GtkWidget*	gtkwin;
+	GdkWindow*	gdkwin;
+};
+
+// Refresh scheduler (one per mirror, see core.c)
+struct mirror;
+struct scheduler {
+	gboolean (*refresh)(struct mirror* m, const GdkRectangle* damaged_rect);
+	struct stats* stats;
+
+	int min_refresh_period;
+	guint32 next_refresh;
+	GSource* refresh_timeout;	// (attached to the context of the thread running the scheduler)
+
+	GdkRectangle accumulated_damage;	// damages of the current batch
+	GdkRectangle pending_damage;		// damages waiting for the next period
+};
+
+// Sources of a mosaic
+struct source {
+	GdkMonitor*	monitor;
+	GdkRectangle	rect;		// geometry of the monitor
+	GdkRectangle	cell;		// location in the composed image
+};
+
+// Mirrors
+//
+// A mirror duplicates one source monitor into one or several destinations.
+// All mirrors share the same connection to the display server, the damage
+// events are dispatched to the mirrors according to their source rectangle.
+//
+// A mosaic mirror composes several source monitors (scaled) into a single
+// image. Its src_rect is then the geometry of the composed image (not the
+// geometry of a monitor) and the damages are translated by
+// compute_damaged_rect() into the coordinates of this image.
+//
+// A window capture mirror duplicates a single window (X11 only). Its src_rect
+// is {0, 0, width, height} of the window and it receives only the damages of
+// this window (see scheduler_add_mirror_damage()).
+//
+// A cross-display mirror duplicates the screen of another X display (X11
+// only). Its src_rect is {0, 0, width, height} of this screen and it receives
+// only the damages of this screen (like a window capture).
+//
+// A follow-focus mirror is handled as a mosaic of a single source: the
+// source rect is the part of the monitor covered by the active window (see
+// focus_crop()). A magnifier mirror too, its source rect is the zoomed area
+// around the pointer (see zoom_step()).
+//
+// In headless mode (--headless) the first mirror has no destination, its
+// capture is only recorded or exported.
+struct mirror {
+	GdkMonitor*	src_monitor;	// NULL for a mosaic, a window capture or a cross-display mirror
+	GdkRectangle	src_rect;
+
+	gulong capture_window;		// 0 if not a window capture
+	const char* source_display;	// NULL if not a cross-display mirror
+
+	struct source sources[MAX_SOURCES];
+	int n_sources;			// 0 if not a mosaic
+
+	gboolean follow_focus;
+	int zoom;			// magnifier: zoom factor (0 if disabled)
+	GdkPoint zoom_target;		// magnifier: location where the viewport is moving to
+	GdkRectangle crop_area;		// follow-focus/magnifier: geometry of the source monitor
 
-void squint_show();
-void squint_hide();
+	struct destination destinations[MAX_DESTINATIONS];
+	int n_destinations;		// 0 in headless mode
+
+	// video wall mode: the destinations are the tiles of a single logical
+	// output (wall_rect is the union of their rects)
+	gboolean wall;
+	GdkRectangle wall_rect;
+
+	gboolean raised;
+	struct scheduler scheduler;
+};
+extern struct mirror mirrors[MAX_MIRRORS];
+extern int n_mirrors;
+
+void squint_show(struct mirror* m);
+void squint_hide(struct mirror* m);
 void squint_disable();
+void squint_monitors_changed();
+void squint_toggle_pause(enum pause_mode mode);
+void squint_quit();
 
 void squint_error(const char* msg);
 
-gboolean x11_init();
-void x11_enable();
-void x11_disable();
+// startup timing (--timing)
+void timing_mark(const char* phase);
+void squint_first_frame();
+
+// recording of the first mirror (--record, see record.c)
+gboolean record_start(const void* canvas, int width, int height, int stride);
+void record_damage(int x, int y, int width, int height);
+void record_stop();
+
+// frame export of the first mirror (--export, see export.c)
+gboolean export_start(const void* canvas, int width, int height, int stride);
+void export_damage(int x, int y, int width, int height);
+void export_stop();
+void export_cleanup();
+
+// CPU scaler (--scale, see scale.c)
+struct scaler;
+void scaler_fit(int src_width, int src_height, int width, int height, GdkRectangle* rect);
+struct scaler* scaler_new(enum scale_filter filter, int src_width, int src_height, int dst_width, int dst_height);
+void scaler_free(struct scaler* s);
+void scaler_map_area(const struct scaler* s, const GdkRectangle* src_area, GdkRectangle* dst_area);
+void scaler_run(struct scaler* s, const void* src, int src_stride, void* dst, int dst_stride,
+		const GdkRectangle* areas, int n_areas);
+
+
+// Backend interface
+#define BACKEND_CAP_DAMAGE		(1<<0)	// refresh only the damaged areas
+#define BACKEND_CAP_CURSOR_TRACKING	(1<<1)	// receive cursor motion events
+#define BACKEND_CAP_COPY_CURSOR		(1<<2)	// clone the cursor image
+#define BACKEND_CAP_FOCUS_TRACKING	(1<<3)	// track the active window
+#define BACKEND_CAP_OVERLAY		(1<<4)	// debug overlay
+
+struct backend {
+	const char* name;
+
+	// FALSE if the backend does not use GTK (no GTK window, no app
+	// indicator, the mirrors are set up by enable())
+	gboolean uses_gtk;
+
+	gboolean (*init)();
+
+	// initialisation deferred after the first frame (NULL if none)
+	void (*late_init)();
+
+	gboolean (*enable)();
+	void (*disable)();
+
+	// update the resources after a change of the geometry of the monitors
+	// or of the settings (NULL if not supported, squint is then restarted)
+	//
+	// old: previous state of mirrors[] (with the same number of mirrors,
+	// sources and destinations). The windows of the destinations may have
+	// been replaced (the old ones are destroyed after this call).
+	void (*reconfigure)(const struct mirror* old);
+
+	// capabilities available at runtime (must be called after init())
+	guint (*capabilities)();
+
+	const struct stats* (*stats)();
+
+	// suspend the capture (freeze/blank mode) or resume it with PAUSE_NONE
+	// (NULL if not supported). config.pause is applied by enable().
+	void (*pause)(enum pause_mode mode);
+};
+
+extern const struct backend* backend;
+extern const struct backend x11_backend;
+extern const struct backend synthetic_backend;
+#ifdef HAVE_WAYLAND
+extern const struct backend wayland_backend;
+#endif
+
+
+// core.c
+void adjust_offset_value(gint* offset, gint src, gint dst, gint cursor);
+gboolean fix_offset(const struct mirror* m, struct destination* dst, const GdkPoint* cursor);
+gboolean compute_damaged_rect(const struct mirror* m, GdkRectangle* rect);
+
+void transform_matrix(enum transform t, int width, int height, int matrix[6]);
+void transform_size(enum transform t, int width, int height, int* t_width, int* t_height);
+void transform_rect(enum transform t, int width, int height, const GdkRectangle* rect, GdkRectangle* t_rect);
+void transform_point(enum transform t, int width, int height, const GdkPoint* point, GdkPoint* t_point);
+void untransform_point(enum transform t, int width, int height, const GdkPoint* t_point, GdkPoint* point);
+
+// cursor prediction (see core.c)
+#define PREDICTION_SAMPLES	16
+struct predictor {
+	struct prediction_sample {
+		gint64		time;		// µs (monotonic)
+		GdkPoint	location;
+	} samples[PREDICTION_SAMPLES];	// (ring)
+	int n, next;
+};
+void predictor_add(struct predictor* p, gint64 time, const GdkPoint* location);
+gint64 predictor_predict(const struct predictor* p, gint64 now, gint64 delay, GdkPoint* location);
+
+void mosaic_layout(struct mirror* m, int width, int height);
+void mosaic_cell_to_source(const struct source* s, const GdkRectangle* cell_rect, GdkRectangle* src_rect);
+void mosaic_source_to_cell(const struct source* s, const GdkRectangle* src_rect, GdkRectangle* cell_rect);
+gboolean mosaic_map_point(const struct mirror* m, GdkPoint* p);
+
+gboolean focus_crop(struct mirror* m, const GdkRectangle* window_rect);
+
+void     zoom_init(struct mirror* m, int zoom, int width, int height);
+gboolean zoom_set_target(struct mirror* m, const GdkPoint* pointer);
+gboolean zoom_step(struct mirror* m);
+
+int  scheduler_get_min_refresh_period();
+void scheduler_enable(gboolean (*refresh)(struct mirror*, const GdkRectangle*), struct stats* stats);
+void scheduler_disable();
+void scheduler_update_limit();
+void scheduler_flush();
+void scheduler_run_due(guint32 timestamp);
+void scheduler_add_damage(guint32 timestamp, const GdkRectangle* damaged_rect, gboolean more);
+void scheduler_add_mirror_damage(struct mirror* m, guint32 timestamp, const GdkRectangle* damaged_rect, gboolean more);
@@ -0,0 +1,326 @@
+#include "config.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "squint.h"
+
+//
+// Synthetic backend
+//
+// This backend runs without any display server. It generates a
+// deterministic stream of damage events and cursor motions and feeds them
+// into the same scheduler, damage merging and viewport logic as the X11
+// backend (see core.c). The refresh copies the damaged area between two
+// memory buffers to simulate the cost of the copy.
+//
+// The events are timestamped with a simulated clock, which advances by a
+// random interval (from the seeded generator) between two batches, and the
+// delayed refreshes of the rate limiter are run when this clock reaches them
+// (their timeouts are attached to a context that is never iterated). Thus the
+// number of frames and drops only depends on the seed and on --limit; the
+// wall time is reported separately (to measure the cost of the pipeline).
+//
+// With --scale, the source is scaled into a canvas of the size of the
+// destination instead (to measure the cost of the CPU scaler).
+//
+// It is intended for benchmarking and profiling, e.g.:
+//
+//	squint --backend=synthetic --limit=60
+//
+// squint exits after SYNTHETIC_EVENTS damage events and prints the
+// statistics.
+//
+
+#define SYNTHETIC_EVENTS	200000
+#define SYNTHETIC_SEED		42
+#define SYNTHETIC_MAX_BATCH	8	// max number of events in a batch
+#define SYNTHETIC_MAX_INTERVAL	4	// max interval between two batches (ms, simulated)
+// initial value of the simulated clock (ms, the scheduler treats the
+// timestamps below 1 s as wrapped around)
+#define SYNTHETIC_START_TIME	3600000
+
+// virtual monitors (the source is larger than the destination so that the
+// viewport has to follow the cursor)
+static const GdkRectangle synthetic_src_rect = { 1920, 0, 2560, 1440 };
+static const GdkRectangle synthetic_dst_rect = {    0, 0, 1920, 1080 };
+
+static GRand*	rng = NULL;
+static guint	generator = 0;
+static guint	events_left = 0;
+static gint64	start_time = 0;		// wall time (µs)
+static guint32	sim_time = 0;		// simulated clock (ms)
+static GMainContext* sim_context = NULL;	// timeouts of the scheduler (never iterated)
+
+static uint32_t* src_pixels = NULL;	// simulated source screen
+static uint32_t* dst_pixels = NULL;	// simulated pixmap (or scaled image)
+
+// scaling (--scale)
+static struct scaler*	scaler = NULL;
+static GdkRectangle	scaled_rect;	// location of the scaled image in the canvas
+static guint64		scaled_pixels = 0;
+
+static GdkPoint cursor;
+static GdkPoint cursor_pos;	// may be outside the source monitor
+static GdkPoint cursor_speed;
+
+static struct stats stats;
+
+// only one mirror is simulated
+static struct mirror* const mirror = &mirrors[0];
+
+
+gboolean
+synthetic_refresh_image(struct mirror* m, const GdkRectangle* damaged_rect)
+{
+	// location of the damaged area relative to the source rect
+	GdkRectangle r = {
+		damaged_rect->x - m->src_rect.x,
+		damaged_rect->y - m->src_rect.y,
+		damaged_rect->width, damaged_rect->height,
+	};
+	int i;
+
+	if (scaler)
+	{
+		const GdkRectangle src_area = r;
+		scaler_map_area(scaler, &src_area, &r);
+		scaler_run(scaler, src_pixels, m->src_rect.width * sizeof(*src_pixels),
+			dst_pixels + scaled_rect.y * synthetic_dst_rect.width + scaled_rect.x,
+			synthetic_dst_rect.width * sizeof(*dst_pixels), &r, 1);
+		r.x += scaled_rect.x;
+		r.y += scaled_rect.y;
+		scaled_pixels += r.width * r.height;
+	} else {
+		for (i=0 ; i<r.height ; i++)
+		{
+			size_t pos = (size_t)(r.y + i) * m->src_rect.width + r.x;
+			memcpy(dst_pixels + pos, src_pixels + pos,
+					r.width * sizeof(*dst_pixels));
+		}
+	}
+
+	record_damage(r.x, r.y, r.width, r.height);
+	export_damage(r.x, r.y, r.width, r.height);
+
+	STATS_ADD(stats.frames, 1);
+	squint_first_frame();
+	STATS_ADD(stats.pixels, damaged_rect->width * damaged_rect->height);
+	return TRUE;
+}
+
+// move the cursor along a deterministic path that bounces on the edges of
+// the source monitor (and goes slightly outside so that the off-screen case
+// is exercised too)
+void
+synthetic_move_cursor()
+{
+	GdkPoint* pos = &cursor_pos;
+	const int margin = 64;
+
+	pos->x += cursor_speed.x;
+	pos->y += cursor_speed.y;
+	if ((pos->x < -margin) || (pos->x >= mirror->src_rect.width + margin)) {
+		cursor_speed.x = -cursor_speed.x;
+		pos->x += 2*cursor_speed.x;
+	}
+	if ((pos->y < -margin) || (pos->y >= mirror->src_rect.height + margin)) {
+		cursor_speed.y = -cursor_speed.y;
+		pos->y += 2*cursor_speed.y;
+	}
+
+	if ((pos->x<0) | (pos->y<0) | (pos->x>=mirror->src_rect.width) | (pos->y>=mirror->src_rect.height)) {
+		cursor.x = cursor.y = -1;
+	} else {
+		cursor = *pos;
+	}
+
+	fix_offset(mirror, &mirror->destinations[0], &cursor);
+}
+
+// generate a damaged rectangle (in root coordinates)
+//
+// the rectangles are spread over the source and destination monitors (to
+// exercise the filtering in compute_damaged_rect()) and their size mimics a
+// typical desktop session: mostly small updates (text, cursor blinks) with
+// some larger ones (scrolling, videos) and a few full-screen repaints
+void
+synthetic_generate_rect(GdkRectangle* r)
+{
+	GdkRectangle area;
+	gdk_rectangle_union(&mirror->src_rect, &mirror->destinations[0].rect, &area);
+
+	int kind = g_rand_int_range(rng, 0, 100);
+	if (kind < 70) {
+		r->width  = g_rand_int_range(rng, 8, 64);
+		r->height = g_rand_int_range(rng, 8, 32);
+	} else if (kind < 97) {
+		r->width  = g_rand_int_range(rng, 100, 800);
+		r->height = g_rand_int_range(rng, 100, 600);
+	} else {
+		*r = mirror->src_rect;
+		return;
+	}
+	r->x = area.x + g_rand_int_range(rng, 0, area.width  - r->width);
+	r->y = area.y + g_rand_int_range(rng, 0, area.height - r->height);
+}
+
+void
+synthetic_print_stats()
+{
+	double s = (sim_time - SYNTHETIC_START_TIME) / 1e3;
+	double wall = (double)(g_get_monotonic_time() - start_time) / G_USEC_PER_SEC;
+
+	// simulated (deterministic)
+	printf("synthetic: %u events in %.3f s simulated (%.0f events/s)\n",
+			stats.events, s, stats.events / s);
+	printf("synthetic: %u frames (%.1f fps), %.1f Mpx copied, %u drops\n",
+			stats.frames, stats.frames / s,
+			stats.pixels / 1e6, stats.drops);
+
+	// measured
+	printf("synthetic: %.3f s wall time (%.0f events/s, %.1f Mpx/s copied)\n",
+			wall, stats.events / wall, stats.pixels / wall / 1e6);
+	if (scaler) {
+		printf("synthetic: %.1f Mpx scaled (%.1f Mpx/s)\n",
+				scaled_pixels / 1e6, scaled_pixels / wall / 1e6);
+	}
+}
+
+gboolean
+synthetic_generate(gpointer data)
+{
+	g_main_context_push_thread_default(sim_context);
+
+	if (!events_left) {
+		// last delayed refresh
+		scheduler_flush();
+		g_main_context_pop_thread_default(sim_context);
+
+		generator = 0;
+		synthetic_print_stats();
+		squint_quit();
+		return G_SOURCE_REMOVE;
+	}
+
+	sim_time += g_rand_int_range(rng, 0, SYNTHETIC_MAX_INTERVAL + 1);
+	scheduler_run_due(sim_time);
+
+	synthetic_move_cursor();
+
+	int n = g_rand_int_range(rng, 1, SYNTHETIC_MAX_BATCH + 1);
+	while (n-- && events_left)
+	{
+		GdkRectangle r;
+		synthetic_generate_rect(&r);
+		events_left--;
+		scheduler_add_damage(sim_time, &r, n && events_left);
+	}
+
+	g_main_context_pop_thread_default(sim_context);
+	return G_SOURCE_CONTINUE;
+}
+
+gboolean
+synthetic_init()
+{
+	return TRUE;
+}
+
+gboolean
+synthetic_enable()
+{
+	memset(mirrors, 0, sizeof(mirrors));
+	mirror->src_rect = synthetic_src_rect;
+	mirror->destinations[0].rect = synthetic_dst_rect;
+	mirror->n_destinations = 1;
+	n_mirrors = 1;
+
+	size_t i, len = (size_t)synthetic_src_rect.width * synthetic_src_rect.height;
+
+	// size of the canvas (the destination if the source is scaled)
+	GdkRectangle canvas = { 0, 0, synthetic_src_rect.width, synthetic_src_rect.height };
+	if (config.scale_filter)
+	{
+		canvas.width  = synthetic_dst_rect.width;
+		canvas.height = synthetic_dst_rect.height;
+		scaler_fit(synthetic_src_rect.width, synthetic_src_rect.height,
+				canvas.width, canvas.height, &scaled_rect);
+		scaler = scaler_new(config.scale_filter, synthetic_src_rect.width, synthetic_src_rect.height,
+				scaled_rect.width, scaled_rect.height);
+		scaled_pixels = 0;
+	}
+
+	memset(&stats, 0, sizeof(stats));
+	rng = g_rand_new_with_seed(SYNTHETIC_SEED);
+
+	src_pixels = g_new(uint32_t, len);
+	dst_pixels = g_new0(uint32_t, (size_t)canvas.width * canvas.height);
+	for (i=0 ; i<len ; i++) {
+		src_pixels[i] = (uint32_t)(i * 2654435761u);
+	}
+
+	cursor.x = cursor.y = -1;
+	cursor_pos.x = cursor_pos.y = 0;
+	cursor_speed.x = 7;
+	cursor_speed.y = 3;
+
+	scheduler_enable(synthetic_refresh_image, &stats);
+	record_start(dst_pixels, canvas.width, canvas.height, canvas.width * sizeof(*dst_pixels));
+	export_start(dst_pixels, canvas.width, canvas.height, canvas.width * sizeof(*dst_pixels));
+
+	events_left = SYNTHETIC_EVENTS;
+	start_time  = g_get_monotonic_time();
+	sim_time    = SYNTHETIC_START_TIME;
+	sim_context = g_main_context_new();
+	generator   = g_idle_add(synthetic_generate, NULL);
+	return TRUE;
+}
+
+void
+synthetic_disable()
+{
+	if (generator) {
+		g_source_remove(generator);
+		generator = 0;
+	}
+	scheduler_disable();
+	if (sim_context) {
+		g_main_context_unref(sim_context);
+		sim_context = NULL;
+	}
+	record_stop();
+	export_stop();
+
+	g_free(src_pixels);
+	g_free(dst_pixels);
+	src_pixels = dst_pixels = NULL;
+	scaler_free(scaler);
+	scaler = NULL;
+
+	g_rand_free(rng);
+	rng = NULL;
+}
+
+guint
+synthetic_capabilities()
+{
+	return BACKEND_CAP_DAMAGE | BACKEND_CAP_CURSOR_TRACKING;
+}
+
+const struct stats*
+synthetic_stats()
+{
+	return &stats;
+}
+
+const struct backend synthetic_backend = {
+	.name		= "synthetic",
+	.uses_gtk	= FALSE,
+	.init		= synthetic_init,
+	.enable		= synthetic_enable,
+	.disable	= synthetic_disable,
+	.capabilities	= synthetic_capabilities,
+	.stats		= synthetic_stats,
+};
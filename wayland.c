@@ -0,0 +1,1040 @@
+#define _GNU_SOURCE
+#include "config.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <glib-unix.h>
+#include <wayland-client.h>
+
+#include "squint.h"
+
+#include "wlr-screencopy-unstable-v1-client-protocol.h"
+#include "xdg-shell-client-protocol.h"
+
+//
+// Wayland backend
+//
+// The source output is captured with the wlr-screencopy protocol (into a
+// shm buffer, using copy_with_damage so that the compositor reports only the
+// damaged areas) and presented into a xdg_toplevel on the destination
+// output. Only the damaged regions are copied and committed.
+//
+// With --scale, the image is scaled to fit the window by the CPU scaler (see
+// scale.c) instead of following the pointer.
+//
+// This backend does not use GTK, the wayland socket is polled directly from
+// the glib main loop.
+//
+// It can be tested without any GPU or physical display with a headless
+// wlroots compositor, e.g.:
+//
+//	WLR_BACKENDS=headless WLR_HEADLESS_OUTPUTS=2 sway
+//	WAYLAND_DISPLAY=wayland-1 squint --backend=wayland HEADLESS-1 HEADLESS-2
+//
+
+#define WAYLAND_MAX_OUTPUTS	16
+#define WAYLAND_MAX_DAMAGES	64	// per captured frame
+
+struct wayland_output {
+	struct wl_output* output;
+	uint32_t global_name;
+	char* name;		// connector name (eg: HDMI-A-1), needs wl_output v4
+	char* model;
+	GdkRectangle rect;	// x,y from the geometry event, size from the current mode
+};
+
+struct wayland_buffer {
+	struct wl_buffer* buffer;
+	void* data;
+	size_t size;
+	int width, height, stride;
+	uint32_t format;
+	gboolean busy;		// held by the compositor
+	GdkRectangle pending;	// area to be redrawn before the next commit
+};
+
+static struct wl_display*	display = NULL;
+static struct wl_registry*	registry = NULL;
+static struct wl_compositor*	compositor = NULL;
+static struct wl_shm*		shm = NULL;
+static struct xdg_wm_base*	wm_base = NULL;
+static struct zwlr_screencopy_manager_v1* screencopy = NULL;
+static uint32_t			screencopy_version = 0;
+static GSource*			display_source = NULL;
+
+static struct wayland_output	outputs[WAYLAND_MAX_OUTPUTS];
+static int			n_outputs = 0;
+static struct wayland_output*	src_output = NULL;
+static struct wayland_output*	dst_output = NULL;
+
+// capture (double-buffered: the compositor writes the next frame into
+// *capture while the presentation reads the last ready one from *captured)
+static struct zwlr_screencopy_frame_v1* frame = NULL;
+static struct wayland_buffer	captures[2];
+static struct wayland_buffer*	capture  = &captures[0];
+static struct wayland_buffer*	captured = &captures[1];
+static gboolean			capture_y_invert = FALSE;
+static gboolean			captured_y_invert = FALSE;
+static gboolean			capture_full = TRUE;	// next frame must be fully refreshed
+static GdkRectangle		frame_damages[WAYLAND_MAX_DAMAGES];
+static int			n_frame_damages = 0;
+static guint			capture_timeout = 0;
+
+// presentation
+static struct wl_surface*	surface = NULL;
+static struct xdg_surface*	xdg_surface = NULL;
+static struct xdg_toplevel*	toplevel = NULL;
+static struct wl_callback*	frame_callback = NULL;
+static struct wayland_buffer	present[2];
+static gboolean			configured = FALSE;
+
+// scaling (--scale)
+static struct scaler*		scaler = NULL;
+static GdkRectangle		scaled_rect;	// location of the scaled image in the window
+
+// only one mirror with one destination is supported by this backend
+static struct mirror* const	mirror = &mirrors[0];
+static struct destination* const dst = &mirrors[0].destinations[0];
+
+static struct stats stats;
+
+void wayland_capture_frame();
+void wayland_redraw();
+void wayland_update_scaler();
+
+
+//
+// shm buffers
+//
+
+gboolean
+wayland_buffer_create(struct wayland_buffer* buf, int width, int height, int stride, uint32_t format)
+{
+	memset(buf, 0, sizeof(*buf));
+	buf->width  = width;
+	buf->height = height;
+	buf->stride = stride;
+	buf->format = format;
+	buf->size   = (size_t)stride * height;
+
+	int fd = memfd_create("squint", MFD_CLOEXEC);
+	if (fd < 0) {
+		squint_error("memfd_create() failed");
+		return FALSE;
+	}
+	if (ftruncate(fd, buf->size) < 0) {
+		squint_error("ftruncate() failed");
+		close(fd);
+		return FALSE;
+	}
+	buf->data = mmap(NULL, buf->size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	if (buf->data == MAP_FAILED) {
+		squint_error("mmap() failed");
+		buf->data = NULL;
+		close(fd);
+		return FALSE;
+	}
+
+	struct wl_shm_pool* pool = wl_shm_create_pool(shm, fd, buf->size);
+	buf->buffer = wl_shm_pool_create_buffer(pool, 0, width, height, stride, format);
+	wl_shm_pool_destroy(pool);
+	close(fd);
+	return TRUE;
+}
+
+void
+wayland_buffer_destroy(struct wayland_buffer* buf)
+{
+	if (buf->buffer) {
+		wl_buffer_destroy(buf->buffer);
+	}
+	if (buf->data) {
+		munmap(buf->data, buf->size);
+	}
+	memset(buf, 0, sizeof(*buf));
+}
+
+void
+wayland_add_pending(struct wayland_buffer* buf, const GdkRectangle* rect)
+{
+	GdkRectangle bounds = { 0, 0, buf->width, buf->height };
+	GdkRectangle r;
+	if (!gdk_rectangle_intersect(rect, &bounds, &r)) {
+		return;
+	}
+
+	if (buf->pending.width == 0) {
+		buf->pending = r;
+	} else {
+		gdk_rectangle_union(&r, &buf->pending, &buf->pending);
+	}
+}
+
+
+//
+// presentation
+//
+
+void
+on_buffer_release(void* data, struct wl_buffer* wl_buffer)
+{
+	struct wayland_buffer* buf = data;
+	buf->busy = FALSE;
+
+	wayland_redraw();
+}
+
+static const struct wl_buffer_listener buffer_listener = {
+	.release = on_buffer_release,
+};
+
+// (re)create the scaler when the size of the captured frame or of the window
+// has changed (--scale)
+//
+// the image is scaled to fit the window instead of following the pointer
+void
+wayland_update_scaler()
+{
+	GdkRectangle r;
+
+	if (!config.scale_filter || !captured->data || !present[0].data) {
+		return;
+	}
+
+	scaler_fit(captured->width, captured->height, present[0].width, present[0].height, &r);
+	dst->offset.x = r.x;
+	dst->offset.y = r.y;
+	if (scaler && gdk_rectangle_equal(&r, &scaled_rect)) {
+		return;
+	}
+
+	scaler_free(scaler);
+	scaler = scaler_new(config.scale_filter, captured->width, captured->height, r.width, r.height);
+	scaled_rect = r;
+
+	// the whole window must be redrawn
+	GdkRectangle all = { 0, 0, present[0].width, present[0].height };
+	wayland_add_pending(&present[0], &all);
+	wayland_add_pending(&present[1], &all);
+}
+
+// (re)create the presentation buffers
+void
+wayland_resize(int width, int height)
+{
+	int i;
+	for (i=0 ; i<2 ; i++)
+	{
+		wayland_buffer_destroy(&present[i]);
+		if (!wayland_buffer_create(&present[i], width, height, width*4, WL_SHM_FORMAT_XRGB8888)) {
+			return;
+		}
+		wl_buffer_add_listener(present[i].buffer, &buffer_listener, &present[i]);
+		present[i].pending = (GdkRectangle){0, 0, width, height};
+	}
+
+	dst->rect.width  = width;
+	dst->rect.height = height;
+	dst->offset.x = dst->offset.y = 0;
+	GdkPoint cursor = {-1, -1};
+	fix_offset(mirror, dst, &cursor);
+
+	wayland_update_scaler();
+}
+
+void
+on_frame_done(void* data, struct wl_callback* callback, uint32_t time)
+{
+	wl_callback_destroy(callback);
+	frame_callback = NULL;
+
+	wayland_redraw();
+}
+
+static const struct wl_callback_listener frame_listener = {
+	.done = on_frame_done,
+};
+
+// copy the pending area of a presentation buffer from the last captured frame
+void
+wayland_copy_pending(struct wayland_buffer* buf)
+{
+	GdkRectangle r = buf->pending;
+	GdkRectangle visible = { dst->offset.x, dst->offset.y, captured->width, captured->height };
+	int y;
+
+	// (the rows are read within the captured frame, whatever its size)
+	if (scaler) {
+		visible = scaled_rect;
+	}
+
+	// clear the area outside the source image
+	for (y=r.y ; y<r.y+r.height ; y++) {
+		memset((char*)buf->data + y*buf->stride + r.x*4, 0, r.width*4);
+	}
+
+	if (!captured->data || !gdk_rectangle_intersect(&r, &visible, &r)) {
+		return;
+	}
+
+	if (scaler)
+	{
+		const char* src = captured->data;
+		int src_stride = captured->stride;
+		if (captured_y_invert) {
+			src += (captured->height - 1) * src_stride;
+			src_stride = -src_stride;
+		}
+		r.x -= scaled_rect.x;
+		r.y -= scaled_rect.y;
+		scaler_run(scaler, src, src_stride,
+			(char*)buf->data + scaled_rect.y*buf->stride + scaled_rect.x*4, buf->stride,
+			&r, 1);
+		return;
+	}
+
+	for (y=r.y ; y<r.y+r.height ; y++)
+	{
+		int sy = y - dst->offset.y;
+		if (captured_y_invert) {
+			sy = captured->height - 1 - sy;
+		}
+		memcpy((char*)buf->data + y*buf->stride + r.x*4,
+			(char*)captured->data + sy*captured->stride + (r.x - dst->offset.x)*4,
+			r.width*4);
+	}
+}
+
+void
+wayland_redraw()
+{
+	if (!configured || frame_callback) {
+		// wait for the next frame callback
+		return;
+	}
+
+	struct wayland_buffer* buf = present[0].busy ? &present[1] : &present[0];
+	if (buf->busy || !buf->buffer || (buf->pending.width == 0)) {
+		return;
+	}
+
+	wayland_copy_pending(buf);
+
+	wl_surface_attach(surface, buf->buffer, 0, 0);
+	wl_surface_damage_buffer(surface, buf->pending.x, buf->pending.y,
+			buf->pending.width, buf->pending.height);
+	buf->pending.width = 0;
+	buf->busy = TRUE;
+
+	frame_callback = wl_surface_frame(surface);
+	wl_callback_add_listener(frame_callback, &frame_listener, NULL);
+	wl_surface_commit(surface);
+	wl_display_flush(display);
+}
+
+gboolean
+wayland_refresh_image(struct mirror* m, const GdkRectangle* damaged_rect)
+{
+	// location of the damaged area inside the window
+	GdkRectangle r = {
+		damaged_rect->x - m->src_rect.x + dst->offset.x,
+		damaged_rect->y - m->src_rect.y + dst->offset.y,
+		damaged_rect->width, damaged_rect->height,
+	};
+
+	if (scaler)
+	{
+		// destination pixels depending on the damaged area
+		GdkRectangle src_area = {
+			damaged_rect->x - m->src_rect.x,
+			damaged_rect->y - m->src_rect.y,
+			damaged_rect->width, damaged_rect->height,
+		};
+		scaler_map_area(scaler, &src_area, &r);
+		r.x += scaled_rect.x;
+		r.y += scaled_rect.y;
+	}
+
+	// both buffers are outdated
+	wayland_add_pending(&present[0], &r);
+	wayland_add_pending(&present[1], &r);
+
+	wayland_redraw();
+
+	STATS_ADD(stats.frames, 1);
+	squint_first_frame();
+	STATS_ADD(stats.pixels, damaged_rect->width * damaged_rect->height);
+	return TRUE;
+}
+
+void
+on_xdg_wm_base_ping(void* data, struct xdg_wm_base* base, uint32_t serial)
+{
+	xdg_wm_base_pong(base, serial);
+}
+
+static const struct xdg_wm_base_listener wm_base_listener = {
+	.ping = on_xdg_wm_base_ping,
+};
+
+void
+on_xdg_surface_configure(void* data, struct xdg_surface* surf, uint32_t serial)
+{
+	xdg_surface_ack_configure(surf, serial);
+	configured = TRUE;
+	wayland_redraw();
+}
+
+static const struct xdg_surface_listener xdg_surface_listener = {
+	.configure = on_xdg_surface_configure,
+};
+
+void
+on_toplevel_configure(void* data, struct xdg_toplevel* tl, int32_t width, int32_t height, struct wl_array* states)
+{
+	if ((width == 0) || (height == 0)) {
+		// we are free to choose the size
+		if (present[0].buffer) {
+			return;
+		}
+		width  = MIN(mirror->src_rect.width,  dst_output->rect.width  - 100);
+		height = MIN(mirror->src_rect.height, dst_output->rect.height - 100);
+	}
+	if ((width != present[0].width) || (height != present[0].height)) {
+		wayland_resize(width, height);
+	}
+}
+
+void
+on_toplevel_close(void* data, struct xdg_toplevel* tl)
+{
+	squint_quit();
+}
+
+static const struct xdg_toplevel_listener toplevel_listener = {
+	.configure = on_toplevel_configure,
+	.close     = on_toplevel_close,
+};
+
+
+//
+// capture
+//
+
+gboolean
+wayland_capture_timeout(gpointer data)
+{
+	capture_timeout = 0;
+	wayland_capture_frame();
+	return G_SOURCE_REMOVE;
+}
+
+void
+wayland_capture_copy()
+{
+	if (screencopy_version >= 2) {
+		// the compositor waits until the output is damaged
+		zwlr_screencopy_frame_v1_copy_with_damage(frame, capture->buffer);
+	} else {
+		zwlr_screencopy_frame_v1_copy(frame, capture->buffer);
+	}
+	wl_display_flush(display);
+}
+
+void
+on_frame_buffer(void* data, struct zwlr_screencopy_frame_v1* f,
+		uint32_t format, uint32_t width, uint32_t height, uint32_t stride)
+{
+	if ((format != WL_SHM_FORMAT_XRGB8888) && (format != WL_SHM_FORMAT_ARGB8888)) {
+		// unsupported format (the compositor may propose another one)
+		return;
+	}
+
+	if (!capture->buffer
+		|| (capture->format != format) || (capture->width != width)
+		|| (capture->height != height) || (capture->stride != stride))
+	{
+		// (the scaler is updated when this frame is ready)
+		wayland_buffer_destroy(capture);
+		if (!wayland_buffer_create(capture, width, height, stride, format)) {
+			return;
+		}
+		capture_full = TRUE;
+	}
+
+	if (screencopy_version < 3) {
+		// no buffer_done event in this version
+		wayland_capture_copy();
+	}
+}
+
+void
+on_frame_buffer_done(void* data, struct zwlr_screencopy_frame_v1* f)
+{
+	if (capture->buffer) {
+		wayland_capture_copy();
+	} else {
+		squint_error("The wayland compositor does not propose any supported pixel format");
+		squint_quit();
+	}
+}
+
+void
+on_frame_linux_dmabuf(void* data, struct zwlr_screencopy_frame_v1* f,
+		uint32_t format, uint32_t width, uint32_t height)
+{
+	// not supported (we use shm buffers)
+}
+
+void
+on_frame_flags(void* data, struct zwlr_screencopy_frame_v1* f, uint32_t flags)
+{
+	capture_y_invert = (flags & ZWLR_SCREENCOPY_FRAME_V1_FLAGS_Y_INVERT) != 0;
+}
+
+void
+on_frame_damage(void* data, struct zwlr_screencopy_frame_v1* f,
+		uint32_t x, uint32_t y, uint32_t width, uint32_t height)
+{
+	if (n_frame_damages < WAYLAND_MAX_DAMAGES) {
+		// in buffer coordinates (converted in on_frame_ready())
+		frame_damages[n_frame_damages++] = (GdkRectangle){ x, y, width, height };
+	} else {
+		// too many damages, refresh the whole frame
+		capture_full = TRUE;
+	}
+}
+
+void
+on_frame_ready(void* data, struct zwlr_screencopy_frame_v1* f,
+		uint32_t tv_sec_hi, uint32_t tv_sec_lo, uint32_t tv_nsec)
+{
+	guint32 timestamp = (guint64)tv_sec_lo * 1000 + tv_nsec / 1000000;
+	int i;
+
+	// the new frame is presented from now on, the compositor will write the
+	// next one into the other buffer (the pending areas of the presentation
+	// buffers are not copied yet and must not change under their feet)
+	struct wayland_buffer* previous = captured;
+	captured = capture;
+	capture  = previous;
+	captured_y_invert = capture_y_invert;
+
+	if ((captured->width != previous->width) || (captured->height != previous->height))
+	{
+		// the source follows the size of the capture (eg: mode switch)
+		mirror->src_rect.width  = captured->width;
+		mirror->src_rect.height = captured->height;
+
+		// (the weights depend on the size of the capture)
+		scaler_free(scaler);
+		scaler = NULL;
+		wayland_update_scaler();
+		if (!scaler)
+		{
+			GdkPoint cursor = {-1, -1};
+			GdkRectangle all = { 0, 0, present[0].width, present[0].height };
+			fix_offset(mirror, dst, &cursor);
+			wayland_add_pending(&present[0], &all);
+			wayland_add_pending(&present[1], &all);
+		}
+	}
+
+	if (capture_full || (n_frame_damages == 0)) {
+		// wlr-screencopy v1 does not report damages
+		frame_damages[0] = (GdkRectangle){ 0, 0, captured->width, captured->height };
+		n_frame_damages = 1;
+		capture_full = FALSE;
+	}
+	for (i=0 ; i<n_frame_damages ; i++)
+	{
+		GdkRectangle r = frame_damages[i];
+		if (captured_y_invert) {
+			r.y = captured->height - r.y - r.height;
+		}
+		r.x += mirror->src_rect.x;
+		r.y += mirror->src_rect.y;
+		scheduler_add_damage(timestamp, &r, i < n_frame_damages-1);
+	}
+
+	zwlr_screencopy_frame_v1_destroy(frame);
+	frame = NULL;
+
+	if (screencopy_version >= 2) {
+		wayland_capture_frame();
+	} else {
+		// poll at the max refresh rate
+		capture_timeout = g_timeout_add(MAX(scheduler_get_min_refresh_period(), 10),
+				wayland_capture_timeout, NULL);
+	}
+}
+
+void
+on_frame_failed(void* data, struct zwlr_screencopy_frame_v1* f)
+{
+	zwlr_screencopy_frame_v1_destroy(frame);
+	frame = NULL;
+
+	// the output may have been reconfigured, retry later
+	capture_full = TRUE;
+	capture_timeout = g_timeout_add(1000, wayland_capture_timeout, NULL);
+}
+
+static const struct zwlr_screencopy_frame_v1_listener frame_capture_listener = {
+	.buffer       = on_frame_buffer,
+	.flags        = on_frame_flags,
+	.ready        = on_frame_ready,
+	.failed       = on_frame_failed,
+	.damage       = on_frame_damage,
+	.linux_dmabuf = on_frame_linux_dmabuf,
+	.buffer_done  = on_frame_buffer_done,
+};
+
+void
+wayland_capture_frame()
+{
+	n_frame_damages = 0;
+	frame = zwlr_screencopy_manager_v1_capture_output(screencopy, TRUE, src_output->output);
+	zwlr_screencopy_frame_v1_add_listener(frame, &frame_capture_listener, NULL);
+	wl_display_flush(display);
+}
+
+
+//
+// outputs
+//
+
+void
+on_output_geometry(void* data, struct wl_output* o, int32_t x, int32_t y,
+		int32_t physical_width, int32_t physical_height, int32_t subpixel,
+		const char* make, const char* model, int32_t transform)
+{
+	struct wayland_output* out = data;
+	out->rect.x = x;
+	out->rect.y = y;
+	g_free(out->model);
+	out->model = g_strdup(model);
+}
+
+void
+on_output_mode(void* data, struct wl_output* o, uint32_t flags,
+		int32_t width, int32_t height, int32_t refresh)
+{
+	struct wayland_output* out = data;
+	if (flags & WL_OUTPUT_MODE_CURRENT) {
+		out->rect.width  = width;
+		out->rect.height = height;
+	}
+}
+
+void
+on_output_done(void* data, struct wl_output* o)
+{
+}
+
+void
+on_output_scale(void* data, struct wl_output* o, int32_t factor)
+{
+}
+
+void
+on_output_name(void* data, struct wl_output* o, const char* name)
+{
+	struct wayland_output* out = data;
+	g_free(out->name);
+	out->name = g_strdup(name);
+}
+
+void
+on_output_description(void* data, struct wl_output* o, const char* description)
+{
+}
+
+static const struct wl_output_listener output_listener = {
+	.geometry    = on_output_geometry,
+	.mode        = on_output_mode,
+	.done        = on_output_done,
+	.scale       = on_output_scale,
+	.name        = on_output_name,
+	.description = on_output_description,
+};
+
+struct wayland_output*
+wayland_find_output(const char* name)
+{
+	int i;
+	for (i=0 ; i<n_outputs ; i++)
+	{
+		if (	   (outputs[i].name  && !strcmp(outputs[i].name,  name))
+			|| (outputs[i].model && !strcmp(outputs[i].model, name)))
+		{
+			return &outputs[i];
+		}
+	}
+
+	char buff[128];
+	g_snprintf(buff, 128, "Monitor %s is not active", name);
+	squint_error(buff);
+	return NULL;
+}
+
+// same policy as select_monitors() in the X11 case
+gboolean
+wayland_select_outputs()
+{
+	int i;
+	src_output = dst_output = NULL;
+
+	// only the first mirror and its first destination monitor are used
+	const struct mirror_config* mc = &config.mirrors[0];
+
+	if (mc->capture_window || mc->source_display) {
+		squint_error("The window capture and the cross-display source are not supported by the wayland backend");
+		return FALSE;
+	}
+	if (config.opt_follow_focus || config.opt_zoom) {
+		squint_error("The follow-focus and magnifier modes are not supported by the wayland backend");
+		return FALSE;
+	}
+	if (config.opt_gl) {
+		squint_error("The OpenGL presenter is not supported by the wayland backend");
+		return FALSE;
+	}
+	if (config.transform || (mc->n_dst_monitor_names && mc->dst_transforms[0])) {
+		squint_error("The transforms are not supported by the wayland backend");
+		return FALSE;
+	}
+	if (config.opt_record || config.opt_export || config.opt_headless) {
+		squint_error("The recording, the export and the headless mode are not supported by the wayland backend");
+		return FALSE;
+	}
+
+	if ((n_outputs < 2) && !mc->src_monitor_name) {
+		squint_error("There is only one monitor. What am I supposed to do?");
+		return FALSE;
+	}
+
+	if (mc->src_monitor_name
+		&& !(src_output = wayland_find_output(mc->src_monitor_name))) {
+		return FALSE;
+	}
+	if (mc->n_dst_monitor_names
+		&& !(dst_output = wayland_find_output(mc->dst_monitor_names[0]))) {
+		return FALSE;
+	}
+
+	// source: rightmost output
+	for (i=0 ; !src_output && (i<n_outputs) ; i++) {
+		if (&outputs[i] == dst_output) {
+			continue;
+		}
+		GdkRectangle* r = &outputs[i].rect;
+		if (!src_output || (r->x+r->width > src_output->rect.x+src_output->rect.width)) {
+			src_output = &outputs[i];
+		}
+	}
+	// destination: first unused output
+	for (i=0 ; !dst_output && (i<n_outputs) ; i++) {
+		if (&outputs[i] != src_output) {
+			dst_output = &outputs[i];
+		}
+	}
+
+	if (!src_output || !dst_output || (src_output == dst_output)) {
+		squint_error("Could not find any monitor to be cloned");
+		return FALSE;
+	}
+
+	// The capture and the presentation use different coordinate spaces.
+	// The destination is moved next to the source so that
+	// compute_damaged_rect() never discards any damage.
+	memset(mirrors, 0, sizeof(mirrors));
+	mirror->src_rect = (GdkRectangle){ 0, 0, src_output->rect.width, src_output->rect.height };
+	dst->rect = (GdkRectangle){ mirror->src_rect.width, 0, dst_output->rect.width, dst_output->rect.height };
+	mirror->n_destinations = 1;
+	n_mirrors = 1;
+	return TRUE;
+}
+
+
+//
+// registry
+//
+
+void
+on_registry_global(void* data, struct wl_registry* reg, uint32_t name,
+		const char* interface, uint32_t version)
+{
+	if (!strcmp(interface, wl_compositor_interface.name)) {
+		if (version >= 4) {
+			// wl_surface.damage_buffer needs version 4
+			compositor = wl_registry_bind(reg, name, &wl_compositor_interface, 4);
+		}
+	} else if (!strcmp(interface, wl_shm_interface.name)) {
+		shm = wl_registry_bind(reg, name, &wl_shm_interface, 1);
+	} else if (!strcmp(interface, xdg_wm_base_interface.name)) {
+		wm_base = wl_registry_bind(reg, name, &xdg_wm_base_interface, 1);
+		xdg_wm_base_add_listener(wm_base, &wm_base_listener, NULL);
+	} else if (!strcmp(interface, zwlr_screencopy_manager_v1_interface.name)) {
+		screencopy_version = MIN(version, 3);
+		screencopy = wl_registry_bind(reg, name,
+				&zwlr_screencopy_manager_v1_interface, screencopy_version);
+	} else if (!strcmp(interface, wl_output_interface.name)) {
+		if (n_outputs < WAYLAND_MAX_OUTPUTS) {
+			struct wayland_output* out = &outputs[n_outputs++];
+			memset(out, 0, sizeof(*out));
+			out->global_name = name;
+			out->output = wl_registry_bind(reg, name, &wl_output_interface, MIN(version, 4));
+			wl_output_add_listener(out->output, &output_listener, out);
+		}
+	}
+}
+
+void
+on_registry_global_remove(void* data, struct wl_registry* reg, uint32_t name)
+{
+	int i;
+	for (i=0 ; i<n_outputs ; i++)
+	{
+		if (outputs[i].global_name == name)
+		{
+			if (enabled && ((&outputs[i] == src_output) || (&outputs[i] == dst_output))) {
+				squint_error("The monitor was disconnected");
+				squint_quit();
+			}
+			wl_output_destroy(outputs[i].output);
+			g_free(outputs[i].name);
+			g_free(outputs[i].model);
+			outputs[i] = outputs[--n_outputs];
+			return;
+		}
+	}
+}
+
+static const struct wl_registry_listener registry_listener = {
+	.global        = on_registry_global,
+	.global_remove = on_registry_global_remove,
+};
+
+// source of the main loop reading the wayland connection
+//
+// With a plain fd watch, the events already queued by libwayland would wait
+// for the next wakeup of poll(), and wl_display_dispatch() could block in
+// read(). The events are read with the wl_display_prepare_read() protocol
+// around poll() and dispatched with wl_display_dispatch_pending().
+struct wayland_source {
+	GSource		source;
+	gpointer	fd_tag;
+	gboolean	reading;	// wl_display_prepare_read() succeeded
+	gboolean	lost;		// the connection is broken
+};
+
+gboolean
+wayland_source_prepare(GSource* source, gint* timeout)
+{
+	struct wayland_source* ws = (struct wayland_source*) source;
+	*timeout = -1;
+
+	if (!ws->reading)
+	{
+		if (wl_display_prepare_read(display) != 0) {
+			// some events are already queued
+			return TRUE;
+		}
+		ws->reading = TRUE;
+	}
+	if ((wl_display_flush(display) < 0) && (errno != EAGAIN)) {
+		ws->lost = TRUE;
+		return TRUE;
+	}
+	return FALSE;
+}
+
+gboolean
+wayland_source_check(GSource* source)
+{
+	struct wayland_source* ws = (struct wayland_source*) source;
+	GIOCondition revents = g_source_query_unix_fd(source, ws->fd_tag);
+
+	if (ws->reading)
+	{
+		ws->reading = FALSE;
+		if (revents & G_IO_IN) {
+			if (wl_display_read_events(display) < 0) {
+				ws->lost = TRUE;
+			}
+		} else {
+			wl_display_cancel_read(display);
+		}
+	}
+	return ws->lost || (revents & (G_IO_IN|G_IO_ERR|G_IO_HUP));
+}
+
+gboolean
+wayland_source_dispatch(GSource* source, GSourceFunc callback, gpointer data)
+{
+	struct wayland_source* ws = (struct wayland_source*) source;
+
+	if (ws->reading) {
+		// (events were queued in prepare())
+		ws->reading = FALSE;
+		wl_display_cancel_read(display);
+	}
+	if (ws->lost || (wl_display_dispatch_pending(display) < 0)
+		|| (g_source_query_unix_fd(source, ws->fd_tag) & (G_IO_ERR|G_IO_HUP)))
+	{
+		squint_error("Lost the connection to the wayland compositor");
+		display_source = NULL;
+		squint_quit();
+		return G_SOURCE_REMOVE;
+	}
+	wl_display_flush(display);
+	return G_SOURCE_CONTINUE;
+}
+
+void
+wayland_source_finalize(GSource* source)
+{
+	struct wayland_source* ws = (struct wayland_source*) source;
+	if (ws->reading) {
+		wl_display_cancel_read(display);
+	}
+}
+
+static GSourceFuncs wayland_source_funcs = {
+	.prepare  = wayland_source_prepare,
+	.check    = wayland_source_check,
+	.dispatch = wayland_source_dispatch,
+	.finalize = wayland_source_finalize,
+};
+
+gboolean
+wayland_init()
+{
+	display = wl_display_connect(NULL);
+	if (!display) {
+		squint_error("No wayland display available");
+		return FALSE;
+	}
+
+	registry = wl_display_get_registry(display);
+	wl_registry_add_listener(registry, &registry_listener, NULL);
+
+	// 1st roundtrip: globals, 2nd roundtrip: output properties
+	wl_display_roundtrip(display);
+	wl_display_roundtrip(display);
+
+	if (!compositor || !shm || !wm_base) {
+		squint_error("The wayland compositor lacks a required interface (wl_compositor v4, wl_shm, xdg_wm_base)");
+		return FALSE;
+	}
+	if (!screencopy) {
+		squint_error("The wayland compositor does not support screen capture (wlr-screencopy)");
+		return FALSE;
+	}
+
+	display_source = g_source_new(&wayland_source_funcs, sizeof(struct wayland_source));
+	((struct wayland_source*) display_source)->fd_tag = g_source_add_unix_fd(display_source,
+			wl_display_get_fd(display), G_IO_IN | G_IO_ERR | G_IO_HUP);
+	g_source_attach(display_source, NULL);
+	g_source_unref(display_source);
+	return TRUE;
+}
+
+gboolean
+wayland_enable()
+{
+	if (!wayland_select_outputs()) {
+		return FALSE;
+	}
+
+	memset(&stats, 0, sizeof(stats));
+	dst->offset.x = dst->offset.y = 0;
+	configured = FALSE;
+	capture_full = TRUE;
+
+	// create the window
+	surface = wl_compositor_create_surface(compositor);
+	xdg_surface = xdg_wm_base_get_xdg_surface(wm_base, surface);
+	xdg_surface_add_listener(xdg_surface, &xdg_surface_listener, NULL);
+	toplevel = xdg_surface_get_toplevel(xdg_surface);
+	xdg_toplevel_add_listener(toplevel, &toplevel_listener, NULL);
+	xdg_toplevel_set_title(toplevel, APPNAME);
+	xdg_toplevel_set_app_id(toplevel, "org.github.a-ba.squint");
+	if (!config.opt_window) {
+		xdg_toplevel_set_fullscreen(toplevel, dst_output->output);
+	}
+	// initial commit (without buffer) to get the first configure event
+	wl_surface_commit(surface);
+
+	scheduler_enable(wayland_refresh_image, &stats);
+
+	wayland_capture_frame();
+	return TRUE;
+}
+
+void
+wayland_disable()
+{
+	scheduler_disable();
+
+	if (capture_timeout) {
+		g_source_remove(capture_timeout);
+		capture_timeout = 0;
+	}
+	if (frame) {
+		zwlr_screencopy_frame_v1_destroy(frame);
+		frame = NULL;
+	}
+	if (frame_callback) {
+		wl_callback_destroy(frame_callback);
+		frame_callback = NULL;
+	}
+	if (toplevel) {
+		xdg_toplevel_destroy(toplevel);
+		toplevel = NULL;
+	}
+	if (xdg_surface) {
+		xdg_surface_destroy(xdg_surface);
+		xdg_surface = NULL;
+	}
+	if (surface) {
+		wl_surface_destroy(surface);
+		surface = NULL;
+	}
+	wayland_buffer_destroy(&present[0]);
+	wayland_buffer_destroy(&present[1]);
+	wayland_buffer_destroy(&captures[0]);
+	wayland_buffer_destroy(&captures[1]);
+	scaler_free(scaler);
+	scaler = NULL;
+
+	wl_display_flush(display);
+}
+
+guint
+wayland_capabilities()
+{
+	return (screencopy_version >= 2) ? BACKEND_CAP_DAMAGE : 0;
+}
+
+const struct stats*
+wayland_stats()
+{
+	return &stats;
+}
+
+const struct backend wayland_backend = {
+	.name		= "wayland",
+	.uses_gtk	= FALSE,
+	.init		= wayland_init,
+	.enable		= wayland_enable,
+	.disable	= wayland_disable,
+	.capabilities	= wayland_capabilities,
+	.stats		= wayland_stats,
+};
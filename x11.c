@@ -3,15 +3,19 @@
 #include <stdint.h>
 
 #include <gdk/gdkx.h>
+#include <glib-unix.h>
 
 #include "squint.h"
 
 #include <X11/Xlib.h>
+#include <X11/Xutil.h>
 #ifdef HAVE_XI
 #include <X11/extensions/XInput2.h>
 #endif
-#ifdef COPY_CURSOR
+#ifdef HAVE_XFIXES
 #include <X11/extensions/Xfixes.h>
+#endif
+#ifdef HAVE_XRENDER
 #include <X11/extensions/Xrender.h>
 #endif
 #ifdef HAVE_XDAMAGE
@@ -20,27 +24,164 @@
 #ifdef HAVE_XRANDR
 #include <X11/extensions/Xrandr.h>
 #endif
+#ifdef HAVE_XCOMPOSITE
+#include <X11/extensions/Xcomposite.h>
+#endif
+#ifdef HAVE_XSHM
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/extensions/XShm.h>
+#endif
+#ifdef HAVE_XTEST
+#include <X11/extensions/XTest.h>
+#endif
+#ifdef HAVE_XSHAPE
+#include <X11/extensions/shape.h>
+#endif
+#ifdef HAVE_GLX
+#include <math.h>
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+#include <GL/glx.h>
+#endif
 
 static Window root_window = 0;
 static GdkRectangle root_window_rect;
-static Window window = 0;
-static Pixmap pixmap = -1;
 static int depth = -1, screen = -1;
-static GC gc = NULL;
-static GC gc_white = NULL;
-static Display* display = NULL;
+
+// connection and graphic contexts of the current thread (see the render
+// thread below)
+static __thread GC gc = NULL;
+static __thread GC gc_white = NULL;
+static __thread Display* display = NULL;
 static gint refresh_timer = 0;
+static gint zoom_timer = 0;
+static GdkPoint pointer_location;	// last known location of the pointer
+static struct predictor predictor;	// of the location of the pointer (see x11_predict_pointer())
+static GSource* prediction_timeout = NULL;	// settles the cursor once the pointer stopped
 static Atom net_active_window_atom = 0;
 
-static GdkPoint backup;
-static Pixmap   backup_pixmap = 0;
+// freeze and blank modes (see x11_pause())
+static enum pause_mode paused = PAUSE_NONE;
+static Pixmap blank_pixmap = 0;		// logo of the blank mode (0 if none)
+static int blank_width, blank_height;
+
+// global shortcuts of the pause modes (see x11_grab_hotkeys())
+#define HOTKEY_MODIFIERS	0xff			// Shift to Mod5
+#define HOTKEY_LOCKS		(LockMask | Mod2Mask)	// Caps Lock and Num Lock (ignored)
+static struct {
+	KeyCode		keycode;	// 0 if none
+	unsigned int	state;		// modifiers (without the locks)
+} hotkeys[PAUSE_BLANK + 1];		// (indexed by the mode toggled)
+
 #define CURSOR_CROSSHAIR_LEN 3
 #define CURSOR_SIZE 9
 
 static Window active_window = 0;
 
-static GdkPoint offset;
-static GdkPoint cursor;
+#ifdef HAVE_GLX
+// OpenGL presenter (see x11_gl_init())
+#define GL_MAX_AGE	4	// number of previous frames whose damages are remembered
+
+static struct {
+	GLXContext	context;	// NULL if not used
+	GLXFBConfig	pixmap_config;	// for binding the pixmaps as textures
+	XVisualInfo*	visual;		// of the subwindows
+	Colormap	colormap;
+	Window		window;		// unmapped (for making the context current when there is no subwindow)
+	int		y_inverted;	// the textures are upside down
+	gboolean	buffer_age;	// GLX_EXT_buffer_age is available
+	PFNGLXBINDTEXIMAGEEXTPROC	bind_tex_image;
+	PFNGLXRELEASETEXIMAGEEXTPROC	release_tex_image;
+	PFNGLXSWAPINTERVALEXTPROC	swap_interval;	// (NULL if not available)
+
+	GLuint		program;
+	GLint		u_window_size, u_image_size, u_footprint;
+
+	guint		present_idle;
+} gl;
+#endif
+
+// image in the memory of the client (see x11_image_create())
+struct x11_image {
+	XImage*		image;		// NULL if not allocated
+#ifdef HAVE_XSHM
+	XShmSegmentInfo	shminfo;	// (shmaddr is NULL if not shared)
+#endif
+};
+
+// per-mirror resources (same index as in mirrors[])
+//
+// All destinations of a mirror share the same pixmap (the source is copied
+// only once), each one has its own subwindow using the pixmap as background.
+static struct x11_mirror {
+	Pixmap		pixmap;
+	GdkPoint	cursor;		// relative to src_rect (-1 if outside)
+	gint64		display_delay;	// between the drawing of the cursor and its display (µs)
+	GdkRectangle	held_damage;	// area damaged while paused (refreshed when resuming)
+	GdkPoint	backup;		// location of the background saved in backup_pixmap
+	Pixmap		backup_pixmap;
+#ifdef COPY_CURSOR
+	Picture		pixmap_picture;
+#endif
+	struct x11_destination {
+		Window	window;		// subwindow
+		Window	blank_window;	// logo of the blank mode (0 if none)
+#ifdef HAVE_XSHAPE
+		Window	overlay_window;	// child of the subwindow (see x11_enable_overlay())
+		Pixmap	overlay_pixmap;	// background of overlay_window
+#endif
+#ifdef HAVE_XRENDER
+		Pixmap	transform_pixmap;	// transformed image (0 if no transform)
+		Picture	transform_src;		// picture of the pixmap (with the inverse transform)
+		Picture	transform_dst;		// picture of transform_pixmap
+#endif
+		// CPU scaler (see x11_enable_scaler())
+		struct scaler*	scaler;		// NULL if not scaled
+		GdkRectangle	scaled_rect;	// location of the scaled image in the window
+		Pixmap		scaled_pixmap;	// background of the subwindow
+		struct x11_image scaled_image;
+#ifdef HAVE_GLX
+		int	gl_width, gl_height;	// size of the subwindow
+		gboolean gl_invalid;		// the whole subwindow must be redrawn
+		GdkRectangle gl_history[GL_MAX_AGE];	// areas modified by the previous frames (window coordinates)
+#endif
+	} destinations[MAX_DESTINATIONS];
+	struct x11_image scale_src;	// copy of the pixmap read by the scalers of the destinations
+#ifdef HAVE_XRENDER
+	// mosaic
+	Picture		mosaic_picture;	// picture of the pixmap (composed image)
+	struct {
+		Pixmap	pixmap;		// capture of the source monitor
+		Picture	picture;	// picture of the capture (scaled to the cell)
+	} sources[MAX_SOURCES];
+#endif
+#ifdef HAVE_XCOMPOSITE
+	// window capture
+	Pixmap		window_pixmap;	// backing pixmap of the window (0 if not viewable)
+	GdkRectangle	window_rect;	// geometry of the window (root coordinates, without the border)
+	int		window_border;
+#ifdef HAVE_XRENDER
+	// converting copy (when the window does not have the depth of the screen)
+	XRenderPictFormat* window_format;	// format of the window (NULL if same depth)
+	Picture		window_picture;		// picture of window_pixmap
+	Picture		window_dst_picture;	// picture of pixmap (created on the first copy)
+#endif
+#ifdef HAVE_XDAMAGE
+	Damage		window_damage;
+#endif
+#endif
+#ifdef HAVE_GLX
+	// OpenGL presenter
+	GLXPixmap	gl_pixmap;	// pixmap bound as gl_texture (0 if not yet created)
+	GLuint		gl_texture;
+	GdkRectangle	gl_damage;	// area of the pixmap modified since the last frame
+#endif
+} x11_mirrors[MAX_MIRRORS];
+
+#define X11_MIRROR(m) (&x11_mirrors[(m) - mirrors])
 
 #ifdef HAVE_XI
 static gboolean can_track_cursor = FALSE;
@@ -51,11 +192,6 @@ static int xi_opcode = 0;
 static gboolean can_use_xdamage = FALSE;
 static int xdamage_event_base;
 static Damage damage = 0;
-static int min_refresh_period=0;
-static Time next_refresh=0;
-static gint refresh_timeout=0;
-
-gboolean x11_compute_damaged_rect(GdkRectangle* rect);
 #endif
 
 #ifdef COPY_CURSOR
@@ -67,7 +203,6 @@ static Pixmap  cursor_pixmap = 0;
 static Picture cursor_picture = 0;
 static XImage* cursor_image = NULL;
 static GC      cursor_gc = NULL;
-static Picture pixmap_picture = 0;
 
 static int cursor_xhot=0;
 static int cursor_yhot=0;
@@ -79,740 +214,4744 @@ static uint32_t* cursor_pixels;
 static int xrandr_event_base = 0;
 #endif
 
-gboolean x11_draw_cursor();
-gboolean x11_clear_cursor();
-void x11_redraw_cursor(gboolean do_clear);
-
-
-void
-x11_adjust_offset_value(gint* offset, gint src, gint dst, gint cursor)
-{
-	if (dst >= src)
-	{
-		// dst window is enough big 
-		// -> static offset
-		*offset = (dst - src) / 2;
-	} else {
-		// dynamic offset
-		if (cursor >= 0) {
-			// on-screen
-			int v = cursor + *offset;
-			
-			if (v < 0) {
-				*offset -= v;
-			} else if (v >= dst) {
-				*offset -= v - dst;
-			}
-		} else {
-			// off-screen
-			// -> update only if there is unused space
-			if (*offset > 0) {
-				*offset = 0;
-			} else {
-				int min_offset = dst - src;
-				if (*offset < min_offset) {
-					*offset = min_offset;
-				}
-			}
-		}
-	}
-}
-
-// return true if offset was updated
-// NOTE: must clear the window if it returns true
-gboolean
-x11_fix_offset()
-{
-	GdkPoint offset_bak = {offset.x, offset.y};
-
-	// Adjust the offsets
-	x11_adjust_offset_value(&offset.x, src_rect.width,  dst_rect.width,  cursor.x);
-	x11_adjust_offset_value(&offset.y, src_rect.height, dst_rect.height, cursor.y);
-	
-	gboolean updated = memcmp(&offset, &offset_bak, sizeof(offset));
-	if (updated) {
-		// offset was updated
-		// -> move the windows
-		XMoveWindow(display, window, offset.x, offset.y);
-	}
-	return updated;
-}
-
+#ifdef HAVE_XCOMPOSITE
+static gboolean can_use_xcomposite = FALSE;
 
-void
-x11_refresh_cursor_location(gboolean force)
-{
-	Window root_return, w;
-	int wx, wy;
-	unsigned int mask;
-	GdkPoint c;
-	XQueryPointer(display, root_window, &root_return, &w,
-			&c.x, &c.y, &wx, &wy, &mask);
+struct mirror* x11_find_capture_mirror(Window w);
+#endif
 
-	c.x -= src_rect.x;
-	c.y -= src_rect.y;
+static struct stats stats;
+
+// copy of the pixmap of the first mirror (for the recording and the export)
+static struct x11_image readback_image;
+static guint32* readback_canvas = NULL;	// XRGB conversion of readback_image (NULL if already XRGB)
+static struct scaler* readback_scaler = NULL;	// --scale (NULL if the frames are not scaled)
+static guint32* readback_scaled = NULL;	// scaled canvas
+static int readback_scaled_width;
+static struct {
+	unsigned long	mask;
+	int		shift, bits;
+} readback_channels[3];			// red, green, blue of the default visual
+#define READBACK_PERIOD		40	// ms (frame rate of the recording)
+static GMutex readback_lock;		// readback_pending (also updated by the render thread)
+static GdkRectangle readback_pending;	// area modified since the last read-back
+static guint readback_timer = 0;
 
-	if ((c.x<0) | (c.y<0) | (c.x>=src_rect.width) | (c.y>=src_rect.height))
-	{
-		// cursor is outside the duplicated screen
-		c.x = c.y = -1;
-	}
+#if HAVE_XDAMAGE && HAVE_XI
+// render thread (see x11_render_start())
+#define RENDER_FIX_OFFSETS	(1<<0)	// a window was moved or resized
+#define RENDER_REDRAW_CURSOR	(1<<1)	// the image of the cursor changed
+
+static struct {
+	GThread*	thread;		// NULL if not running
+	GMainContext*	context;
+	GMainLoop*	loop;
+	Display*	display;	// connection of the thread
+	GC		gc, gc_white;
+	gint		requests;	// RENDER_* for the thread (atomic)
+	gint		raise[MAX_MIRRORS];	// for the main thread: 1 raise, 0 lower, -1 none (atomic)
+
+	// geometry of the destination windows, applied by the thread with
+	// RENDER_FIX_OFFSETS (the thread owns mirrors[].destinations[].rect)
+	GMutex		lock;
+	GdkRectangle	geometry[MAX_MIRRORS][MAX_DESTINATIONS];
+} render;
+
+void x11_render_start();
+void x11_render_stop();
+void x11_render_request(gint request);
+#endif
 
-	// cursor was really moved
-	cursor = c;
+#ifdef HAVE_XSHM
+// cross-display source (see x11_remote_start())
+#define REMOTE_SLOTS	2
+#define REMOTE_PERIOD	40	// ms (pointer polling, periodic capture without XDamage)
+
+struct remote_slot {
+	char*		shmaddr;	// segment attached to both displays
+	XShmSegmentInfo	remote_shminfo;
+	XShmSegmentInfo	local_shminfo;
+	XImage*		remote_image;	// (same pixels)
+	XImage*		local_image;
+	GdkRectangle	rect;		// area captured
+	guint32		timestamp;	// of the last damage (time of the source display)
+};
+
+static struct {
+	Display*	display;	// NULL if not in use
+	Window		root;
+	GdkRectangle	rect;		// geometry of the source screen
+	struct mirror*	mirror;
+	Pixmap		pixmap;		// copy of the source screen (on the local display)
+	int		completion_event;	// type of the ShmCompletion events (local display)
+#ifdef HAVE_XDAMAGE
+	int		damage_event_base;
+	Damage		damage;		// 0 if XDamage is not available
+#endif
+	gboolean	lost;		// the connection was lost (unusable)
 
-	if (cursor.x >= 0) {
-		/* raise the window when the pointer enters the duplicated screen */
-		squint_show();
-	} else {
-		/* lower the window when the pointer leaves the duplicated screen */
-		squint_hide();
-	}
+	struct remote_slot slots[REMOTE_SLOTS];
+	GAsyncQueue*	free_slots;	// waiting for a capture
+	GAsyncQueue*	full_slots;	// waiting for the upload
+	GThread*	thread;
+	int		wakeup[2];	// pipe for stopping the thread
 
-	// update the offsets and redraw the cursor
-	gboolean updated = x11_fix_offset();
-	x11_redraw_cursor(!updated);
-	if (updated) {
-		XClearWindow(display, window);
-	}
-}
+	GMutex		lock;
+	GdkPoint	pointer;	// location on the source screen (protected by lock)
+	gint		paused;		// the captures are suspended (atomic, see x11_pause())
 
-gboolean
-x11_refresh_image(const GdkRectangle* damaged_rect)
-{
-#ifdef HAVE_XI
-	if (!can_track_cursor)
+	Display*	input_display;	// injection of the input events (NULL if not in use, see --interactive)
+} remote;
 #endif
-	{
-		x11_refresh_cursor_location(FALSE);
-	}
-
-	// location of the damaged area relative to the source rect
-	int x = damaged_rect->x - src_rect.x;
-	int y = damaged_rect->y - src_rect.y;
 
-	x11_clear_cursor();
+#if HAVE_XSHM && HAVE_XI && HAVE_XTEST
+// input forwarding of the local mirrors (see x11_forward_local_input())
+static struct {
+	gboolean	checked;	// the XTest extension was queried
+	gboolean	available;
+	gboolean	enabled;	// the buttons of the subwindows are selected
+	int		button;		// held until its release (0 if none)
+	GdkPoint	press;		// location of its press (root coordinates)
+	gboolean	press_inside;	// (FALSE if inside a mirror window)
+} local_input;
+#endif
 
-	XCopyArea (display, root_window, pixmap, gc,
-			damaged_rect->x,     damaged_rect->y,
-			damaged_rect->width , damaged_rect->height,
-			x, y);
+#ifdef HAVE_XRENDER
+static gboolean can_use_xrender = FALSE;
+static XRenderPictFormat* screen_format = NULL;	// format of the pixmaps (default visual)
 
-	x11_draw_cursor();
+void x11_refresh_mosaic(struct mirror* m, const GdkRectangle* damaged_rect);
+#endif
 
-	// redraw the damaged area
-	XClearArea(display, window, x, y, damaged_rect->width, damaged_rect->height, FALSE);
+#ifdef HAVE_XSHAPE
+// debug overlay
+#define OVERLAY_MAX_RECTS	64
+#define OVERLAY_FADE_TIME	1000	// ms
+#define OVERLAY_PERIOD		40	// ms (while some rectangles are fading)
+#define OVERLAY_HUD_PERIOD	1000	// ms (idle)
+#define OVERLAY_BORDER		2	// width of the outlines
+static gboolean	can_use_xshape = FALSE;
+static gboolean	overlay_enabled = FALSE;
+static GMutex	overlay_lock;		// overlay_rects[], overlay_next, overlay_period, overlay_wakeup
+static struct x11_overlay_rect {
+	int		mirror;	// index in mirrors[]
+	GdkRectangle	rect;	// in the coordinates of the subwindow
+	gint64		time;	// µs
+} overlay_rects[OVERLAY_MAX_RECTS];
+static int	overlay_next = 0;
+static int	overlay_n_drawn = 0;	// rectangles displayed by the last redraw
+static GC	overlay_gc = NULL;
+static guint	overlay_timer = 0;
+static guint	overlay_period = 0;	// of overlay_timer (0 if stopped)
+static guint	overlay_wakeup = 0;	// idle source restarting overlay_timer
+static char	overlay_hud[64];
+
+void x11_overlay_add_rect(struct mirror* m, int x, int y, int width, int height);
+#endif
 
-	XFlush (display);
+void x11_start_zoom_timer();
+void x11_refresh_cursor_location(gboolean force, gint64 time);
+void x11_readback_stop();
+void x11_enable_focus_tracking();
+void x11_active_window_start_monitoring();
+void x11_enable_destination(struct mirror* m, int j);
+gboolean x11_draw_cursor(struct mirror* m);
+gboolean x11_clear_cursor(struct mirror* m);
+void x11_redraw_cursor(struct mirror* m, gboolean do_clear);
+void x11_set_raised(struct mirror* m, gboolean raised);
+void x11_get_destination_rect(const struct mirror* m, int j, GdkRectangle* r);
+#ifdef HAVE_GLX
+void x11_gl_fit_window(struct mirror* m, int j);
+void x11_gl_damage(struct mirror* m, const GdkRectangle* area);
+#endif
 
-	return TRUE;
-}
 
-#ifdef HAVE_XDAMAGE
-void x11_try_refresh_image (Time timestamp, const GdkRectangle* damaged_rect);
+//
+// Images in the memory of the client (CPU scaler, read-back)
+//
+// The images have the default visual. They are stored in a shared memory
+// segment when MIT-SHM is available (no copy through the connection).
+//
 
-gboolean 
-x11_try_refresh_image_timeout (gpointer data)
+#ifdef HAVE_XSHM
+// allocate the image in a shared memory segment
+//
+// return FALSE on failure (eg: remote display)
+gboolean
+x11_image_create_shm(struct x11_image* img, int width, int height)
 {
-	refresh_timeout=0;
+	XShmSegmentInfo* shminfo = &img->shminfo;
 
-	if ((Time)data == next_refresh)
-	{
-		x11_try_refresh_image(next_refresh, NULL);
+	img->image = XShmCreateImage(display, DefaultVisual(display, screen), depth, ZPixmap, NULL,
+			shminfo, width, height);
+	if (!img->image) {
+		return FALSE;
 	}
-	return FALSE;
-}
 
-void
-x11_try_refresh_image (Time timestamp, const GdkRectangle* damaged_rect)
-{
-	static GdkRectangle acc = { 0, 0, 0, 0 };
-	if (damaged_rect != NULL) {
-		if (acc.width == 0) {
-			acc = *damaged_rect;
-		} else {
-			gdk_rectangle_union(damaged_rect, &acc, &acc);
-		}
-	}
+	shminfo->shmid = shmget(IPC_PRIVATE, img->image->bytes_per_line * height,
+			IPC_CREAT | 0600);
+	shminfo->shmaddr = (shminfo->shmid < 0) ? (char*)-1
+			 : shmat(shminfo->shmid, NULL, 0);
+	if (shminfo->shmaddr != (char*)-1)
+	{
+		img->image->data = shminfo->shmaddr;
+		shminfo->readOnly = False;
 
-	if ((timestamp >= next_refresh) || (timestamp < next_refresh - 1000)) {
-		if (refresh_timeout) {
-			g_source_remove(refresh_timeout);
-			refresh_timeout=0;
-		}
-		next_refresh = timestamp + min_refresh_period;
-		if (acc.width) {
-			x11_refresh_image(&acc);
-			acc.width = 0;
+		gdk_x11_display_error_trap_push(gdisplay);
+		XShmAttach(display, shminfo);
+		XSync(display, False);
+		if (!gdk_x11_display_error_trap_pop(gdisplay)) {
+			// the segment is destroyed once detached by both sides
+			shmctl(shminfo->shmid, IPC_RMID, NULL);
+			return TRUE;
 		}
-
-	} else if (!refresh_timeout) {
-		refresh_timeout = g_timeout_add (next_refresh - timestamp, x11_try_refresh_image_timeout, (gpointer)next_refresh);
+		shmdt(shminfo->shmaddr);
 	}
+	if (shminfo->shmid >= 0) {
+		shmctl(shminfo->shmid, IPC_RMID, NULL);
+	}
+	XDestroyImage(img->image);
+	img->image = NULL;
+	shminfo->shmaddr = NULL;
+	return FALSE;
 }
 #endif
 
-
-
-#ifdef COPY_CURSOR
+// allocate an image of width x height (see x11_image_destroy())
 void
-x11_refresh_cursor_image()
+x11_image_create(struct x11_image* img, int width, int height)
 {
-	XFixesCursorImage* img = XFixesGetCursorImage (display);
-	if (!img)
+#ifdef HAVE_XSHM
+	img->shminfo.shmaddr = NULL;
+	if (XShmQueryExtension(display) && x11_image_create_shm(img, width, height)) {
 		return;
-
-	int width  = (img->width  < CURSOR_SIZE) ? img->width  : CURSOR_SIZE;
-	int height = (img->height < CURSOR_SIZE) ? img->height : CURSOR_SIZE;
-
-	int x, y;
-	// copy the cursor image
-	for(y=0 ; y<height ; y++)
-	{
-		for(x=0 ; x<width ; x++)
-		{
-			cursor_pixels[y*CURSOR_SIZE + x] = img->pixels[y*img->width + x];
-		}
 	}
-
-	// clear the cursor_pixmap and upload the new image
-	XFillRectangle(display, cursor_pixmap, cursor_gc, 0, 0, CURSOR_SIZE, CURSOR_SIZE);
-	XPutImage(display, cursor_pixmap, cursor_gc, cursor_image,
-			0, 0, 0, 0, width, height);
-	cursor_xhot = img->xhot;
-	cursor_yhot = img->yhot;
-
-	XFree(img);
-
-	x11_redraw_cursor(TRUE);
+#endif
+	// no shared memory -> XGetSubImage() and XPutImage()
+	img->image = XCreateImage(display, DefaultVisual(display, screen), depth, ZPixmap, 0, NULL,
+			width, height, 32, 0);
+	img->image->data = malloc(img->image->bytes_per_line * height);
 }
 
 void
-x11_init_copy_cursor()
+x11_image_destroy(struct x11_image* img)
 {
-	// ensure we are in true color
-	if (XDefaultDepth(display, screen) != 24) {
+	if (!img->image) {
 		return;
 	}
-
-	// ensure the screen supports 32 bit depth
+#ifdef HAVE_XSHM
+	if (img->shminfo.shmaddr) {
+		XShmDetach(display, &img->shminfo);
+		XDestroyImage(img->image);
+		shmdt(img->shminfo.shmaddr);
+		img->shminfo.shmaddr = NULL;
+	} else
+#endif
 	{
-		int depth_count = 0;
-		int* depths = XListDepths(display, screen, &depth_count);
-		if (depths == NULL) {
-			return;
-		}
-		int i;
-		for (i=depth_count-1 ; i>=0 ; i--) {
-			if (depths[i] == 32) {
-				break;
-			}
-		}
-		XFree(depths);
-		if (i < 0) {
-			return;
-		}
+		XDestroyImage(img->image);
 	}
+	img->image = NULL;
+}
 
-	// check if xfixes and xrender are available on this display
-	int major=1, minor=0, event_base, error_base;
-	if ((	   !XFixesQueryExtension(display, &xfixes_event_base, &error_base)
-		|| !XFixesQueryVersion(display, &major, &minor)
-		|| (major<1)
-		|| !XRenderQueryExtension(display, &event_base, &error_base)
-	)) {
+// return TRUE if the pixels are XRGB (the format of the scaler, of the
+// recorder and of the export)
+gboolean
+x11_image_is_xrgb(const struct x11_image* img)
+{
+	return (img->image->bits_per_pixel == 32) && (img->image->red_mask == 0xff0000)
+		&& (img->image->green_mask == 0xff00) && (img->image->blue_mask == 0xff);
+}
+
+// read an area of a drawable into the image (at the same location)
+void
+x11_image_get(struct x11_image* img, Drawable d, const GdkRectangle* r)
+{
+	XImage* image = img->image;
+#ifdef HAVE_XSHM
+	if (img->shminfo.shmaddr)
+	{
+		// read the whole rows (the segment has the layout of the image, so
+		// that they land at their place)
+		char* data = image->data;
+		int full_height = image->height;
+		image->data  += r->y * image->bytes_per_line;
+		image->height = r->height;
+		XShmGetImage(display, d, image, 0, r->y, AllPlanes);
+		image->data   = data;
+		image->height = full_height;
 		return;
 	}
+#endif
+	XGetSubImage(display, d, r->x, r->y, r->width, r->height,
+			AllPlanes, ZPixmap, image, r->x, r->y);
+}
 
-	// create an image for storing the cursor
-	cursor_pixels = (uint32_t*) malloc(CURSOR_PIXELS_SIZE);
-	cursor_image = XCreateImage(display, NULL, 32, ZPixmap, 0, (char*)cursor_pixels,
-				CURSOR_SIZE, CURSOR_SIZE, 32, 4*CURSOR_SIZE);
-	if (!cursor_image) {
-		squint_error("XCreateImage() failed");
+// write an area of the image into a drawable (at the same location)
+void
+x11_image_put(struct x11_image* img, Drawable d, const GdkRectangle* r)
+{
+#ifdef HAVE_XSHM
+	if (img->shminfo.shmaddr) {
+		// (the server reads the segment when it processes the request,
+		// the image must not be modified before the next round trip)
+		XShmPutImage(display, d, gc, img->image, r->x, r->y, r->x, r->y,
+				r->width, r->height, False);
 		return;
 	}
+#endif
+	XPutImage(display, d, gc, img->image, r->x, r->y, r->x, r->y, r->width, r->height);
+}
 
-	// create a pixmap for storing the cursor
-	cursor_pixmap = XCreatePixmap(display, root_window,
-				CURSOR_SIZE, CURSOR_SIZE, 32);
 
-	// create a context for manipulating the cursor pixmap (must have 32-bit depth)
-	cursor_gc = XCreateGC(display, cursor_pixmap, 0, NULL);
-	if(!cursor_gc) {
-		squint_error("XCreateGC() failed");
+//
+// Destination transforms (--transform)
+//
+// A rotated/flipped destination does not display the pixmap of the mirror
+// but a transformed copy of it (transform_pixmap, the background of its
+// subwindow). XRender composes into the copy only the areas redrawn by
+// x11_clear_area() (the damages and the cursor), thus it costs nothing while
+// the image does not change.
+//
+
+#ifdef HAVE_XRENDER
+void
+x11_disable_transform(struct mirror* m, int j)
+{
+	struct x11_mirror* xm = X11_MIRROR(m);
+	struct x11_destination* xd = &xm->destinations[j];
+
+	if (!xd->transform_pixmap) {
 		return;
 	}
-
-	// create a picture for the cursor_pixmap
-	cursor_picture = XRenderCreatePicture(display, cursor_pixmap,
-			XRenderFindStandardFormat(display, PictStandardARGB32),
-			0, NULL);
+	XRenderFreePicture(display, xd->transform_src);
+	XRenderFreePicture(display, xd->transform_dst);
+	XFreePixmap(display, xd->transform_pixmap);
+	xd->transform_src = xd->transform_dst = 0;
+	xd->transform_pixmap = 0;
 }
 
+// (re)create the transformed copy of the pixmap for destination j (if
+// needed)
+//
+// The transform of the destination is reset if not available. The copy is
+// empty, the caller must refresh the whole image.
 void
-x11_enable_copy_cursor()
+x11_enable_transform(struct mirror* m, int j)
 {
-	if (copy_cursor || (cursor_picture == 0)) {
+	struct x11_mirror* xm = X11_MIRROR(m);
+	struct x11_destination* xd = &xm->destinations[j];
+	struct destination* dst = &m->destinations[j];
+	const char* error = NULL;
+	int width, height, a[6];
+
+	x11_disable_transform(m, j);
+	if (!dst->transform) {
 		return;
 	}
 
-	// create a picture for the main pixmap
-	pixmap_picture = XRenderCreatePicture(display, pixmap,
-			XRenderFindStandardFormat(display, PictStandardRGB24),
-			0, NULL);
-
-	copy_cursor = TRUE;
+	if (!can_use_xrender) {
+		error = "The transforms require the XRender extension";
+	} else if (m->wall) {
+		error = "The transforms are not available in video wall mode";
+	}
+#ifdef HAVE_GLX
+	else if (gl.context) {
+		error = "The transforms are not available with the OpenGL presenter";
+	}
+#endif
+	if (error) {
+		squint_error(error);
+		dst->transform = TRANSFORM_NORMAL;
+		return;
+	}
 
-	// refresh the cursor
-	x11_refresh_cursor_image();
+	transform_size(dst->transform, m->src_rect.width, m->src_rect.height, &width, &height);
+	xd->transform_pixmap = XCreatePixmap(display, root_window, width, height, depth);
+	XFillRectangle(display, xd->transform_pixmap, gc, 0, 0, width, height);
+	xd->transform_dst = XRenderCreatePicture(display, xd->transform_pixmap,
+			screen_format, 0, NULL);
+	xd->transform_src = XRenderCreatePicture(display, xm->pixmap,
+			screen_format, 0, NULL);
+
+	// XRender maps the destination to the source -> inverse transform
+	// (the matrix is orthogonal: transposed)
+	transform_matrix(dst->transform, m->src_rect.width, m->src_rect.height, a);
+	XTransform xform = {{
+		{ XDoubleToFixed(a[0]), XDoubleToFixed(a[3]), XDoubleToFixed(-(a[0]*a[2] + a[3]*a[5])) },
+		{ XDoubleToFixed(a[1]), XDoubleToFixed(a[4]), XDoubleToFixed(-(a[1]*a[2] + a[4]*a[5])) },
+		{ 0, 0, XDoubleToFixed(1) },
+	}};
+	XRenderSetPictureTransform(display, xd->transform_src, &xform);
+}
 
-	x11_refresh_cursor_location(TRUE);
+// compose an area of the pixmap into the transformed copy of destination j
+//
+// t_area: location of the area in the copy
+void
+x11_transform_area(struct mirror* m, int j, const GdkRectangle* area, GdkRectangle* t_area)
+{
+	struct x11_destination* xd = &X11_MIRROR(m)->destinations[j];
 
-	// request cursor change notifications
-	XFixesSelectCursorInput(display, gdk_x11_window_get_xid(gdkwin), XFixesCursorNotify);
+	transform_rect(m->destinations[j].transform, m->src_rect.width, m->src_rect.height,
+			area, t_area);
+	XRenderComposite(display, PictOpSrc, xd->transform_src, None, xd->transform_dst,
+			t_area->x, t_area->y, 0, 0, t_area->x, t_area->y,
+			t_area->width, t_area->height);
 }
-
+#else
 void
-x11_disable_copy_cursor()
+x11_disable_transform(struct mirror* m, int j)
 {
-	if (!copy_cursor) {
-		return;
-	}
-	copy_cursor = FALSE;
+}
 
-	if (pixmap_picture) {
-		XRenderFreePicture(display, pixmap_picture);
-		pixmap_picture = 0;
+void
+x11_enable_transform(struct mirror* m, int j)
+{
+	if (m->destinations[j].transform) {
+		squint_error("The transforms are not available (squint was built without XRender)");
+		m->destinations[j].transform = TRANSFORM_NORMAL;
 	}
 }
 #endif
 
+//
+// CPU scaler (--scale)
+//
+// Without the OpenGL presenter, a destination may display the image scaled
+// by the CPU (see scale.c) to fit its window: like a transformed destination,
+// its subwindow uses a copy as background (scaled_pixmap, centered at
+// scaled_rect). x11_clear_area() reads the redrawn area of the pixmap back
+// into scale_src (once for all the destinations of the mirror), scales the
+// area of the copy it affects into scaled_image and uploads it. The read-back
+// is a round trip per redraw, thus the render thread is not used.
+//
 
 void
-x11_show_active_window()
+x11_disable_scaler(struct mirror* m, int j)
 {
-	if (!active_window)
-		return;
+	struct x11_mirror* xm = X11_MIRROR(m);
+	struct x11_destination* xd = &xm->destinations[j];
+	int i;
 
-	// check if it overlaps more whith the src or the dst window
-	GdkRectangle inter_src, inter_dst;
-	gdk_rectangle_intersect(&active_window_rect, &src_rect, &inter_src);
-	gdk_rectangle_intersect(&active_window_rect, &dst_rect, &inter_dst);
-
-	if((inter_src.height*inter_src.width) > (inter_dst.height*inter_dst.width))
-	{
-		// the active window overlaps more with the source screen
-		squint_show();
-	} else {
-		// the active window overlaps more with the destination screen
-		squint_hide();
+	if (!xd->scaler) {
+		return;
+	}
+	scaler_free(xd->scaler);
+	xd->scaler = NULL;
+	x11_image_destroy(&xd->scaled_image);
+	XFreePixmap(display, xd->scaled_pixmap);
+	xd->scaled_pixmap = 0;
+
+	// (scale_src is shared by the scaled destinations)
+	for (i=0 ; i<MAX_DESTINATIONS ; i++) {
+		if (xm->destinations[i].scaler) {
+			return;
+		}
 	}
+	x11_image_destroy(&xm->scale_src);
 }
 
-gboolean
-x11_get_window_geometry(Window w, GdkRectangle* r)
+// scale an area of the pixmap (already read into scale_src) into the copy of
+// destination j
+//
+// s_area: location of the area in the copy
+void
+x11_scale_area(struct mirror* m, int j, const GdkRectangle* area, GdkRectangle* s_area)
 {
-	gboolean result;
-	Window root;
-	int x, y;
-	unsigned int width, height, border_width, depth;
-
-	gdk_x11_display_error_trap_push(gdisplay);
+	struct x11_mirror* xm = X11_MIRROR(m);
+	struct x11_destination* xd = &xm->destinations[j];
+	const XImage* src = xm->scale_src.image;
+	XImage* dst = xd->scaled_image.image;
+
+	scaler_map_area(xd->scaler, area, s_area);
+	scaler_run(xd->scaler, src->data, src->bytes_per_line, dst->data, dst->bytes_per_line, s_area, 1);
+	x11_image_put(&xd->scaled_image, xd->scaled_pixmap, s_area);
+}
 
-	if (XGetGeometry(display, w, &root, &x, &y, &width, &height,
-			&border_width, &depth))
+// (re)create the scaled copy of the pixmap for destination j (if needed),
+// fitting the current size of its window
+//
+// The copy is computed from the current content of the pixmap.
+void
+x11_enable_scaler(struct mirror* m, int j)
+{
+	struct x11_mirror* xm = X11_MIRROR(m);
+	struct x11_destination* xd = &xm->destinations[j];
+	struct destination* dst = &m->destinations[j];
+	const GdkRectangle image = { 0, 0, m->src_rect.width, m->src_rect.height };
+	const char* error = NULL;
+	GdkRectangle r;
+
+	x11_disable_scaler(m, j);
+	if (!config.scale_filter) {
+		return;
+	}
+#ifdef HAVE_GLX
+	if (gl.context) {
+		// (scaled by OpenGL)
+		return;
+	}
+#endif
+	if (m->wall) {
+		error = "The CPU scaler is not available in video wall mode";
+	} else if (dst->transform) {
+		error = "The CPU scaler is not available with the transforms";
+	}
+	if (error) {
+		squint_error(error);
+		return;
+	}
+
+	if (xm->scale_src.image && ((xm->scale_src.image->width != image.width)
+				 || (xm->scale_src.image->height != image.height))) {
+		// the pixmap was resized (the other destinations follow)
+		x11_image_destroy(&xm->scale_src);
+	}
+	if (!xm->scale_src.image)
 	{
-		r->x = x - border_width;
-		r->y = y - border_width;
-		r->width  = width  + 2*border_width;
-		r->height = height + 2*border_width;
+		x11_image_create(&xm->scale_src, image.width, image.height);
+		if (!x11_image_is_xrgb(&xm->scale_src)) {
+			squint_error("The CPU scaler requires a 24-bit screen");
+			x11_image_destroy(&xm->scale_src);
+			return;
+		}
+	}
 
-		result = TRUE;
-	} else {
-		result = FALSE;
+	scaler_fit(image.width, image.height, MAX(dst->rect.width, 1), MAX(dst->rect.height, 1),
+			&xd->scaled_rect);
+	xd->scaler = scaler_new(config.scale_filter, image.width, image.height,
+			xd->scaled_rect.width, xd->scaled_rect.height);
+	x11_image_create(&xd->scaled_image, xd->scaled_rect.width, xd->scaled_rect.height);
+	xd->scaled_pixmap = XCreatePixmap(display, root_window,
+			xd->scaled_rect.width, xd->scaled_rect.height, depth);
+
+	x11_image_get(&xm->scale_src, xm->pixmap, &image);
+	x11_scale_area(m, j, &image, &r);
+
+	// centered in the window (no panning)
+	dst->offset.x = xd->scaled_rect.x;
+	dst->offset.y = xd->scaled_rect.y;
+	if (xd->window) {
+		XMoveWindow(display, xd->window, dst->offset.x, dst->offset.y);
 	}
-	gdk_x11_display_error_trap_pop_ignored(gdisplay);
+}
 
-	return result;
+void x11_set_destination_image(struct mirror* m, int j);
+
+// follow the size of the window of the scaled destination j
+//
+// return TRUE if the copy was recreated
+gboolean
+x11_fit_scaler(struct mirror* m, int j)
+{
+	const GdkRectangle* rect = &m->destinations[j].rect;
+	GdkRectangle fit;
+
+	scaler_fit(m->src_rect.width, m->src_rect.height, MAX(rect->width, 1), MAX(rect->height, 1),
+			&fit);
+	if (gdk_rectangle_equal(&fit, &X11_MIRROR(m)->destinations[j].scaled_rect)) {
+		return FALSE;
+	}
+	x11_set_destination_image(m, j);
+	return TRUE;
+}
+
+// image displayed by destination j (and its size)
+Pixmap
+x11_destination_pixmap(struct mirror* m, int j, int* width, int* height)
+{
+	struct x11_destination* xd = &X11_MIRROR(m)->destinations[j];
+	if (xd->scaler) {
+		*width  = xd->scaled_rect.width;
+		*height = xd->scaled_rect.height;
+		return xd->scaled_pixmap;
+	}
+	transform_size(m->destinations[j].transform, m->src_rect.width, m->src_rect.height,
+			width, height);
+#ifdef HAVE_XRENDER
+	if (xd->transform_pixmap) {
+		return xd->transform_pixmap;
+	}
+#endif
+	return X11_MIRROR(m)->pixmap;
 }
 
+// display the image (possibly transformed or scaled) in the subwindow of
+// destination j, after a change of the pixmap, of the transform or of the size
+// of the scaled image
 void
-x11_refresh_active_window_geometry()
+x11_set_destination_image(struct mirror* m, int j)
 {
-	if(!active_window)
+	Window w = X11_MIRROR(m)->destinations[j].window;
+	int width, height;
+
+	x11_enable_transform(m, j);
+#ifdef HAVE_GLX
+	if (gl.context) {
+		// (not available, the subwindow is drawn by OpenGL)
 		return;
+	}
+#endif
+	x11_enable_scaler(m, j);
+	XSetWindowBackgroundPixmap(display, w, x11_destination_pixmap(m, j, &width, &height));
+	XResizeWindow(display, w, width, height);
+}
 
-	// ignore X11 errors (this function can produce BadWindow errors since
-	// it makes queries on windows controlled by other applications)
-	gdk_x11_display_error_trap_push(gdisplay);
 
+// return true if the offset of destination i was updated
+// NOTE: must clear the window if it returns true
+gboolean
+x11_fix_offset(struct mirror* m, int i)
+{
+	struct x11_mirror* xm = X11_MIRROR(m);
+	struct destination* dst = &m->destinations[i];
+#ifdef HAVE_GLX
+	if (gl.context) {
+		// the image is scaled to fit the window (no offset)
+		x11_gl_fit_window(m, i);
+		return FALSE;
+	}
+#endif
+	if (xm->destinations[i].scaler) {
+		// the image is scaled to fit the window (no offset)
+		return x11_fit_scaler(m, i);
+	}
+	gboolean updated = fix_offset(m, dst, &xm->cursor);
+	if (updated) {
+		// offset was updated
+		// -> move the windows
+		XMoveWindow(display, xm->destinations[i].window, dst->offset.x, dst->offset.y);
+	}
+	return updated;
+}
+
+// redraw an area of the pixmap in all destinations of the mirror
+//
+// Only the destinations displaying (a part of) this area are redrawn (in
+// video wall mode each tile displays only a sub-rectangle of the pixmap).
+void
+x11_clear_area(struct mirror* m, int x, int y, int width, int height)
+{
+	struct x11_mirror* xm = X11_MIRROR(m);
+	const GdkRectangle area = { x, y, width, height };
+	int i;
+#ifdef HAVE_GLX
+	if (gl.context) {
+		// presented later (see x11_gl_present())
+		x11_gl_damage(m, &area);
+		return;
+	}
+#endif
+	GdkRectangle src_area = { 0, 0, 0, 0 };
+	if (xm->scale_src.image)
 	{
-		Window w = active_window;
-		Window root, parent, *children;
-		unsigned int nchildren;
+		// read back once for all the scaled destinations
+		const GdkRectangle image = { 0, 0, m->src_rect.width, m->src_rect.height };
+		if (gdk_rectangle_intersect(&area, &image, &src_area)) {
+			x11_image_get(&xm->scale_src, xm->pixmap, &src_area);
+		}
+	}
 
-		// identify the top-level window
-		parent = w;
-		while(parent != root_window)
+	for (i=0 ; i<m->n_destinations ; i++)
+	{
+		// visible part of the subwindow
+		struct destination* dst = &m->destinations[i];
+		GdkRectangle r = { -dst->offset.x, -dst->offset.y, dst->rect.width, dst->rect.height };
+		GdkRectangle a = area;
+		if (xm->destinations[i].scaler)
 		{
-			w = parent;
-			if(!XQueryTree(display, w, &root, &parent, &children, &nchildren))
-				goto err;
-			XFree(children);
+			// update the scaled copy first
+			if (!src_area.width) {
+				continue;
+			}
+			x11_scale_area(m, i, &src_area, &a);
+		}
+#ifdef HAVE_XRENDER
+		if (xm->destinations[i].transform_pixmap)
+		{
+			// update the transformed copy first
+			const GdkRectangle image = { 0, 0, m->src_rect.width, m->src_rect.height };
+			if (!gdk_rectangle_intersect(&area, &image, &a)) {
+				continue;
+			}
+			x11_transform_area(m, i, &a, &a);
+		}
+#endif
+
+		if (gdk_rectangle_intersect(&a, &r, &r)) {
+			XClearArea(display, xm->destinations[i].window, r.x, r.y, r.width, r.height, FALSE);
 		}
-		
-		// get its coordinates
-		x11_get_window_geometry(w, &active_window_rect);
 	}
-err:	
-	gdk_x11_display_error_trap_pop_ignored(gdisplay);
 }
 
-Window
-x11_get_active_window()
+//
+// Read-back (recording and export)
+//
+// The pixmap of the first mirror (including the cursor) is read back into
+// readback_image (the canvas of the recorder and of the export).
+//
+// The refreshes (possibly run by the render thread) only accumulate the
+// modified areas, which are read back together by the main loop at the frame
+// rate of the recording: a single synchronous request per tick, whatever the
+// number of refreshes and cursor redraws. The main connection may then read
+// the pixmap between two requests of the render thread (eg: while the cursor
+// is moved), the next tick reads the area again.
+//
+// The recorder and the export expect XRGB pixels: on the other TrueColor
+// screens (eg: 30-bit deep color or 16-bit), the modified areas are converted
+// with the masks of the visual into readback_canvas.
+//
+// With --scale, the frames have the size of the image displayed by the first
+// destination (when the recording starts): the area read back is scaled by
+// readback_scaler into readback_scaled, which is the canvas instead.
+//
+
+gboolean x11_readback_on_tick(gpointer data);
+
+void
+x11_readback_start()
 {
-	Window result = 0;
-	Window* w;
-	Atom actual_type_return;
-	int  actual_format_return;
-	unsigned long nitems_return, bytes_after_return;
+	struct mirror* m = &mirrors[0];
+	Visual* visual = DefaultVisual(display, screen);
+	int width = m->src_rect.width, height = m->src_rect.height;
 
-	if (XGetWindowProperty(display, root_window, net_active_window_atom, 0, 1,
-			FALSE, AnyPropertyType,	&actual_type_return,
-			&actual_format_return, &nitems_return,
-			&bytes_after_return, (unsigned char**)&w)
-		== Success)
+	if ((!config.opt_record && !config.opt_export) || readback_image.image) {
+		return;
+	}
+	if (visual->class != TrueColor) {
+		squint_error("The recording and the export require a TrueColor screen");
+		return;
+	}
+
+	x11_image_create(&readback_image, width, height);
+	XImage* image = readback_image.image;
+	if ((image->bits_per_pixel != 32) && (image->bits_per_pixel != 16)) {
+		squint_error("Cannot read back the mirror");
+		x11_readback_stop();
+		return;
+	}
+
+	const void* canvas = image->data;
+	int stride = image->bytes_per_line;
+	if (!x11_image_is_xrgb(&readback_image))
 	{
-		result = *w;
-		XFree(w);
+		// not XRGB -> converted copy
+		const unsigned long masks[3] = { visual->red_mask, visual->green_mask, visual->blue_mask };
+		int i;
+		for (i=0 ; i<3 ; i++)
+		{
+			readback_channels[i].mask  = masks[i];
+			readback_channels[i].shift = masks[i] ? __builtin_ctzl(masks[i]) : 0;
+			readback_channels[i].bits  = __builtin_popcountl(masks[i]);
+		}
+		readback_canvas = g_new0(guint32, (gsize)width * height);
+		canvas = readback_canvas;
+		stride = width * sizeof(guint32);
 	}
-	return result;
+
+	if (config.scale_filter && m->n_destinations && !m->wall)
+	{
+		GdkRectangle fit;
+		scaler_fit(width, height, MAX(m->destinations[0].rect.width, 1),
+				MAX(m->destinations[0].rect.height, 1), &fit);
+		readback_scaler = scaler_new(config.scale_filter, width, height, fit.width, fit.height);
+		readback_scaled = g_new0(guint32, (gsize)fit.width * fit.height);
+		readback_scaled_width = fit.width;
+		canvas = readback_scaled;
+		width  = fit.width;
+		height = fit.height;
+		stride = width * sizeof(guint32);
+	}
+	record_start(canvas, width, height, stride);
+	export_start(canvas, width, height, stride);
+
+	readback_pending = (GdkRectangle){ 0, 0, image->width, image->height };
+	readback_timer = g_timeout_add(READBACK_PERIOD, x11_readback_on_tick, NULL);
 }
 
+// convert an area of readback_image into readback_canvas
 void
-x11_active_window_stop_monitoring()
+x11_readback_convert(const GdkRectangle* r)
 {
-	if (!gdk_x11_window_lookup_for_display(gdisplay, active_window))
+	const XImage* image = readback_image.image;
+	int x, y, i;
+	for (y=r->y ; y<r->y+r->height ; y++)
 	{
-		// ignore X11 errors (this function can produce BadWindow errors since
-		// it makes queries on windows controlled by other applications)
-		gdk_x11_display_error_trap_push(gdisplay);
+		const char* row = image->data + y * image->bytes_per_line;
+		guint32* out = readback_canvas + y * image->width;
+		for (x=r->x ; x<r->x+r->width ; x++)
+		{
+			unsigned long pixel = (image->bits_per_pixel == 32)
+				? ((const guint32*)row)[x] : ((const guint16*)row)[x];
+			guint32 xrgb = 0;
+			for (i=0 ; i<3 ; i++)
+			{
+				// scaled to 8 bits
+				unsigned long v = (pixel & readback_channels[i].mask) >> readback_channels[i].shift;
+				int bits = readback_channels[i].bits;
+				if (bits >= 8) {
+					v >>= bits - 8;
+				} else if (bits) {
+					v = v * 255 / ((1 << bits) - 1);
+				}
+				xrgb = (xrgb << 8) | v;
+			}
+			out[x] = xrgb;
+		}
+	}
+}
 
-		XSetWindowAttributes attr;
-		attr.event_mask = 0;
-		XChangeWindowAttributes(display, active_window, CWEventMask, &attr);
+void
+x11_readback_stop()
+{
+	if (!readback_image.image) {
+		return;
+	}
+	if (readback_timer) {
+		g_source_remove(readback_timer);
+		readback_timer = 0;
 
-		gdk_x11_display_error_trap_pop_ignored(gdisplay);
-	} 
-	active_window = 0;
+		// last changes
+		x11_readback_on_tick(NULL);
+
+		record_stop();
+		export_stop();
+	}
+	g_free(readback_canvas);
+	readback_canvas = NULL;
+	scaler_free(readback_scaler);
+	readback_scaler = NULL;
+	g_free(readback_scaled);
+	readback_scaled = NULL;
+
+	x11_image_destroy(&readback_image);
 }
 
+// an area of the pixmap of the mirror was modified (x, y relative to src_rect)
 void
-x11_active_window_start_monitoring()
+x11_readback_area(struct mirror* m, int x, int y, int width, int height)
 {
-	if (active_window)
-		x11_active_window_stop_monitoring();
-
-	if (config.opt_passive)
+	if (!readback_image.image || (m != &mirrors[0])) {
 		return;
-
-	active_window = x11_get_active_window();
-	if (!active_window)
+	}
+	GdkRectangle r = { x, y, width, height };
+	const GdkRectangle image = { 0, 0, readback_image.image->width, readback_image.image->height };
+	if (!gdk_rectangle_intersect(&r, &image, &r)) {
 		return;
+	}
 
-	x11_refresh_active_window_geometry();
-	if (!memcmp(&active_window_rect, &root_window_rect, sizeof(GdkRectangle))) {
-		// same geometry as the root window
-		// -> ignore it
-		// TODO: make the match more loose
-		active_window = 0;
-		return;
+	g_mutex_lock(&readback_lock);
+	if (readback_pending.width) {
+		gdk_rectangle_union(&r, &readback_pending, &readback_pending);
+	} else {
+		readback_pending = r;
 	}
+	g_mutex_unlock(&readback_lock);
+}
 
-	if (!gdk_x11_window_lookup_for_display(gdisplay, active_window))
+// read back the areas modified since the previous tick (main thread)
+gboolean
+x11_readback_on_tick(gpointer data)
+{
+	struct mirror* m = &mirrors[0];
+	const XImage* image = readback_image.image;
+
+	g_mutex_lock(&readback_lock);
+	GdkRectangle r = readback_pending;
+	readback_pending.width = 0;
+	g_mutex_unlock(&readback_lock);
+	if (!r.width) {
+		return G_SOURCE_CONTINUE;
+	}
+
+	x11_image_get(&readback_image, X11_MIRROR(m)->pixmap, &r);
+	if (readback_canvas) {
+		x11_readback_convert(&r);
+	}
+	if (readback_scaler)
 	{
-		// this is a foreign window
-		// -> we need to monitor it explicitely
-		
-		 
-		// ignore X11 errors (this function can produce BadWindow errors since
-		// it makes queries on windows controlled by other applications)
-		gdk_x11_display_error_trap_push(gdisplay);
+		// scaled frames
+		const void* src = readback_canvas ? (const void*)readback_canvas : image->data;
+		int src_stride  = readback_canvas ? image->width * (int)sizeof(guint32) : image->bytes_per_line;
+		GdkRectangle s;
+		scaler_map_area(readback_scaler, &r, &s);
+		scaler_run(readback_scaler, src, src_stride, readback_scaled,
+				readback_scaled_width * sizeof(guint32), &s, 1);
+		r = s;
+	}
+	record_damage(r.x, r.y, r.width, r.height);
+	export_damage(r.x, r.y, r.width, r.height);
+	return G_SOURCE_CONTINUE;
+}
 
-		XSetWindowAttributes attr;
-		attr.event_mask = StructureNotifyMask;
-		XChangeWindowAttributes(display, active_window, CWEventMask, &attr);
 
-		gdk_x11_display_error_trap_pop_ignored(gdisplay);
+//
+// Cursor prediction
+//
+// The cursor is drawn into the pixmap when the motion of the pointer is
+// received, it is displayed at the next frame of the destination. To hide
+// this delay (and the latency of the capture), the cursor is drawn where the
+// pointer is expected to be at the display time, extrapolated from the
+// locations queried on the previous motion events (see predictor_predict()).
+// The samples are dated with the server time of the motion events (see
+// x11_event_time()): the delays of the event loop do not distort the
+// velocity, they are compensated by the extrapolation instead.
+// The cursor is kept inside the source monitor of the pointer and redrawn at
+// the real location shortly after the pointer stopped. The remaining
+// (uncompensated) delay is reported in stats.cursor_latency.
+//
+// Disabled with --no-prediction or at runtime with the 'prediction' action.
+//
+
+#define PREDICTION_SETTLE	20	// ms
+#define PREDICTION_MAX_LATENCY	100000	// µs (beyond, the clocks are synchronized again)
+
+// local time (µs, monotonic) of the server timestamp of an input event
+//
+// The offset between the clocks is the one of the fastest event received. It
+// is measured again if the server time moves ahead of the local one or if
+// the latency becomes too large (eg: drift of a remote server).
+gint64
+x11_event_time(Time time)
+{
+	static guint32 base_time = 0;	// server (ms)
+	static gint64  base_local = 0;	// local time of base_time (0 if not synchronized)
+	gint64 now = g_get_monotonic_time();
+
+	// (the server time wraps after 49 days)
+	gint64 local = base_local + (gint64)(gint32)((guint32)time - base_time) * 1000;
+	if (!base_local || (local > now) || (now - local > PREDICTION_MAX_LATENCY)) {
+		base_time  = time;
+		base_local = now;
+		local = now;
+	}
+	return local;
+}
+
+void
+x11_cancel_prediction_timeout()
+{
+	if (prediction_timeout) {
+		g_source_destroy(prediction_timeout);
+		g_source_unref(prediction_timeout);
+		prediction_timeout = NULL;
+	}
+}
+
+gboolean
+x11_on_prediction_timeout(gpointer data)
+{
+	g_source_unref(prediction_timeout);
+	prediction_timeout = NULL;
+
+	// new sample (at the same location if the pointer stopped)
+	x11_refresh_cursor_location(FALSE, 0);
+	XFlush(display);
+	return G_SOURCE_REMOVE;
+}
+
+// the delay between the drawing of the cursor and its display is a frame of
+// the first destination
+void
+x11_update_display_delay(struct mirror* m)
+{
+	int rate = 0;	// mHz
+	if (m->n_destinations && m->destinations[0].monitor) {
+		rate = gdk_monitor_get_refresh_rate(m->destinations[0].monitor);
+	}
+	X11_MIRROR(m)->display_delay = !m->n_destinations ? 0
+		: (G_USEC_PER_SEC * (gint64)1000 / ((rate > 0) ? rate : 60000));
+}
+
+// location of the pointer at the time the cursor of mirror m is displayed
+//
+// time: of the sample of the pointer
+//
+// return the delay of the cursor behind the pointer, once displayed (µs, -1
+// if the cursor is not displayed)
+gint64
+x11_predict_pointer(struct mirror* m, gint64 now, gint64 time, const GdkPoint* pointer, GdkPoint* p)
+{
+	struct x11_mirror* xm = X11_MIRROR(m);
+	GdkRectangle bounds = { 0, 0, 0, 0 };	// source monitor of the pointer
+	const GdkRectangle point = { pointer->x, pointer->y, 1, 1 };
+	gint64 horizon = 0;
+	int j;
+
+	*p = *pointer;
+	if (m->n_sources) {
+		for (j=0 ; j<m->n_sources ; j++) {
+			if (gdk_rectangle_intersect(&point, &m->sources[j].rect, NULL)) {
+				bounds = m->sources[j].rect;
+			}
+		}
+	}
+#ifdef HAVE_XCOMPOSITE
+	else if (m->capture_window) {
+		bounds = xm->window_rect;
+	}
+#endif
+	else {
+		bounds = m->src_rect;
+	}
+	if (!gdk_rectangle_intersect(&point, &bounds, NULL)) {
+		// the cursor is not displayed
+		return -1;
+	}
+
+	if (!config.opt_no_prediction)
+	{
+		horizon = predictor_predict(&predictor, now, xm->display_delay, p);
+		p->x = CLAMP(p->x, bounds.x, bounds.x + bounds.width  - 1);
+		p->y = CLAMP(p->y, bounds.y, bounds.y + bounds.height - 1);
+
+		if (horizon && !prediction_timeout)
+		{
+			// (the scheduler may run in the render thread)
+			prediction_timeout = g_timeout_source_new(PREDICTION_SETTLE);
+			g_source_set_callback(prediction_timeout, x11_on_prediction_timeout, NULL, NULL);
+			g_source_attach(prediction_timeout, g_main_context_get_thread_default());
+		}
+	}
+
+	return MAX(now + xm->display_delay - time - horizon, 0);
+}
+
+// query the location of the pointer and redraw the cursors
+//
+// time: of the motion (µs, see x11_event_time()), 0 if now
+void
+x11_refresh_cursor_location(gboolean force, gint64 time)
+{
+	Window root_return, w;
+	int wx, wy;
+	unsigned int mask;
+	GdkPoint pointer;
+
+	if (paused) {
+		// (refreshed by x11_resume())
+		return;
+	}
+	XQueryPointer(display, root_window, &root_return, &w,
+			&pointer.x, &pointer.y, &wx, &wy, &mask);
+	pointer_location = pointer;
+
+	gint64 now = g_get_monotonic_time();
+	if (!time) {
+		time = now;
 	}
+	predictor_add(&predictor, time, &pointer);
+
+	gint64 latency = -1;	// (of the first mirror displaying the cursor)
+	int i, j;
+	for (i=0 ; i<n_mirrors ; i++)
+	{
+		struct mirror* m = &mirrors[i];
+		struct x11_mirror* xm = X11_MIRROR(m);
+		const GdkRectangle* src_rect = &m->src_rect;
+		GdkPoint p;
+		gboolean inside = FALSE;
+
+		if (m->source_display) {
+			// the local pointer is not related to this mirror (see
+			// x11_remote_on_update())
+			continue;
+		}
+
+		// (where the cursor is drawn)
+		gint64 l = x11_predict_pointer(m, now, time, &pointer, &p);
+		if (latency < 0) {
+			latency = l;
+		}
+		GdkPoint c = { p.x - src_rect->x, p.y - src_rect->y };
+
+		if (m->zoom && zoom_set_target(m, &pointer))
+		{
+			// magnifier: the area follows the pointer (the cursor may be
+			// outside the area while it is moving)
+			inside = TRUE;
+			x11_start_zoom_timer();
+		}
+
+#ifdef HAVE_XCOMPOSITE
+		if (m->capture_window) {
+			// src_rect is in the coordinates of the window
+			c.x = p.x - xm->window_rect.x;
+			c.y = p.y - xm->window_rect.y;
+		}
+#endif
+
+		if (m->n_sources)
+		{
+			// mosaic
+			c = p;
+			if (!mosaic_map_point(m, &c)) {
+				c.x = c.y = -1;
+			}
+		}
+		else if ((c.x<0) | (c.y<0) | (c.x>=src_rect->width) | (c.y>=src_rect->height))
+		{
+			// cursor is outside the duplicated screen
+			c.x = c.y = -1;
+		}
+
+		// cursor was really moved
+		xm->cursor = c;
+
+		// raise the window when the pointer enters the duplicated screen,
+		// lower it when the pointer leaves
+		x11_set_raised(m, (c.x >= 0) || inside);
+
+		// update the offsets and redraw the cursor
+		x11_redraw_cursor(m, TRUE);
+
+		for (j=0 ; j<m->n_destinations ; j++) {
+			if (x11_fix_offset(m, j)) {
+				XClearWindow(display, xm->destinations[j].window);
+			}
+		}
+	}
+
+	if (latency >= 0) {
+		// (smoothed once per motion)
+		__atomic_store_n(&stats.cursor_latency, (7 * (gint64)STATS_GET(stats.cursor_latency)
+				+ latency) / 8, __ATOMIC_RELAXED);
+	}
+}
+
+// area to be refreshed when resuming (see x11_resume())
+void
+x11_hold_damage(struct mirror* m, const GdkRectangle* damaged_rect)
+{
+	struct x11_mirror* xm = X11_MIRROR(m);
+	if (xm->held_damage.width) {
+		gdk_rectangle_union(&xm->held_damage, damaged_rect, &xm->held_damage);
+	} else {
+		xm->held_damage = *damaged_rect;
+	}
+}
+
+gboolean
+x11_refresh_image(struct mirror* m, const GdkRectangle* damaged_rect)
+{
+	struct x11_mirror* xm = X11_MIRROR(m);
+
+	if (paused) {
+		// copied when resuming
+		x11_hold_damage(m, damaged_rect);
+		return TRUE;
+	}
+
+#ifdef HAVE_XI
+	if (!can_track_cursor)
+#endif
+	{
+		x11_refresh_cursor_location(FALSE, 0);
+	}
+
+	// location of the damaged area relative to the source rect
+	int x = damaged_rect->x - m->src_rect.x;
+	int y = damaged_rect->y - m->src_rect.y;
+
+	x11_clear_cursor(m);
+
+	if (m->n_sources)
+	{
+#ifdef HAVE_XRENDER
+		x11_refresh_mosaic(m, damaged_rect);
+#endif
+	}
+#ifdef HAVE_XCOMPOSITE
+	else if (m->capture_window)
+	{
+		// copy from the backing pixmap of the window (which includes the
+		// border)
+		if (xm->window_pixmap) {
+#ifdef HAVE_XRENDER
+			if (xm->window_picture)
+			{
+				// different depth -> converted by the X server
+				if (!xm->window_dst_picture) {
+					xm->window_dst_picture = XRenderCreatePicture(display,
+							xm->pixmap, screen_format, 0, NULL);
+				}
+				XRenderComposite(display, PictOpSrc,
+						xm->window_picture, None, xm->window_dst_picture,
+						damaged_rect->x + xm->window_border,
+						damaged_rect->y + xm->window_border,
+						0, 0, x, y,
+						damaged_rect->width, damaged_rect->height);
+			} else
+#endif
+			XCopyArea (display, xm->window_pixmap, xm->pixmap, gc,
+					damaged_rect->x + xm->window_border,
+					damaged_rect->y + xm->window_border,
+					damaged_rect->width , damaged_rect->height,
+					x, y);
+			STATS_ADD(stats.pixels, damaged_rect->width * damaged_rect->height);
+		}
+	}
+#endif
+	else {
+		Drawable source = root_window;
+#ifdef HAVE_XSHM
+		if (m->source_display) {
+			// copy of the screen of the source display
+			source = remote.pixmap;
+		}
+#endif
+		XCopyArea (display, source, xm->pixmap, gc,
+				damaged_rect->x,     damaged_rect->y,
+				damaged_rect->width , damaged_rect->height,
+				x, y);
+		STATS_ADD(stats.pixels, damaged_rect->width * damaged_rect->height);
+	}
+
+	x11_draw_cursor(m);
+
+	// redraw the damaged area
+	x11_clear_area(m, x, y, damaged_rect->width, damaged_rect->height);
+	x11_readback_area(m, x, y, damaged_rect->width, damaged_rect->height);
+
+	STATS_ADD(stats.frames, 1);
+	squint_first_frame();
+#ifdef HAVE_XSHAPE
+	if (overlay_enabled) {
+		x11_overlay_add_rect(m, x, y, damaged_rect->width, damaged_rect->height);
+	}
+#endif
+
+	XFlush (display);
+
+	return TRUE;
+}
+
+// move the area of the magnifiers towards the pointer (one step per frame)
+gboolean
+x11_on_zoom_timer(gpointer data)
+{
+	gboolean moving = FALSE;
+	int i;
+
+	for (i=0 ; i<n_mirrors ; i++)
+	{
+		struct mirror* m = &mirrors[i];
+		struct x11_mirror* xm = X11_MIRROR(m);
+		if (!m->zoom || !zoom_step(m)) {
+			continue;
+		}
+		moving = TRUE;
+
+		// the cursor moves inside the image too
+		xm->cursor = pointer_location;
+		if (!mosaic_map_point(m, &xm->cursor)) {
+			xm->cursor.x = xm->cursor.y = -1;
+		}
+
+		// capture the new area
+		x11_refresh_image(m, &m->src_rect);
+	}
+
+	if (!moving) {
+		zoom_timer = 0;
+		return G_SOURCE_REMOVE;
+	}
+	return G_SOURCE_CONTINUE;
+}
+
+void
+x11_start_zoom_timer()
+{
+	if (!zoom_timer) {
+		int period = scheduler_get_min_refresh_period();
+		zoom_timer = g_timeout_add(period ? period : 1000/60, x11_on_zoom_timer, NULL);
+	}
+}
+
+// periodic refresh of all mirrors (when XDamage is not available)
+gboolean
+x11_on_refresh_timer(gpointer data)
+{
+	int i;
+	for (i=0 ; i<n_mirrors ; i++) {
+		x11_refresh_image(&mirrors[i], &mirrors[i].src_rect);
+	}
+	return G_SOURCE_CONTINUE;
+}
+
+void
+x11_start_refresh_timer()
+{
+#if HAVE_XDAMAGE && HAVE_XI
+	if (damage && can_track_cursor) {
+		// not needed
+		return;
+	}
+#endif
+	int rate = 25; // default to 25 fps
+	if(config.opt_rate > 0) {
+		rate = config.opt_rate;
+	} else if ((config.opt_limit > 0) && (config.opt_limit < rate)) {
+		rate = config.opt_limit;
+	}
+
+	refresh_timer = g_timeout_add (1000/rate, x11_on_refresh_timer, NULL);
+}
+
+
+
+#ifdef COPY_CURSOR
+void
+x11_refresh_cursor_image()
+{
+	XFixesCursorImage* img = XFixesGetCursorImage (display);
+	if (!img)
+		return;
+
+	int width  = (img->width  < CURSOR_SIZE) ? img->width  : CURSOR_SIZE;
+	int height = (img->height < CURSOR_SIZE) ? img->height : CURSOR_SIZE;
+
+	int x, y;
+	// copy the cursor image
+	for(y=0 ; y<height ; y++)
+	{
+		for(x=0 ; x<width ; x++)
+		{
+			cursor_pixels[y*CURSOR_SIZE + x] = img->pixels[y*img->width + x];
+		}
+	}
+
+	// clear the cursor_pixmap and upload the new image
+	XFillRectangle(display, cursor_pixmap, cursor_gc, 0, 0, CURSOR_SIZE, CURSOR_SIZE);
+	XPutImage(display, cursor_pixmap, cursor_gc, cursor_image,
+			0, 0, 0, 0, width, height);
+	cursor_xhot = img->xhot;
+	cursor_yhot = img->yhot;
+
+	XFree(img);
+
+#if HAVE_XDAMAGE && HAVE_XI
+	if (render.thread) {
+		// the cursors are drawn by the render thread (once the new
+		// image is uploaded)
+		XSync(display, False);
+		x11_render_request(RENDER_REDRAW_CURSOR);
+		return;
+	}
+#endif
+	int i;
+	for (i=0 ; i<n_mirrors ; i++) {
+		x11_redraw_cursor(&mirrors[i], TRUE);
+	}
+}
+
+// window receiving the cursor change notifications (the root window in
+// headless mode)
+Window
+x11_cursor_notify_window()
+{
+	return mirrors[0].n_destinations
+		? gdk_x11_window_get_xid(mirrors[0].destinations[0].gdkwin)
+		: root_window;
+}
+
+void
+x11_init_copy_cursor()
+{
+	// ensure we are in true color (the cursor is composed by XRender, which
+	// converts it to the depth of the screen)
+	if (DefaultVisual(display, screen)->class != TrueColor) {
+		return;
+	}
+
+	// ensure the screen supports 32 bit depth
+	{
+		int depth_count = 0;
+		int* depths = XListDepths(display, screen, &depth_count);
+		if (depths == NULL) {
+			return;
+		}
+		int i;
+		for (i=depth_count-1 ; i>=0 ; i--) {
+			if (depths[i] == 32) {
+				break;
+			}
+		}
+		XFree(depths);
+		if (i < 0) {
+			return;
+		}
+	}
+
+	// check if xfixes and xrender are available on this display
+	int major=1, minor=0, event_base, error_base;
+	if ((	   !XFixesQueryExtension(display, &xfixes_event_base, &error_base)
+		|| !XFixesQueryVersion(display, &major, &minor)
+		|| (major<1)
+		|| !XRenderQueryExtension(display, &event_base, &error_base)
+		|| !screen_format
+	)) {
+		return;
+	}
+
+	// create an image for storing the cursor
+	cursor_pixels = (uint32_t*) malloc(CURSOR_PIXELS_SIZE);
+	cursor_image = XCreateImage(display, NULL, 32, ZPixmap, 0, (char*)cursor_pixels,
+				CURSOR_SIZE, CURSOR_SIZE, 32, 4*CURSOR_SIZE);
+	if (!cursor_image) {
+		squint_error("XCreateImage() failed");
+		return;
+	}
+
+	// create a pixmap for storing the cursor
+	cursor_pixmap = XCreatePixmap(display, root_window,
+				CURSOR_SIZE, CURSOR_SIZE, 32);
+
+	// create a context for manipulating the cursor pixmap (must have 32-bit depth)
+	cursor_gc = XCreateGC(display, cursor_pixmap, 0, NULL);
+	if(!cursor_gc) {
+		squint_error("XCreateGC() failed");
+		return;
+	}
+
+	// create a picture for the cursor_pixmap
+	cursor_picture = XRenderCreatePicture(display, cursor_pixmap,
+			XRenderFindStandardFormat(display, PictStandardARGB32),
+			0, NULL);
+}
+
+void
+x11_enable_copy_cursor()
+{
+	if (copy_cursor || (cursor_picture == 0)) {
+		return;
+	}
+
+	// create a picture for the main pixmaps
+	int i;
+	for (i=0 ; i<n_mirrors ; i++) {
+		x11_mirrors[i].pixmap_picture = XRenderCreatePicture(display, x11_mirrors[i].pixmap,
+				screen_format, 0, NULL);
+	}
+
+	copy_cursor = TRUE;
+
+	// refresh the cursor
+	x11_refresh_cursor_image();
+
+	x11_refresh_cursor_location(TRUE, 0);
+
+	// request cursor change notifications (see x11_resume())
+	if (!paused) {
+		XFixesSelectCursorInput(display, x11_cursor_notify_window(), XFixesCursorNotify);
+	}
+}
+
+void
+x11_disable_copy_cursor()
+{
+	if (!copy_cursor) {
+		return;
+	}
+	copy_cursor = FALSE;
+
+	int i;
+	for (i=0 ; i<n_mirrors ; i++)
+	{
+		if (x11_mirrors[i].pixmap_picture) {
+			XRenderFreePicture(display, x11_mirrors[i].pixmap_picture);
+			x11_mirrors[i].pixmap_picture = 0;
+		}
+	}
+}
+#endif
+
+#ifdef HAVE_XSHAPE
+//
+// Debug overlay
+//
+// The rectangles copied by x11_refresh_image() are outlined in red (and faded
+// over time) and a small HUD displays the performance counters. They are
+// drawn into a pixmap used as the background of a child window stacked above
+// each subwindow; the shape of this window is reduced to the outlines and
+// the HUD, so the mirror stays visible around them and the refreshes of the
+// subwindow (possibly by the render thread) never erase them. Nothing is ever
+// drawn into the pixmap of the mirror.
+//
+// The timer runs only while some rectangles are fading, then once per second
+// until the HUD is stable. The input goes through the window (empty input
+// shape).
+//
+// Note: the overlay generates damage events only inside the destinations, thus they
+// are ignored by compute_damaged_rect() and do not affect the counters.
+//
+
+gboolean x11_overlay_redraw(gpointer data);
+
+// (main thread, overlay_lock held)
+void
+x11_overlay_set_period(guint period)
+{
+	if (overlay_timer) {
+		g_source_remove(overlay_timer);
+	}
+	overlay_timer  = period ? g_timeout_add(period, x11_overlay_redraw, NULL) : 0;
+	overlay_period = period;
+}
+
+gboolean
+x11_overlay_on_wakeup(gpointer data)
+{
+	g_mutex_lock(&overlay_lock);
+	overlay_wakeup = 0;
+	if (overlay_period != OVERLAY_PERIOD) {
+		x11_overlay_set_period(OVERLAY_PERIOD);
+	}
+	g_mutex_unlock(&overlay_lock);
+	return G_SOURCE_REMOVE;
+}
+
+// (called by the thread running the scheduler)
+void
+x11_overlay_add_rect(struct mirror* m, int x, int y, int width, int height)
+{
+	g_mutex_lock(&overlay_lock);
+	overlay_rects[overlay_next].mirror = m - mirrors;
+	overlay_rects[overlay_next].rect = (GdkRectangle){x, y, width, height};
+	overlay_rects[overlay_next].time = g_get_monotonic_time();
+	overlay_next = (overlay_next + 1) % OVERLAY_MAX_RECTS;
+
+	if ((overlay_period != OVERLAY_PERIOD) && !overlay_wakeup) {
+		overlay_wakeup = g_idle_add(x11_overlay_on_wakeup, NULL);
+	}
+	g_mutex_unlock(&overlay_lock);
+}
+
+// return TRUE if the text of the HUD was changed
+gboolean
+x11_overlay_update_hud(gint64 now)
+{
+	static gint64  last_time = 0;
+	static guint   last_frames = 0, last_drops = 0;
+	static guint64 last_pixels = 0;
+
+	gint64 elapsed = now - last_time;
+	if (elapsed < G_USEC_PER_SEC) {
+		return FALSE;
+	}
+
+	guint   frames = STATS_GET(stats.frames);
+	guint64 pixels = STATS_GET(stats.pixels);
+	guint   drops  = STATS_GET(stats.drops);
+
+	double s = (double)elapsed / G_USEC_PER_SEC;
+	char hud[sizeof(overlay_hud)];
+	g_snprintf(hud, sizeof(hud),
+			"%5.1f fps  %7.2f Mpx/s  %5.1f drops/s  %4.1f ms cursor",
+			(frames - last_frames) / s,
+			(pixels - last_pixels) / s / 1e6,
+			(drops  - last_drops)  / s,
+			STATS_GET(stats.cursor_latency) / 1e3);
+
+	last_time   = now;
+	last_frames = frames;
+	last_pixels = pixels;
+	last_drops  = drops;
+
+	if (!strcmp(hud, overlay_hud)) {
+		return FALSE;
+	}
+	strcpy(overlay_hud, hud);
+	return TRUE;
+}
+
+// draw the overlay of destination j
+void
+x11_overlay_draw(struct mirror* m, int j, const struct x11_overlay_rect* rects, int n, gint64 now)
+{
+	struct x11_destination* xd = &X11_MIRROR(m)->destinations[j];
+	XRectangle shape[4*OVERLAY_MAX_RECTS + 1];
+	int i, n_shape = 0;
+
+	// outlines (the most recent ones on top)
+	for (i=0 ; i<n ; i++)
+	{
+		if (&mirrors[rects[i].mirror] != m) {
+			continue;
+		}
+		GdkRectangle t;
+		if (xd->scaler) {
+			scaler_map_area(xd->scaler, &rects[i].rect, &t);
+		} else {
+			transform_rect(m->destinations[j].transform,
+					m->src_rect.width, m->src_rect.height, &rects[i].rect, &t);
+		}
+
+		// red/orange, fading to black
+		gint64 age = (now - rects[i].time) / 1000;
+		unsigned long level = 0xff * (OVERLAY_FADE_TIME - age) / OVERLAY_FADE_TIME;
+		XSetForeground(display, overlay_gc, (level << 16) | ((level/4) << 8));
+
+		XRectangle* edges = &shape[n_shape];
+		int b = OVERLAY_BORDER;
+		edges[0] = (XRectangle){ t.x, t.y, t.width, MIN(b, t.height) };
+		edges[1] = (XRectangle){ t.x, t.y + t.height - edges[0].height, t.width, edges[0].height };
+		edges[2] = (XRectangle){ t.x, t.y, MIN(b, t.width), t.height };
+		edges[3] = (XRectangle){ t.x + t.width - edges[2].width, t.y, edges[2].width, t.height };
+		XFillRectangles(display, xd->overlay_pixmap, overlay_gc, edges, 4);
+		n_shape += 4;
+	}
+
+	// HUD in the top-left corner of the visible area
+	if (overlay_hud[0])
+	{
+		int x = MAX(0, -m->destinations[j].offset.x) + 8;
+		int y = MAX(0, -m->destinations[j].offset.y) + 8;
+		int width = 6*strlen(overlay_hud)+8;
+		XSetForeground(display, overlay_gc, BlackPixel(display, screen));
+		XFillRectangle(display, xd->overlay_pixmap, overlay_gc, x, y, width, 18);
+		XSetForeground(display, overlay_gc, WhitePixel(display, screen));
+		XDrawString(display, xd->overlay_pixmap, overlay_gc, x+4, y+13,
+				overlay_hud, strlen(overlay_hud));
+		shape[n_shape++] = (XRectangle){ x, y, width, 18 };
+	}
+
+	XShapeCombineRectangles(display, xd->overlay_window, ShapeBounding, 0, 0,
+			shape, n_shape, ShapeSet, Unsorted);
+	XClearWindow(display, xd->overlay_window);
+}
+
+gboolean
+x11_overlay_redraw(gpointer data)
+{
+	struct x11_overlay_rect rects[OVERLAY_MAX_RECTS];
+	gint64 now = g_get_monotonic_time();
+	gboolean hud_changed = x11_overlay_update_hud(now);
+	int i, j, n = 0;
+
+	g_mutex_lock(&overlay_lock);
+
+	// live rectangles, from the oldest one
+	for (i=0 ; i<OVERLAY_MAX_RECTS ; i++)
+	{
+		struct x11_overlay_rect* r = &overlay_rects[(overlay_next + i) % OVERLAY_MAX_RECTS];
+		if (!r->rect.width) {
+			continue;
+		}
+		if ((now - r->time) / 1000 >= OVERLAY_FADE_TIME) {
+			r->rect.width = 0;
+			continue;
+		}
+		rects[n++] = *r;
+	}
+
+	// fading -> animate, just idle or HUD changed -> wait for the next HUD
+	// update, otherwise stop (restarted by x11_overlay_add_rect())
+	guint period = n ? OVERLAY_PERIOD
+		     : ((overlay_period == OVERLAY_PERIOD) || hud_changed) ? OVERLAY_HUD_PERIOD
+		     : 0;
+	gboolean keep = (period == overlay_period);
+	if (!keep) {
+		// (this source is removed when G_SOURCE_REMOVE is returned)
+		overlay_timer = 0;
+		x11_overlay_set_period(period);
+	}
+	g_mutex_unlock(&overlay_lock);
+
+	if (n || overlay_n_drawn || hud_changed)
+	{
+		for (i=0 ; i<n_mirrors ; i++) {
+			for (j=0 ; j<mirrors[i].n_destinations ; j++) {
+				x11_overlay_draw(&mirrors[i], j, rects, n, now);
+			}
+		}
+		XFlush(display);
+	}
+	overlay_n_drawn = n;
+
+	return keep ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+}
+
+void
+x11_enable_overlay()
+{
+	if (!config.opt_overlay) {
+		return;
+	}
+
+	if (!can_use_xshape) {
+		squint_error("The debug overlay requires the Shape extension");
+		return;
+	}
+#ifdef HAVE_GLX
+	if (gl.context) {
+		squint_error("The debug overlay is not available with the OpenGL presenter");
+		return;
+	}
+#endif
+
+	int i, j;
+	for (i=0 ; i<n_mirrors ; i++)
+	{
+		for (j=0 ; j<mirrors[i].n_destinations ; j++)
+		{
+			struct x11_destination* xd = &x11_mirrors[i].destinations[j];
+			Window root;
+			int x, y;
+			unsigned int width, height, border_width, win_depth;
+			XGetGeometry(display, xd->window, &root, &x, &y, &width, &height, &border_width, &win_depth);
+
+			XSetWindowAttributes attr;
+			xd->overlay_pixmap = XCreatePixmap(display, xd->window, width, height, win_depth);
+			attr.background_pixmap = xd->overlay_pixmap;
+			xd->overlay_window = XCreateWindow(display, xd->window, 0, 0, width, height, 0,
+					CopyFromParent, InputOutput, CopyFromParent, CWBackPixmap, &attr);
+
+			// invisible until the first redraw, transparent for the input
+			XShapeCombineRectangles(display, xd->overlay_window, ShapeBounding, 0, 0,
+					NULL, 0, ShapeSet, Unsorted);
+			XShapeCombineRectangles(display, xd->overlay_window, ShapeInput, 0, 0,
+					NULL, 0, ShapeSet, Unsorted);
+			XMapWindow(display, xd->overlay_window);
+		}
+	}
+	overlay_gc = XCreateGC(display, root_window, 0, NULL);
+
+	memset(overlay_rects, 0, sizeof(overlay_rects));
+	overlay_next = 0;
+	overlay_n_drawn = 0;
+	overlay_hud[0] = 0;
+	overlay_enabled = TRUE;
+
+	g_mutex_lock(&overlay_lock);
+	x11_overlay_set_period(OVERLAY_HUD_PERIOD);
+	g_mutex_unlock(&overlay_lock);
+}
+
+// (the render thread must be stopped)
+void
+x11_disable_overlay()
+{
+	overlay_enabled = FALSE;
+	if (overlay_timer) {
+		g_source_remove(overlay_timer);
+		overlay_timer = 0;
+	}
+	overlay_period = 0;
+	if (overlay_wakeup) {
+		g_source_remove(overlay_wakeup);
+		overlay_wakeup = 0;
+	}
+
+	// (the destinations may have been removed by a reconfiguration, the
+	// overlay windows are then already destroyed with their parent)
+	int i, j;
+	gdk_x11_display_error_trap_push(gdisplay);
+	for (i=0 ; i<MAX_MIRRORS ; i++)
+	{
+		for (j=0 ; j<MAX_DESTINATIONS ; j++)
+		{
+			struct x11_destination* xd = &x11_mirrors[i].destinations[j];
+			if (xd->overlay_window) {
+				XDestroyWindow(display, xd->overlay_window);
+				xd->overlay_window = 0;
+			}
+			if (xd->overlay_pixmap) {
+				XFreePixmap(display, xd->overlay_pixmap);
+				xd->overlay_pixmap = 0;
+			}
+		}
+	}
+	gdk_x11_display_error_trap_pop_ignored(gdisplay);
+	if (overlay_gc) {
+		XFreeGC(display, overlay_gc);
+		overlay_gc = NULL;
+	}
+}
+#endif
+
+#ifdef HAVE_GLX
+//
+// OpenGL presenter (--gl)
+//
+// The pixmap of each mirror is bound as a texture (GLX_EXT_texture_from_pixmap)
+// and drawn into the subwindows by a shader which scales it to fit the
+// destination (or the whole video wall) and keeps its aspect ratio. The
+// filter works in linear light: bilinear when magnifying, box filter over the
+// footprint of the pixel when minifying.
+//
+// The areas modified in the pixmap are accumulated by x11_clear_area() and
+// presented once the main loop is idle. Only the matching area of the
+// subwindows is redrawn: the age of the back buffer (GLX_EXT_buffer_age)
+// tells which damages of the previous frames it lacks, the subwindow is
+// redrawn entirely when the age is unknown.
+//
+// All the subwindows share the same context. No hardware driver is required,
+// this runs on Mesa's software rasterizer (llvmpipe) too.
+//
+
+static const char* gl_vertex_shader =
+	"#version 120\n"
+	"attribute vec2 position;	// in the window (pixels, top-left origin)\n"
+	"attribute vec2 texel;		// in the image (texels, top-left origin)\n"
+	"uniform vec2 window_size;\n"
+	"varying vec2 coord;\n"
+	"void main() {\n"
+	"	coord = texel;\n"
+	"	gl_Position = vec4(position.x / window_size.x * 2.0 - 1.0,\n"
+	"			1.0 - position.y / window_size.y * 2.0, 0.0, 1.0);\n"
+	"}\n";
+
+static const char* gl_fragment_shader =
+	"#version 120\n"
+	"uniform sampler2D image;\n"
+	"uniform vec2 image_size;\n"
+	"uniform float footprint;	// size of a pixel of the window (in texels)\n"
+	"uniform float y_inverted;\n"
+	"varying vec2 coord;\n"
+	"\n"
+	"vec3 decode(vec3 c) {		// sRGB -> linear\n"
+	"	return mix(c / 12.92, pow((c + 0.055) / 1.055, vec3(2.4)), step(0.04045, c));\n"
+	"}\n"
+	"vec3 encode(vec3 c) {		// linear -> sRGB\n"
+	"	return mix(c * 12.92, 1.055 * pow(c, vec3(1.0/2.4)) - 0.055, step(0.0031308, c));\n"
+	"}\n"
+	"vec3 fetch(vec2 t) {\n"
+	"	vec2 uv = (clamp(t, vec2(0.0), image_size - 1.0) + 0.5) / image_size;\n"
+	"	uv.y = mix(1.0 - uv.y, uv.y, y_inverted);\n"
+	"	return decode(texture2D(image, uv).rgb);\n"
+	"}\n"
+	"\n"
+	"void main() {\n"
+	"	vec3 c = vec3(0.0);\n"
+	"	if (footprint <= 1.0) {\n"
+	"		// bilinear\n"
+	"		vec2 p = coord - 0.5;\n"
+	"		vec2 i = floor(p);\n"
+	"		vec2 f = p - i;\n"
+	"		c = mix(mix(fetch(i),                 fetch(i + vec2(1.0, 0.0)), f.x),\n"
+	"			mix(fetch(i + vec2(0.0, 1.0)), fetch(i + vec2(1.0, 1.0)), f.x), f.y);\n"
+	"	} else {\n"
+	"		// box filter (up to 4x4 samples)\n"
+	"		float n = min(ceil(footprint), 4.0);\n"
+	"		for (float y = 0.0 ; y < n ; y++) {\n"
+	"			for (float x = 0.0 ; x < n ; x++) {\n"
+	"				c += fetch(floor(coord + ((vec2(x, y) + 0.5) / n - 0.5) * footprint));\n"
+	"			}\n"
+	"		}\n"
+	"		c /= n * n;\n"
+	"	}\n"
+	"	gl_FragColor = vec4(encode(c), 1.0);\n"
+	"}\n";
+
+gboolean
+x11_gl_has_extension(const char* extensions, const char* name)
+{
+	// (the names are separated by spaces)
+	size_t len = strlen(name);
+	const char* p = extensions;
+	while (p && (p = strstr(p, name)))
+	{
+		if (((p == extensions) || (p[-1] == ' ')) && ((p[len] == ' ') || !p[len])) {
+			return TRUE;
+		}
+		p += len;
+	}
+	return FALSE;
+}
+
+GLuint
+x11_gl_compile(GLenum type, const char* source)
+{
+	GLuint shader = glCreateShader(type);
+	GLint ok;
+	glShaderSource(shader, 1, &source, NULL);
+	glCompileShader(shader);
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+	if (!ok)
+	{
+		char log[512];
+		glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+		char* msg = g_strdup_printf("Cannot compile the shaders of the OpenGL presenter: %s", log);
+		squint_error(msg);
+		g_free(msg);
+		glDeleteShader(shader);
+		return 0;
+	}
+	return shader;
+}
+
+// build the program (the context must be current)
+gboolean
+x11_gl_create_program()
+{
+	GLuint vs = x11_gl_compile(GL_VERTEX_SHADER,   gl_vertex_shader);
+	GLuint fs = x11_gl_compile(GL_FRAGMENT_SHADER, gl_fragment_shader);
+	GLint ok = FALSE;
+
+	if (vs && fs)
+	{
+		gl.program = glCreateProgram();
+		glAttachShader(gl.program, vs);
+		glAttachShader(gl.program, fs);
+		glBindAttribLocation(gl.program, 0, "position");
+		glBindAttribLocation(gl.program, 1, "texel");
+		glLinkProgram(gl.program);
+		glGetProgramiv(gl.program, GL_LINK_STATUS, &ok);
+		if (!ok) {
+			squint_error("Cannot link the shaders of the OpenGL presenter");
+		}
+	}
+	// (released with the program)
+	if (vs) {
+		glDeleteShader(vs);
+	}
+	if (fs) {
+		glDeleteShader(fs);
+	}
+	if (!ok) {
+		return FALSE;
+	}
+
+	gl.u_window_size = glGetUniformLocation(gl.program, "window_size");
+	gl.u_image_size  = glGetUniformLocation(gl.program, "image_size");
+	gl.u_footprint   = glGetUniformLocation(gl.program, "footprint");
+
+	// the state never changes (all the subwindows share the context)
+	glUseProgram(gl.program);
+	glUniform1i(glGetUniformLocation(gl.program, "image"), 0);
+	glUniform1f(glGetUniformLocation(gl.program, "y_inverted"), gl.y_inverted ? 1.0 : 0.0);
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+	glEnable(GL_SCISSOR_TEST);
+	glClearColor(0, 0, 0, 1);
+	return TRUE;
+}
+
+// choose the configuration for binding the pixmaps (the depth of the screen)
+gboolean
+x11_gl_choose_pixmap_config()
+{
+	const int attribs[] = {
+		GLX_DRAWABLE_TYPE,		GLX_PIXMAP_BIT,
+		GLX_BIND_TO_TEXTURE_RGB_EXT,	True,
+		GLX_BIND_TO_TEXTURE_TARGETS_EXT, GLX_TEXTURE_2D_BIT_EXT,
+		None
+	};
+	int i, n = 0;
+	GLXFBConfig* configs = glXChooseFBConfig(display, screen, attribs, &n);
+
+	for (i=0 ; i<n ; i++)
+	{
+		XVisualInfo* vi = glXGetVisualFromFBConfig(display, configs[i]);
+		int d = vi ? vi->depth : 0;
+		if (vi) {
+			XFree(vi);
+		}
+		if (d == depth) {
+			gl.pixmap_config = configs[i];
+			glXGetFBConfigAttrib(display, configs[i], GLX_Y_INVERTED_EXT, &gl.y_inverted);
+			break;
+		}
+	}
+	if (configs) {
+		XFree(configs);
+	}
+	return i < n;
+}
+
+void
+x11_gl_fini()
+{
+	if (gl.context) {
+		glXMakeCurrent(display, None, NULL);
+		glXDestroyContext(display, gl.context);
+	}
+	if (gl.window) {
+		XDestroyWindow(display, gl.window);
+	}
+	if (gl.colormap) {
+		XFreeColormap(display, gl.colormap);
+	}
+	if (gl.visual) {
+		XFree(gl.visual);
+	}
+	memset(&gl, 0, sizeof(gl));
+}
+
+// set up the OpenGL presenter
+//
+// return FALSE if not available (the subwindows are then presented by the X
+// server as usual)
+gboolean
+x11_gl_init()
+{
+	int error_base, event_base, n = 0;
+
+	if (!glXQueryExtension(display, &error_base, &event_base)) {
+		squint_error("The OpenGL presenter requires the GLX extension");
+		return FALSE;
+	}
+	const char* extensions = glXQueryExtensionsString(display, screen);
+	if (!x11_gl_has_extension(extensions, "GLX_EXT_texture_from_pixmap")) {
+		squint_error("The OpenGL presenter requires GLX_EXT_texture_from_pixmap");
+		return FALSE;
+	}
+	gl.bind_tex_image = (PFNGLXBINDTEXIMAGEEXTPROC)
+		glXGetProcAddress((const GLubyte*) "glXBindTexImageEXT");
+	gl.release_tex_image = (PFNGLXRELEASETEXIMAGEEXTPROC)
+		glXGetProcAddress((const GLubyte*) "glXReleaseTexImageEXT");
+	if (x11_gl_has_extension(extensions, "GLX_EXT_swap_control")) {
+		gl.swap_interval = (PFNGLXSWAPINTERVALEXTPROC)
+			glXGetProcAddress((const GLubyte*) "glXSwapIntervalEXT");
+	}
+	gl.buffer_age = x11_gl_has_extension(extensions, "GLX_EXT_buffer_age");
+
+	if (!x11_gl_choose_pixmap_config()) {
+		squint_error("The OpenGL presenter cannot bind the pixmaps of the screen as textures");
+		x11_gl_fini();
+		return FALSE;
+	}
+
+	// configuration of the subwindows
+	const int attribs[] = {
+		GLX_DRAWABLE_TYPE,	GLX_WINDOW_BIT,
+		GLX_RENDER_TYPE,	GLX_RGBA_BIT,
+		GLX_X_RENDERABLE,	True,
+		GLX_DOUBLEBUFFER,	True,
+		GLX_RED_SIZE,		8,
+		GLX_GREEN_SIZE,		8,
+		GLX_BLUE_SIZE,		8,
+		None
+	};
+	GLXFBConfig* configs = glXChooseFBConfig(display, screen, attribs, &n);
+	if (n) {
+		gl.visual = glXGetVisualFromFBConfig(display, configs[0]);
+	}
+	if (gl.visual) {
+		gl.context = glXCreateNewContext(display, configs[0], GLX_RGBA_TYPE, NULL, True);
+	}
+	if (configs) {
+		XFree(configs);
+	}
+	if (!gl.context) {
+		squint_error("Cannot create the OpenGL context");
+		x11_gl_fini();
+		return FALSE;
+	}
+
+	XSetWindowAttributes attr;
+	gl.colormap = XCreateColormap(display, root_window, gl.visual->visual, AllocNone);
+	attr.colormap = gl.colormap;
+	attr.border_pixel = 0;
+	gl.window = XCreateWindow(display, root_window, 0, 0, 1, 1, 0,
+			gl.visual->depth, InputOutput, gl.visual->visual,
+			CWColormap | CWBorderPixel, &attr);
+
+	if (!glXMakeCurrent(display, gl.window, gl.context) || !x11_gl_create_program()) {
+		x11_gl_fini();
+		return FALSE;
+	}
+	return TRUE;
+}
+
+gboolean x11_gl_present(gpointer data);
+
+void
+x11_gl_schedule()
+{
+	if (!gl.present_idle) {
+		gl.present_idle = g_idle_add(x11_gl_present, NULL);
+	}
+}
+
+// the whole subwindow of destination j must be redrawn
+void
+x11_gl_invalidate(struct mirror* m, int j)
+{
+	X11_MIRROR(m)->destinations[j].gl_invalid = TRUE;
+	x11_gl_schedule();
+}
+
+// an area of the pixmap was modified
+void
+x11_gl_damage(struct mirror* m, const GdkRectangle* area)
+{
+	GdkRectangle* d = &X11_MIRROR(m)->gl_damage;
+	if (!m->n_destinations) {
+		return;
+	}
+	if (d->width) {
+		gdk_rectangle_union(area, d, d);
+	} else {
+		*d = *area;
+	}
+	x11_gl_schedule();
+}
+
+// create the subwindow of destination j
+Window
+x11_gl_create_window(struct mirror* m, int j, Window parent)
+{
+	struct x11_mirror* xm = X11_MIRROR(m);
+	const GdkRectangle* rect = &m->destinations[j].rect;
+	XSetWindowAttributes attr;
+	attr.background_pixmap = None;	// (never cleared by the X server)
+	attr.colormap = gl.colormap;
+	attr.border_pixel = 0;
+	attr.event_mask = ExposureMask;
+
+	xm->destinations[j].gl_width   = MAX(rect->width,  1);
+	xm->destinations[j].gl_height  = MAX(rect->height, 1);
+	xm->destinations[j].gl_invalid = TRUE;
+	return XCreateWindow(display, parent, 0, 0,
+			xm->destinations[j].gl_width, xm->destinations[j].gl_height,
+			0, gl.visual->depth, InputOutput, gl.visual->visual,
+			CWBackPixmap | CWColormap | CWBorderPixel | CWEventMask, &attr);
+}
+
+// give the subwindow of destination j the size of the destination
+void
+x11_gl_fit_window(struct mirror* m, int j)
+{
+	struct x11_mirror* xm = X11_MIRROR(m);
+	const GdkRectangle* rect = &m->destinations[j].rect;
+	int width  = MAX(rect->width,  1);
+	int height = MAX(rect->height, 1);
+
+	if ((width != xm->destinations[j].gl_width) || (height != xm->destinations[j].gl_height))
+	{
+		XResizeWindow(display, xm->destinations[j].window, width, height);
+		xm->destinations[j].gl_width  = width;
+		xm->destinations[j].gl_height = height;
+		x11_gl_invalidate(m, j);
+	}
+}
+
+// return FALSE if the window is not a subwindow
+gboolean
+x11_gl_on_expose(XExposeEvent* ev)
+{
+	int i, j;
+	for (i=0 ; i<n_mirrors ; i++) {
+		for (j=0 ; j<mirrors[i].n_destinations ; j++) {
+			if (x11_mirrors[i].destinations[j].window == ev->window) {
+				x11_gl_invalidate(&mirrors[i], j);
+				return TRUE;
+			}
+		}
+	}
+	return FALSE;
+}
+
+// bind the pixmap of the mirror as the current texture
+gboolean
+x11_gl_bind(struct mirror* m)
+{
+	struct x11_mirror* xm = X11_MIRROR(m);
+
+	if (!xm->gl_pixmap)
+	{
+		const int attribs[] = {
+			GLX_TEXTURE_TARGET_EXT,	GLX_TEXTURE_2D_EXT,
+			GLX_TEXTURE_FORMAT_EXT,	GLX_TEXTURE_FORMAT_RGB_EXT,
+			None
+		};
+		gdk_x11_display_error_trap_push(gdisplay);
+		xm->gl_pixmap = glXCreatePixmap(display, gl.pixmap_config, xm->pixmap, attribs);
+		XSync(display, False);
+		if (gdk_x11_display_error_trap_pop(gdisplay)) {
+			// (reported once)
+			static gboolean reported = FALSE;
+			if (!reported) {
+				squint_error("The OpenGL presenter cannot bind the pixmap as a texture");
+				reported = TRUE;
+			}
+			xm->gl_pixmap = 0;
+			return FALSE;
+		}
+
+		// (filtered by the shader)
+		glGenTextures(1, &xm->gl_texture);
+		glBindTexture(GL_TEXTURE_2D, xm->gl_texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	}
+
+	// the copies into the pixmap must be complete
+	glXWaitX();
+
+	glBindTexture(GL_TEXTURE_2D, xm->gl_texture);
+	gl.bind_tex_image(display, xm->gl_pixmap, GLX_FRONT_EXT, NULL);
+	return TRUE;
+}
+
+// free the texture of the mirror (before its pixmap is freed)
+void
+x11_gl_release(struct mirror* m)
+{
+	struct x11_mirror* xm = X11_MIRROR(m);
+	if (!xm->gl_pixmap) {
+		return;
+	}
+	// (the subwindows may be destroyed)
+	glXMakeCurrent(display, gl.window, gl.context);
+	glDeleteTextures(1, &xm->gl_texture);
+	glXDestroyPixmap(display, xm->gl_pixmap);
+	xm->gl_texture = 0;
+	xm->gl_pixmap  = 0;
+}
+
+// location of the image in the subwindow of destination j: scaled to fit the
+// window (or the video wall) and centered
+void
+x11_gl_fit(const struct mirror* m, int j, float* x0, float* y0, float* scale)
+{
+	const struct destination* dst = &m->destinations[j];
+	const struct x11_destination* xd = &x11_mirrors[m - mirrors].destinations[j];
+	const GdkRectangle out = m->wall
+		? (GdkRectangle){ -dst->tile.x, -dst->tile.y, m->wall_rect.width, m->wall_rect.height }
+		: (GdkRectangle){ 0, 0, xd->gl_width, xd->gl_height };
+	const float sw = m->src_rect.width, sh = m->src_rect.height;
+
+	*scale = MIN(out.width / sw, out.height / sh);
+	*x0 = out.x + (out.width  - sw * *scale) / 2;
+	*y0 = out.y + (out.height - sh * *scale) / 2;
+}
+
+// redraw the subwindow of destination j (the context must be current on the
+// subwindow and the texture bound)
+//
+// return FALSE if nothing was drawn
+gboolean
+x11_gl_draw(struct mirror* m, int j)
+{
+	struct x11_mirror* xm = X11_MIRROR(m);
+	const int width  = xm->destinations[j].gl_width;
+	const int height = xm->destinations[j].gl_height;
+	const GdkRectangle window = { 0, 0, width, height };
+	const GdkRectangle* d = &xm->gl_damage;
+	GdkRectangle* history = xm->destinations[j].gl_history;
+	const float sw = m->src_rect.width, sh = m->src_rect.height;
+	float x0, y0, scale;
+	int k;
+
+	x11_gl_fit(m, j, &x0, &y0, &scale);
+
+	// area modified by this frame (with a margin for the filter)
+	GdkRectangle area = { 0, 0, 0, 0 };
+	if (xm->destinations[j].gl_invalid) {
+		area = window;
+	}
+	else if (d->width)
+	{
+		int margin = ceilf(scale) + 1;
+		area.x = floorf(x0 + d->x * scale) - margin;
+		area.y = floorf(y0 + d->y * scale) - margin;
+		area.width  = ceilf(x0 + (d->x + d->width)  * scale) + margin - area.x;
+		area.height = ceilf(y0 + (d->y + d->height) * scale) + margin - area.y;
+		if (!gdk_rectangle_intersect(&area, &window, &area)) {
+			// (another tile of the video wall)
+			area.width = 0;
+		}
+	}
+	if (!area.width) {
+		return FALSE;
+	}
+
+	// the back buffer also lacks the areas modified since it was last
+	// presented
+	unsigned int age = 0;
+	if (gl.buffer_age && !xm->destinations[j].gl_invalid) {
+		glXQueryDrawable(display, xm->destinations[j].window, GLX_BACK_BUFFER_AGE_EXT, &age);
+	}
+	GdkRectangle redraw = area;
+	if ((age == 0) || (age > GL_MAX_AGE)) {
+		redraw = window;
+	} else {
+		for (k=0 ; k<(int)age-1 ; k++) {
+			if (history[k].width) {
+				gdk_rectangle_union(&redraw, &history[k], &redraw);
+			}
+		}
+	}
+	memmove(history + 1, history, (GL_MAX_AGE - 1) * sizeof(*history));
+	history[0] = area;
+	xm->destinations[j].gl_invalid = FALSE;
+
+	glViewport(0, 0, width, height);
+	glScissor(redraw.x, height - redraw.y - redraw.height, redraw.width, redraw.height);
+
+	// (borders)
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	const GLfloat vertices[] = {
+	//	position			texel
+		x0,		y0,		0,	0,
+		x0 + sw*scale,	y0,		sw,	0,
+		x0,		y0 + sh*scale,	0,	sh,
+		x0 + sw*scale,	y0 + sh*scale,	sw,	sh,
+	};
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4*sizeof(GLfloat), vertices);
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4*sizeof(GLfloat), vertices + 2);
+	glUniform2f(gl.u_window_size, width, height);
+	glUniform2f(gl.u_image_size, sw, sh);
+	glUniform1f(gl.u_footprint, 1 / scale);
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	return TRUE;
+}
+
+gboolean
+x11_gl_present(gpointer data)
+{
+	int i, j;
+
+	gl.present_idle = 0;
+
+	for (i=0 ; i<n_mirrors ; i++)
+	{
+		struct mirror* m = &mirrors[i];
+		struct x11_mirror* xm = &x11_mirrors[i];
+		gboolean bound = FALSE;
+
+		for (j=0 ; j<m->n_destinations ; j++)
+		{
+			Window window = xm->destinations[j].window;
+			if (!xm->gl_damage.width && !xm->destinations[j].gl_invalid) {
+				continue;
+			}
+			glXMakeCurrent(display, window, gl.context);
+			if (xm->destinations[j].gl_invalid && gl.swap_interval) {
+				// do not wait for the vertical blank (the subwindows
+				// are presented one after the other)
+				gl.swap_interval(display, window, 0);
+			}
+			if (!bound && !(bound = x11_gl_bind(m))) {
+				break;
+			}
+			if (x11_gl_draw(m, j)) {
+				glXSwapBuffers(display, window);
+			}
+		}
+		if (bound) {
+			gl.release_tex_image(display, xm->gl_pixmap, GLX_FRONT_EXT);
+		}
+		xm->gl_damage.width = 0;
+	}
+	return G_SOURCE_REMOVE;
+}
+#endif
+
+#ifdef HAVE_XRENDER
+//
+// Mosaic
+//
+// Each source monitor is copied into its own capture pixmap, then composed
+// (scaled with a bilinear filter) into the pixmap of the mirror by XRender.
+// Only the cells intersecting the damaged area are updated.
+//
+
+void
+x11_enable_mosaic(struct mirror* m)
+{
+	struct x11_mirror* xm = X11_MIRROR(m);
+	int i;
+
+	xm->mosaic_picture = XRenderCreatePicture(display, xm->pixmap, screen_format, 0, NULL);
+
+	for (i=0 ; i<m->n_sources ; i++)
+	{
+		struct source* s = &m->sources[i];
+		xm->sources[i].pixmap = XCreatePixmap(display, root_window,
+				s->rect.width, s->rect.height, depth);
+		xm->sources[i].picture = XRenderCreatePicture(display, xm->sources[i].pixmap,
+				screen_format, 0, NULL);
+
+		// scale the source to the size of the cell
+		XTransform transform = {{
+			{ XDoubleToFixed((double)s->rect.width / s->cell.width), 0, 0 },
+			{ 0, XDoubleToFixed((double)s->rect.height / s->cell.height), 0 },
+			{ 0, 0, XDoubleToFixed(1) },
+		}};
+		XRenderSetPictureTransform(display, xm->sources[i].picture, &transform);
+		XRenderSetPictureFilter(display, xm->sources[i].picture, FilterBilinear, NULL, 0);
+	}
+}
+
+void
+x11_disable_mosaic(struct mirror* m)
+{
+	struct x11_mirror* xm = X11_MIRROR(m);
+	int i;
+
+	for (i=0 ; i<m->n_sources ; i++)
+	{
+		XRenderFreePicture(display, xm->sources[i].picture);
+		XFreePixmap(display, xm->sources[i].pixmap);
+		xm->sources[i].picture = 0;
+		xm->sources[i].pixmap  = 0;
+	}
+	XRenderFreePicture(display, xm->mosaic_picture);
+	xm->mosaic_picture = 0;
+}
+
+// recreate the captures of the sources after a change of the cells (the
+// caller must refresh the whole image)
+void
+x11_reset_mosaic(struct mirror* m)
+{
+	struct x11_mirror* xm = X11_MIRROR(m);
+
+	x11_disable_mosaic(m);
+	XFillRectangle(display, xm->pixmap, gc, 0, 0,
+			m->src_rect.width, m->src_rect.height);
+	xm->backup.x = -CURSOR_SIZE;
+	x11_enable_mosaic(m);
+}
+
+// damaged_rect is in the coordinates of the composed image
+void
+x11_refresh_mosaic(struct mirror* m, const GdkRectangle* damaged_rect)
+{
+	struct x11_mirror* xm = X11_MIRROR(m);
+	int i;
+
+	if (!xm->mosaic_picture) {
+		return;
+	}
+
+	// the cells are composed in order (the insets of the pip layout are
+	// drawn last)
+	for (i=0 ; i<m->n_sources ; i++)
+	{
+		struct source* s = &m->sources[i];
+		GdkRectangle r, sr;
+		if (!gdk_rectangle_intersect(damaged_rect, &s->cell, &r)) {
+			continue;
+		}
+
+		// capture the corresponding area of the source monitor
+		mosaic_cell_to_source(s, &r, &sr);
+		if (sr.width) {
+			XCopyArea(display, root_window, xm->sources[i].pixmap, gc,
+					sr.x, sr.y, sr.width, sr.height,
+					sr.x - s->rect.x, sr.y - s->rect.y);
+			STATS_ADD(stats.pixels, sr.width * sr.height);
+		}
+
+		// scale it into the cell
+		XRenderComposite(display, PictOpSrc,
+				xm->sources[i].picture, None, xm->mosaic_picture,
+				r.x - s->cell.x, r.y - s->cell.y, 0, 0,
+				r.x, r.y, r.width, r.height);
+	}
+}
+
+// update the crop of the follow-focus mirrors after a change of the active
+// window (or of its geometry)
+void
+x11_refresh_focus_crop()
+{
+	int i;
+	for (i=0 ; i<n_mirrors ; i++)
+	{
+		struct mirror* m = &mirrors[i];
+		struct x11_mirror* xm = X11_MIRROR(m);
+
+		if (!m->follow_focus || !xm->mosaic_picture
+			|| !focus_crop(m, active_window ? &active_window_rect : NULL))
+		{
+			continue;
+		}
+
+		// reallocate the capture of the source and redraw the whole image
+		x11_reset_mosaic(m);
+		x11_refresh_image(m, &m->src_rect);
+	}
+}
+#endif
+
+
+// reallocate the pixmap of a mirror after a change of the size of src_rect
+//
+// The content is lost, the caller must refresh the whole image.
+void
+x11_resize_pixmap(struct mirror* m)
+{
+	struct x11_mirror* xm = X11_MIRROR(m);
+	int j;
+
+	// the cursor backup refers to the old pixmap
+	xm->backup.x = -CURSOR_SIZE;
+
+#ifdef HAVE_XRENDER
+	gboolean mosaic = (xm->mosaic_picture != 0);
+	if (mosaic) {
+		x11_disable_mosaic(m);
+	}
+#endif
+#if HAVE_XCOMPOSITE && HAVE_XRENDER
+	if (xm->window_dst_picture) {
+		// recreated on the next copy
+		XRenderFreePicture(display, xm->window_dst_picture);
+		xm->window_dst_picture = 0;
+	}
+#endif
+
+#ifdef HAVE_GLX
+	x11_gl_release(m);
+#endif
+	XFreePixmap(display, xm->pixmap);
+	xm->pixmap = XCreatePixmap (display, root_window,
+			m->src_rect.width, m->src_rect.height, depth);
+#ifdef COPY_CURSOR
+	if (xm->pixmap_picture) {
+		XRenderFreePicture(display, xm->pixmap_picture);
+		xm->pixmap_picture = XRenderCreatePicture(display, xm->pixmap,
+				screen_format, 0, NULL);
+	}
+#endif
+
+#ifdef HAVE_XRENDER
+	if (mosaic) {
+		// the cells may not cover the whole image
+		XFillRectangle(display, xm->pixmap, gc, 0, 0,
+				m->src_rect.width, m->src_rect.height);
+		x11_enable_mosaic(m);
+	}
+#endif
+
+	for (j=0 ; j<m->n_destinations ; j++)
+	{
+#ifdef HAVE_GLX
+		if (gl.context) {
+			// (the scale changed)
+			x11_gl_invalidate(m, j);
+			continue;
+		}
+#endif
+		x11_set_destination_image(m, j);
+	}
+
+	if (readback_image.image && (m == &mirrors[0])) {
+		// the size of the frames changed -> new file
+		x11_readback_stop();
+		x11_readback_start();
+	}
+}
+
+
+#ifdef HAVE_XCOMPOSITE
+//
+// Window capture
+//
+// The captured window is redirected off-screen by the Composite extension,
+// so that its content remains available when it is covered by other windows
+// or moved to another monitor. Its backing pixmap is used as the source of
+// the copies (instead of the root window) and only the damages of this
+// window are tracked.
+//
+// The server allocates a new backing pixmap each time the window is resized
+// or mapped, then it has to be named again.
+//
+
+// return the mirror capturing window w (if any)
+struct mirror*
+x11_find_capture_mirror(Window w)
+{
+	int i;
+	for (i=0 ; i<n_mirrors ; i++) {
+		if (w && (mirrors[i].capture_window == w)) {
+			return &mirrors[i];
+		}
+	}
+	return NULL;
+}
+
+// update the geometry of the captured window
+//
+// return FALSE if the window does not exist
+gboolean
+x11_update_window_capture_geometry(struct mirror* m)
+{
+	struct x11_mirror* xm = X11_MIRROR(m);
+	Window root, child;
+	int x, y;
+	unsigned int width, height, border_width, depth;
+	gboolean result;
+
+	// ignore X11 errors (the window is controlled by another application)
+	gdk_x11_display_error_trap_push(gdisplay);
+
+	result = XGetGeometry(display, m->capture_window, &root, &x, &y,
+				&width, &height, &border_width, &depth)
+		&& XTranslateCoordinates(display, m->capture_window, root_window,
+				0, 0, &x, &y, &child);
+	if (result) {
+		xm->window_rect.x = x;
+		xm->window_rect.y = y;
+		xm->window_rect.width  = width;
+		xm->window_rect.height = height;
+		xm->window_border = border_width;
+	}
+	gdk_x11_display_error_trap_pop_ignored(gdisplay);
+
+	return result;
+}
+
+// (re)name the backing pixmap of the captured window
+//
+// The pixmap is available only when the window is viewable (otherwise the
+// last image is kept).
+void
+x11_name_window_pixmap(struct mirror* m)
+{
+	struct x11_mirror* xm = X11_MIRROR(m);
+	XWindowAttributes attr;
+
+	gdk_x11_display_error_trap_push(gdisplay);
+#ifdef HAVE_XRENDER
+	if (xm->window_picture) {
+		XRenderFreePicture(display, xm->window_picture);
+		xm->window_picture = 0;
+	}
+#endif
+	if (xm->window_pixmap) {
+		XFreePixmap(display, xm->window_pixmap);
+		xm->window_pixmap = 0;
+	}
+	if (XGetWindowAttributes(display, m->capture_window, &attr)
+		&& (attr.map_state == IsViewable))
+	{
+		xm->window_pixmap = XCompositeNameWindowPixmap(display, m->capture_window);
+#ifdef HAVE_XRENDER
+		if (xm->window_format) {
+			xm->window_picture = XRenderCreatePicture(display, xm->window_pixmap,
+					xm->window_format, 0, NULL);
+		}
+#endif
+	}
+	if (gdk_x11_display_error_trap_pop(gdisplay)) {
+		// the window was unmapped in the meantime
+		xm->window_pixmap = 0;
+#ifdef HAVE_XRENDER
+		xm->window_picture = 0;
+#endif
+	}
+}
+
+// set up the capture of the window
+//
+// initialises:
+// 	m->src_rect
+gboolean
+x11_enable_window_capture(struct mirror* m)
+{
+	struct x11_mirror* xm = X11_MIRROR(m);
+	XWindowAttributes attr;
+
+	if (!can_use_xcomposite) {
+		squint_error("The window capture requires the Composite extension");
+		return FALSE;
+	}
+
+	gdk_x11_display_error_trap_push(gdisplay);
+	if (!XGetWindowAttributes(display, m->capture_window, &attr)) {
+		attr.depth = 0;
+	}
+	gdk_x11_display_error_trap_pop_ignored(gdisplay);
+
+	if (!attr.depth || !x11_update_window_capture_geometry(m)) {
+		squint_error("The window to be captured does not exist");
+		return FALSE;
+	}
+	if (attr.depth != depth)
+	{
+		// the content has to be converted (eg: ARGB window on a 24-bit
+		// screen, or 24-bit window on a 30-bit screen)
+#ifdef HAVE_XRENDER
+		xm->window_format = can_use_xrender ? XRenderFindVisualFormat(display, attr.visual) : NULL;
+		if (!xm->window_format)
+#endif
+		{
+			squint_error("The window to be captured does not have the depth of the screen (the conversion requires the XRender extension)");
+			return FALSE;
+		}
+	}
+
+	m->src_rect.x = 0;
+	m->src_rect.y = 0;
+	m->src_rect.width  = xm->window_rect.width;
+	m->src_rect.height = xm->window_rect.height;
+
+	gdk_x11_display_error_trap_push(gdisplay);
+
+	// keep the content of the window off-screen
+	XCompositeRedirectWindow(display, m->capture_window, CompositeRedirectAutomatic);
+
+	// monitor the geometry and the visibility of the window
+	XSelectInput(display, m->capture_window, StructureNotifyMask);
+
+#ifdef HAVE_XDAMAGE
+	if (can_use_xdamage) {
+		xm->window_damage = XDamageCreate(display, m->capture_window,
+				XDamageReportRawRectangles);
+	}
+#endif
+	gdk_x11_display_error_trap_pop_ignored(gdisplay);
+
+	x11_name_window_pixmap(m);
+	return TRUE;
+}
+
+void
+x11_disable_window_capture(struct mirror* m)
+{
+	struct x11_mirror* xm = X11_MIRROR(m);
+
+	// the window may have been destroyed
+	gdk_x11_display_error_trap_push(gdisplay);
+
+#ifdef HAVE_XRENDER
+	if (xm->window_picture) {
+		XRenderFreePicture(display, xm->window_picture);
+		xm->window_picture = 0;
+	}
+	if (xm->window_dst_picture) {
+		XRenderFreePicture(display, xm->window_dst_picture);
+		xm->window_dst_picture = 0;
+	}
+	xm->window_format = NULL;
+#endif
+	if (xm->window_pixmap) {
+		XFreePixmap(display, xm->window_pixmap);
+		xm->window_pixmap = 0;
+	}
+#ifdef HAVE_XDAMAGE
+	if (xm->window_damage) {
+		XDamageDestroy(display, xm->window_damage);
+		xm->window_damage = 0;
+	}
+#endif
+	XSelectInput(display, m->capture_window, 0);
+	XCompositeUnredirectWindow(display, m->capture_window, CompositeRedirectAutomatic);
+
+	gdk_x11_display_error_trap_pop_ignored(gdisplay);
+}
+
+// the captured window was resized
+// -> reallocate the pixmap of the mirror and refresh the whole image
+void
+x11_resize_window_capture(struct mirror* m)
+{
+	struct x11_mirror* xm = X11_MIRROR(m);
+	int j;
+
+	m->src_rect.width  = xm->window_rect.width;
+	m->src_rect.height = xm->window_rect.height;
+
+	x11_resize_pixmap(m);
+	for (j=0 ; j<m->n_destinations ; j++) {
+		x11_fix_offset(m, j);
+	}
+
+	x11_refresh_image(m, &m->src_rect);
+}
+
+// StructureNotify event on the captured window
+void
+x11_on_window_capture_event(struct mirror* m, XEvent* ev)
+{
+	struct x11_mirror* xm = X11_MIRROR(m);
+	GdkRectangle old_rect = xm->window_rect;
+
+	switch (ev->type)
+	{
+	case ConfigureNotify:
+		if (!x11_update_window_capture_geometry(m)) {
+			break;
+		}
+		if (	(old_rect.width  != xm->window_rect.width)
+		     ||	(old_rect.height != xm->window_rect.height))
+		{
+			x11_name_window_pixmap(m);
+			x11_resize_window_capture(m);
+		}
+		// (if the window was only moved, the content is unchanged)
+		break;
+
+	case MapNotify:
+		x11_name_window_pixmap(m);
+		x11_refresh_image(m, &m->src_rect);
+		break;
+
+	case UnmapNotify:
+	case DestroyNotify:
+		// keep the last image
+		gdk_x11_display_error_trap_push(gdisplay);
+		if (xm->window_pixmap) {
+			XFreePixmap(display, xm->window_pixmap);
+			xm->window_pixmap = 0;
+		}
+		gdk_x11_display_error_trap_pop_ignored(gdisplay);
+		break;
+	}
+}
+#endif
+
+
+#ifdef HAVE_XSHM
+//
+// Cross-display source (--source-display)
+//
+// The source of the mirror is the screen of another X display (eg: an Xvfb).
+// XCopyArea() cannot copy across two connections, so the pixels go through
+// shared memory segments attached to both X servers (which must run on the
+// same host): XShmGetImage() from the source display, then XShmPutImage()
+// into remote.pixmap, a copy of the source screen that replaces the root
+// window as the source of the refreshes.
+//
+// The source display is used only by the capture thread: it tracks the
+// damages of the screen, reads the damaged rows into a free slot and hands
+// the slot over to the main loop, which uploads it and feeds the damage to
+// the scheduler. With two slots the capture of a frame overlaps the upload of
+// the previous one. A slot returns to the capture thread once the local
+// server has completed the upload (ShmCompletion event), so the main loop
+// never waits for the source display (nor the thread for the local one).
+//
+
+// pushed into free_slots to stop the capture thread
+static struct remote_slot remote_end;
+
+static XIOErrorHandler x11_default_io_error_handler = NULL;
+
+// the capture thread stopped on an error (the mirror keeps its last image)
+gboolean
+x11_remote_on_lost(gpointer data)
+{
+	squint_error("The capture of the source display was interrupted");
+	return G_SOURCE_REMOVE;
+}
+
+// the connection to the source display was lost
+//
+// Xlib does not survive the return of this handler: the capture thread is
+// terminated (the connection is leaked) instead of the whole process.
+int
+x11_remote_on_io_error(Display* d)
+{
+	if (remote.display && (d == remote.display) && (g_thread_self() == remote.thread)) {
+		remote.lost = TRUE;
+		g_idle_add(x11_remote_on_lost, &remote);
+		g_thread_exit(NULL);
+	}
+	return x11_default_io_error_handler(d);
+}
+
+// allocate a slot and attach it to both displays
+gboolean
+x11_remote_create_slot(struct remote_slot* s)
+{
+	const int width = remote.rect.width, height = remote.rect.height;
+	int shmid;
+	gboolean attached = FALSE;
+
+	s->remote_image = XShmCreateImage(remote.display,
+			DefaultVisual(remote.display, DefaultScreen(remote.display)),
+			depth, ZPixmap, NULL, &s->remote_shminfo, width, height);
+	s->local_image = XShmCreateImage(display, DefaultVisual(display, screen),
+			depth, ZPixmap, NULL, &s->local_shminfo, width, height);
+	if (!s->remote_image || !s->local_image
+			|| (s->remote_image->bytes_per_line != s->local_image->bytes_per_line)) {
+		return FALSE;
+	}
+
+	shmid = shmget(IPC_PRIVATE, s->local_image->bytes_per_line * height, IPC_CREAT | 0600);
+	s->shmaddr = (shmid < 0) ? (char*)-1 : shmat(shmid, NULL, 0);
+	if (s->shmaddr == (char*)-1) {
+		s->shmaddr = NULL;
+		if (shmid >= 0) {
+			shmctl(shmid, IPC_RMID, NULL);
+		}
+		return FALSE;
+	}
+	s->remote_image->data = s->local_image->data = s->shmaddr;
+	s->remote_shminfo.shmid   = s->local_shminfo.shmid   = shmid;
+	s->remote_shminfo.shmaddr = s->local_shminfo.shmaddr = s->shmaddr;
+	s->remote_shminfo.readOnly = False;
+	s->local_shminfo.readOnly  = True;
+
+	gdk_x11_display_error_trap_push(gdisplay);
+	XShmAttach(display, &s->local_shminfo);
+	XSync(display, False);
+	if (!gdk_x11_display_error_trap_pop(gdisplay))
+	{
+		// the errors of the source display are not reported (it is not
+		// managed by GDK) -> try a capture
+		XShmAttach(remote.display, &s->remote_shminfo);
+		attached = XShmGetImage(remote.display, remote.root, s->remote_image,
+				0, 0, AllPlanes);
+		if (!attached) {
+			XShmDetach(display, &s->local_shminfo);
+		}
+	}
+
+	// the segment is destroyed once detached by all sides
+	shmctl(shmid, IPC_RMID, NULL);
+	if (!attached) {
+		shmdt(s->shmaddr);
+		s->shmaddr = NULL;
+	}
+	return attached;
+}
+
+void
+x11_remote_destroy_slot(struct remote_slot* s)
+{
+	if (s->shmaddr)
+	{
+		XShmDetach(display, &s->local_shminfo);
+		if (!remote.lost) {
+			XShmDetach(remote.display, &s->remote_shminfo);
+		}
+		shmdt(s->shmaddr);
+	}
+	if (s->remote_image) {
+		XDestroyImage(s->remote_image);
+	}
+	if (s->local_image) {
+		XDestroyImage(s->local_image);
+	}
+	memset(s, 0, sizeof(*s));
+}
+
+// the pointer of the source display is now at c (main loop)
+void
+x11_remote_set_cursor(GdkPoint c)
+{
+	struct mirror* m = remote.mirror;
+	struct x11_mirror* xm = X11_MIRROR(m);
+	int j;
+
+	if (paused) {
+		// (updated by x11_resume())
+		return;
+	}
+	if ((c.x >= m->src_rect.width) || (c.y >= m->src_rect.height)) {
+		c.x = c.y = -1;
+	}
+	if ((c.x != xm->cursor.x) || (c.y != xm->cursor.y))
+	{
+		xm->cursor = c;
+		x11_redraw_cursor(m, TRUE);
+		for (j=0 ; j<m->n_destinations ; j++) {
+			if (x11_fix_offset(m, j)) {
+				XClearWindow(display, xm->destinations[j].window);
+			}
+		}
+	}
+}
+
+// upload the frames captured and update the cursor (main loop)
+gboolean
+x11_remote_on_update(gpointer data)
+{
+	struct mirror* m = remote.mirror;
+	struct remote_slot* s;
+	GdkPoint c;
+
+	while ((s = g_async_queue_try_pop(remote.full_slots)))
+	{
+		// the slot is released by the completion event (see
+		// x11_on_x11_event())
+		XShmPutImage(display, remote.pixmap, gc, s->local_image,
+				s->rect.x, s->rect.y, s->rect.x, s->rect.y,
+				s->rect.width, s->rect.height, True);
+
+		if (m->scheduler.refresh) {
+			scheduler_add_mirror_damage(m, s->timestamp, &s->rect, FALSE);
+		}
+		// (otherwise copied by the refresh timer)
+	}
+
+	g_mutex_lock(&remote.lock);
+	c = remote.pointer;
+	g_mutex_unlock(&remote.lock);
+	x11_remote_set_cursor(c);
+	XFlush(display);
+	return G_SOURCE_REMOVE;
+}
+
+// ShmCompletion event: the upload of a slot is complete
+void
+x11_remote_on_completion(XShmCompletionEvent* ev)
+{
+	int i;
+	for (i=0 ; i<REMOTE_SLOTS ; i++) {
+		if (remote.slots[i].local_shminfo.shmseg == ev->shmseg) {
+			g_async_queue_push(remote.free_slots, &remote.slots[i]);
+		}
+	}
+}
+
+// capture thread (the only user of remote.display once started)
+gpointer
+x11_remote_capture(gpointer data)
+{
+	Display* d = remote.display;
+	struct pollfd fds[2] = {
+		{ .fd = ConnectionNumber(d),	.events = POLLIN },
+		{ .fd = remote.wakeup[0],	.events = POLLIN },
+	};
+	GdkRectangle pending = remote.rect;	// the first capture is complete
+	GdkPoint pointer = { -1, -1 };
+	guint32 timestamp = 0;
+	gint64 now, next_capture = 0, next_poll = 0;
+
+	for (;;)
+	{
+		while (XPending(d))
+		{
+			XEvent ev;
+			XNextEvent(d, &ev);
+#ifdef HAVE_XDAMAGE
+			if (remote.damage && (ev.type == remote.damage_event_base + XDamageNotify))
+			{
+				XDamageNotifyEvent* xd_ev = (XDamageNotifyEvent*) &ev;
+				GdkRectangle rect = {
+					xd_ev->area.x,     xd_ev->area.y,
+					xd_ev->area.width, xd_ev->area.height
+				};
+				if (pending.width == 0) {
+					pending = rect;
+				} else {
+					gdk_rectangle_union(&rect, &pending, &pending);
+				}
+				timestamp = xd_ev->timestamp;
+			}
+#endif
+		}
+
+		now = g_get_monotonic_time() / 1000;
+		if (now >= next_poll)
+		{
+			// the moves of the pointer do not damage the screen
+			Window root, child;
+			int x, y, wx, wy;
+			unsigned int mask;
+			GdkPoint p = { -1, -1 };
+			if (XQueryPointer(d, remote.root, &root, &child, &x, &y, &wx, &wy, &mask)) {
+				p.x = x;
+				p.y = y;
+			}
+			if ((p.x != pointer.x) || (p.y != pointer.y))
+			{
+				pointer = p;
+				g_mutex_lock(&remote.lock);
+				remote.pointer = p;
+				g_mutex_unlock(&remote.lock);
+				g_idle_add(x11_remote_on_update, &remote);
+			}
+#ifdef HAVE_XDAMAGE
+			if (!remote.damage)
+#endif
+			{
+				// no damage events -> periodic capture
+				pending = remote.rect;
+				timestamp = now;
+			}
+			next_poll = now + REMOTE_PERIOD;
+		}
+
+		// (the damages are accumulated while paused)
+		gboolean paused = __atomic_load_n(&remote.paused, __ATOMIC_RELAXED);
+		if (pending.width && !paused && (now >= next_capture))
+		{
+			// wait until the upload of a previous frame is complete
+			struct remote_slot* s = g_async_queue_pop(remote.free_slots);
+			if (s == &remote_end) {
+				break;
+			}
+			gboolean empty = !gdk_rectangle_intersect(&pending, &remote.rect, &s->rect);
+			pending.width = 0;
+			if (empty) {
+				g_async_queue_push(remote.free_slots, s);
+				continue;
+			}
+
+			// read the whole rows (the segment has the layout of the
+			// screen, so that they land at their place)
+			XImage* image = s->remote_image;
+			image->data  += s->rect.y * image->bytes_per_line;
+			image->height = s->rect.height;
+			Status ok = XShmGetImage(d, remote.root, image, 0, s->rect.y, AllPlanes);
+			image->data   = s->shmaddr;
+			image->height = remote.rect.height;
+			if (!ok) {
+				// eg: the screen was resized
+				g_idle_add(x11_remote_on_lost, &remote);
+				break;
+			}
+
+			s->timestamp = timestamp;
+			g_async_queue_push(remote.full_slots, s);
+			g_idle_add(x11_remote_on_update, &remote);
+
+			// the refresh rate limit applies to the captures too
+			next_capture = now + scheduler_get_min_refresh_period();
+			continue;
+		}
+
+		int timeout = next_poll - now;
+		if (pending.width && !paused) {
+			timeout = MIN(timeout, next_capture - now);
+		}
+		if ((poll(fds, 2, timeout) > 0) && fds[1].revents) {
+			break;
+		}
+	}
+	return NULL;
+}
+
+void
+x11_remote_stop()
+{
+	int i;
+
+	if (!remote.display) {
+		return;
+	}
+	if (remote.thread)
+	{
+		g_async_queue_push(remote.free_slots, &remote_end);
+		if (write(remote.wakeup[1], "", 1) < 0) {
+			// (the thread is stopped by remote_end anyway)
+		}
+		g_thread_join(remote.thread);
+	}
+	while (g_idle_remove_by_data(&remote))
+		;
+
+	// wait until the pending uploads are complete
+	XSync(display, False);
+
+	for (i=0 ; i<REMOTE_SLOTS ; i++) {
+		x11_remote_destroy_slot(&remote.slots[i]);
+	}
+	if (remote.pixmap) {
+		XFreePixmap(display, remote.pixmap);
+	}
+	if (remote.free_slots) {
+		g_async_queue_unref(remote.free_slots);
+		g_async_queue_unref(remote.full_slots);
+	}
+	if (remote.thread) {
+		close(remote.wakeup[0]);
+		close(remote.wakeup[1]);
+	}
+	if (remote.input_display) {
+		XCloseDisplay(remote.input_display);
+	}
+	if (!remote.lost) {
+		XCloseDisplay(remote.display);
+	}
+	memset(&remote, 0, sizeof(remote));
+}
+
+// connect to the source display and start the capture thread
+//
+// initialises:
+// 	m->src_rect
+gboolean
+x11_remote_start(struct mirror* m)
+{
+	int i;
+
+	remote.display = XOpenDisplay(m->source_display);
+	if (!remote.display) {
+		char* msg = g_strdup_printf("Cannot open the source display %s", m->source_display);
+		squint_error(msg);
+		g_free(msg);
+		return FALSE;
+	}
+	remote.mirror = m;
+
+	int s = DefaultScreen(remote.display);
+	Visual* v = DefaultVisual(remote.display, s);
+	Visual* local = DefaultVisual(display, screen);
+	if ((DefaultDepth(remote.display, s) != depth) || (v->red_mask != local->red_mask)
+		|| (v->green_mask != local->green_mask) || (v->blue_mask != local->blue_mask))
+	{
+		squint_error("The source display does not have the pixel format of the local screen");
+		x11_remote_stop();
+		return FALSE;
+	}
+	if (!XShmQueryExtension(display) || !XShmQueryExtension(remote.display)) {
+		squint_error("The cross-display source requires the MIT-SHM extension on both displays");
+		x11_remote_stop();
+		return FALSE;
+	}
+
+	remote.root = RootWindow(remote.display, s);
+	remote.rect.x = 0;
+	remote.rect.y = 0;
+	remote.rect.width  = DisplayWidth(remote.display, s);
+	remote.rect.height = DisplayHeight(remote.display, s);
+
+	for (i=0 ; i<REMOTE_SLOTS ; i++) {
+		if (!x11_remote_create_slot(&remote.slots[i])) {
+			squint_error("Cannot share memory with the source display (it must run on the same host)");
+			x11_remote_stop();
+			return FALSE;
+		}
+	}
+
+#ifdef HAVE_XDAMAGE
+	{
+		int error_base;
+		if (XDamageQueryExtension(remote.display, &remote.damage_event_base, &error_base)) {
+			remote.damage = XDamageCreate(remote.display, remote.root,
+					XDamageReportRawRectangles);
+		}
+	}
+#endif
+
+	// black until the first upload
+	remote.pixmap = XCreatePixmap(display, root_window,
+			remote.rect.width, remote.rect.height, depth);
+	XFillRectangle(display, remote.pixmap, gc, 0, 0, remote.rect.width, remote.rect.height);
+	remote.completion_event = XShmGetEventBase(display) + ShmCompletion;
+
+	if (!x11_default_io_error_handler) {
+		x11_default_io_error_handler = XSetIOErrorHandler(x11_remote_on_io_error);
+	}
+
+	remote.pointer.x = remote.pointer.y = -1;
+	remote.free_slots = g_async_queue_new();
+	remote.full_slots = g_async_queue_new();
+	for (i=0 ; i<REMOTE_SLOTS ; i++) {
+		g_async_queue_push(remote.free_slots, &remote.slots[i]);
+	}
+	if (pipe(remote.wakeup) < 0) {
+		squint_error("pipe() failed");
+		x11_remote_stop();
+		return FALSE;
+	}
+	XFlush(remote.display);
+	remote.thread = g_thread_new("capture", x11_remote_capture, NULL);
+
+	m->src_rect = remote.rect;
+	return TRUE;
+}
+#endif
+
+#if HAVE_XSHM && HAVE_XI && HAVE_XTEST
+//
+// Input forwarding (--interactive)
+//
+// The pointer and keyboard events received by the subwindows of the
+// cross-display mirror are injected into the source display with XTest, so
+// that the mirror can be used like the screen of the source display (eg: to
+// drive an application running in a Xvfb).
+//
+// The events are selected with XInput 2 on the subwindows and received by
+// x11_on_x11_event() like the raw events of the cursor tracking. Their
+// location is relative to the subwindow, thus the offset of the destination
+// is already applied: it is only converted from the (transformed or scaled)
+// image into the source screen. The fake events are sent on a dedicated
+// connection to the source display (the other one belongs to the capture
+// thread) and flushed immediately, without waiting for any reply. The cursor
+// of the mirror is moved at once instead of waiting for the next poll of the
+// pointer.
+//
+// The keycodes are forwarded as is (the keymaps of both displays are expected
+// to match), the key repeats are left to the source display. Nothing is
+// forwarded in passive mode.
+//
+// The mirrors of the local display only forward the buttons (clicks, drags
+// and wheel), since the injected pointer would leave the mirror: the press is
+// held until the release, then the pointer is moved to the location of the
+// press in the source, the press, the motion to the location of the release
+// and the release are faked, and the pointer is moved back onto the mirror
+// (a click-through, the intermediate motions of a drag are not replayed).
+// The keys then go to the window focused by the click. The locations inside
+// a mirror window are ignored (the events would come back to the mirror).
+// Not available for the mosaics and the magnifier.
+//
+
+// convert a location in the subwindow of destination j into the source
+// screen
+void
+x11_input_to_source(struct mirror* m, int j, double x, double y, GdkPoint* p)
+{
+	const struct destination* dst = &m->destinations[j];
+	const int width = m->src_rect.width, height = m->src_rect.height;
+#ifdef HAVE_GLX
+	if (gl.context)
+	{
+		float x0, y0, scale;
+		x11_gl_fit(m, j, &x0, &y0, &scale);
+		p->x = (x - x0) / scale;
+		p->y = (y - y0) / scale;
+	}
+	else
+#endif
+	if (X11_MIRROR(m)->destinations[j].scaler)
+	{
+		// (the subwindow has the size of the scaled image)
+		const GdkRectangle* r = &X11_MIRROR(m)->destinations[j].scaled_rect;
+		p->x = x * width  / r->width;
+		p->y = y * height / r->height;
+	}
+	else
+	{
+		int t_width, t_height;
+		transform_size(dst->transform, width, height, &t_width, &t_height);
+		GdkPoint t = { CLAMP((int)x, 0, t_width - 1), CLAMP((int)y, 0, t_height - 1) };
+		untransform_point(dst->transform, width, height, &t, p);
+	}
+
+	// (the pointer may be dragged out of the subwindow)
+	p->x = CLAMP(p->x, 0, width  - 1);
+	p->y = CLAMP(p->y, 0, height - 1);
+}
+
+// XI event received by a subwindow
+//
+// return FALSE if the window is not a subwindow of the cross-display mirror
+gboolean
+x11_forward_input(XIDeviceEvent* ev)
+{
+	struct mirror* m = remote.mirror;
+	GdkPoint p;
+	int j;
+
+	for (j=0 ; (j<m->n_destinations) && (X11_MIRROR(m)->destinations[j].window != ev->event) ; j++)
+		;
+	if (j == m->n_destinations) {
+		return FALSE;
+	}
+
+	switch (ev->evtype)
+	{
+	case XI_KeyPress:
+	case XI_KeyRelease:
+		if (!(ev->flags & XIKeyRepeat)) {
+			XTestFakeKeyEvent(remote.input_display, ev->detail,
+					ev->evtype == XI_KeyPress, CurrentTime);
+		}
+		break;
+
+	default:
+		x11_input_to_source(m, j, ev->event_x, ev->event_y, &p);
+		XTestFakeMotionEvent(remote.input_display, DefaultScreen(remote.input_display),
+				p.x, p.y, CurrentTime);
+		if (ev->evtype != XI_Motion) {
+			XTestFakeButtonEvent(remote.input_display, ev->detail,
+					ev->evtype == XI_ButtonPress, CurrentTime);
+		}
+
+		g_mutex_lock(&remote.lock);
+		remote.pointer = p;
+		g_mutex_unlock(&remote.lock);
+		x11_remote_set_cursor(p);
+		XFlush(display);
+	}
+	XFlush(remote.input_display);
+	return TRUE;
+}
+
+// convert a location in the subwindow of destination j of a local mirror
+// into root coordinates
+//
+// return FALSE if the location is inside a mirror window
+gboolean
+x11_input_to_root(struct mirror* m, int j, double x, double y, GdkPoint* p)
+{
+	const GdkRectangle* origin = &m->src_rect;
+	int i, k;
+
+	x11_input_to_source(m, j, x, y, p);
+#ifdef HAVE_XCOMPOSITE
+	if (m->capture_window) {
+		// (src_rect is in the coordinates of the window)
+		origin = &X11_MIRROR(m)->window_rect;
+	}
+#endif
+	p->x += origin->x;
+	p->y += origin->y;
+
+	const GdkRectangle point = { p->x, p->y, 1, 1 };
+	for (i=0 ; i<n_mirrors ; i++)
+	{
+		for (k=0 ; k<mirrors[i].n_destinations ; k++)
+		{
+			GdkRectangle r;
+			x11_get_destination_rect(&mirrors[i], k, &r);
+			if (gdk_rectangle_intersect(&point, &r, NULL)) {
+				return FALSE;
+			}
+		}
+	}
+	return TRUE;
+}
+
+// XI button event received by a subwindow of a local mirror
+//
+// return FALSE if the window is not a subwindow of a local mirror
+gboolean
+x11_forward_local_input(XIDeviceEvent* ev)
+{
+	struct mirror* m = NULL;
+	GdkPoint p;
+	int i, j = 0;
+
+	if (!local_input.enabled || ((ev->evtype != XI_ButtonPress) && (ev->evtype != XI_ButtonRelease))) {
+		return FALSE;
+	}
+	for (i=0 ; (i<n_mirrors) && !m ; i++)
+	{
+		if (mirrors[i].source_display) {
+			continue;
+		}
+		for (j=0 ; j<mirrors[i].n_destinations ; j++) {
+			if (x11_mirrors[i].destinations[j].window == ev->event) {
+				m = &mirrors[i];
+				break;
+			}
+		}
+	}
+	if (!m) {
+		return FALSE;
+	}
+	gboolean inside = x11_input_to_root(m, j, ev->event_x, ev->event_y, &p);
+
+	if (ev->evtype == XI_ButtonPress)
+	{
+		// replayed with the release
+		if (!local_input.button) {
+			local_input.button = ev->detail;
+			local_input.press  = p;
+			local_input.press_inside = inside;
+		}
+		return TRUE;
+	}
+
+	// (the physical button is up, the subwindow no longer grabs the
+	// pointer)
+	GdkPoint press = p;
+	if (ev->detail == local_input.button) {
+		press  = local_input.press;
+		inside = inside && local_input.press_inside;
+		local_input.button = 0;
+	}
+	if (!inside) {
+		return TRUE;
+	}
+	XTestFakeMotionEvent(display, screen, press.x, press.y, CurrentTime);
+	XTestFakeButtonEvent(display, ev->detail, True, CurrentTime);
+	if ((press.x != p.x) || (press.y != p.y)) {
+		XTestFakeMotionEvent(display, screen, p.x, p.y, CurrentTime);
+	}
+	XTestFakeButtonEvent(display, ev->detail, False, CurrentTime);
+	XTestFakeMotionEvent(display, screen, ev->root_x, ev->root_y, CurrentTime);
+	XFlush(display);
+	return TRUE;
+}
+
+// select the forwarded input events on the subwindows of mirror m (none if
+// n_events is 0)
+void
+x11_select_forwarded_input(struct mirror* m, const int* events, int n_events)
+{
+	XIEventMask evmasks[1];
+	unsigned char mask1[(XI_LASTEVENT + 7)/8];
+	int i;
+
+	memset(mask1, 0, sizeof(mask1));
+	for (i=0 ; i<n_events ; i++) {
+		XISetMask(mask1, events[i]);
+	}
+	evmasks[0].deviceid = XIAllMasterDevices;
+	evmasks[0].mask_len = sizeof(mask1);
+	evmasks[0].mask = mask1;
+
+	for (i=0 ; i<m->n_destinations ; i++) {
+		XISelectEvents(display, X11_MIRROR(m)->destinations[i].window, evmasks, 1);
+	}
+}
+
+// select (or not) the input events on the subwindows of the mirrors,
+// according to --interactive and to the passive mode
+void
+x11_enable_input_forwarding()
+{
+	static const int remote_events[] = {
+		XI_ButtonPress, XI_ButtonRelease, XI_Motion, XI_KeyPress, XI_KeyRelease
+	};
+	static const int local_events[] = { XI_ButtonPress, XI_ButtonRelease };
+	int i;
+
+	if (!can_track_cursor) {
+		return;
+	}
+
+	// local mirrors
+	gboolean enable = config.opt_interactive && !config.opt_passive;
+	if (enable && !local_input.checked)
+	{
+		int event_base, error_base, major, minor;
+		local_input.available = XTestQueryExtension(display, &event_base, &error_base, &major, &minor);
+		local_input.checked = TRUE;
+		if (!local_input.available) {
+			squint_error("The interactive mode requires the XTest extension");
+		}
+	}
+	local_input.enabled = enable && local_input.available;
+	local_input.button = 0;
+	for (i=0 ; i<n_mirrors ; i++)
+	{
+		const struct mirror* m = &mirrors[i];
+		if (m->source_display) {
+			continue;
+		}
+		gboolean local = local_input.enabled && !m->n_sources && !m->zoom;
+		x11_select_forwarded_input(&mirrors[i], local_events, local ? G_N_ELEMENTS(local_events) : 0);
+	}
+
+	// cross-display mirror
+	if (!remote.display) {
+		return;
+	}
+	struct mirror* m = remote.mirror;
+	enable = enable && !remote.lost;
+
+	if (enable && !remote.input_display)
+	{
+		int event_base, error_base, major, minor;
+		remote.input_display = XOpenDisplay(m->source_display);
+		if (!remote.input_display
+			|| !XTestQueryExtension(remote.input_display, &event_base, &error_base, &major, &minor))
+		{
+			squint_error("The interactive mode requires the XTest extension on the source display");
+			if (remote.input_display) {
+				XCloseDisplay(remote.input_display);
+				remote.input_display = NULL;
+			}
+			enable = FALSE;
+		}
+	}
+
+	x11_select_forwarded_input(m, remote_events, enable ? G_N_ELEMENTS(remote_events) : 0);
+}
+#endif
+
+
+// geometry of the window of destination j (main thread)
+void
+x11_get_destination_rect(const struct mirror* m, int j, GdkRectangle* r)
+{
+#if HAVE_XDAMAGE && HAVE_XI
+	if (render.thread) {
+		g_mutex_lock(&render.lock);
+		*r = render.geometry[m - mirrors][j];
+		g_mutex_unlock(&render.lock);
+		return;
+	}
+#endif
+	*r = m->destinations[j].rect;
+}
+
+void
+x11_show_active_window()
+{
+	if (!active_window)
+		return;
+
+	int i, j;
+	for (i=0 ; i<n_mirrors ; i++)
+	{
+		struct mirror* m = &mirrors[i];
+		if (m->source_display) {
+			// the local activity is not related to this mirror
+			continue;
+		}
+
+		// check if it overlaps more whith the src or a dst window
+		GdkRectangle inter_src, inter_dst;
+		int src_area = 0, max_dst = 0;
+		if (m->n_sources) {
+			// mosaic
+			for (j=0 ; j<m->n_sources ; j++) {
+				gdk_rectangle_intersect(&active_window_rect, &m->sources[j].rect, &inter_src);
+				src_area += inter_src.height*inter_src.width;
+			}
+		}
+#ifdef HAVE_XCOMPOSITE
+		else if (m->capture_window) {
+			gdk_rectangle_intersect(&active_window_rect, &X11_MIRROR(m)->window_rect, &inter_src);
+			src_area = inter_src.height*inter_src.width;
+		}
+#endif
+		else {
+			gdk_rectangle_intersect(&active_window_rect, &m->src_rect, &inter_src);
+			src_area = inter_src.height*inter_src.width;
+		}
+		for (j=0 ; j<m->n_destinations ; j++) {
+			GdkRectangle rect;
+			x11_get_destination_rect(m, j, &rect);
+			gdk_rectangle_intersect(&active_window_rect, &rect, &inter_dst);
+			max_dst = MAX(max_dst, inter_dst.height*inter_dst.width);
+		}
+
+		if(src_area > max_dst)
+		{
+			// the active window overlaps more with the source screen
+			squint_show(m);
+		} else {
+			// the active window overlaps more with the destination screen
+			squint_hide(m);
+		}
+	}
+}
+
+gboolean
+x11_get_window_geometry(Window w, GdkRectangle* r)
+{
+	gboolean result;
+	Window root;
+	int x, y;
+	unsigned int width, height, border_width, depth;
+
+	gdk_x11_display_error_trap_push(gdisplay);
+
+	if (XGetGeometry(display, w, &root, &x, &y, &width, &height,
+			&border_width, &depth))
+	{
+		r->x = x - border_width;
+		r->y = y - border_width;
+		r->width  = width  + 2*border_width;
+		r->height = height + 2*border_width;
+
+		result = TRUE;
+	} else {
+		result = FALSE;
+	}
+	gdk_x11_display_error_trap_pop_ignored(gdisplay);
+
+	return result;
+}
+
+void
+x11_refresh_active_window_geometry()
+{
+	if(!active_window)
+		return;
+
+	// ignore X11 errors (this function can produce BadWindow errors since
+	// it makes queries on windows controlled by other applications)
+	gdk_x11_display_error_trap_push(gdisplay);
+
+	{
+		Window w = active_window;
+		Window root, parent, *children;
+		unsigned int nchildren;
+
+		// identify the top-level window
+		parent = w;
+		while(parent != root_window)
+		{
+			w = parent;
+			if(!XQueryTree(display, w, &root, &parent, &children, &nchildren))
+				goto err;
+			XFree(children);
+		}
+		
+		// get its coordinates
+		x11_get_window_geometry(w, &active_window_rect);
+	}
+err:	
+	gdk_x11_display_error_trap_pop_ignored(gdisplay);
+}
+
+Window
+x11_get_active_window()
+{
+	Window result = 0;
+	Window* w;
+	Atom actual_type_return;
+	int  actual_format_return;
+	unsigned long nitems_return, bytes_after_return;
+
+	if (XGetWindowProperty(display, root_window, net_active_window_atom, 0, 1,
+			FALSE, AnyPropertyType,	&actual_type_return,
+			&actual_format_return, &nitems_return,
+			&bytes_after_return, (unsigned char**)&w)
+		== Success)
+	{
+		result = *w;
+		XFree(w);
+	}
+	return result;
+}
+
+void
+x11_active_window_stop_monitoring()
+{
+	if (!gdk_x11_window_lookup_for_display(gdisplay, active_window))
+	{
+		// ignore X11 errors (this function can produce BadWindow errors since
+		// it makes queries on windows controlled by other applications)
+		gdk_x11_display_error_trap_push(gdisplay);
+
+		XSetWindowAttributes attr;
+		attr.event_mask = 0;
+#ifdef HAVE_XCOMPOSITE
+		if (x11_find_capture_mirror(active_window)) {
+			// still monitored for the window capture
+			attr.event_mask = StructureNotifyMask;
+		}
+#endif
+		XChangeWindowAttributes(display, active_window, CWEventMask, &attr);
+
+		gdk_x11_display_error_trap_pop_ignored(gdisplay);
+	} 
+	active_window = 0;
+}
+
+void
+x11_active_window_start_monitoring()
+{
+	if (active_window)
+		x11_active_window_stop_monitoring();
+
+	if (config.opt_passive && !config.opt_follow_focus)
+		return;
+
+	active_window = x11_get_active_window();
+	if (!active_window)
+		return;
+
+	x11_refresh_active_window_geometry();
+	if (!memcmp(&active_window_rect, &root_window_rect, sizeof(GdkRectangle))) {
+		// same geometry as the root window
+		// -> ignore it
+		// TODO: make the match more loose
+		active_window = 0;
+		return;
+	}
+
+	if (!gdk_x11_window_lookup_for_display(gdisplay, active_window))
+	{
+		// this is a foreign window
+		// -> we need to monitor it explicitely
+		
+		 
+		// ignore X11 errors (this function can produce BadWindow errors since
+		// it makes queries on windows controlled by other applications)
+		gdk_x11_display_error_trap_push(gdisplay);
+
+		XSetWindowAttributes attr;
+		attr.event_mask = StructureNotifyMask;
+		XChangeWindowAttributes(display, active_window, CWEventMask, &attr);
+
+		gdk_x11_display_error_trap_pop_ignored(gdisplay);
+	}
+}
+
+GdkFilterReturn
+x11_on_x11_event (GdkXEvent *xevent, GdkEvent *event, gpointer data)
+{
+	XEvent* ev = (XEvent*)xevent;
+
+#ifdef HAVE_GLX
+	if (gl.context && (ev->type == Expose) && x11_gl_on_expose((XExposeEvent*) ev)) {
+		return GDK_FILTER_REMOVE;
+	}
+#endif
+
+	if ((ev->type == KeyPress) && (ev->xkey.window == root_window))
+	{
+		// global shortcut (see x11_grab_hotkeys())
+		unsigned int state = ev->xkey.state & HOTKEY_MODIFIERS & ~HOTKEY_LOCKS;
+		enum pause_mode mode;
+		for (mode=PAUSE_FREEZE ; mode<=PAUSE_BLANK ; mode++) {
+			if (hotkeys[mode].keycode && (hotkeys[mode].keycode == ev->xkey.keycode)
+					&& (hotkeys[mode].state == state))
+			{
+				squint_toggle_pause(mode);
+				return GDK_FILTER_REMOVE;
+			}
+		}
+	}
+
+	if (ev->type == PropertyNotify)
+	{
+		XPropertyEvent* pn_ev = (XPropertyEvent*) ev;
+		if ((pn_ev->window == root_window) && (pn_ev->atom == net_active_window_atom))
+		{
+			// property _NET_ACTIVE_WINDOW was changed
+			x11_active_window_start_monitoring();
+#ifdef HAVE_XRENDER
+			x11_refresh_focus_crop();
+#endif
+			if (!config.opt_passive) {
+				x11_show_active_window();
+			}
+			return GDK_FILTER_REMOVE;
+		}
+		
+	}
+
+#ifdef HAVE_XCOMPOSITE
+	if (	(ev->type == ConfigureNotify) || (ev->type == MapNotify)
+	     ||	(ev->type == UnmapNotify) || (ev->type == DestroyNotify))
+	{
+		struct mirror* m = x11_find_capture_mirror(ev->xany.window);
+		if (m) {
+			x11_on_window_capture_event(m, ev);
+		}
+	}
+#endif
+
+	if (ev->type == ConfigureNotify)
+	{
+		XConfigureEvent* c_ev = (XConfigureEvent*) ev;
+		if (c_ev->window == active_window)
+		{
+			x11_refresh_active_window_geometry();
+#ifdef HAVE_XRENDER
+			x11_refresh_focus_crop();
+#endif
+			return GDK_FILTER_CONTINUE;
+		}
+	}
+
+#ifdef HAVE_XI
+	if(can_track_cursor)
+	{
+		XGenericEventCookie *cookie = &ev->xcookie;
+
+		if (	(cookie->type == GenericEvent)
+		    &&	(cookie->extension == xi_opcode))
+		{
+			switch (cookie->evtype)
+			{
+			case XI_RawMotion:
+				// cursor was moved
+				x11_refresh_cursor_location(FALSE,
+						x11_event_time(((XIRawEvent*)cookie->data)->time));
+
+				return GDK_FILTER_REMOVE;
+#if HAVE_XSHM && HAVE_XTEST
+			case XI_ButtonPress:
+			case XI_ButtonRelease:
+			case XI_Motion:
+			case XI_KeyPress:
+			case XI_KeyRelease:
+				// event of the mirror (interactive mode)
+				if (remote.input_display && x11_forward_input(cookie->data)) {
+					return GDK_FILTER_REMOVE;
+				}
+				if (x11_forward_local_input(cookie->data)) {
+					return GDK_FILTER_REMOVE;
+				}
+				break;
+#endif
+			case XI_RawKeyPress:
+				// a key was pressed
+				// -> we ensure that the active window is on screen
+				{
+					XIRawEvent* xi_ev = (XIRawEvent*) cookie->data;
+					GdkKeymap* km = gdk_keymap_get_for_display(gdisplay);
+					guint keyval;
+
+					if(gdk_keymap_translate_keyboard_state(km, xi_ev->detail,
+							0, // FIXME: do we need the modifier?
+							0, // FIXME: how to determine the group?
+							&keyval, NULL, NULL, NULL))
+					{
+						switch(keyval)
+						{
+						case  GDK_KEY_Control_L:
+						case  GDK_KEY_Control_R:
+						case  GDK_KEY_Meta_L:
+						case  GDK_KEY_Meta_R:
+						case  GDK_KEY_Alt_L:
+						case  GDK_KEY_Alt_R:
+							// ignore modifier keys (except shift)
+							// because they may be used by the
+							// window manager
+							return GDK_FILTER_REMOVE;
+						}
+					}
+				
+					x11_show_active_window();
+					return GDK_FILTER_REMOVE;
+				}
+			}
+		}
+	}
+#endif
+
+#ifdef HAVE_XSHM
+	if (remote.display && (ev->type == remote.completion_event)) {
+		x11_remote_on_completion((XShmCompletionEvent*) ev);
+		return GDK_FILTER_REMOVE;
+	}
+#endif
+
+#ifdef COPY_CURSOR
+	if(copy_cursor)
+	{
+		if (ev->type == xfixes_event_base + XFixesCursorNotify) {
+			x11_refresh_cursor_image();
+
+			return GDK_FILTER_REMOVE;
+		}
+	}
+#endif
+
+#ifdef HAVE_XDAMAGE
+	if(damage)
+	{
+		if (ev->type == xdamage_event_base + XDamageNotify)
+		{
+			XDamageNotifyEvent* xd_ev = (XDamageNotifyEvent*) ev;
+
+			// get the damaged area
+			GdkRectangle rect = {
+				xd_ev->area.x,     xd_ev->area.y,
+				xd_ev->area.width, xd_ev->area.height
+			};
+			if (xd_ev->damage == damage) {
+				scheduler_add_damage(xd_ev->timestamp, &rect, xd_ev->more);
+			}
+#ifdef HAVE_XCOMPOSITE
+			else {
+				// damage of a captured window
+				int i;
+				for (i=0 ; i<n_mirrors ; i++) {
+					if (x11_mirrors[i].window_damage == xd_ev->damage) {
+						scheduler_add_mirror_damage(&mirrors[i],
+							xd_ev->timestamp, &rect, xd_ev->more);
+					}
+				}
+			}
+#endif
+		}
+	}
+#endif
+
+#ifdef HAVE_XRANDR
+	if (xrandr_event_base)
+	{
+		if (ev->type == xrandr_event_base + RRScreenChangeNotify) {
+			squint_monitors_changed();
+		}
+		else if (ev->type == xrandr_event_base + RRNotify)
+		{
+			int subtype = ((XRRNotifyEvent*) ev)->subtype;
+			if ((subtype == RRNotify_CrtcChange) || (subtype == RRNotify_OutputChange)) {
+				squint_monitors_changed();
+			}
+		}
+	}
+#endif
+	return GDK_FILTER_CONTINUE;
+}
+
+#ifdef HAVE_XI
+// select the raw events of all master devices on connection dpy
+//
+// motion: pointer motion (cursor tracking)
+// keys:   key presses (the active window is shown, not in passive mode)
+void
+x11_set_xi_eventmask(Display* dpy, gboolean motion, gboolean keys)
+{
+	// inspired from: http://keithp.com/blogs/Cursor_tracking/
+
+	XIEventMask evmasks[1];
+	unsigned char mask1[(XI_LASTEVENT + 7)/8];
+	memset(mask1, 0, sizeof(mask1));
+
+	if (motion) {
+		XISetMask(mask1, XI_RawMotion);
+	}
+	if (keys && !config.opt_passive) {
+		XISetMask(mask1, XI_RawKeyPress);
+	}
+
+	evmasks[0].deviceid = XIAllMasterDevices;
+	evmasks[0].mask_len = sizeof(mask1);
+	evmasks[0].mask = mask1;
+
+	XISelectEvents(dpy, root_window, evmasks, 1);
+}
+
+void x11_init_cursor_tracking()
+{
+	int event, error;
+	if (!XQueryExtension(display, "XInputExtension", &xi_opcode, &event, &error))
+		return;
+
+	int major=2, minor=2;
+	if (XIQueryVersion(display, &major, &minor) != Success)
+		return;
+
+	if ((major > 2) || ((major == 2) && (minor >= 2))) {
+		can_track_cursor = TRUE;
+	}
+}
+
+void
+x11_enable_cursor_tracking()
+{
+	if (can_track_cursor && !paused) {
+		x11_set_xi_eventmask(display, TRUE, TRUE);
+	}
+}
+
+void
+x11_disable_cursor_tracking()
+{
+	if (can_track_cursor) {
+		x11_set_xi_eventmask(display, FALSE, FALSE);
+	}
+}
+#endif
+
+#ifdef HAVE_XDAMAGE
+void
+x11_init_xdamage()
+{
+	if (config.opt_rate > 0) {
+		// user requested fixed refresh rate
+		return;
+	}
+
+	// detect the Xdamage extension
+	int major=1, minor=0, error_base;
+	if (	   !XDamageQueryExtension(display, &xdamage_event_base, &error_base)
+		|| !XDamageQueryVersion(display, &major, &minor)
+		|| (major<1)
+	) {
+		return;
+	}
+
+	can_use_xdamage = TRUE;
+}
+
+void
+x11_enable_xdamage()
+{
+	if (can_use_xdamage) {
+		scheduler_enable(x11_refresh_image, &stats);
+		damage = XDamageCreate(display, root_window, XDamageReportRawRectangles);
+	}
+}
+
+void
+x11_disable_xdamage()
+{
+	if (damage) {
+		XDamageDestroy(display, damage);
+		damage = 0;
+	}
+	scheduler_disable();
+}
+#endif
+
+
+#if HAVE_XDAMAGE && HAVE_XI
+//
+// Render thread
+//
+// When all the mirrors are plain copies of a monitor (no mosaic, magnifier,
+// window capture, cross-display source nor OpenGL presenter), the refresh
+// pipeline runs in a dedicated thread with its own connection to the X server
+// and its own main context: it receives the damage and the pointer motion
+// events, runs the schedulers, copies the damaged areas and draws the cursor.
+// The main thread keeps GTK (windows, menu, dialogs), the focus tracking, the
+// reconfigurations and the read-back, so that a slow redraw of the UI never
+// delays a frame.
+//
+// The pixmaps and the windows are shared through the server, but not the GCs
+// (which are cached by Xlib in each connection), hence the thread-local
+// display, gc and gc_white.
+//
+// The main thread does not touch the resources of the mirrors while the
+// thread runs: it stops the thread before reconfiguring them, and forwards
+// the few events it still receives as requests (render.requests). The thread
+// returns its raise/lower decisions the same way (render.raise), both are
+// lock-free.
+//
+
+// events of the connection of the render thread
+gboolean
+x11_render_on_event()
+{
+	gboolean moved = FALSE;
+	Time motion_time = 0;
+
+	while (XPending(display))
+	{
+		XEvent ev;
+		XNextEvent(display, &ev);
+
+		if (ev.type == xdamage_event_base + XDamageNotify)
+		{
+			XDamageNotifyEvent* xd_ev = (XDamageNotifyEvent*) &ev;
+			GdkRectangle rect = {
+				xd_ev->area.x,     xd_ev->area.y,
+				xd_ev->area.width, xd_ev->area.height
+			};
+			scheduler_add_damage(xd_ev->timestamp, &rect, xd_ev->more);
+		}
+		else if ((ev.xcookie.type == GenericEvent) && (ev.xcookie.extension == xi_opcode)
+				&& (ev.xcookie.evtype == XI_RawMotion))
+		{
+			// (the location is queried once for the whole batch, at the
+			// time of the last motion)
+			if (XGetEventData(display, &ev.xcookie)) {
+				motion_time = ((XIRawEvent*)ev.xcookie.data)->time;
+				XFreeEventData(display, &ev.xcookie);
+			}
+			moved = TRUE;
+		}
+	}
+	if (moved) {
+		x11_refresh_cursor_location(FALSE, motion_time ? x11_event_time(motion_time) : 0);
+	}
+	return G_SOURCE_CONTINUE;
+}
+
+// source of the events of the connection of the render thread
+//
+// The round trips of the thread (eg: XQueryPointer()) move the events
+// received meanwhile into the queue of Xlib, the socket is then no longer
+// readable: the queue is checked before polling.
+struct x11_render_source {
+	GSource		source;
+	gpointer	fd_tag;
+};
+
+gboolean
+x11_render_source_prepare(GSource* source, gint* timeout)
+{
+	*timeout = -1;
+	XFlush(display);
+	return XEventsQueued(display, QueuedAlready) > 0;
+}
+
+gboolean
+x11_render_source_check(GSource* source)
+{
+	struct x11_render_source* rs = (struct x11_render_source*) source;
+	return (XEventsQueued(display, QueuedAlready) > 0)
+		|| (g_source_query_unix_fd(source, rs->fd_tag) & G_IO_IN);
+}
+
+gboolean
+x11_render_source_dispatch(GSource* source, GSourceFunc callback, gpointer data)
+{
+	return x11_render_on_event();
 }
 
-GdkFilterReturn
-x11_on_x11_event (GdkXEvent *xevent, GdkEvent *event, gpointer data)
+static GSourceFuncs x11_render_source_funcs = {
+	.prepare  = x11_render_source_prepare,
+	.check    = x11_render_source_check,
+	.dispatch = x11_render_source_dispatch,
+};
+
+// requests of the main thread (run by the render thread)
+gboolean
+x11_render_on_request(gpointer data)
 {
-	XEvent* ev = (XEvent*)xevent;
+	gint requests = __atomic_exchange_n(&render.requests, 0, __ATOMIC_ACQUIRE);
+	int i, j;
 
-	if (ev->type == PropertyNotify)
+	for (i=0 ; i<n_mirrors ; i++)
 	{
-		XPropertyEvent* pn_ev = (XPropertyEvent*) ev;
-		if ((pn_ev->window == root_window) && (pn_ev->atom == net_active_window_atom))
-		{
-			// property _NET_ACTIVE_WINDOW was changed
-			x11_active_window_start_monitoring();
-			x11_show_active_window();
-			return GDK_FILTER_REMOVE;
+		struct mirror* m = &mirrors[i];
+		if (requests & RENDER_FIX_OFFSETS) {
+			g_mutex_lock(&render.lock);
+			for (j=0 ; j<m->n_destinations ; j++) {
+				m->destinations[j].rect = render.geometry[i][j];
+			}
+			g_mutex_unlock(&render.lock);
+			for (j=0 ; j<m->n_destinations ; j++) {
+				if (x11_fix_offset(m, j)) {
+					XClearWindow(display, X11_MIRROR(m)->destinations[j].window);
+				}
+			}
+		}
+		if (requests & RENDER_REDRAW_CURSOR) {
+			x11_redraw_cursor(m, TRUE);
 		}
-		
 	}
+	XFlush(display);
+	return G_SOURCE_REMOVE;
+}
 
-	if (ev->type == ConfigureNotify)
+// forward a request to the render thread (main thread)
+void
+x11_render_request(gint request)
+{
+	__atomic_fetch_or(&render.requests, request, __ATOMIC_RELEASE);
+	g_main_context_invoke(render.context, x11_render_on_request, NULL);
+}
+
+// raise/lower requests of the render thread (run by the main thread)
+gboolean
+x11_render_on_raise(gpointer data)
+{
+	int i;
+	for (i=0 ; i<n_mirrors ; i++)
 	{
-		XConfigureEvent* c_ev = (XConfigureEvent*) ev;
-		if (c_ev->window == active_window)
-		{
-			x11_refresh_active_window_geometry();
-			return GDK_FILTER_CONTINUE;
+		gint raise = __atomic_exchange_n(&render.raise[i], -1, __ATOMIC_ACQUIRE);
+		if (raise == 1) {
+			squint_show(&mirrors[i]);
+		} else if (raise == 0) {
+			squint_hide(&mirrors[i]);
 		}
 	}
+	return G_SOURCE_REMOVE;
+}
 
-#ifdef HAVE_XI
-	if(can_track_cursor)
-	{
-		XGenericEventCookie *cookie = &ev->xcookie;
-
-		if (	(cookie->type == GenericEvent)
-		    &&	(cookie->extension == xi_opcode))
-		{
-			switch (cookie->evtype)
-			{
-			case XI_RawMotion:
-				// cursor was moved
-				x11_refresh_cursor_location(FALSE);
+gpointer
+x11_render_main(gpointer data)
+{
+	g_main_context_push_thread_default(render.context);
+	display  = render.display;
+	gc       = render.gc;
+	gc_white = render.gc_white;
+
+	// (the events already queued by Xlib are dispatched first)
+	GSource* source = g_source_new(&x11_render_source_funcs, sizeof(struct x11_render_source));
+	((struct x11_render_source*) source)->fd_tag =
+		g_source_add_unix_fd(source, ConnectionNumber(display), G_IO_IN);
+	g_source_attach(source, render.context);
+
+	g_main_loop_run(render.loop);
+
+	g_source_destroy(source);
+	g_source_unref(source);
+	g_main_context_pop_thread_default(render.context);
+	return NULL;
+}
 
-				return GDK_FILTER_REMOVE;
-			case XI_RawKeyPress:
-				// a key was pressed
-				// -> we ensure that the active window is on screen
-				{
-					XIRawEvent* xi_ev = (XIRawEvent*) cookie->data;
-					GdkKeymap* km = gdk_keymap_get_for_display(gdisplay);
-					guint keyval;
+// move the refresh pipeline into the render thread, if the mirrors allow it
+// (main thread)
+void
+x11_render_start()
+{
+	int i;
 
-					if(gdk_keymap_translate_keyboard_state(km, xi_ev->detail,
-							0, // FIXME: do we need the modifier?
-							0, // FIXME: how to determine the group?
-							&keyval, NULL, NULL, NULL))
-					{
-						switch(keyval)
-						{
-						case  GDK_KEY_Control_L:
-						case  GDK_KEY_Control_R:
-						case  GDK_KEY_Meta_L:
-						case  GDK_KEY_Meta_R:
-						case  GDK_KEY_Alt_L:
-						case  GDK_KEY_Alt_R:
-							// ignore modifier keys (except shift)
-							// because they may be used by the
-							// window manager
-							return GDK_FILTER_REMOVE;
-						}
-					}
-				
-					x11_show_active_window();
-					return GDK_FILTER_REMOVE;
-				}
-			}
-		}
+	if (render.thread || !damage || !can_track_cursor || paused) {
+		return;
+	}
+#ifdef HAVE_GLX
+	if (gl.context) {
+		return;
 	}
 #endif
-
-#ifdef COPY_CURSOR
-	if(copy_cursor)
+	for (i=0 ; i<n_mirrors ; i++)
 	{
-		if (ev->type == xfixes_event_base + XFixesCursorNotify) {
-			x11_refresh_cursor_image();
+		const struct mirror* m = &mirrors[i];
+		if (m->n_sources || m->zoom || m->capture_window || m->source_display) {
+			return;
+		}
+		if (x11_mirrors[i].scale_src.image) {
+			// (the scaled destinations read the pixmap back)
+			return;
+		}
+	}
 
-			return GDK_FILTER_REMOVE;
+	// the resources of the mirrors must exist before the thread uses them
+	XSync(display, False);
+
+	render.display = XOpenDisplay(DisplayString(display));
+	if (!render.display) {
+		return;
+	}
+
+	// set up the connection of the thread (the events are received twice
+	// until the main connection stops receiving them)
+	XGCValues values;
+	values.subwindow_mode = IncludeInferiors;
+	render.gc = XCreateGC(render.display, root_window, GCSubwindowMode, &values);
+	values.line_width = 3;
+	values.foreground = 0xe0e0e0;
+	render.gc_white = XCreateGC(render.display, root_window, GCLineWidth | GCForeground, &values);
+
+	int event_base, error_base, major=2, minor=2;
+	XDamageQueryExtension(render.display, &event_base, &error_base);
+	XDamageCreate(render.display, root_window, XDamageReportRawRectangles);	// (destroyed with the connection)
+	XIQueryVersion(render.display, &major, &minor);
+	x11_set_xi_eventmask(render.display, TRUE, FALSE);
+	XSync(render.display, False);
+
+	XDamageDestroy(display, damage);
+	damage = 0;
+	x11_set_xi_eventmask(display, FALSE, TRUE);
+	XFlush(display);
+
+	render.requests = 0;
+	for (i=0 ; i<MAX_MIRRORS ; i++) {
+		render.raise[i] = -1;
+	}
+	for (i=0 ; i<n_mirrors ; i++) {
+		int j;
+		for (j=0 ; j<mirrors[i].n_destinations ; j++) {
+			render.geometry[i][j] = mirrors[i].destinations[j].rect;
 		}
 	}
-#endif
+	// (recreated in the context of the thread)
+	x11_cancel_prediction_timeout();
+	render.context = g_main_context_new();
+	render.loop    = g_main_loop_new(render.context, FALSE);
+	render.thread  = g_thread_new("render", x11_render_main, NULL);
+}
 
-#ifdef HAVE_XDAMAGE
-	if(damage)
+// move the refresh pipeline back into the main thread (main thread)
+void
+x11_render_stop()
+{
+	if (!render.thread) {
+		return;
+	}
+
+	// receive the events again before stopping the thread (they are
+	// received twice until its connection is closed)
+	damage = XDamageCreate(display, root_window, XDamageReportRawRectangles);
+	x11_set_xi_eventmask(display, TRUE, TRUE);
+	XSync(display, False);
+
+	g_main_loop_quit(render.loop);
+	g_thread_join(render.thread);
+	render.thread = NULL;
+
+	// damages received by the thread but not yet handled (the later ones
+	// are received by the main connection too)
+	while (XPending(render.display))
 	{
-		if (ev->type == xdamage_event_base + XDamageNotify)
+		XEvent ev;
+		XNextEvent(render.display, &ev);
+		if (ev.type == xdamage_event_base + XDamageNotify)
 		{
-			XDamageNotifyEvent* xd_ev = (XDamageNotifyEvent*) ev;
-			static GdkRectangle accumulated_damage = { 0, 0, 0, 0 };
-
-			// get the damaged area
+			XDamageNotifyEvent* xd_ev = (XDamageNotifyEvent*) &ev;
 			GdkRectangle rect = {
 				xd_ev->area.x,     xd_ev->area.y,
 				xd_ev->area.width, xd_ev->area.height
 			};
-
-			if (x11_compute_damaged_rect(&rect)) {
-				// source screen damaged
-				if (accumulated_damage.width == 0) {
-					accumulated_damage = rect;
-				} else {
-					gdk_rectangle_union(&rect,
-							&accumulated_damage,
-							&accumulated_damage);
-				}
-			}
-
-			if (!xd_ev->more && accumulated_damage.width)
-			{
-				x11_try_refresh_image(xd_ev->timestamp, &accumulated_damage);
-				accumulated_damage.width = 0;
-			}
+			scheduler_add_damage(xd_ev->timestamp, &rect, xd_ev->more);
 		}
 	}
-#endif
 
-#ifdef HAVE_XRANDR
-	if (xrandr_event_base)
-	{
-		if (ev->type == xrandr_event_base + RRScreenChangeNotify) {
-			squint_disable();
-		}
-	}
+	// requests not yet run by the thread (the geometry of the windows)
+	x11_render_on_request(NULL);
+
+	// last raise/lower requests
+	while (g_idle_remove_by_data(&render))
+		;
+	x11_render_on_raise(NULL);
+
+	// the delayed damages (the timeouts are attached to the context of the
+	// thread)
+	scheduler_flush();
+	x11_cancel_prediction_timeout();
+
+	XCloseDisplay(render.display);
+	g_main_loop_unref(render.loop);
+	g_main_context_unref(render.context);
+	memset(&render, 0, sizeof(render));
+}
 #endif
-	return GDK_FILTER_CONTINUE;
+
+//
+// Freeze and blank modes
+//
+// The presenter may check something privately on the source monitor: in
+// freeze mode the destinations keep displaying the last frame, in blank mode
+// they are black (or display the logo given with --blank-image).
+//
+// While paused, nothing is captured: the render thread is stopped, the
+// cursor tracking and the cursor notifications are deselected, the refresh
+// timers are removed and the captures of the cross-display source are
+// suspended. The damage object of the root window is replaced by one
+// reporting only the transition to non-empty (XDamageReportNonEmpty): the
+// server accumulates the damaged region without sending any more event. The
+// other damages (window capture, reconfiguration) are merged by
+// x11_refresh_image() into held_damage.
+//
+// When resuming, the region accumulated by the server is fetched and each
+// mirror is refreshed once with the bounding box of its damages (the
+// resources of the mirrors are kept).
+//
+
+// pixel of the default visual (TrueColor) for an opaque colour
+unsigned long
+x11_pixel(const Visual* v, guint r, guint g, guint b)
+{
+	return (((guint64)r * v->red_mask   / 255) & v->red_mask)
+	     | (((guint64)g * v->green_mask / 255) & v->green_mask)
+	     | (((guint64)b * v->blue_mask  / 255) & v->blue_mask);
 }
 
-#ifdef HAVE_XI
+// load the logo of the blank mode (composed over black)
 void
-x11_set_xi_eventmask(gboolean active)
+x11_init_blank_image()
 {
-	// inspired from: http://keithp.com/blogs/Cursor_tracking/
+	GError* err = NULL;
+	Visual* v = DefaultVisual(display, screen);
+	int x, y;
 
-	XIEventMask evmasks[1];
-	unsigned char mask1[(XI_LASTEVENT + 7)/8];
-	memset(mask1, 0, sizeof(mask1));
+	if (v->class != TrueColor) {
+		squint_error("The blank image requires a TrueColor visual");
+		return;
+	}
+	GdkPixbuf* pixbuf = gdk_pixbuf_new_from_file(config.opt_blank_image, &err);
+	if (!pixbuf) {
+		squint_error(err->message);
+		g_clear_error(&err);
+		return;
+	}
 
-	if (active) {
-		// select for button and key events from all master devices
-		XISetMask(mask1, XI_RawMotion);
-		if (!config.opt_passive) {
-			XISetMask(mask1, XI_RawKeyPress);
+	int width  = gdk_pixbuf_get_width(pixbuf);
+	int height = gdk_pixbuf_get_height(pixbuf);
+	int stride = gdk_pixbuf_get_rowstride(pixbuf);
+	int n_channels = gdk_pixbuf_get_n_channels(pixbuf);
+	gboolean alpha = gdk_pixbuf_get_has_alpha(pixbuf);
+	const guchar* pixels = gdk_pixbuf_get_pixels(pixbuf);
+
+	XImage* image = XCreateImage(display, v, depth, ZPixmap, 0, NULL,
+			width, height, 32, 0);
+	if (!image) {
+		squint_error("XCreateImage() failed");
+		g_object_unref(pixbuf);
+		return;
+	}
+	image->data = malloc(image->bytes_per_line * height);
+	for (y=0 ; y<height ; y++)
+	{
+		for (x=0 ; x<width ; x++)
+		{
+			const guchar* p = pixels + y*stride + x*n_channels;
+			guint a = alpha ? p[3] : 255;
+			XPutPixel(image, x, y, x11_pixel(v, p[0]*a/255, p[1]*a/255, p[2]*a/255));
 		}
 	}
 
-	evmasks[0].deviceid = XIAllMasterDevices;
-	evmasks[0].mask_len = sizeof(mask1);
-	evmasks[0].mask = mask1;
+	blank_pixmap = XCreatePixmap(display, root_window, width, height, depth);
+	XPutImage(display, blank_pixmap, gc, image, 0, 0, 0, 0, width, height);
+	blank_width  = width;
+	blank_height = height;
 
-	XISelectEvents(display, root_window, evmasks, 1);
+	XDestroyImage(image);
+	g_object_unref(pixbuf);
 }
 
-void x11_init_cursor_tracking()
+// keep the logo in the middle of the window of destination j
+void
+x11_move_blank_window(struct mirror* m, int j)
 {
-	int event, error;
-	if (!XQueryExtension(display, "XInputExtension", &xi_opcode, &event, &error))
-		return;
-
-	int major=2, minor=2;
-	if (XIQueryVersion(display, &major, &minor) != Success)
-		return;
-
-	if ((major > 2) || ((major == 2) && (minor >= 2))) {
-		can_track_cursor = TRUE;
+	const struct destination* dst = &m->destinations[j];
+	Window w = X11_MIRROR(m)->destinations[j].blank_window;
+	if (w) {
+		XMoveWindow(display, w, (dst->rect.width  - blank_width)  / 2,
+					(dst->rect.height - blank_height) / 2);
 	}
 }
 
 void
-x11_enable_cursor_tracking()
+x11_destroy_blank_windows()
 {
-	if (can_track_cursor) {
-		x11_set_xi_eventmask(TRUE);
+	int i, j;
+	for (i=0 ; i<n_mirrors ; i++)
+	{
+		for (j=0 ; j<mirrors[i].n_destinations ; j++)
+		{
+			struct x11_destination* xd = &x11_mirrors[i].destinations[j];
+			if (xd->blank_window) {
+				XDestroyWindow(display, xd->blank_window);
+				xd->blank_window = 0;
+			}
+		}
 	}
 }
 
+// blank mode: the subwindows are unmapped (the windows of the destinations
+// are painted black by X11, see x11_enable_destination()) and the logo is
+// displayed in the middle
 void
-x11_disable_cursor_tracking()
+x11_show_blank(gboolean blank)
 {
-	if (can_track_cursor) {
-		x11_set_xi_eventmask(FALSE);
+	int i, j;
+
+	x11_destroy_blank_windows();
+	for (i=0 ; i<n_mirrors ; i++)
+	{
+		struct mirror* m = &mirrors[i];
+		for (j=0 ; j<m->n_destinations ; j++)
+		{
+			struct x11_destination* xd = &x11_mirrors[i].destinations[j];
+			if (!blank) {
+				XMapWindow(display, xd->window);
+				continue;
+			}
+			XUnmapWindow(display, xd->window);
+
+			if (blank_pixmap)
+			{
+				// (the window of the destination may not have the
+				// default visual)
+				XSetWindowAttributes attr;
+				attr.background_pixmap = blank_pixmap;
+				attr.colormap = DefaultColormap(display, screen);
+				attr.border_pixel = 0;
+				xd->blank_window = XCreateWindow(display,
+						gdk_x11_window_get_xid(m->destinations[j].gdkwin),
+						0, 0, blank_width, blank_height,
+						0, depth, InputOutput, DefaultVisual(display, screen),
+						CWBackPixmap | CWColormap | CWBorderPixel, &attr);
+				x11_move_blank_window(m, j);
+				XMapWindow(display, xd->blank_window);
+			}
+		}
 	}
 }
+
+// stop capturing (the current frame stays in the pixmaps)
+void
+x11_suspend()
+{
+#if HAVE_XDAMAGE && HAVE_XI
+	x11_render_stop();
 #endif
+	// (the damages already received complete the last frame)
+	scheduler_flush();
 
+	if (refresh_timer) {
+		g_source_remove(refresh_timer);
+		refresh_timer = 0;
+	}
+	if (zoom_timer) {
+		g_source_remove(zoom_timer);
+		zoom_timer = 0;
+	}
+	x11_cancel_prediction_timeout();
+#ifdef HAVE_XI
+	x11_disable_cursor_tracking();
+#endif
+#ifdef COPY_CURSOR
+	if (copy_cursor) {
+		XFixesSelectCursorInput(display, x11_cursor_notify_window(), 0);
+	}
+#endif
 #ifdef HAVE_XDAMAGE
+	if (damage) {
+		XDamageDestroy(display, damage);
+		damage = XDamageCreate(display, root_window, XDamageReportNonEmpty);
+	}
+#endif
+#ifdef HAVE_XSHM
+	__atomic_store_n(&remote.paused, TRUE, __ATOMIC_RELAXED);
+#endif
+}
+
+// capture again, starting with a single refresh of the areas damaged while
+// paused
 void
-x11_init_xdamage()
+x11_resume()
 {
-	if (config.opt_rate > 0) {
-		// user requested fixed refresh rate
-		return;
+	int i;
+
+#ifdef HAVE_XDAMAGE
+	if (damage)
+	{
+		// bounding box of the region accumulated by the server (the
+		// whole screen without XFixes)
+		GdkRectangle rect = root_window_rect;
+#ifdef HAVE_XFIXES
+		XserverRegion region = XFixesCreateRegion(display, NULL, 0);
+		XRectangle bounds;
+		int n = 0;
+		XDamageSubtract(display, damage, None, region);
+		XRectangle* rects = XFixesFetchRegionAndBounds(display, region, &n, &bounds);
+		if (rects)
+		{
+			XFree(rects);
+			rect.x = bounds.x;
+			rect.y = bounds.y;
+			rect.width  = n ? bounds.width : 0;
+			rect.height = bounds.height;
+		}
+		// (otherwise the whole screen)
+		XFixesDestroyRegion(display, region);
+#endif
+		XDamageDestroy(display, damage);
+		damage = XDamageCreate(display, root_window, XDamageReportRawRectangles);
+
+		for (i=0 ; i<n_mirrors ; i++)
+		{
+			// (the window captures and the cross-display source
+			// have their own damages)
+			struct mirror* m = &mirrors[i];
+			GdkRectangle r = rect;
+			if (!m->capture_window && !m->source_display && r.width
+				&& compute_damaged_rect(m, &r))
+			{
+				x11_hold_damage(m, &r);
+			}
+		}
+	}
+	else
+#endif
+	{
+		// the refresh timer was stopped
+		for (i=0 ; i<n_mirrors ; i++) {
+			x11_hold_damage(&mirrors[i], &mirrors[i].src_rect);
+		}
+	}
+	for (i=0 ; i<n_mirrors ; i++)
+	{
+		struct x11_mirror* xm = &x11_mirrors[i];
+		if (xm->held_damage.width) {
+			GdkRectangle r = xm->held_damage;
+			xm->held_damage.width = 0;
+			x11_refresh_image(&mirrors[i], &r);
+		}
 	}
 
-	// detect the Xdamage extension
-	int major=1, minor=0, error_base;
-	if (	   !XDamageQueryExtension(display, &xdamage_event_base, &error_base)
-		|| !XDamageQueryVersion(display, &major, &minor)
-		|| (major<1)
-	) {
+#ifdef HAVE_XSHM
+	if (remote.display) {
+		// the accumulated damages are captured at the next poll
+		__atomic_store_n(&remote.paused, FALSE, __ATOMIC_RELAXED);
+		x11_remote_on_update(&remote);
+	}
+#endif
+#ifdef COPY_CURSOR
+	if (copy_cursor) {
+		XFixesSelectCursorInput(display, x11_cursor_notify_window(), XFixesCursorNotify);
+		x11_refresh_cursor_image();
+	}
+#endif
+#ifdef HAVE_XI
+	x11_enable_cursor_tracking();
+#endif
+	x11_refresh_cursor_location(TRUE, 0);
+	x11_start_refresh_timer();
+
+#if HAVE_XDAMAGE && HAVE_XI
+	x11_render_start();
+#endif
+}
+
+// enter or leave the freeze/blank mode (PAUSE_NONE to resume)
+void
+x11_pause(enum pause_mode mode)
+{
+	if (mode == paused) {
 		return;
 	}
-
-	if (config.opt_limit == 0) {
-		// no limit
-		min_refresh_period = 0;
-	} else {
-		// 50 fps by default
-		min_refresh_period = 1000 / ((config.opt_limit<0) ? 50 : config.opt_limit); 
+	if (!paused) {
+		x11_suspend();
+	}
+	if (paused == PAUSE_BLANK) {
+		x11_show_blank(FALSE);
 	}
 
-	can_use_xdamage = TRUE;
-}
+	paused = mode;
 
-void
-x11_enable_xdamage()
-{
-	if (can_use_xdamage) {
-		damage = XDamageCreate(display, root_window, XDamageReportRawRectangles);
+	if (paused == PAUSE_BLANK) {
+		x11_show_blank(TRUE);
+	}
+	if (!paused) {
+		x11_resume();
 	}
+	XFlush(display);
 }
 
+// grab (or release) the global shortcuts of the pause modes on the root
+// window (--freeze-key, --blank-key), with any state of the locks
 void
-x11_disable_xdamage()
+x11_grab_hotkeys(gboolean grab)
 {
-	if (damage) {
-		XDamageDestroy(display, damage);
-		damage = 0;
+	static const unsigned int locks[] = { 0, LockMask, Mod2Mask, LockMask | Mod2Mask };
+	const struct hotkey* keys[] = {
+		[PAUSE_FREEZE]	= &config.freeze_key,
+		[PAUSE_BLANK]	= &config.blank_key,
+	};
+	int mode, i;
+
+	gdk_x11_display_error_trap_push(gdisplay);
+	for (mode=PAUSE_FREEZE ; mode<=PAUSE_BLANK ; mode++)
+	{
+		if (grab && keys[mode]->keyval)
+		{
+			// <Super>, <Hyper> and <Meta> are virtual modifiers
+			GdkModifierType state = keys[mode]->modifiers;
+			gdk_keymap_map_virtual_modifiers(gdk_keymap_get_for_display(gdisplay), &state);
+			hotkeys[mode].keycode = XKeysymToKeycode(display, keys[mode]->keyval);
+			hotkeys[mode].state   = state & HOTKEY_MODIFIERS & ~HOTKEY_LOCKS;
+			if (!hotkeys[mode].keycode) {
+				squint_error("The hotkey is not available on this keyboard");
+			}
+		}
+		if (!hotkeys[mode].keycode) {
+			continue;
+		}
+		for (i=0 ; i<G_N_ELEMENTS(locks) ; i++) {
+			if (grab) {
+				XGrabKey(display, hotkeys[mode].keycode, hotkeys[mode].state | locks[i],
+						root_window, False, GrabModeAsync, GrabModeAsync);
+			} else {
+				XUngrabKey(display, hotkeys[mode].keycode, hotkeys[mode].state | locks[i],
+						root_window);
+			}
+		}
+		if (!grab) {
+			hotkeys[mode].keycode = 0;
+		}
+	}
+	if (gdk_x11_display_error_trap_pop(gdisplay) && grab) {
+		squint_error("Cannot grab the hotkey (it may be used by another application)");
 	}
 }
 
-gboolean
-x11_compute_damaged_rect(GdkRectangle* rect)
+// raise/lower the windows of a mirror (the GTK windows are handled by the main
+// thread)
+void
+x11_set_raised(struct mirror* m, gboolean raised)
 {
-	// intersect the rectangle with src_rect
-	if (!gdk_rectangle_intersect(&src_rect, rect, rect)) {
-		// src_rect not damaged
-		return FALSE;
+#if HAVE_XDAMAGE && HAVE_XI
+	if (render.display && (display == render.display))
+	{
+		// render thread
+		if (m->raised != raised) {
+			__atomic_store_n(&render.raise[m - mirrors], raised, __ATOMIC_RELEASE);
+			g_idle_add(x11_render_on_raise, &render);
+		}
+		return;
 	}
-
-	// does it intersect with the dst_rect?
-	if (gdk_rectangle_intersect(rect, &dst_rect, NULL)) {
-		// part of the damages are inside dst_rect
-		// return TRUE only if we have other damages outside dst_rect
-		GdkRectangle r;
-		gdk_rectangle_union(rect,   &dst_rect, &r);
-		return !gdk_rectangle_equal(&dst_rect, &r);
+#endif
+	if (raised) {
+		squint_show(m);
 	} else {
-		// all damages outside dst_rect
-		return TRUE;
+		squint_hide(m);
 	}
 }
-#endif
 
 
 gboolean
 x11_on_window_configure_event(GtkWidget *widget, GdkEvent *event, gpointer   user_data)
 {
+	// user_data: mirror index << 8 | destination index
+	struct mirror* m = &mirrors[(intptr_t) user_data >> 8];
+	int i = (intptr_t) user_data & 0xff;
 	GdkEventConfigure* e = (GdkEventConfigure*) event;
 	GdkRectangle rect;
 	rect.x = e->x;
@@ -825,14 +4964,167 @@ x11_on_window_configure_event(GtkWidget *widget, GdkEvent *event, gpointer   use
 	}
 
 	if(!fullscreen) {
-		memcpy(&dst_rect, &rect, sizeof(rect));
-		if (x11_fix_offset()) {
-			XClearWindow(display, window);
+#if HAVE_XDAMAGE && HAVE_XI
+		if (render.thread) {
+			// (the rect is written by the render thread)
+			g_mutex_lock(&render.lock);
+			render.geometry[m - mirrors][i] = rect;
+			g_mutex_unlock(&render.lock);
+			x11_render_request(RENDER_FIX_OFFSETS);
+			return TRUE;
+		}
+#endif
+		memcpy(&m->destinations[i].rect, &rect, sizeof(rect));
+		x11_move_blank_window(m, i);
+		if (x11_fix_offset(m, i)) {
+			XClearWindow(display, X11_MIRROR(m)->destinations[i].window);
 		}
 	}
 	return TRUE;
 }
 
+// the geometry of the monitors or the settings were changed (see
+// reconfigure() in squint.c)
+//
+// Only the resources of the mirrors affected are updated: the pixmap is
+// reallocated if the size of the source changed, the captures of a mosaic
+// are recreated if its cells changed, the subwindows are moved into the new
+// windows (if replaced), then the whole image is refreshed.
+void
+x11_reconfigure(const struct mirror* old)
+{
+	int i, j;
+
+#if HAVE_XDAMAGE && HAVE_XI
+	x11_render_stop();
+#endif
+	if (paused == PAUSE_BLANK) {
+		// the windows of the destinations may be replaced (the logos
+		// are recreated below)
+		x11_destroy_blank_windows();
+	}
+#ifdef HAVE_XSHAPE
+	// (same for the overlay, which also follows the size of the
+	// subwindows)
+	x11_disable_overlay();
+#endif
+	x11_get_window_geometry(root_window, &root_window_rect);
+
+	// apply the passive mode
+	x11_enable_focus_tracking();
+	x11_active_window_start_monitoring();
+#ifdef HAVE_XI
+	x11_enable_cursor_tracking();
+#endif
+
+	for (i=0 ; i<n_mirrors ; i++)
+	{
+		struct mirror* m = &mirrors[i];
+		const struct mirror* o = &old[i];
+
+		// (the destination may have been replaced)
+		x11_update_display_delay(m);
+
+		if (m->capture_window || m->source_display) {
+			// the captured window and the source display do not
+			// depend on the monitors
+			m->src_rect = o->src_rect;
+		}
+		if (m->follow_focus) {
+			focus_crop(m, active_window ? &active_window_rect : NULL);
+		}
+		if (m->zoom)
+		{
+			// keep the zoomed area where it was
+			GdkRectangle* r = &m->sources[0].rect;
+			const GdkRectangle* a = &m->crop_area;
+			r->x = CLAMP(o->sources[0].rect.x, a->x, a->x + a->width  - r->width);
+			r->y = CLAMP(o->sources[0].rect.y, a->y, a->y + a->height - r->height);
+			m->zoom_target.x = r->x;
+			m->zoom_target.y = r->y;
+		}
+
+		gboolean resized = (m->src_rect.width  != o->src_rect.width)
+				|| (m->src_rect.height != o->src_rect.height);
+		gboolean src_changed = !gdk_rectangle_equal(&m->src_rect, &o->src_rect);
+		gboolean dst_changed = FALSE;
+		for (j=0 ; j<m->n_sources ; j++) {
+			src_changed |= !gdk_rectangle_equal(&m->sources[j].rect, &o->sources[j].rect)
+				    || !gdk_rectangle_equal(&m->sources[j].cell, &o->sources[j].cell);
+		}
+		for (j=0 ; j<m->n_destinations ; j++)
+		{
+			struct destination* dst = &m->destinations[j];
+			dst_changed |= !gdk_rectangle_equal(&dst->rect, &o->destinations[j].rect)
+				    || memcmp(&dst->tile, &o->destinations[j].tile, sizeof(GdkPoint));
+
+			if (dst->gdkwin != o->destinations[j].gdkwin)
+			{
+				// new window
+				x11_enable_destination(m, j);
+				XClearWindow(display, gdk_x11_window_get_xid(dst->gdkwin));
+				dst_changed = TRUE;
+			}
+			if ((dst->transform != o->destinations[j].transform) && !resized)
+			{
+				// (done by x11_resize_pixmap() otherwise)
+				x11_set_destination_image(m, j);
+				XClearWindow(display, gdk_x11_window_get_xid(dst->gdkwin));
+				dst_changed = TRUE;
+			}
+		}
+		if (!src_changed && !dst_changed) {
+			continue;
+		}
+
+		if (resized) {
+			x11_resize_pixmap(m);
+			if (paused) {
+				// black until resumed (the image is held by
+				// x11_refresh_image())
+				XFillRectangle(display, X11_MIRROR(m)->pixmap, gc, 0, 0,
+						m->src_rect.width, m->src_rect.height);
+				x11_clear_area(m, 0, 0, m->src_rect.width, m->src_rect.height);
+			}
+		}
+#ifdef HAVE_XRENDER
+		else if (src_changed && X11_MIRROR(m)->mosaic_picture) {
+			x11_reset_mosaic(m);
+		}
+#endif
+
+		for (j=0 ; j<m->n_destinations ; j++) {
+			x11_fix_offset(m, j);
+		}
+		x11_refresh_image(m, &m->src_rect);
+	}
+
+#ifdef COPY_CURSOR
+	if (copy_cursor && !paused) {
+		// the window receiving the notifications may have been replaced
+		XFixesSelectCursorInput(display, x11_cursor_notify_window(), XFixesCursorNotify);
+	}
+#endif
+#if HAVE_XSHM && HAVE_XI && HAVE_XTEST
+	// (the passive mode may have been toggled)
+	x11_enable_input_forwarding();
+#endif
+	if (paused == PAUSE_BLANK) {
+		x11_show_blank(TRUE);
+	}
+#ifdef HAVE_XSHAPE
+	x11_enable_overlay();
+#endif
+
+	// the pointer may now be located in another mirror
+	x11_refresh_cursor_location(TRUE, 0);
+	XFlush(display);
+
+#if HAVE_XDAMAGE && HAVE_XI
+	x11_render_start();
+#endif
+}
+
 #ifdef HAVE_XRANDR
 void
 x11_init_xrandr()
@@ -842,10 +5134,39 @@ x11_init_xrandr()
 		return;
 	}
 
-	XRRSelectInput(display, root_window, RRScreenChangeNotifyMask);
+	// the crtc/output notifications are received also when the size of the
+	// screen is unchanged (e.g. a monitor is moved or changes its mode)
+	XRRSelectInput(display, root_window, RRScreenChangeNotifyMask
+			| RRCrtcChangeNotifyMask | RROutputChangeNotifyMask);
 }
 #endif
 
+// initialisation deferred after the first frame (not needed for displaying
+// it)
+void
+x11_late_init()
+{
+#ifdef HAVE_XRANDR
+	x11_init_xrandr();
+#endif
+	if (config.opt_blank_image) {
+		x11_init_blank_image();
+	}
+#ifdef COPY_CURSOR
+	x11_init_copy_cursor();
+	if (enabled) {
+		// replace the crosshair with the real cursor
+#if HAVE_XDAMAGE && HAVE_XI
+		x11_render_stop();
+#endif
+		x11_enable_copy_cursor();
+#if HAVE_XDAMAGE && HAVE_XI
+		x11_render_start();
+#endif
+	}
+#endif
+}
+
 gboolean
 x11_init()
 {
@@ -878,12 +5199,6 @@ x11_init()
 		}
 	}
 
-#ifdef HAVE_XRANDR
-	x11_init_xrandr();
-#endif
-#ifdef COPY_CURSOR
-	x11_init_copy_cursor();
-#endif
 #ifdef HAVE_XI
 	x11_init_cursor_tracking();
 #endif
@@ -891,6 +5206,53 @@ x11_init()
 	x11_init_xdamage();
 #endif
 
+#ifdef HAVE_XRENDER
+	{
+		int event_base, error_base;
+		can_use_xrender = XRenderQueryExtension(display, &event_base, &error_base);
+
+		// format of the pixmaps (used by all the converting copies)
+		if (can_use_xrender) {
+			screen_format = XRenderFindVisualFormat(display, DefaultVisual(display, screen));
+			can_use_xrender = (screen_format != NULL);
+		}
+	}
+#endif
+
+#ifdef HAVE_XSHAPE
+	{
+		int event_base, error_base;
+		can_use_xshape = XShapeQueryExtension(display, &event_base, &error_base);
+	}
+#else
+	if (config.opt_overlay) {
+		squint_error("The debug overlay is not available (squint was built without Xext)");
+	}
+#endif
+
+	if (config.opt_gl && !config.opt_headless) {
+#ifdef HAVE_GLX
+		x11_gl_init();
+#else
+		squint_error("The OpenGL presenter is not available (squint was built without GLX)");
+#endif
+	}
+#if !(HAVE_XSHM && HAVE_XI && HAVE_XTEST)
+	if (config.opt_interactive) {
+		squint_error("The interactive mode is not available (squint was built without MIT-SHM, XInput or XTest)");
+	}
+#endif
+
+#ifdef HAVE_XCOMPOSITE
+	{
+		// XCompositeNameWindowPixmap() requires version 0.2
+		int event_base, error_base, major=0, minor=2;
+		can_use_xcomposite = XCompositeQueryExtension(display, &event_base, &error_base)
+			&& XCompositeQueryVersion(display, &major, &minor)
+			&& ((major > 0) || (minor >= 2));
+	}
+#endif
+
 	// atom name
 	net_active_window_atom = XInternAtom(display, "_NET_ACTIVE_WINDOW", FALSE);
 
@@ -906,15 +5268,17 @@ x11_on_squint_window_draw(GtkWidget* widget, void* cairo_ctx, gpointer user_data
 
 // erase the previous cursor (if any)
 gboolean
-x11_clear_cursor()
+x11_clear_cursor(struct mirror* m)
 {
-	if (backup.x != -CURSOR_SIZE)
+	struct x11_mirror* xm = X11_MIRROR(m);
+
+	if (xm->backup.x != -CURSOR_SIZE)
 	{
-		XCopyArea(display, backup_pixmap, pixmap, gc,
+		XCopyArea(display, xm->backup_pixmap, xm->pixmap, gc,
 				0, 0,
 				CURSOR_SIZE, CURSOR_SIZE,
-				backup.x, backup.y);
-		backup.x = -CURSOR_SIZE;
+				xm->backup.x, xm->backup.y);
+		xm->backup.x = -CURSOR_SIZE;
 		return TRUE;
 	} else {
 		return FALSE;
@@ -923,46 +5287,48 @@ x11_clear_cursor()
 
 // draw the new cursor (if on screen)
 gboolean
-x11_draw_cursor()
+x11_draw_cursor(struct mirror* m)
 {
-	if (cursor.x >= 0)
+	struct x11_mirror* xm = X11_MIRROR(m);
+
+	if (xm->cursor.x >= 0)
 	{
 #ifdef COPY_CURSOR
 		if (copy_cursor) {
-			backup.x = cursor.x - cursor_xhot;
-			backup.y = cursor.y - cursor_yhot;
-			XCopyArea(display, pixmap, backup_pixmap, gc,
-					backup.x, backup.y,
+			xm->backup.x = xm->cursor.x - cursor_xhot;
+			xm->backup.y = xm->cursor.y - cursor_yhot;
+			XCopyArea(display, xm->pixmap, xm->backup_pixmap, gc,
+					xm->backup.x, xm->backup.y,
 					CURSOR_SIZE, CURSOR_SIZE,
 					0, 0);
 			XRenderComposite(display, PictOpOver,
 					cursor_picture, 0,
-					pixmap_picture,
+					xm->pixmap_picture,
 					0, 0, 0, 0,
-					backup.x, backup.y, CURSOR_SIZE, CURSOR_SIZE);
+					xm->backup.x, xm->backup.y, CURSOR_SIZE, CURSOR_SIZE);
 		}
 		else
 #endif
 		{
 			const int len = CURSOR_CROSSHAIR_LEN;
-			backup.x = cursor.x - (len+1);
-			backup.y = cursor.y - (len+1);
-			XCopyArea(display, pixmap, backup_pixmap, gc,
-					backup.x, backup.y,
+			xm->backup.x = xm->cursor.x - (len+1);
+			xm->backup.y = xm->cursor.y - (len+1);
+			XCopyArea(display, xm->pixmap, xm->backup_pixmap, gc,
+					xm->backup.x, xm->backup.y,
 					CURSOR_SIZE, CURSOR_SIZE,
 					0, 0);
-			XDrawLine(display, pixmap, gc_white,
-					cursor.x-(len+1), cursor.y,
-					cursor.x+(len+2), cursor.y);
-			XDrawLine(display, pixmap, gc_white,
-					cursor.x, cursor.y-(len+1),
-					cursor.x, cursor.y+(len+2));
-			XDrawLine(display, pixmap, gc,
-					cursor.x-len, cursor.y,
-					cursor.x+len, cursor.y);
-			XDrawLine(display, pixmap, gc,
-					cursor.x, cursor.y-len,
-					cursor.x, cursor.y+len);
+			XDrawLine(display, xm->pixmap, gc_white,
+					xm->cursor.x-(len+1), xm->cursor.y,
+					xm->cursor.x+(len+2), xm->cursor.y);
+			XDrawLine(display, xm->pixmap, gc_white,
+					xm->cursor.x, xm->cursor.y-(len+1),
+					xm->cursor.x, xm->cursor.y+(len+2));
+			XDrawLine(display, xm->pixmap, gc,
+					xm->cursor.x-len, xm->cursor.y,
+					xm->cursor.x+len, xm->cursor.y);
+			XDrawLine(display, xm->pixmap, gc,
+					xm->cursor.x, xm->cursor.y-len,
+					xm->cursor.x, xm->cursor.y+len);
 
 		}
 		return TRUE;
@@ -972,26 +5338,31 @@ x11_draw_cursor()
 }
 
 void
-x11_redraw_cursor(gboolean clear_window)
+x11_redraw_cursor(struct mirror* m, gboolean clear_window)
 {
-	int cleared_x = backup.x;
-	int cleared_y = backup.y;
+	struct x11_mirror* xm = X11_MIRROR(m);
+	int cleared_x = xm->backup.x;
+	int cleared_y = xm->backup.y;
 
-	gboolean cleared = x11_clear_cursor();
-	gboolean drawn   = x11_draw_cursor();
+	if (paused) {
+		// (redrawn by x11_resume())
+		return;
+	}
+	gboolean cleared = x11_clear_cursor(m);
+	gboolean drawn   = x11_draw_cursor(m);
 
 	if (clear_window) {
 		GdkRectangle rect = {0, 0, CURSOR_SIZE, CURSOR_SIZE };
 		if (drawn && cleared) {
-			rect.x = MIN(backup.x, cleared_x);
-			rect.y = MIN(backup.y, cleared_y);
-			rect.width  += ABS(backup.x - cleared_x);
-			rect.height += ABS(backup.y - cleared_y);
+			rect.x = MIN(xm->backup.x, cleared_x);
+			rect.y = MIN(xm->backup.y, cleared_y);
+			rect.width  += ABS(xm->backup.x - cleared_x);
+			rect.height += ABS(xm->backup.y - cleared_y);
 		}
 		else if (drawn)
 		{
-			rect.x = backup.x;
-			rect.y = backup.y;
+			rect.x = xm->backup.x;
+			rect.y = xm->backup.y;
 		}
 		else if (cleared)
 		{
@@ -1002,79 +5373,223 @@ x11_redraw_cursor(gboolean clear_window)
 		{
 			return;
 		}
-		XClearArea(display, window, rect.x, rect.y,
-				rect.width, rect.height, FALSE);
+		x11_clear_area(m, rect.x, rect.y, rect.width, rect.height);
+		x11_readback_area(m, rect.x, rect.y, rect.width, rect.height);
 	}
 }
 
+// prepare the window of destination j to host the duplicated screen
 //
-// Prepare the window to host the duplicated screen (create the pixmap, subwindow)
-//
-// initialises:
-// 	offset
-// 	pixmap
-// 	window
-//	cursor
-//
-
+// The subwindow is created, or moved from the previous window of the
+// destination if it already exists (see x11_reconfigure()).
 void
-x11_enable_window()
+x11_enable_destination(struct mirror* m, int j)
 {
-	cursor.x = -1;
-	cursor.y = -1;
-	offset.x = 0;
-	offset.y = 0;
+	struct x11_mirror* xm = X11_MIRROR(m);
+	struct destination* dst = &m->destinations[j];
+	int i = m - mirrors;
 
 	if (!fullscreen) {
 		// register events
 		// - window moved/resized
-		g_signal_connect (gtkwin, "configure-event", G_CALLBACK (x11_on_window_configure_event), NULL);
+		g_signal_connect (dst->gtkwin, "configure-event",
+				G_CALLBACK (x11_on_window_configure_event),
+				(gpointer)(intptr_t)(i<<8 | j));
 	}
 
 	// intercept the 'draw' event of the squint window to prevent any rendering by gtk
-	g_signal_connect(gtkwin, "draw", G_CALLBACK(x11_on_squint_window_draw), NULL);
+	g_signal_connect(dst->gtkwin, "draw", G_CALLBACK(x11_on_squint_window_draw), NULL);
 
 	// have the main window painted black by X11
-	Window squint_window = gdk_x11_window_get_xid(gdkwin);
+	Window squint_window = gdk_x11_window_get_xid(dst->gdkwin);
 	XSetWindowBackground(display, squint_window, 0);
 
-	// create the pixmap
-	pixmap = XCreatePixmap (display, root_window, src_rect.width, src_rect.height, depth);
-	
-	// create the sub-window
+	if (xm->destinations[j].window)
 	{
+		// reuse the sub-window
+		XReparentWindow(display, xm->destinations[j].window, squint_window,
+				dst->offset.x, dst->offset.y);
+	}
+#ifdef HAVE_GLX
+	else if (gl.context) {
+		// drawn by OpenGL (see x11_gl_present())
+		x11_enable_transform(m, j);
+		xm->destinations[j].window = x11_gl_create_window(m, j, squint_window);
+	}
+#endif
+	else {
+		// create the sub-window
 		XSetWindowAttributes attr;
-		attr.background_pixmap = pixmap;
-		window = XCreateWindow (display, squint_window,
-					offset.x, offset.y,
-					src_rect.width, src_rect.height,
-					0, CopyFromParent,
-					InputOutput, CopyFromParent,
-					CWBackPixmap, &attr);
-		XMapWindow(display, window);
+		unsigned long mask = CWBackPixmap;
+		int win_depth = CopyFromParent;
+		Visual* visual = CopyFromParent;
+		int width, height;
+		x11_enable_transform(m, j);
+		x11_enable_scaler(m, j);
+		attr.background_pixmap = x11_destination_pixmap(m, j, &width, &height);
+
+		if (gdk_visual_get_depth(gdk_window_get_visual(dst->gdkwin)) != depth)
+		{
+			// the pixmap (used as background) must have the depth of the
+			// window -> use the default visual instead of the one of the
+			// squint window
+			win_depth = depth;
+			visual = DefaultVisual(display, screen);
+			attr.colormap = DefaultColormap(display, screen);
+			attr.border_pixel = 0;
+			mask |= CWColormap | CWBorderPixel;
+		}
+		xm->destinations[j].window = XCreateWindow (display, squint_window,
+					dst->offset.x, dst->offset.y,
+					width, height,
+					0, win_depth,
+					InputOutput, visual,
+					mask, &attr);
+	}
+	XMapWindow(display, xm->destinations[j].window);
+}
+
+//
+// Prepare the windows to host the duplicated screen (create the pixmaps, subwindows)
+//
+// initialises:
+// 	mirrors[].destinations[].offset
+// 	x11_mirrors[]
+//
+
+gboolean
+x11_enable_window()
+{
+	int i, j;
+
+	// set up the window captures and the cross-display source first (they
+	// determine the src_rect)
+	for (i=0 ; i<n_mirrors ; i++)
+	{
+		if (!mirrors[i].capture_window) {
+			continue;
+		}
+#ifdef HAVE_XCOMPOSITE
+		if (!x11_enable_window_capture(&mirrors[i]))
+		{
+			while (i--) {
+				if (mirrors[i].capture_window) {
+					x11_disable_window_capture(&mirrors[i]);
+				}
+			}
+			return FALSE;
+		}
+#else
+		squint_error("The window capture is not available (squint was built without XComposite)");
+		return FALSE;
+#endif
+	}
+	if (mirrors[0].source_display)
+	{
+		// (exclusive with the window capture)
+#ifdef HAVE_XSHM
+		if (!x11_remote_start(&mirrors[0])) {
+			return FALSE;
+		}
+#else
+		squint_error("The cross-display source is not available (squint was built without MIT-SHM)");
+		return FALSE;
+#endif
 	}
 
-	// create a backup pixmap for storing the background (below the cursor)
-	backup.x = -CURSOR_SIZE;
-	backup_pixmap = XCreatePixmap(display, root_window,
-				CURSOR_SIZE, CURSOR_SIZE, 24);
+	for (i=0 ; i<n_mirrors ; i++)
+	{
+		struct mirror* m = &mirrors[i];
+		struct x11_mirror* xm = &x11_mirrors[i];
+
+		xm->cursor.x = -1;
+		xm->cursor.y = -1;
+		x11_update_display_delay(m);
+
+		// create the pixmap (shared by all destinations)
+		xm->pixmap = XCreatePixmap (display, root_window,
+				m->src_rect.width, m->src_rect.height, depth);
+
+		if (m->n_sources)
+		{
+			// mosaic: the cells may not cover the whole image
+			XFillRectangle(display, xm->pixmap, gc, 0, 0,
+					m->src_rect.width, m->src_rect.height);
+#ifdef HAVE_XRENDER
+			if (can_use_xrender) {
+				x11_enable_mosaic(m);
+			} else
+#endif
+			{
+				squint_error("The mosaics require the XRender extension");
+			}
+		}
+
+		for (j=0 ; j<m->n_destinations ; j++)
+		{
+			m->destinations[j].offset.x = 0;
+			m->destinations[j].offset.y = 0;
+			x11_enable_destination(m, j);
+		}
+
+		// create a backup pixmap for storing the background (below the cursor)
+		xm->backup.x = -CURSOR_SIZE;
+		xm->backup_pixmap = XCreatePixmap(display, root_window,
+					CURSOR_SIZE, CURSOR_SIZE, depth);
+	}
 
 	// force refreshing the cursor position
-	x11_refresh_cursor_location(TRUE);
+	x11_refresh_cursor_location(TRUE, 0);
+	return TRUE;
 }
 
 void
 x11_disable_window()
 {
-	XFreePixmap(display, backup_pixmap);
-	backup_pixmap = 0;
-	backup.x = -CURSOR_SIZE;
+	int i, j;
+#ifdef HAVE_XSHM
+	x11_remote_stop();
+#endif
+#ifdef HAVE_GLX
+	if (gl.present_idle) {
+		g_source_remove(gl.present_idle);
+		gl.present_idle = 0;
+	}
+#endif
+	for (i=0 ; i<n_mirrors ; i++)
+	{
+		struct x11_mirror* xm = &x11_mirrors[i];
+
+#ifdef HAVE_GLX
+		x11_gl_release(&mirrors[i]);
+		xm->gl_damage.width = 0;
+#endif
+		XFreePixmap(display, xm->backup_pixmap);
+		xm->backup_pixmap = 0;
+		xm->backup.x = -CURSOR_SIZE;
+		xm->held_damage.width = 0;
+
+		for (j=0 ; j<mirrors[i].n_destinations ; j++) {
+			x11_disable_transform(&mirrors[i], j);
+			x11_disable_scaler(&mirrors[i], j);
+			XDestroyWindow(display, xm->destinations[j].window);
+			xm->destinations[j].window = 0;
+		}
 
-	XDestroyWindow(display, window);
-	window = 0;
+#ifdef HAVE_XRENDER
+		if (xm->mosaic_picture) {
+			x11_disable_mosaic(&mirrors[i]);
+		}
+#endif
+#ifdef HAVE_XCOMPOSITE
+		if (mirrors[i].capture_window) {
+			x11_disable_window_capture(&mirrors[i]);
+		}
+#endif
 
-	XFreePixmap(display, pixmap);
-	pixmap = 0;
+		XFreePixmap(display, xm->pixmap);
+		xm->pixmap = 0;
+	}
 }
 
 
@@ -1083,11 +5598,9 @@ x11_enable_focus_tracking()
 {
 	memset(&active_window_rect, 0, sizeof(active_window_rect));
 
-	if (config.opt_passive)
-		return;
-
+	// the active window is not tracked in passive mode
 	XSetWindowAttributes attr;
-	attr.event_mask = PropertyChangeMask;
+	attr.event_mask = (config.opt_passive && !config.opt_follow_focus) ? 0 : PropertyChangeMask;
 	XChangeWindowAttributes(display, root_window, CWEventMask, &attr);
 }
 
@@ -1099,10 +5612,12 @@ x11_disable_focus_tracking()
 	XChangeWindowAttributes(display, root_window, CWEventMask, &attr);
 }
 
-void
+gboolean
 x11_enable()
 {
-	x11_enable_window();
+	if (!x11_enable_window()) {
+		return FALSE;
+	}
 
 	x11_enable_focus_tracking();
 	
@@ -1118,49 +5633,81 @@ x11_enable()
 	x11_enable_xdamage();
 #endif
 
+#ifdef HAVE_XSHAPE
+	x11_enable_overlay();
+#endif
+
+#if HAVE_XSHM && HAVE_XI && HAVE_XTEST
+	x11_enable_input_forwarding();
+#endif
+
 	XFlush (display);
 
 	x11_get_window_geometry(root_window, &root_window_rect);
 	x11_active_window_start_monitoring();
+#ifdef HAVE_XRENDER
+	x11_refresh_focus_crop();
+#endif
 
 	// catch all X11 events
 	gdk_window_add_filter(NULL, x11_on_x11_event, NULL);
+	x11_grab_hotkeys(TRUE);
 
-#if HAVE_XDAMAGE && HAVE_XI
-	if (!(damage && can_track_cursor))
-#endif
-	{
-		int rate = 25; // default to 25 fps
-		if(config.opt_rate > 0) {
-			rate = config.opt_rate;
-		} else if ((config.opt_limit > 0) && (config.opt_limit < rate)) {
-			rate = config.opt_limit;
+	x11_start_refresh_timer();
+
+	// Redraw the windows
+	int i, j;
+	for (i=0 ; i<n_mirrors ; i++) {
+		for (j=0 ; j<mirrors[i].n_destinations ; j++) {
+			XClearWindow(display, gdk_x11_window_get_xid(mirrors[i].destinations[j].gdkwin));
 		}
+	}
+
+	x11_readback_start();
 
-		refresh_timer = g_timeout_add (1000/rate,
-				G_SOURCE_FUNC(&x11_refresh_image), &src_rect);
+	// copy the first frame now (instead of waiting for the first damage)
+	for (i=0 ; i<n_mirrors ; i++) {
+		x11_refresh_image(&mirrors[i], &mirrors[i].src_rect);
 	}
 
-	// Redraw the window
-	XClearWindow(display, gdk_x11_window_get_xid(gdkwin));
+	// (frozen after the first frame)
+	x11_pause(config.pause);
+
+#if HAVE_XDAMAGE && HAVE_XI
+	x11_render_start();
+#endif
+	return TRUE;
 }
 
 void
 x11_disable()
 {
-#ifdef HAVE_XDAMAGE
-	if (refresh_timeout) {
-		g_source_remove(refresh_timeout);
-		refresh_timeout = 0;
-	}
+#if HAVE_XDAMAGE && HAVE_XI
+	x11_render_stop();
 #endif
+	// (the resources of the pause are released with the others)
+	x11_destroy_blank_windows();
+	paused = PAUSE_NONE;
+	x11_grab_hotkeys(FALSE);
+
 	if (refresh_timer) {
 		g_source_remove(refresh_timer);
 		refresh_timer = 0;
 	}
+	if (zoom_timer) {
+		g_source_remove(zoom_timer);
+		zoom_timer = 0;
+	}
+	x11_cancel_prediction_timeout();
 
 	gdk_window_remove_filter(NULL, x11_on_x11_event, NULL);
 
+	x11_readback_stop();
+
+#ifdef HAVE_XSHAPE
+	x11_disable_overlay();
+#endif
+
 	x11_active_window_stop_monitoring();
 
 #ifdef HAVE_XI
@@ -1178,3 +5725,49 @@ x11_disable()
 
 	x11_disable_window();
 }
+
+guint
+x11_capabilities()
+{
+	guint caps = BACKEND_CAP_FOCUS_TRACKING;
+#ifdef HAVE_XDAMAGE
+	if (can_use_xdamage) {
+		caps |= BACKEND_CAP_DAMAGE;
+	}
+#endif
+#ifdef HAVE_XI
+	if (can_track_cursor) {
+		caps |= BACKEND_CAP_CURSOR_TRACKING;
+	}
+#endif
+#ifdef COPY_CURSOR
+	if (cursor_picture) {
+		caps |= BACKEND_CAP_COPY_CURSOR;
+	}
+#endif
+#ifdef HAVE_XSHAPE
+	if (can_use_xshape) {
+		caps |= BACKEND_CAP_OVERLAY;
+	}
+#endif
+	return caps;
+}
+
+const struct stats*
+x11_stats()
+{
+	return &stats;
+}
+
+const struct backend x11_backend = {
+	.name		= "x11",
+	.uses_gtk	= TRUE,
+	.init		= x11_init,
+	.late_init	= x11_late_init,
+	.enable		= x11_enable,
+	.disable	= x11_disable,
+	.reconfigure	= x11_reconfigure,
+	.capabilities	= x11_capabilities,
+	.stats		= x11_stats,
+	.pause		= x11_pause,
+};